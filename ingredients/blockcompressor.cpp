@@ -0,0 +1,346 @@
+#include "blockcompressor.h"
+#include "threadpool.h"
+#include "packedfloat.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <glm/glm.hpp>
+
+using glm::vec3;
+
+namespace {
+    // BC6H interpolation weights for 4 bit indices
+    const int BC6H_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+    // Direction of largest variance of n points, by power iteration
+    vec3 principalAxis(const vec3 * p, int n, const vec3 & mean) {
+        float c[6] = { 0, 0, 0, 0, 0, 0 };     // xx xy xz yy yz zz
+        for( int i = 0; i < n; i++ ) {
+            vec3 d = p[i] - mean;
+            c[0] += d.x * d.x; c[1] += d.x * d.y; c[2] += d.x * d.z;
+            c[3] += d.y * d.y; c[4] += d.y * d.z; c[5] += d.z * d.z;
+        }
+        vec3 axis(1.0f, 1.0f, 1.0f);
+        for( int iter = 0; iter < 8; iter++ ) {
+            vec3 next(c[0] * axis.x + c[1] * axis.y + c[2] * axis.z,
+                      c[1] * axis.x + c[3] * axis.y + c[4] * axis.z,
+                      c[2] * axis.x + c[4] * axis.y + c[5] * axis.z);
+            float len = glm::length(next);
+            if( len < 1e-12f ) break;
+            axis = next / len;
+        }
+        return axis;
+    }
+
+    // The texels with the smallest and largest projection onto the axis
+    void axisExtremes(const vec3 * p, int n, vec3 & lo, vec3 & hi) {
+        vec3 mean(0.0f);
+        for( int i = 0; i < n; i++ ) mean += p[i];
+        mean /= (float)n;
+        vec3 axis = principalAxis(p, n, mean);
+        float tMin = HUGE_VALF, tMax = -HUGE_VALF;
+        for( int i = 0; i < n; i++ ) {
+            float t = glm::dot(p[i] - mean, axis);
+            if( t < tMin ) { tMin = t; lo = p[i]; }
+            if( t > tMax ) { tMax = t; hi = p[i]; }
+        }
+    }
+
+    uint16_t to565(const vec3 & c) {
+        vec3 q = glm::clamp(c, 0.0f, 255.0f);
+        int r = (int)(q.x * 31.0f / 255.0f + 0.5f);
+        int g = (int)(q.y * 63.0f / 255.0f + 0.5f);
+        int b = (int)(q.z * 31.0f / 255.0f + 0.5f);
+        return (uint16_t)((r << 11) | (g << 5) | b);
+    }
+
+    vec3 from565(uint16_t c) {
+        int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+        return vec3((float)((r << 3) | (r >> 2)), (float)((g << 2) | (g >> 4)), (float)((b << 3) | (b >> 2)));
+    }
+
+    // Four color palette of BC1 (c0 > c1), in index order
+    void palette565(uint16_t c0, uint16_t c1, vec3 pal[4]) {
+        pal[0] = from565(c0);
+        pal[1] = from565(c1);
+        pal[2] = (2.0f * pal[0] + pal[1]) / 3.0f;
+        pal[3] = (pal[0] + 2.0f * pal[1]) / 3.0f;
+    }
+
+    // Pick the nearest palette entries; returns the squared error
+    float chooseIndices(const vec3 * p, const vec3 pal[4], uint8_t idx[16]) {
+        float error = 0.0f;
+        for( int i = 0; i < 16; i++ ) {
+            float best = HUGE_VALF;
+            for( int k = 0; k < 4; k++ ) {
+                vec3 d = p[i] - pal[k];
+                float e = glm::dot(d, d);
+                if( e < best ) { best = e; idx[i] = (uint8_t)k; }
+            }
+            error += best;
+        }
+        return error;
+    }
+
+    // Least squares endpoints for fixed indices. False if the system is
+    // singular (all texels on one palette entry).
+    bool refineEndpoints(const vec3 * p, const uint8_t idx[16], vec3 & a, vec3 & b) {
+        const float weight[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };   // of endpoint a
+        float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+        vec3 ax(0.0f), bx(0.0f);
+        for( int i = 0; i < 16; i++ ) {
+            float w = weight[idx[i]], v = 1.0f - w;
+            aa += w * w; ab += w * v; bb += v * v;
+            ax += w * p[i];
+            bx += v * p[i];
+        }
+        float det = aa * bb - ab * ab;
+        if( std::fabs(det) < 1e-6f ) return false;
+        a = (ax * bb - bx * ab) / det;
+        b = (bx * aa - ax * ab) / det;
+        return true;
+    }
+
+    struct ColorFit {
+        uint16_t c0, c1;
+        uint8_t idx[16];
+        float error;
+    };
+
+    ColorFit fitEndpoints(const vec3 * p, const vec3 & a, const vec3 & b) {
+        ColorFit fit;
+        fit.c0 = to565(a);
+        fit.c1 = to565(b);
+        if( fit.c0 < fit.c1 ) std::swap(fit.c0, fit.c1);
+        if( fit.c0 == fit.c1 ) {
+            // Would select the three color mode; a single color needs no interpolation
+            vec3 c = from565(fit.c0);
+            memset(fit.idx, 0, sizeof(fit.idx));
+            fit.error = 0.0f;
+            for( int i = 0; i < 16; i++ ) fit.error += glm::dot(p[i] - c, p[i] - c);
+            return fit;
+        }
+        vec3 pal[4];
+        palette565(fit.c0, fit.c1, pal);
+        fit.error = chooseIndices(p, pal, fit.idx);
+        return fit;
+    }
+
+    // The color part of BC1 and BC3, always in four color mode
+    void encodeColorBlock(const uint8_t rgba[64], uint8_t out[8]) {
+        vec3 p[16];
+        for( int i = 0; i < 16; i++ ) p[i] = vec3(rgba[4*i], rgba[4*i+1], rgba[4*i+2]);
+
+        vec3 lo, hi;
+        axisExtremes(p, 16, lo, hi);
+        ColorFit fit = fitEndpoints(p, hi, lo);
+
+        vec3 a, b;
+        if( fit.c0 != fit.c1 && refineEndpoints(p, fit.idx, a, b) ) {
+            ColorFit refined = fitEndpoints(p, a, b);
+            if( refined.error < fit.error ) fit = refined;
+        }
+
+        uint32_t bits = 0;
+        for( int i = 0; i < 16; i++ ) bits |= (uint32_t)fit.idx[i] << (2 * i);
+        out[0] = (uint8_t)(fit.c0 & 0xff); out[1] = (uint8_t)(fit.c0 >> 8);
+        out[2] = (uint8_t)(fit.c1 & 0xff); out[3] = (uint8_t)(fit.c1 >> 8);
+        for( int i = 0; i < 4; i++ ) out[4 + i] = (uint8_t)(bits >> (8 * i));
+    }
+
+    // Little endian bit stream of a 128 bit block
+    struct BitWriter {
+        uint8_t * out;
+        int pos;
+
+        void put(uint32_t value, int bits) {
+            for( int i = 0; i < bits; i++, pos++ )
+                if( (value >> i) & 1 ) out[pos >> 3] |= (uint8_t)(1 << (pos & 7));
+        }
+    };
+
+    // Half float bits of a value clamped to [0, 65504]
+    int toHalf(float f) {
+        return f > 0.0f ? floatToHalf(f) : 0;
+    }
+
+    // Unsigned BC6H with 10 bit endpoints (mode 11): what the decoder makes
+    // of an endpoint before interpolation, and of an interpolated value
+    int unquantize10(int e) {
+        if( e == 0 ) return 0;
+        if( e == 1023 ) return 0xffff;
+        return ((e << 16) + 0x8000) >> 10;
+    }
+
+    int finishUnquantize(int v) {
+        return (v * 31) >> 6;
+    }
+
+    // The endpoint whose decoded value is nearest to a half float bit pattern
+    int quantize10(float h) {
+        // decoded endpoint = 31 e + 15 for 0 < e < 1023
+        int e = (int)std::floor((h - 15.0f) / 31.0f + 0.5f);
+        return std::min(std::max(e, 0), 1023);
+    }
+}
+
+size_t BlockCompressor::blockBytes(TextureCodec codec) {
+    return codec == TextureCodec::BC1 ? 8 : 16;
+}
+
+size_t BlockCompressor::imageBytes(TextureCodec codec, int w, int h) {
+    return (size_t)((w + 3) / 4) * ((h + 3) / 4) * blockBytes(codec);
+}
+
+void BlockCompressor::encodeBC1(const uint8_t rgba[64], uint8_t out[8]) {
+    encodeColorBlock(rgba, out);
+}
+
+void BlockCompressor::encodeBC4(const uint8_t values[16], uint8_t out[8]) {
+    int lo = 255, hi = 0;
+    for( int i = 0; i < 16; i++ ) {
+        lo = std::min(lo, (int)values[i]);
+        hi = std::max(hi, (int)values[i]);
+    }
+    memset(out, 0, 8);
+    out[0] = (uint8_t)hi;
+    out[1] = (uint8_t)lo;
+    if( hi == lo ) return;
+
+    // Eight value mode (a0 > a1): a0, a1, then six steps from a0 to a1
+    int pal[8] = { hi, lo };
+    for( int k = 2; k < 8; k++ ) pal[k] = ((8 - k) * hi + (k - 1) * lo) / 7;
+
+    uint64_t bits = 0;
+    for( int i = 0; i < 16; i++ ) {
+        int best = 0, bestError = 256;
+        for( int k = 0; k < 8; k++ ) {
+            int e = std::abs(values[i] - pal[k]);
+            if( e < bestError ) { bestError = e; best = k; }
+        }
+        bits |= (uint64_t)best << (3 * i);
+    }
+    for( int i = 0; i < 6; i++ ) out[2 + i] = (uint8_t)(bits >> (8 * i));
+}
+
+void BlockCompressor::encodeBC3(const uint8_t rgba[64], uint8_t out[16]) {
+    uint8_t alpha[16];
+    for( int i = 0; i < 16; i++ ) alpha[i] = rgba[4*i+3];
+    encodeBC4(alpha, out);
+    encodeColorBlock(rgba, out + 8);
+}
+
+void BlockCompressor::encodeBC5(const uint8_t rgba[64], uint8_t out[16]) {
+    uint8_t red[16], green[16];
+    for( int i = 0; i < 16; i++ ) {
+        red[i] = rgba[4*i];
+        green[i] = rgba[4*i+1];
+    }
+    encodeBC4(red, out);
+    encodeBC4(green, out + 8);
+}
+
+// Mode 11: one region, 10 bit endpoints stored directly, 4 bit indices. The
+// fit works on half float bit patterns, which is what the format
+// interpolates.
+void BlockCompressor::encodeBC6H(const float rgb[48], uint8_t out[16]) {
+    vec3 p[16];
+    for( int i = 0; i < 16; i++ )
+        p[i] = vec3((float)toHalf(rgb[3*i]), (float)toHalf(rgb[3*i+1]), (float)toHalf(rgb[3*i+2]));
+
+    vec3 lo, hi;
+    axisExtremes(p, 16, lo, hi);
+    int e[2][3];
+    for( int c = 0; c < 3; c++ ) {
+        e[0][c] = quantize10(lo[c]);
+        e[1][c] = quantize10(hi[c]);
+    }
+
+    vec3 pal[16];
+    for( int k = 0; k < 16; k++ ) {
+        int w = BC6H_WEIGHTS[k];
+        for( int c = 0; c < 3; c++ )
+            pal[k][c] = (float)finishUnquantize(((64 - w) * unquantize10(e[0][c]) + w * unquantize10(e[1][c]) + 32) >> 6);
+    }
+
+    int idx[16];
+    for( int i = 0; i < 16; i++ ) {
+        float best = HUGE_VALF;
+        for( int k = 0; k < 16; k++ ) {
+            vec3 d = p[i] - pal[k];
+            float err = glm::dot(d, d);
+            if( err < best ) { best = err; idx[i] = k; }
+        }
+    }
+
+    // The first index is stored without its top bit; the weights are
+    // symmetric, so swapping the endpoints mirrors the indices exactly
+    if( idx[0] >= 8 ) {
+        for( int c = 0; c < 3; c++ ) std::swap(e[0][c], e[1][c]);
+        for( int i = 0; i < 16; i++ ) idx[i] = 15 - idx[i];
+    }
+
+    memset(out, 0, 16);
+    BitWriter bw = { out, 0 };
+    bw.put(0x03, 5);
+    for( int c = 0; c < 3; c++ ) bw.put((uint32_t)e[0][c], 10);
+    for( int c = 0; c < 3; c++ ) bw.put((uint32_t)e[1][c], 10);
+    bw.put((uint32_t)idx[0], 3);
+    for( int i = 1; i < 16; i++ ) bw.put((uint32_t)idx[i], 4);
+}
+
+std::vector<uint8_t> BlockCompressor::compress(TextureCodec codec, const uint8_t * rgba, int w, int h) {
+    int bw = (w + 3) / 4, bh = (h + 3) / 4;
+    size_t bytes = blockBytes(codec);
+    std::vector<uint8_t> out((size_t)bw * bh * bytes);
+
+    ThreadPool::shared().parallelFor((size_t)bh, [&](size_t by) {
+        uint8_t block[64];
+        for( int bx = 0; bx < bw; bx++ ) {
+            for( int y = 0; y < 4; y++ ) {
+                int sy = std::min((int)by * 4 + y, h - 1);
+                for( int x = 0; x < 4; x++ ) {
+                    int sx = std::min(bx * 4 + x, w - 1);
+                    memcpy(block + 4 * (4 * y + x), rgba + 4 * ((size_t)sy * w + sx), 4);
+                }
+            }
+            uint8_t * dst = &out[(by * bw + bx) * bytes];
+            switch( codec ) {
+                case TextureCodec::BC1: encodeBC1(block, dst); break;
+                case TextureCodec::BC3: encodeBC3(block, dst); break;
+                case TextureCodec::BC5: encodeBC5(block, dst); break;
+                case TextureCodec::BC6H: {
+                    // The 8 bit values as [0, 1] floats, so it samples like the UNORM formats
+                    float rgb[48];
+                    for( int i = 0; i < 16; i++ )
+                        for( int c = 0; c < 3; c++ ) rgb[3 * i + c] = block[4 * i + c] / 255.0f;
+                    encodeBC6H(rgb, dst);
+                    break;
+                }
+            }
+        }
+    });
+    return out;
+}
+
+std::vector<uint8_t> BlockCompressor::compressHdr(const float * rgb, int w, int h) {
+    int bw = (w + 3) / 4, bh = (h + 3) / 4;
+    std::vector<uint8_t> out((size_t)bw * bh * 16);
+
+    ThreadPool::shared().parallelFor((size_t)bh, [&](size_t by) {
+        float block[48];
+        for( int bx = 0; bx < bw; bx++ ) {
+            for( int y = 0; y < 4; y++ ) {
+                int sy = std::min((int)by * 4 + y, h - 1);
+                for( int x = 0; x < 4; x++ ) {
+                    int sx = std::min(bx * 4 + x, w - 1);
+                    memcpy(block + 3 * (4 * y + x), rgb + 3 * ((size_t)sy * w + sx), 3 * sizeof(float));
+                }
+            }
+            encodeBC6H(block, &out[(by * bw + bx) * 16]);
+        }
+    });
+    return out;
+}
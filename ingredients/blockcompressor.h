@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// The block compressed formats textures can be stored in. All encode 4x4
+// texel blocks.
+enum class TextureCodec : uint32_t {
+    BC1,        // RGB, 8 bytes per block (4 bits per texel)
+    BC3,        // RGBA, 16 bytes per block
+    BC5,        // two channels from R and G (normal maps, z rebuilt in the shader), 16 bytes per block
+    BC6H        // unsigned half float RGB, 16 bytes per block
+};
+
+// Single pass BCn encoders: a principal axis fit of the block, refined once
+// by least squares for BC1. Fast enough to run on first load, on the shared
+// thread pool.
+class BlockCompressor {
+public:
+    static size_t blockBytes(TextureCodec codec);
+    // Compressed size of a w x h image, edge blocks included
+    static size_t imageBytes(TextureCodec codec, int w, int h);
+
+    // Compress a row major RGBA8 image. Edge blocks are padded by repeating
+    // the last row and column. BC6H takes the 8 bit values as [0, 1] and
+    // drops alpha; compressHdr() is the one for HDR data.
+    static std::vector<uint8_t> compress(TextureCodec codec, const uint8_t * rgba, int w, int h);
+    // Compress a row major float RGB image to BC6H. Negative values are
+    // clamped to 0, values above the half float range to its maximum.
+    static std::vector<uint8_t> compressHdr(const float * rgb, int w, int h);
+
+    // One 4x4 block, texels in row order
+    static void encodeBC1(const uint8_t rgba[64], uint8_t out[8]);
+    static void encodeBC3(const uint8_t rgba[64], uint8_t out[16]);
+    static void encodeBC4(const uint8_t values[16], uint8_t out[8]);
+    static void encodeBC5(const uint8_t rgba[64], uint8_t out[16]);
+    static void encodeBC6H(const float rgb[48], uint8_t out[16]);
+};
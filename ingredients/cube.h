@@ -1,9 +1,10 @@
 #pragma once
 
 #include "drawable.h"
-#include "trianglemesh.h"
+#include "staticmesh.h"
 
-class Cube : public TriangleMesh
+// Uploaded from StaticMeshGenerator::cube, without heap allocations
+class Cube : public StaticMesh
 {
 public:
     Cube(GLfloat size = 1.0f);
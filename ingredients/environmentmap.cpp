@@ -0,0 +1,675 @@
+#include "environmentmap.h"
+#include "texture.h"
+#include "threadpool.h"
+#include "mappedfile.h"
+#include "packedfloat.h"
+#include "glslprogram.h"
+#include "stb/stb_image.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+
+#include <glm/gtc/constants.hpp>
+
+using glm::vec3;
+
+namespace {
+    const char * CUBE_SUFFIXES[] = { "posx", "negx", "posy", "negy", "posz", "negz" };
+
+    // GGX samples per texel of level 1. Each smaller level has a quarter of
+    // the texels and gets four times the samples, up to the maximum, since
+    // the rough levels are the noisy ones.
+    const int SPECULAR_SAMPLES = 256;
+    const int MAX_SPECULAR_SAMPLES = 4096;
+    // Largest source level used for the SH projection
+    const int SH_SOURCE_SIZE = 64;
+    // Samples per texel of the BRDF table
+    const int BRDF_SAMPLES = 512;
+
+    // The cache: this header, then the specular levels from largest to
+    // smallest as R11G11B10F texels, each holding all faces back to back.
+    struct IblFileHeader {
+        char magic[4];          // "SIBL"
+        uint32_t version;
+        uint32_t size, levels;  // of the specular cube
+        uint32_t samples, maxSamples;
+        uint64_t sourceSize;    // total size and newest modification time of
+        int64_t sourceMtime;    // the faces, to detect a stale cache
+        float sh[27];
+        uint32_t pad;
+    };
+
+    const uint32_t IBL_FILE_VERSION = 1;
+
+    bool sourceStamp(const std::vector<std::string> & sources, uint64_t & size, int64_t & mtime) {
+        size = 0;
+        mtime = 0;
+        for( const std::string & name : sources ) {
+            std::error_code ec;
+            size += (uint64_t)std::filesystem::file_size(name, ec);
+            if( ec ) return false;
+            auto time = std::filesystem::last_write_time(name, ec);
+            if( ec ) return false;
+            mtime = std::max(mtime, (int64_t)time.time_since_epoch().count());
+        }
+        return true;
+    }
+
+    std::vector<std::string> cubeMapSources(const std::string & baseName) {
+        std::vector<std::string> sources;
+        for( const char * suffix : CUBE_SUFFIXES ) sources.push_back(baseName + "_" + suffix + ".hdr");
+        return sources;
+    }
+
+    size_t levelBytes(int size) {
+        return (size_t)6 * size * size * sizeof(uint32_t);
+    }
+
+    // Direction through a point of a face, u and v in [-1, 1] along the s and
+    // t axes of GL's cube map selection rules
+    vec3 faceDirection(int face, float u, float v) {
+        switch( face ) {
+            case 0: return vec3(1.0f, -v, -u);
+            case 1: return vec3(-1.0f, -v, u);
+            case 2: return vec3(u, 1.0f, v);
+            case 3: return vec3(u, -1.0f, -v);
+            case 4: return vec3(u, -v, 1.0f);
+            default: return vec3(-u, -v, -1.0f);
+        }
+    }
+
+    // The inverse: the face a direction hits and s, t in [0, 1]
+    int cubeFace(const vec3 & d, float & s, float & t) {
+        vec3 a = glm::abs(d);
+        int face;
+        float sc, tc, ma;
+        if( a.x >= a.y && a.x >= a.z ) {
+            face = d.x > 0.0f ? 0 : 1;
+            sc = d.x > 0.0f ? -d.z : d.z;
+            tc = -d.y;
+            ma = a.x;
+        } else if( a.y >= a.z ) {
+            face = d.y > 0.0f ? 2 : 3;
+            sc = d.x;
+            tc = d.y > 0.0f ? d.z : -d.z;
+            ma = a.y;
+        } else {
+            face = d.z > 0.0f ? 4 : 5;
+            sc = d.z > 0.0f ? d.x : -d.x;
+            tc = -d.y;
+            ma = a.z;
+        }
+        s = 0.5f * (sc / ma + 1.0f);
+        t = 0.5f * (tc / ma + 1.0f);
+        return face;
+    }
+
+    // Float RGB cube with a box filtered mip chain, sampled like GL does
+    // (bilinear within a face, linear between levels)
+    struct CubeImage {
+        std::vector<int> sizes;
+        std::vector<std::vector<float>> levels;     // six faces back to back
+
+        vec3 texel(int level, int face, int x, int y) const {
+            const float * p = &levels[level][(((size_t)face * sizes[level] + y) * sizes[level] + x) * 3];
+            return vec3(p[0], p[1], p[2]);
+        }
+
+        vec3 sampleLevel(int level, const vec3 & dir) const {
+            float s, t;
+            int face = cubeFace(dir, s, t);
+            int size = sizes[level];
+            float x = glm::clamp(s * size - 0.5f, 0.0f, (float)(size - 1));
+            float y = glm::clamp(t * size - 0.5f, 0.0f, (float)(size - 1));
+            int x0 = (int)x, y0 = (int)y;
+            int x1 = std::min(x0 + 1, size - 1), y1 = std::min(y0 + 1, size - 1);
+            float fx = x - x0, fy = y - y0;
+            return glm::mix(glm::mix(texel(level, face, x0, y0), texel(level, face, x1, y0), fx),
+                            glm::mix(texel(level, face, x0, y1), texel(level, face, x1, y1), fx), fy);
+        }
+
+        vec3 sample(const vec3 & dir, float lod) const {
+            lod = glm::clamp(lod, 0.0f, (float)(levels.size() - 1));
+            int l0 = (int)lod;
+            int l1 = std::min(l0 + 1, (int)levels.size() - 1);
+            vec3 c = sampleLevel(l0, dir);
+            return l1 == l0 ? c : glm::mix(c, sampleLevel(l1, dir), lod - l0);
+        }
+    };
+
+    bool readCube(const std::vector<std::string> & sources, CubeImage & cube) {
+        float * data[6];
+        int w[6] = { 0 }, h[6] = { 0 };
+        ThreadPool::shared().parallelFor(6, [&](size_t i) {
+            data[i] = stbi_loadf(sources[i].c_str(), &w[i], &h[i], NULL, 3);
+        });
+        bool ok = true;
+        for( int i = 0; i < 6; i++ ) {
+            if( data[i] == nullptr || w[i] != w[0] || h[i] != w[0] ) {
+                fprintf(stderr, "Unable to read cube map face (or not square): %s\n", sources[i].c_str());
+                ok = false;
+            }
+        }
+
+        if( ok ) {
+            int size = w[0];
+            size_t faceFloats = (size_t)size * size * 3;
+            cube.sizes.assign(1, size);
+            cube.levels.assign(1, std::vector<float>(6 * faceFloats));
+            for( int i = 0; i < 6; i++ ) memcpy(&cube.levels[0][i * faceFloats], data[i], faceFloats * sizeof(float));
+
+            // 2x2 box filter per face; odd edges repeat the last texel
+            for( ; size > 1; size = std::max(size / 2, 1) ) {
+                int next = std::max(size / 2, 1);
+                const std::vector<float> & src = cube.levels.back();
+                std::vector<float> dst((size_t)6 * next * next * 3);
+                ThreadPool::shared().parallelFor(6, [&](size_t face) {
+                    for( int y = 0; y < next; y++ ) {
+                        int y0 = std::min(2 * y, size - 1), y1 = std::min(2 * y + 1, size - 1);
+                        for( int x = 0; x < next; x++ ) {
+                            int x0 = std::min(2 * x, size - 1), x1 = std::min(2 * x + 1, size - 1);
+                            for( int c = 0; c < 3; c++ ) {
+                                auto at = [&](int tx, int ty) { return src[(((size_t)face * size + ty) * size + tx) * 3 + c]; };
+                                dst[(((size_t)face * next + y) * next + x) * 3 + c] =
+                                    0.25f * (at(x0, y0) + at(x1, y0) + at(x0, y1) + at(x1, y1));
+                            }
+                        }
+                    }
+                });
+                cube.sizes.push_back(next);
+                cube.levels.push_back(std::move(dst));
+            }
+        }
+        for( int i = 0; i < 6; i++ ) stbi_image_free(data[i]);
+        return ok;
+    }
+
+    // Solid angle of the part of a face between its centre and (u, v); a
+    // texel's is the signed sum over its four corners
+    float areaElement(float u, float v) {
+        return std::atan2(u * v, std::sqrt(u * u + v * v + 1.0f));
+    }
+
+    // Radiance projected on the first 9 real spherical harmonics, convolved
+    // with the clamped cosine (Ramamoorthi and Hanrahan 2001)
+    void projectIrradiance(const CubeImage & cube, vec3 sh[9]) {
+        int level = 0;
+        while( cube.sizes[level] > SH_SOURCE_SIZE ) level++;
+        int size = cube.sizes[level];
+
+        // Per face partial sums, added up in order so the result is the same
+        // for any number of threads
+        vec3 faceSums[6][9];
+        ThreadPool::shared().parallelFor(6, [&](size_t face) {
+            vec3 * sum = faceSums[face];
+            for( int i = 0; i < 9; i++ ) sum[i] = vec3(0.0f);
+            float step = 2.0f / size;
+            for( int y = 0; y < size; y++ ) {
+                for( int x = 0; x < size; x++ ) {
+                    float u0 = -1.0f + x * step, v0 = -1.0f + y * step;
+                    float u1 = u0 + step, v1 = v0 + step;
+                    float dw = areaElement(u0, v0) - areaElement(u0, v1) - areaElement(u1, v0) + areaElement(u1, v1);
+                    vec3 d = glm::normalize(faceDirection((int)face, u0 + 0.5f * step, v0 + 0.5f * step));
+                    vec3 c = cube.texel(level, (int)face, x, y) * dw;
+                    sum[0] += c * 0.282095f;
+                    sum[1] += c * (0.488603f * d.y);
+                    sum[2] += c * (0.488603f * d.z);
+                    sum[3] += c * (0.488603f * d.x);
+                    sum[4] += c * (1.092548f * d.x * d.y);
+                    sum[5] += c * (1.092548f * d.y * d.z);
+                    sum[6] += c * (0.315392f * (3.0f * d.z * d.z - 1.0f));
+                    sum[7] += c * (1.092548f * d.x * d.z);
+                    sum[8] += c * (0.546274f * (d.x * d.x - d.y * d.y));
+                }
+            }
+        });
+
+        const float band[9] = { glm::pi<float>(),
+                                2.0f * glm::pi<float>() / 3.0f, 2.0f * glm::pi<float>() / 3.0f, 2.0f * glm::pi<float>() / 3.0f,
+                                glm::pi<float>() / 4.0f, glm::pi<float>() / 4.0f, glm::pi<float>() / 4.0f,
+                                glm::pi<float>() / 4.0f, glm::pi<float>() / 4.0f };
+        for( int i = 0; i < 9; i++ ) {
+            sh[i] = vec3(0.0f);
+            for( int face = 0; face < 6; face++ ) sh[i] += faceSums[face][i];
+            sh[i] *= band[i];
+        }
+    }
+
+    // GGX half vector around the normal (0, 0, 1) for Hammersley point i of
+    // count. bitfieldReverse() in the shaders.
+    vec3 ggxHalfVector(uint32_t i, uint32_t count, float alpha2) {
+        uint32_t bits = i;
+        bits = (bits << 16) | (bits >> 16);
+        bits = ((bits & 0x55555555u) << 1) | ((bits & 0xAAAAAAAAu) >> 1);
+        bits = ((bits & 0x33333333u) << 2) | ((bits & 0xCCCCCCCCu) >> 2);
+        bits = ((bits & 0x0F0F0F0Fu) << 4) | ((bits & 0xF0F0F0F0u) >> 4);
+        bits = ((bits & 0x00FF00FFu) << 8) | ((bits & 0xFF00FF00u) >> 8);
+        float e1 = (float)i / count, e2 = bits * 2.3283064365386963e-10f;
+
+        float phi = 2.0f * glm::pi<float>() * e1;
+        float cosTheta = std::sqrt((1.0f - e2) / (1.0f + (alpha2 - 1.0f) * e2));
+        float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+        return vec3(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+    }
+
+    uint32_t specularSampleCount(int level) {
+        return (uint32_t)std::min(SPECULAR_SAMPLES << std::min(std::max(0, 2 * (level - 1)), 16), MAX_SPECULAR_SAMPLES);
+    }
+
+    // A GGX sample around the normal (0, 0, 1), reflected about the normal
+    // (n = v = r), with the source level whose texels cover the solid angle
+    // the sample stands for (filtered importance sampling)
+    struct SpecularSample {
+        vec3 l;
+        float lod;
+    };
+
+    std::vector<SpecularSample> specularSamples(float roughness, int sourceSize, uint32_t count) {
+        float alpha = roughness * roughness, alpha2 = alpha * alpha;
+        float texelAngle = 4.0f * glm::pi<float>() / (6.0f * sourceSize * sourceSize);
+        std::vector<SpecularSample> samples;
+        for( uint32_t i = 0; i < count; i++ ) {
+            vec3 h = ggxHalfVector(i, count, alpha2);
+            vec3 l = 2.0f * h.z * h - vec3(0.0f, 0.0f, 1.0f);
+            if( l.z <= 0.0f ) continue;
+
+            // pdf of l is D(h) / 4 when n = v
+            float denom = h.z * h.z * (alpha2 - 1.0f) + 1.0f;
+            float pdf = alpha2 / (glm::pi<float>() * denom * denom) / 4.0f;
+            float sampleAngle = 1.0f / (count * pdf);
+            // One level coarser than the exact match, as in GPU Gems 3, ch. 20
+            samples.push_back({ l, std::max(0.5f * std::log2(sampleAngle / texelAngle) + 1.0f, 0.0f) });
+        }
+        return samples;
+    }
+
+    // Prefiltered level of the given size, packed as R11G11B10F
+    void prefilterLevel(const CubeImage & cube, int level, int size, float roughness, uint32_t * out) {
+        std::vector<SpecularSample> samples;
+        if( roughness > 0.0f ) samples = specularSamples(roughness, cube.sizes[0], specularSampleCount(level));
+        float mirrorLod = std::log2((float)cube.sizes[0] / size);
+
+        ThreadPool::shared().parallelFor((size_t)6 * size, [&](size_t row) {
+            int face = (int)(row / size), y = (int)(row % size);
+            for( int x = 0; x < size; x++ ) {
+                vec3 n = glm::normalize(faceDirection(face, 2.0f * (x + 0.5f) / size - 1.0f, 2.0f * (y + 0.5f) / size - 1.0f));
+                vec3 color(0.0f);
+                if( samples.empty() ) {
+                    color = cube.sample(n, mirrorLod);
+                } else {
+                    vec3 up = std::fabs(n.z) < 0.999f ? vec3(0.0f, 0.0f, 1.0f) : vec3(1.0f, 0.0f, 0.0f);
+                    vec3 tx = glm::normalize(glm::cross(up, n));
+                    vec3 ty = glm::cross(n, tx);
+                    float weight = 0.0f;
+                    for( const SpecularSample & s : samples ) {
+                        vec3 l = tx * s.l.x + ty * s.l.y + n * s.l.z;
+                        color += cube.sample(l, s.lod) * s.l.z;
+                        weight += s.l.z;
+                    }
+                    color /= weight;
+                }
+                out[row * size + x] = packR11G11B10F(color.x, color.y, color.z);
+            }
+        });
+    }
+
+    int levelSize(const IblFileHeader & header, int level) {
+        return std::max((int)header.size >> level, 1);
+    }
+
+    // Texels of all specular levels
+    size_t specularTexels(const IblFileHeader & header) {
+        size_t texels = 0;
+        for( uint32_t level = 0; level < header.levels; level++ )
+            texels += levelBytes(levelSize(header, level)) / sizeof(uint32_t);
+        return texels;
+    }
+
+    void prefilter(const CubeImage & cube, const IblFileHeader & header, uint32_t * out) {
+        for( uint32_t level = 0; level < header.levels; level++ ) {
+            int size = levelSize(header, level);
+            float roughness = header.levels > 1 ? (float)level / (header.levels - 1) : 0.0f;
+            prefilterLevel(cube, (int)level, size, roughness, out);
+            out += levelBytes(size) / sizeof(uint32_t);
+        }
+    }
+
+    // Decode the faces and fill in everything of the header but the specular
+    // levels themselves
+    bool readSources(const std::string & baseName, IblFileHeader & header, CubeImage & cube) {
+        std::vector<std::string> sources = cubeMapSources(baseName);
+        memset(&header, 0, sizeof(header));
+        if( !sourceStamp(sources, header.sourceSize, header.sourceMtime) || !readCube(sources, cube) ) {
+            fprintf(stderr, "Unable to read cube map: %s\n", baseName.c_str());
+            return false;
+        }
+
+        memcpy(header.magic, "SIBL", 4);
+        header.version = IBL_FILE_VERSION;
+        header.size = (uint32_t)std::min(EnvironmentMap::SPECULAR_SIZE, cube.sizes[0]);
+        header.levels = (uint32_t)std::min(EnvironmentMap::SPECULAR_LEVELS, Texture::mipLevels(header.size, header.size));
+        header.samples = SPECULAR_SAMPLES;
+        header.maxSamples = MAX_SPECULAR_SAMPLES;
+
+        vec3 sh[9];
+        projectIrradiance(cube, sh);
+        for( int i = 0; i < 9; i++ ) memcpy(&header.sh[3 * i], &sh[i][0], 3 * sizeof(float));
+        return true;
+    }
+
+    bool writeCache(const std::string & fileName, const IblFileHeader & header, const std::vector<uint32_t> & texels) {
+        // Write to a temporary and rename, so a reader never maps half a file
+        std::string tmpName = fileName + ".tmp";
+        FILE * fp = fopen(tmpName.c_str(), "wb");
+        if( fp == NULL ) {
+            fprintf(stderr, "Unable to write environment map: %s\n", fileName.c_str());
+            return false;
+        }
+        bool written = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+                       fwrite(texels.data(), sizeof(uint32_t), texels.size(), fp) == texels.size();
+        written = (fclose(fp) == 0) && written;
+
+        std::error_code ec;
+        if( written ) std::filesystem::rename(tmpName, fileName, ec);
+        if( !written || ec ) {
+            fprintf(stderr, "Unable to write environment map: %s\n", fileName.c_str());
+            std::filesystem::remove(tmpName, ec);
+            return false;
+        }
+        return true;
+    }
+
+    // Map the cache if it is complete and current
+    bool openCache(const std::string & baseName, MappedFile & file, IblFileHeader & header) {
+        uint64_t size;
+        int64_t mtime;
+        if( !sourceStamp(cubeMapSources(baseName), size, mtime) ) return false;
+        if( !file.open(EnvironmentMap::cacheFileName(baseName).c_str()) ) return false;
+
+        if( file.size() >= sizeof(header) ) memcpy(&header, file.data(), sizeof(header));
+        bool ok = file.size() >= sizeof(header) && memcmp(header.magic, "SIBL", 4) == 0 &&
+                  header.version == IBL_FILE_VERSION && header.sourceSize == size && header.sourceMtime == mtime &&
+                  header.samples == (uint32_t)SPECULAR_SAMPLES && header.maxSamples == (uint32_t)MAX_SPECULAR_SAMPLES &&
+                  header.size >= 1 && header.size <= (uint32_t)EnvironmentMap::SPECULAR_SIZE && header.levels >= 1 &&
+                  header.levels == (uint32_t)std::min(EnvironmentMap::SPECULAR_LEVELS, Texture::mipLevels(header.size, header.size));
+        if( !ok || file.size() < sizeof(header) + specularTexels(header) * sizeof(uint32_t) ) {
+            file.close();
+            return false;
+        }
+        return true;
+    }
+
+    // Split sum scale and bias of f0 for n.v and roughness (Karis 2013), with
+    // the Smith-Schlick visibility term using k = alpha / 2
+    glm::vec2 integrateBrdf(float nDotV, float roughness) {
+        float alpha = roughness * roughness, alpha2 = alpha * alpha, k = alpha / 2.0f;
+        vec3 v(std::sqrt(1.0f - nDotV * nDotV), 0.0f, nDotV);
+        float a = 0.0f, b = 0.0f;
+        for( uint32_t i = 0; i < (uint32_t)BRDF_SAMPLES; i++ ) {
+            vec3 h = ggxHalfVector(i, BRDF_SAMPLES, alpha2);
+            float vDotH = glm::dot(v, h);
+            float nDotL = 2.0f * vDotH * h.z - nDotV;
+            if( nDotL <= 0.0f ) continue;
+            float g = nDotL / (nDotL * (1.0f - k) + k) * nDotV / (nDotV * (1.0f - k) + k);
+            float visibility = g * std::max(vDotH, 0.0f) / (h.z * nDotV);
+            float fc = std::pow(1.0f - std::max(vDotH, 0.0f), 5.0f);
+            a += (1.0f - fc) * visibility;
+            b += fc * visibility;
+        }
+        return glm::vec2(a, b) / (float)BRDF_SAMPLES;
+    }
+
+    // Hammersley points and GGX sampling as on the CPU side
+    const char * SAMPLING_GLSL =
+        "#version 430\n"
+        "layout(local_size_x = 8, local_size_y = 8) in;\n"
+        "const float PI = 3.14159265358979323846;\n"
+        "vec3 ggxHalfVector(uint i, uint count, float alpha2) {\n"
+        "    float e1 = float(i) / float(count), e2 = float(bitfieldReverse(i)) * 2.3283064365386963e-10;\n"
+        "    float phi = 2.0 * PI * e1;\n"
+        "    float cosTheta = sqrt((1.0 - e2) / (1.0 + (alpha2 - 1.0) * e2));\n"
+        "    float sinTheta = sqrt(1.0 - cosTheta * cosTheta);\n"
+        "    return vec3(sinTheta * cos(phi), sinTheta * sin(phi), cosTheta);\n"
+        "}\n";
+
+    const char * PREFILTER_CS =
+        "layout(binding = 0) uniform samplerCube Source;\n"
+        "layout(r11f_g11f_b10f, binding = 0) writeonly uniform imageCube Level;\n"
+        "uniform int Size;\n"
+        "uniform float Roughness;\n"
+        "uniform uint SampleCount;\n"
+        "uniform float SourceSize;\n"
+        "vec3 faceDirection(uint face, vec2 uv) {\n"
+        "    if (face == 0u) return vec3(1.0, -uv.y, -uv.x);\n"
+        "    if (face == 1u) return vec3(-1.0, -uv.y, uv.x);\n"
+        "    if (face == 2u) return vec3(uv.x, 1.0, uv.y);\n"
+        "    if (face == 3u) return vec3(uv.x, -1.0, -uv.y);\n"
+        "    if (face == 4u) return vec3(uv.x, -uv.y, 1.0);\n"
+        "    return vec3(-uv.x, -uv.y, -1.0);\n"
+        "}\n"
+        "void main() {\n"
+        "    uvec3 id = gl_GlobalInvocationID;\n"
+        "    if (id.x >= uint(Size) || id.y >= uint(Size)) return;\n"
+        "    vec3 n = normalize(faceDirection(id.z, 2.0 * (vec2(id.xy) + 0.5) / float(Size) - 1.0));\n"
+        "    vec3 color = vec3(0.0);\n"
+        "    if (Roughness == 0.0) {\n"
+        "        color = textureLod(Source, n, log2(SourceSize / float(Size))).rgb;\n"
+        "    } else {\n"
+        "        vec3 tx = normalize(cross(abs(n.z) < 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(1.0, 0.0, 0.0), n));\n"
+        "        vec3 ty = cross(n, tx);\n"
+        "        float alpha2 = Roughness * Roughness * Roughness * Roughness;\n"
+        "        float texelAngle = 4.0 * PI / (6.0 * SourceSize * SourceSize);\n"
+        "        float weight = 0.0;\n"
+        "        for (uint i = 0u; i < SampleCount; i++) {\n"
+        "            vec3 h = ggxHalfVector(i, SampleCount, alpha2);\n"
+        "            vec3 l = 2.0 * h.z * h - vec3(0.0, 0.0, 1.0);\n"
+        "            if (l.z <= 0.0) continue;\n"
+        "            float d = h.z * h.z * (alpha2 - 1.0) + 1.0;\n"
+        "            float pdf = alpha2 / (PI * d * d) / 4.0;\n"
+        "            float lod = max(0.5 * log2(1.0 / (float(SampleCount) * pdf) / texelAngle) + 1.0, 0.0);\n"
+        "            color += textureLod(Source, tx * l.x + ty * l.y + n * l.z, lod).rgb * l.z;\n"
+        "            weight += l.z;\n"
+        "        }\n"
+        "        color /= weight;\n"
+        "    }\n"
+        "    imageStore(Level, ivec3(id), vec4(color, 1.0));\n"
+        "}\n";
+
+    const char * BRDF_CS =
+        "layout(rg16f, binding = 0) writeonly uniform image2D Lut;\n"
+        "uniform int Size;\n"
+        "uniform uint SampleCount;\n"
+        "void main() {\n"
+        "    ivec2 id = ivec2(gl_GlobalInvocationID.xy);\n"
+        "    if (id.x >= Size || id.y >= Size) return;\n"
+        "    float nDotV = (float(id.x) + 0.5) / float(Size), roughness = (float(id.y) + 0.5) / float(Size);\n"
+        "    float alpha = roughness * roughness, alpha2 = alpha * alpha, k = alpha / 2.0;\n"
+        "    vec3 v = vec3(sqrt(1.0 - nDotV * nDotV), 0.0, nDotV);\n"
+        "    vec2 ab = vec2(0.0);\n"
+        "    for (uint i = 0u; i < SampleCount; i++) {\n"
+        "        vec3 h = ggxHalfVector(i, SampleCount, alpha2);\n"
+        "        float vDotH = dot(v, h);\n"
+        "        float nDotL = 2.0 * vDotH * h.z - nDotV;\n"
+        "        if (nDotL <= 0.0) continue;\n"
+        "        float g = nDotL / (nDotL * (1.0 - k) + k) * nDotV / (nDotV * (1.0 - k) + k);\n"
+        "        float visibility = g * max(vDotH, 0.0) / (h.z * nDotV);\n"
+        "        float fc = pow(1.0 - max(vDotH, 0.0), 5.0);\n"
+        "        ab += vec2(1.0 - fc, fc) * visibility;\n"
+        "    }\n"
+        "    imageStore(Lut, id, vec4(ab / float(SampleCount), 0.0, 0.0));\n"
+        "}\n";
+
+    GLuint createCubeTexture(GLenum internalFormat, int size, int levels) {
+        GLuint tex;
+        glGenTextures(1, &tex);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, tex);
+        glTexStorage2D(GL_TEXTURE_CUBE_MAP, levels, internalFormat, size, size);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        return tex;
+    }
+}
+
+EnvironmentMap::EnvironmentMap()
+    : specular(0), brdfLut(0), specularLevels(0), computeAvailable(GLAD_GL_VERSION_4_3 != 0),
+      useCompute(GLAD_GL_VERSION_4_3 != 0) {
+    for( int i = 0; i < 9; i++ ) sh[i] = vec3(0.0f);
+}
+
+EnvironmentMap::~EnvironmentMap() {
+    release();
+}
+
+void EnvironmentMap::release() {
+    if( specular != 0 ) glDeleteTextures(1, &specular);
+    if( brdfLut != 0 ) glDeleteTextures(1, &brdfLut);
+    specular = brdfLut = 0;
+    specularLevels = 0;
+}
+
+std::string EnvironmentMap::cacheFileName(const std::string & baseName) {
+    return baseName + "_ibl.cache";
+}
+
+bool EnvironmentMap::bake(const std::string & baseName) {
+    IblFileHeader header;
+    CubeImage cube;
+    if( !readSources(baseName, header, cube) ) return false;
+    std::vector<uint32_t> texels(specularTexels(header));
+    prefilter(cube, header, texels.data());
+    return writeCache(cacheFileName(baseName), header, texels);
+}
+
+bool EnvironmentMap::load(const std::string & baseName) {
+    if( specular != 0 ) glDeleteTextures(1, &specular);
+    specular = 0;
+
+    MappedFile file;
+    IblFileHeader header;
+    std::vector<uint32_t> baked;
+    const char * texels;
+    if( openCache(baseName, file, header) ) {
+        texels = file.data() + sizeof(header);
+    } else {
+        CubeImage cube;
+        if( !readSources(baseName, header, cube) ) return false;
+        baked.resize(specularTexels(header));
+        if( !prefilterOnGpu(cube.sizes, cube.levels, header.size, header.levels, baked.data()) )
+            prefilter(cube, header, baked.data());
+        // Only costs the next start if it fails
+        writeCache(cacheFileName(baseName), header, baked);
+        texels = reinterpret_cast<const char *>(baked.data());
+    }
+
+    for( int i = 0; i < 9; i++ ) sh[i] = vec3(header.sh[3*i], header.sh[3*i+1], header.sh[3*i+2]);
+    specularLevels = (int)header.levels;
+
+    // The compute path leaves its result in place
+    if( specular == 0 ) {
+        specular = createCubeTexture(GL_R11F_G11F_B10F, header.size, specularLevels);
+        for( int level = 0; level < specularLevels; level++ ) {
+            int size = levelSize(header, level);
+            size_t faceBytes = levelBytes(size) / 6;
+            for( int face = 0; face < 6; face++ )
+                glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, 0, 0, size, size, GL_RGB,
+                                GL_UNSIGNED_INT_10F_11F_11F_REV, texels + face * faceBytes);
+            texels += levelBytes(size);
+        }
+    }
+
+    if( brdfLut == 0 ) createBrdfLut();
+    return true;
+}
+
+// Prefilter into a new specular texture with a compute shader and read the
+// levels back for the cache. False (and no texture) without compute support
+// or if the shader does not build.
+bool EnvironmentMap::prefilterOnGpu(const std::vector<int> & sourceSizes, const std::vector<std::vector<float>> & source,
+                                    int size, int levels, uint32_t * out) {
+    if( !useCompute ) return false;
+    GLSLProgram program;
+    try {
+        program.compileShader(std::string(SAMPLING_GLSL) + PREFILTER_CS, GLSLShader::COMPUTE);
+        program.link();
+    } catch( GLSLProgramException & e ) {
+        fprintf(stderr, "Prefilter shader failed, baking on the CPU: %s\n", e.what());
+        return false;
+    }
+
+    // The source with the same box filtered mips the CPU path samples
+    GLuint sourceTex = createCubeTexture(GL_RGB16F, sourceSizes[0], (int)sourceSizes.size());
+    for( size_t level = 0; level < source.size(); level++ ) {
+        size_t faceFloats = (size_t)sourceSizes[level] * sourceSizes[level] * 3;
+        for( int face = 0; face < 6; face++ )
+            glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, (GLint)level, 0, 0, sourceSizes[level], sourceSizes[level],
+                            GL_RGB, GL_FLOAT, &source[level][face * faceFloats]);
+    }
+
+    specular = createCubeTexture(GL_R11F_G11F_B10F, size, levels);
+    program.use();
+    program.setUniform("SourceSize", (float)sourceSizes[0]);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, sourceTex);
+    for( int level = 0; level < levels; level++ ) {
+        int levelSize = std::max(size >> level, 1);
+        program.setUniform("Size", levelSize);
+        program.setUniform("Roughness", levels > 1 ? (float)level / (levels - 1) : 0.0f);
+        program.setUniform("SampleCount", (GLuint)specularSampleCount(level));
+        glBindImageTexture(0, specular, level, GL_TRUE, 0, GL_WRITE_ONLY, GL_R11F_G11F_B10F);
+        glDispatchCompute((levelSize + 7) / 8, (levelSize + 7) / 8, 6);
+    }
+    glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+
+    glBindTexture(GL_TEXTURE_CUBE_MAP, specular);
+    for( int level = 0; level < levels; level++ ) {
+        int levelSize = std::max(size >> level, 1);
+        for( int face = 0; face < 6; face++ ) {
+            glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_RGB, GL_UNSIGNED_INT_10F_11F_11F_REV, out);
+            out += (size_t)levelSize * levelSize;
+        }
+    }
+    glDeleteTextures(1, &sourceTex);
+    return true;
+}
+
+void EnvironmentMap::createBrdfLut() {
+    glGenTextures(1, &brdfLut);
+    glBindTexture(GL_TEXTURE_2D, brdfLut);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RG16F, BRDF_LUT_SIZE, BRDF_LUT_SIZE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    if( useCompute ) {
+        GLSLProgram program;
+        try {
+            program.compileShader(std::string(SAMPLING_GLSL) + BRDF_CS, GLSLShader::COMPUTE);
+            program.link();
+            program.use();
+            program.setUniform("Size", BRDF_LUT_SIZE);
+            program.setUniform("SampleCount", (GLuint)BRDF_SAMPLES);
+            glBindImageTexture(0, brdfLut, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG16F);
+            glDispatchCompute((BRDF_LUT_SIZE + 7) / 8, (BRDF_LUT_SIZE + 7) / 8, 1);
+            glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+            return;
+        } catch( GLSLProgramException & e ) {
+            fprintf(stderr, "BRDF shader failed, integrating on the CPU: %s\n", e.what());
+        }
+    }
+
+    std::vector<glm::vec2> lut((size_t)BRDF_LUT_SIZE * BRDF_LUT_SIZE);
+    ThreadPool::shared().parallelFor(BRDF_LUT_SIZE, [&](size_t y) {
+        for( int x = 0; x < BRDF_LUT_SIZE; x++ )
+            lut[y * BRDF_LUT_SIZE + x] = integrateBrdf((x + 0.5f) / BRDF_LUT_SIZE, (y + 0.5f) / BRDF_LUT_SIZE);
+    });
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, BRDF_LUT_SIZE, BRDF_LUT_SIZE, GL_RG, GL_FLOAT, lut.data());
+}
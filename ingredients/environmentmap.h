@@ -0,0 +1,71 @@
+#pragma once
+
+#include "cookbookogl.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Image based lighting for an HDR cube map (baseName_posx.hdr ...): a GGX
+// prefiltered specular cube whose mip levels hold rising roughness, and the
+// diffuse irradiance as 9 spherical harmonic coefficients. Both are baked on
+// the thread pool and cached in baseName_ibl.cache, which is rebuilt when
+// the source faces change. With GL 4.3 a missing cache is prefiltered by a
+// compute shader instead and read back into the cache. The sky itself is
+// loaded separately, e.g. with Texture::loadHdrCubeMap.
+//
+// load() also makes the split sum BRDF table that goes with the specular
+// cube, specular = prefiltered(r) * (f0 * lut.x + lut.y).
+class EnvironmentMap {
+public:
+    // Size of the largest specular level (smaller if the source is)
+    static const int SPECULAR_SIZE = 128;
+    // Level l of n holds roughness l / (n - 1)
+    static const int SPECULAR_LEVELS = 6;
+    static const int BRDF_LUT_SIZE = 64;
+
+    EnvironmentMap();
+    ~EnvironmentMap();
+
+    // Read the cache, baking it first if it is missing or stale, and upload
+    // the specular cube. False if the faces could not be read. Shader build
+    // errors fall back to the CPU.
+    bool load(const std::string & baseName);
+    // Delete the textures (also done by the destructor)
+    void release();
+
+    // Write the cache ahead of time. No GL needed.
+    static bool bake(const std::string & baseName);
+    static std::string cacheFileName(const std::string & baseName);
+
+    // R11F_G11F_B10F cube with getSpecularLevels() levels
+    GLuint getSpecular() const { return specular; }
+    int getSpecularLevels() const { return specularLevels; }
+    // RG16F, s = n.v and t = roughness: scale and bias of f0
+    GLuint getBrdfLut() const { return brdfLut; }
+
+    bool hasCompute() const { return computeAvailable; }
+    // Bake on the CPU even when compute shaders are available
+    void setUseCompute(bool use) { useCompute = use && computeAvailable; }
+
+    // Irradiance (cosine convolved radiance) E(n) = sum of sh[i] * Y_i(n),
+    // in the order Y00, Y1-1, Y10, Y11, Y2-2, Y2-1, Y20, Y21, Y22. A
+    // Lambertian surface reflects albedo * E(n) / pi.
+    const glm::vec3 * getIrradianceSH() const { return sh; }
+
+private:
+    GLuint specular, brdfLut;
+    int specularLevels;
+    glm::vec3 sh[9];
+    bool computeAvailable, useCompute;
+
+    bool prefilterOnGpu(const std::vector<int> & sourceSizes, const std::vector<std::vector<float>> & source,
+                        int size, int levels, uint32_t * out);
+    void createBrdfLut();
+
+    // Make it non-copyable.
+    EnvironmentMap(const EnvironmentMap &) = delete;
+    EnvironmentMap & operator=(const EnvironmentMap &) = delete;
+};
@@ -0,0 +1,115 @@
+#include "mappedfile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    // What an empty file maps to: the OS cannot map zero bytes, but an
+    // empty file is still a valid one (e.g. an empty OBJ)
+    char emptyFile[1] = { 0 };
+}
+
+MappedFile::MappedFile() : ptr(nullptr), length(0)
+#ifdef _WIN32
+    , fileHandle(nullptr), mappingHandle(nullptr)
+#endif
+{ }
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const char * fileName, bool copyOnWrite) {
+    close();
+
+    HANDLE file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if( file == INVALID_HANDLE_VALUE ) return false;
+
+    LARGE_INTEGER fileSize;
+    if( !GetFileSizeEx(file, &fileSize) ) {
+        CloseHandle(file);
+        return false;
+    }
+    if( fileSize.QuadPart == 0 ) {
+        CloseHandle(file);
+        ptr = emptyFile;
+        return true;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, copyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+    if( mapping == NULL ) {
+        CloseHandle(file);
+        return false;
+    }
+
+    ptr = MapViewOfFile(mapping, copyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+    if( ptr == nullptr ) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    fileHandle = file;
+    mappingHandle = mapping;
+    length = (size_t)fileSize.QuadPart;
+    return true;
+}
+
+void MappedFile::close() {
+    if( ptr != nullptr && ptr != emptyFile ) UnmapViewOfFile(ptr);
+    if( mappingHandle != nullptr ) CloseHandle((HANDLE)mappingHandle);
+    if( fileHandle != nullptr ) CloseHandle((HANDLE)fileHandle);
+    ptr = nullptr;
+    mappingHandle = fileHandle = nullptr;
+    length = 0;
+}
+
+#else
+
+bool MappedFile::open(const char * fileName, bool copyOnWrite) {
+    close();
+
+    int fd = ::open(fileName, O_RDONLY);
+    if( fd < 0 ) return false;
+
+    struct stat st;
+    if( fstat(fd, &st) != 0 ) {
+        ::close(fd);
+        return false;
+    }
+    if( st.st_size == 0 ) {
+        ::close(fd);
+        ptr = emptyFile;
+        return true;
+    }
+
+    int prot = copyOnWrite ? (PROT_READ | PROT_WRITE) : PROT_READ;
+    void * p = mmap(nullptr, (size_t)st.st_size, prot, MAP_PRIVATE, fd, 0);
+    // The mapping keeps its own reference to the file
+    ::close(fd);
+    if( p == MAP_FAILED ) return false;
+
+    madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    ptr = p;
+    length = (size_t)st.st_size;
+    return true;
+}
+
+void MappedFile::close() {
+    if( ptr != nullptr && ptr != emptyFile ) munmap(ptr, length);
+    ptr = nullptr;
+    length = 0;
+}
+
+#endif
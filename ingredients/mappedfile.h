@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+
+// Read-only (or copy-on-write) memory mapping of a whole file. Pages are
+// faulted in by the OS on first access, so large files can be used without
+// reading them into a separate buffer first.
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+
+    // Map the whole file. With copyOnWrite the mapping is writable but
+    // changes stay private to this process and never reach the file. An
+    // empty file opens with size() 0 and a data() that must not be read.
+    bool open(const char * fileName, bool copyOnWrite = false);
+    void close();
+
+    bool isOpen() const { return ptr != nullptr; }
+    char * data() const { return static_cast<char *>(ptr); }
+    size_t size() const { return length; }
+
+private:
+    void * ptr;
+    size_t length;
+#ifdef _WIN32
+    void * fileHandle;
+    void * mappingHandle;
+#endif
+
+    // Make it non-copyable.
+    MappedFile(const MappedFile &) = delete;
+    MappedFile & operator=(const MappedFile &) = delete;
+};
@@ -0,0 +1,223 @@
+#include "mesharena.h"
+#include "trianglemesh.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace {
+    // Storage that cannot be resized, written with glBufferSubData and
+    // glMapBufferRange. Plain glBufferData before GL 4.4.
+    void createStorage(GLenum target, size_t bytes) {
+        if( GLAD_GL_VERSION_4_4 || GLAD_GL_ARB_buffer_storage )
+            glBufferStorage(target, bytes, nullptr, GL_DYNAMIC_STORAGE_BIT | GL_MAP_WRITE_BIT);
+        else
+            glBufferData(target, bytes, nullptr, GL_STATIC_DRAW);
+    }
+}
+
+MeshArena::MeshArena(size_t vertexBytes, size_t indices) :
+    blockVertexBytes(vertexBytes), blockIndices(indices)
+{ }
+
+MeshArena::~MeshArena() {
+    for( Block & b : blocks ) {
+        GLuint buffers[2] = { b.vertexBuffer, b.indexBuffer };
+        glDeleteBuffers(2, buffers);
+        glDeleteVertexArrays(1, &b.vao);
+    }
+}
+
+MeshArena::Range MeshArena::allocate(GLuint layout, GLsizei stride, size_t vertexCount, size_t indexCount,
+                                     const std::function<void(GLuint)> & setupVao) {
+    Range r;
+    r.vertexCount = (GLuint)vertexCount;
+    r.indexCount = (GLuint)indexCount;
+
+    // First fit over the blocks of this layout. A range of one block may fit
+    // and the other not, so the first one is taken back then.
+    for( size_t i = 0; i < blocks.size() && r.block < 0; i++ ) {
+        Block & b = blocks[i];
+        if( b.layout != layout || b.stride != stride ) continue;
+        if( !take(b.freeVertices, r.vertexCount, r.firstVertex) ) continue;
+        if( !take(b.freeIndices, r.indexCount, r.firstIndex) ) {
+            give(b.freeVertices, r.firstVertex, r.vertexCount);
+            continue;
+        }
+        r.block = (int)i;
+    }
+
+    if( r.block < 0 ) {
+        GLuint vertexCapacity = std::max((GLuint)(blockVertexBytes / stride), r.vertexCount);
+        GLuint indexCapacity = std::max((GLuint)blockIndices, r.indexCount);
+        r.block = createBlock(layout, stride, vertexCapacity, indexCapacity, setupVao);
+        Block & b = blocks[r.block];
+        take(b.freeVertices, r.vertexCount, r.firstVertex);
+        take(b.freeIndices, r.indexCount, r.firstIndex);
+    }
+    return r;
+}
+
+void MeshArena::release(Range & r) {
+    if( r.block < 0 ) return;
+    Block & b = blocks[r.block];
+    give(b.freeVertices, r.firstVertex, r.vertexCount);
+    give(b.freeIndices, r.firstIndex, r.indexCount);
+    r = Range();
+}
+
+size_t MeshArena::getUsedBytes() const {
+    size_t bytes = 0;
+    for( const Block & b : blocks )
+        bytes += (size_t)(b.vertexCapacity - freeCount(b.freeVertices)) * b.stride +
+                 (size_t)(b.indexCapacity - freeCount(b.freeIndices)) * sizeof(GLuint);
+    return bytes;
+}
+
+size_t MeshArena::getCapacityBytes() const {
+    size_t bytes = 0;
+    for( const Block & b : blocks )
+        bytes += (size_t)b.vertexCapacity * b.stride + (size_t)b.indexCapacity * sizeof(GLuint);
+    return bytes;
+}
+
+int MeshArena::createBlock(GLuint layout, GLsizei stride, GLuint vertexCapacity, GLuint indexCapacity,
+                           const std::function<void(GLuint)> & setupVao) {
+    Block b;
+    b.layout = layout;
+    b.stride = stride;
+    b.vertexCapacity = vertexCapacity;
+    b.indexCapacity = indexCapacity;
+    give(b.freeVertices, 0, vertexCapacity);
+    give(b.freeIndices, 0, indexCapacity);
+
+    GLuint buffers[2];
+    glGenBuffers(2, buffers);
+    b.vertexBuffer = buffers[0];
+    b.indexBuffer = buffers[1];
+    glBindBuffer(GL_COPY_WRITE_BUFFER, b.vertexBuffer);
+    createStorage(GL_COPY_WRITE_BUFFER, (size_t)vertexCapacity * stride);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, b.indexBuffer);
+    createStorage(GL_COPY_WRITE_BUFFER, (size_t)indexCapacity * sizeof(GLuint));
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    glGenVertexArrays(1, &b.vao);
+    glBindVertexArray(b.vao);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, b.indexBuffer);
+    setupVao(b.vertexBuffer);
+    glBindVertexArray(0);
+
+    blocks.push_back(b);
+    return (int)blocks.size() - 1;
+}
+
+bool MeshArena::take(FreeList & list, GLuint count, GLuint & first) {
+    if( count == 0 ) {
+        first = 0;
+        return true;
+    }
+    for( auto it = list.begin(); it != list.end(); ++it ) {
+        if( it->second < count ) continue;
+        first = it->first;
+        GLuint rest = it->second - count;
+        list.erase(it);
+        if( rest > 0 ) list[first + count] = rest;
+        return true;
+    }
+    return false;
+}
+
+void MeshArena::give(FreeList & list, GLuint first, GLuint count) {
+    if( count == 0 ) return;
+    auto next = list.lower_bound(first);
+    if( next != list.end() && first + count == next->first ) {
+        count += next->second;
+        next = list.erase(next);
+    }
+    if( next != list.begin() ) {
+        auto prev = std::prev(next);
+        if( prev->first + prev->second == first ) {
+            prev->second += count;
+            return;
+        }
+    }
+    list[first] = count;
+}
+
+GLuint MeshArena::freeCount(const FreeList & list) {
+    GLuint n = 0;
+    for( const auto & r : list ) n += r.second;
+    return n;
+}
+
+MeshBatch::MeshBatch() : instanceCount(0), commandBuffer(0), uploadedCapacity(0), dirty(false) { }
+
+MeshBatch::~MeshBatch() {
+    if( commandBuffer != 0 ) glDeleteBuffers(1, &commandBuffer);
+}
+
+void MeshBatch::clear() {
+    commands.clear();
+    runs.clear();
+    instanceCount = 0;
+    dirty = true;
+}
+
+void MeshBatch::add(const TriangleMesh & mesh, int lodLevel, GLuint instances) {
+    if( mesh.getVao() == 0 || mesh.getLodCount() == 0 || instances == 0 ) return;
+
+    commands.push_back(mesh.getDrawCommand(lodLevel, instances, instanceCount));
+    instanceCount += instances;
+    dirty = true;
+
+    if( runs.empty() || runs.back().vao != mesh.getVao() || runs.back().primitive != mesh.getPrimitive() )
+        runs.push_back(Run{ mesh.getVao(), mesh.getPrimitive(), commands.size() - 1, 0 });
+    runs.back().count++;
+}
+
+size_t MeshBatch::getDrawCalls() const {
+    return GLAD_GL_VERSION_4_3 ? runs.size() : commands.size();
+}
+
+void MeshBatch::render() {
+    if( commands.empty() ) return;
+
+    if( !GLAD_GL_VERSION_4_3 ) {
+        for( const Run & run : runs ) {
+            glBindVertexArray(run.vao);
+            for( size_t c = run.first; c < run.first + run.count; c++ ) {
+                const DrawElementsIndirectCommand & cmd = commands[c];
+                const GLvoid * offset = (const GLvoid *)(cmd.firstIndex * sizeof(GLuint));
+                if( GLAD_GL_VERSION_4_2 )
+                    glDrawElementsInstancedBaseVertexBaseInstance(run.primitive, cmd.count, GL_UNSIGNED_INT, offset,
+                                                                  cmd.instanceCount, cmd.baseVertex, cmd.baseInstance);
+                else
+                    glDrawElementsInstancedBaseVertex(run.primitive, cmd.count, GL_UNSIGNED_INT, offset,
+                                                      cmd.instanceCount, cmd.baseVertex);
+            }
+        }
+        glBindVertexArray(0);
+        return;
+    }
+
+    if( commandBuffer == 0 ) glGenBuffers(1, &commandBuffer);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    if( dirty ) {
+        size_t bytes = commands.size() * sizeof(DrawElementsIndirectCommand);
+        if( bytes > uploadedCapacity ) {
+            uploadedCapacity = bytes;
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, bytes, commands.data(), GL_DYNAMIC_DRAW);
+        } else {
+            glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, bytes, commands.data());
+        }
+        dirty = false;
+    }
+
+    for( const Run & run : runs ) {
+        glBindVertexArray(run.vao);
+        glMultiDrawElementsIndirect(run.primitive, GL_UNSIGNED_INT,
+                                    (const GLvoid *)(run.first * sizeof(DrawElementsIndirectCommand)),
+                                    (GLsizei)run.count, 0);
+    }
+    glBindVertexArray(0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
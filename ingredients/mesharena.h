@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <vector>
+
+#include "cookbookogl.h"
+
+class TriangleMesh;
+
+// Layout of a glMultiDrawElementsIndirect command
+struct DrawElementsIndirectCommand {
+    GLuint count, instanceCount, firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// Vertex and index ranges for many meshes, suballocated from a few large
+// buffers. Meshes with the same vertex layout share blocks of one vertex
+// buffer, one index buffer and one VAO, and draw with a base vertex, so
+// switching between them needs no rebinding and MeshBatch can draw them all
+// with one glMultiDrawElementsIndirect. The buffers are immutable (GL 4.4
+// buffer storage) where available; they are never resized either way, a
+// full block is followed by a new one.
+//
+// See TriangleMesh::setDefaultArena(). The arena must outlive its meshes.
+class MeshArena {
+public:
+    // Where a mesh lives, in vertices and indices of its block
+    struct Range {
+        int block;                  // -1 when nothing is allocated
+        GLuint firstVertex, vertexCount;
+        GLuint firstIndex, indexCount;
+
+        Range() : block(-1), firstVertex(0), vertexCount(0), firstIndex(0), indexCount(0) { }
+    };
+
+    // Capacity of every block. Larger meshes get a block of their own.
+    explicit MeshArena(size_t blockVertexBytes = 32 << 20, size_t blockIndices = 8 << 20);
+    ~MeshArena();
+
+    // Room for vertexCount vertices of stride bytes and indexCount indices
+    // in a block of the given layout (any key that tells layouts apart).
+    // setupVao is called with the VAO of a new block bound, to set up the
+    // attributes at offset 0 of its vertex buffer; the index buffer is
+    // already bound to it.
+    Range allocate(GLuint layout, GLsizei stride, size_t vertexCount, size_t indexCount,
+                   const std::function<void(GLuint vertexBuffer)> & setupVao);
+    void release(Range & range);
+
+    GLuint getVao(int block) const { return blocks[block].vao; }
+    GLuint getVertexBuffer(int block) const { return blocks[block].vertexBuffer; }
+    GLuint getIndexBuffer(int block) const { return blocks[block].indexBuffer; }
+    GLsizei getStride(int block) const { return blocks[block].stride; }
+
+    int getBlockCount() const { return (int)blocks.size(); }
+    // Bytes of vertices and indices handed out, and reserved on the GPU
+    size_t getUsedBytes() const;
+    size_t getCapacityBytes() const;
+
+private:
+    // Free ranges, first -> count, merged with their neighbours on release
+    typedef std::map<GLuint, GLuint> FreeList;
+
+    struct Block {
+        GLuint layout;
+        GLsizei stride;
+        GLuint vao, vertexBuffer, indexBuffer;
+        GLuint vertexCapacity, indexCapacity;
+        FreeList freeVertices, freeIndices;
+    };
+
+    size_t blockVertexBytes, blockIndices;
+    std::vector<Block> blocks;
+
+    static bool take(FreeList & list, GLuint count, GLuint & first);
+    static void give(FreeList & list, GLuint first, GLuint count);
+    static GLuint freeCount(const FreeList & list);
+    int createBlock(GLuint layout, GLsizei stride, GLuint vertexCapacity, GLuint indexCapacity,
+                    const std::function<void(GLuint)> & setupVao);
+
+    // Make it non-copyable.
+    MeshArena(const MeshArena &) = delete;
+    MeshArena & operator=(const MeshArena &) = delete;
+};
+
+// Draw commands for many meshes, issued with one glMultiDrawElementsIndirect
+// per run of meshes sharing a VAO (and primitive): a single call when they
+// all come from the same MeshArena block. Without GL 4.3 the commands are
+// drawn one by one, still without rebinding.
+//
+// Instances are numbered across the batch: the instances of a command start
+// at the sum of the instance counts before it (its baseInstance), so a
+// vertex attribute with divisor 1 can hold per object data in add() order.
+// Needs GL 4.2 for that; before it every command starts at instance 0.
+class MeshBatch {
+public:
+    MeshBatch();
+    ~MeshBatch();
+
+    void clear();
+    // The mesh must stay alive until the batch is cleared
+    void add(const TriangleMesh & mesh, int lodLevel = 0, GLuint instances = 1);
+
+    // Uploads the commands when they changed
+    void render();
+
+    size_t size() const { return commands.size(); }
+    GLuint getInstanceCount() const { return instanceCount; }
+    // Draw calls render() makes
+    size_t getDrawCalls() const;
+
+private:
+    struct Run {
+        GLuint vao;
+        GLenum primitive;
+        size_t first, count;
+    };
+
+    std::vector<DrawElementsIndirectCommand> commands;
+    std::vector<Run> runs;
+    GLuint instanceCount;
+    GLuint commandBuffer;
+    size_t uploadedCapacity;
+    bool dirty;
+
+    MeshBatch(const MeshBatch &) = delete;
+    MeshBatch & operator=(const MeshBatch &) = delete;
+};
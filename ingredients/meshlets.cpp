@@ -0,0 +1,235 @@
+#include "meshlets.h"
+#include "trianglemesh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+static_assert(sizeof(Meshlet) == 48, "Meshlet must match the std430 layout of the culling shader");
+
+namespace {
+    const int CULL_GROUP_SIZE = 64;
+
+    const char * CULL_CS =
+        "#version 430\n"
+        "layout(local_size_x = 64) in;\n"
+        "struct Meshlet { vec4 sphere; vec4 cone; uvec4 range; };\n"
+        "struct DrawCommand { uint count; uint instanceCount; uint firstIndex; int baseVertex; uint baseInstance; };\n"
+        "layout(std430, binding = 0) readonly buffer Meshlets { Meshlet meshlets[]; };\n"
+        "layout(std430, binding = 1) writeonly buffer Commands { DrawCommand commands[]; };\n"
+        "layout(std430, binding = 2) buffer Counter { uint visibleCount; };\n"
+        "uniform vec4 FrustumPlanes[6];\n"
+        "uniform vec3 CameraPosition;\n"
+        "uniform uint MeshletCount;\n"
+        "uniform uint FirstIndex;\n"
+        "uniform int BaseVertex;\n"
+        "void main() {\n"
+        "    uint i = gl_GlobalInvocationID.x;\n"
+        "    if (i >= MeshletCount) return;\n"
+        "    Meshlet m = meshlets[i];\n"
+        "    bool visible = true;\n"
+        "    for (int p = 0; p < 6; p++)\n"
+        "        visible = visible && dot(FrustumPlanes[p].xyz, m.sphere.xyz) + FrustumPlanes[p].w >= -m.sphere.w;\n"
+        "    vec3 v = m.sphere.xyz - CameraPosition;\n"
+        "    visible = visible && dot(v, m.cone.xyz) < m.cone.w * length(v) + m.sphere.w;\n"
+        "    commands[i] = DrawCommand(m.range.y, visible ? 1u : 0u, FirstIndex + m.range.x, BaseVertex, 0u);\n"
+        "    if (visible) atomicAdd(visibleCount, 1u);\n"
+        "}\n";
+
+    glm::vec3 point(const GLfloat * points, GLuint v) {
+        return glm::vec3(points[3*v], points[3*v+1], points[3*v+2]);
+    }
+
+    void computeBounds(Meshlet & m, const GLuint * indices, const GLfloat * points) {
+        glm::vec3 lo(HUGE_VALF), hi(-HUGE_VALF);
+        for( GLuint i = 0; i < m.nIndices; i++ ) {
+            glm::vec3 p = point(points, indices[m.firstIndex + i]);
+            lo = glm::min(lo, p);
+            hi = glm::max(hi, p);
+        }
+        m.center = 0.5f * (lo + hi);
+        m.radius = 0.0f;
+        for( GLuint i = 0; i < m.nIndices; i++ )
+            m.radius = std::max(m.radius, glm::length(point(points, indices[m.firstIndex + i]) - m.center));
+
+        // Cone around the average normal, wide enough for all triangles.
+        // Degenerate triangles face nowhere and don't count.
+        size_t nTris = m.nIndices / 3;
+        std::vector<glm::vec3> n(nTris);
+        size_t count = 0;
+        glm::vec3 axis(0.0f);
+        for( size_t t = 0; t < nTris; t++ ) {
+            const GLuint * tri = indices + m.firstIndex + 3 * t;
+            glm::vec3 p0 = point(points, tri[0]);
+            glm::vec3 c = glm::cross(point(points, tri[1]) - p0, point(points, tri[2]) - p0);
+            float len = glm::length(c);
+            if( len == 0.0f ) continue;
+            n[count] = c / len;
+            axis += n[count];
+            count++;
+        }
+
+        float axisLength = glm::length(axis);
+        m.coneAxis = axisLength > 0.0f ? axis / axisLength : glm::vec3(0.0f, 0.0f, 1.0f);
+        m.coneCutoff = 1.0f;    // never culled
+        if( count == 0 || axisLength == 0.0f ) return;
+
+        float minDot = 1.0f;
+        for( size_t t = 0; t < count; t++ ) minDot = std::min(minDot, glm::dot(n[t], m.coneAxis));
+        // Beyond about 84 degrees the cone would hardly ever cull
+        if( minDot > 0.1f ) m.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+    }
+
+    // Normalized planes (xyz normal pointing inside, w distance) of the
+    // frustum of a view-projection matrix, in the matrix's input space
+    void frustumPlanes(const glm::mat4 & m, glm::vec4 planes[6]) {
+        glm::vec4 row[4];
+        for( int i = 0; i < 4; i++ ) row[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+        for( int i = 0; i < 3; i++ ) {
+            planes[2 * i] = row[3] + row[i];
+            planes[2 * i + 1] = row[3] - row[i];
+        }
+        for( int i = 0; i < 6; i++ ) planes[i] = planes[i] / glm::length(glm::vec3(planes[i]));
+    }
+}
+
+std::vector<Meshlet> buildMeshlets(const GLuint * indices, size_t nIndices, const GLfloat * points,
+                                   size_t nVertices, size_t maxVertices, size_t maxTriangles) {
+    std::vector<Meshlet> meshlets;
+    std::vector<GLuint> owner(nVertices, 0);     // 1 + the meshlet a vertex was last counted in
+
+    Meshlet current = Meshlet();
+    auto finish = [&]() {
+        if( current.nIndices == 0 ) return;
+        computeBounds(current, indices, points);
+        meshlets.push_back(current);
+    };
+
+    for( size_t t = 0; t < nIndices / 3; t++ ) {
+        const GLuint * tri = indices + 3 * t;
+        GLuint id = (GLuint)meshlets.size() + 1;
+        size_t added = 0;
+        for( int k = 0; k < 3; k++ ) {
+            bool repeated = (k > 0 && tri[k] == tri[0]) || (k == 2 && tri[2] == tri[1]);
+            if( owner[tri[k]] != id && !repeated ) added++;
+        }
+
+        if( current.nVertices + added > maxVertices || current.nIndices / 3 + 1 > maxTriangles ) {
+            finish();
+            current = Meshlet();
+            current.firstIndex = (GLuint)(3 * t);
+            id = (GLuint)meshlets.size() + 1;
+        }
+        for( int k = 0; k < 3; k++ ) {
+            if( owner[tri[k]] != id ) {
+                owner[tri[k]] = id;
+                current.nVertices++;
+            }
+        }
+        current.nIndices += 3;
+    }
+    finish();
+    return meshlets;
+}
+
+MeshletCuller::MeshletCuller(const TriangleMesh & m, const std::vector<Meshlet> & ml)
+    : mesh(m), meshlets(ml), computeAvailable(GLAD_GL_VERSION_4_3 != 0), useCompute(false),
+      meshletBuffer(0), commandBuffer(0), counterBuffer(0) {
+
+    counts.reserve(meshlets.size());
+    offsets.reserve(meshlets.size());
+    baseVertices.reserve(meshlets.size());
+    if( !computeAvailable ) return;
+
+    program.compileShader(std::string(CULL_CS), GLSLShader::COMPUTE);
+    program.link();
+
+    GLuint buffers[3];
+    glGenBuffers(3, buffers);
+    meshletBuffer = buffers[0];
+    commandBuffer = buffers[1];
+    counterBuffer = buffers[2];
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, meshletBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, meshlets.size() * sizeof(Meshlet), meshlets.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, meshlets.size() * sizeof(DrawElementsIndirectCommand), nullptr, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, counterBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), nullptr, GL_DYNAMIC_READ);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    useCompute = true;
+}
+
+MeshletCuller::~MeshletCuller() {
+    if( meshletBuffer != 0 ) {
+        GLuint buffers[3] = { meshletBuffer, commandBuffer, counterBuffer };
+        glDeleteBuffers(3, buffers);
+    }
+}
+
+void MeshletCuller::cull(const glm::mat4 & modelView, const glm::mat4 & projection) {
+    glm::vec4 planes[6];
+    frustumPlanes(projection * modelView, planes);
+    glm::vec3 eye = glm::vec3(glm::inverse(modelView)[3]);
+
+    if( useCompute ) {
+        program.use();
+        for( int i = 0; i < 6; i++ )
+            program.setUniform(("FrustumPlanes[" + std::to_string(i) + "]").c_str(), planes[i]);
+        program.setUniform("CameraPosition", eye);
+        program.setUniform("MeshletCount", (GLuint)meshlets.size());
+        program.setUniform("FirstIndex", mesh.getFirstIndex());
+        program.setUniform("BaseVertex", mesh.getBaseVertex());
+
+        GLuint zero = 0;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, counterBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zero), &zero);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, meshletBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, commandBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, counterBuffer);
+        glDispatchCompute((GLuint)((meshlets.size() + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE), 1, 1);
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+        return;
+    }
+
+    // Same tests as the shader
+    counts.clear();
+    offsets.clear();
+    for( const Meshlet & m : meshlets ) {
+        bool visible = true;
+        for( int p = 0; p < 6 && visible; p++ )
+            visible = glm::dot(glm::vec3(planes[p]), m.center) + planes[p].w >= -m.radius;
+        glm::vec3 v = m.center - eye;
+        visible = visible && glm::dot(v, m.coneAxis) < m.coneCutoff * glm::length(v) + m.radius;
+        if( visible ) {
+            counts.push_back((GLsizei)m.nIndices);
+            offsets.push_back((const GLvoid *)((mesh.getFirstIndex() + m.firstIndex) * sizeof(GLuint)));
+        }
+    }
+    baseVertices.assign(counts.size(), mesh.getBaseVertex());
+}
+
+void MeshletCuller::render() const {
+    glBindVertexArray(mesh.getVao());
+    if( useCompute ) {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, (GLsizei)meshlets.size(), 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    } else if( !counts.empty() ) {
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts.data(), GL_UNSIGNED_INT, offsets.data(),
+                                      (GLsizei)counts.size(), baseVertices.data());
+    }
+    glBindVertexArray(0);
+}
+
+GLuint MeshletCuller::countVisible() {
+    if( !useCompute ) return (GLuint)counts.size();
+
+    GLuint visible = 0;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, counterBuffer);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(visible), &visible);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return visible;
+}
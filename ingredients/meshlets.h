@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "cookbookogl.h"
+#include "glslprogram.h"
+
+class TriangleMesh;
+
+// A cluster of neighbouring triangles: a range of the mesh's index buffer
+// plus the bounds to cull it with. Laid out as the std430 struct of the
+// culling shader.
+struct Meshlet {
+    glm::vec3 center;       // bounding sphere
+    float radius;
+    glm::vec3 coneAxis;     // normal cone: every triangle faces away from
+    float coneCutoff;       // eye if dot(c - eye, axis) >= cutoff * |c - eye| + radius
+    GLuint firstIndex;
+    GLuint nIndices;
+    GLuint nVertices;       // unique vertices
+    GLuint reserved;
+};
+
+// Split an indexed triangle list into meshlets of at most maxVertices
+// vertices and maxTriangles triangles, in index order. Works best on
+// indices already in vertex cache order (see MeshOptimizer).
+std::vector<Meshlet> buildMeshlets(const GLuint * indices, size_t nIndices, const GLfloat * points,
+                                   size_t nVertices, size_t maxVertices = 64, size_t maxTriangles = 124);
+
+// Culls the meshlets of a mesh against the view frustum and their normal
+// cones, then draws the rest. With GL 4.3 the culling is a compute pass that
+// writes one indirect command per meshlet (zero instances when culled) for
+// a single glMultiDrawElementsIndirect; before that it runs on the CPU and
+// draws with glMultiDrawElementsBaseVertex. The mesh (which may live in a
+// MeshArena) must outlive the culler.
+class MeshletCuller {
+public:
+    // Throws GLSLProgramException if the culling shader fails to build
+    MeshletCuller(const TriangleMesh & mesh, const std::vector<Meshlet> & meshlets);
+    ~MeshletCuller();
+
+    // Cull for a view of the mesh (modelView includes its model matrix)
+    void cull(const glm::mat4 & modelView, const glm::mat4 & projection);
+    // Draw the meshlets that passed the last cull
+    void render() const;
+
+    // Meshlets that passed the last cull. Reads back from the GPU, so it
+    // waits for the culling pass.
+    GLuint countVisible();
+    GLuint getMeshletCount() const { return (GLuint)meshlets.size(); }
+
+    bool hasCompute() const { return computeAvailable; }
+    // Cull on the CPU even when the compute path is available
+    void setUseCompute(bool use) { useCompute = use && computeAvailable; }
+
+private:
+    const TriangleMesh & mesh;
+    std::vector<Meshlet> meshlets;
+    bool computeAvailable, useCompute;
+
+    // Compute path
+    GLSLProgram program;
+    GLuint meshletBuffer, commandBuffer, counterBuffer;
+
+    // CPU path
+    std::vector<GLsizei> counts;
+    std::vector<const GLvoid *> offsets;
+    std::vector<GLint> baseVertices;
+
+    MeshletCuller(const MeshletCuller &) = delete;
+    MeshletCuller & operator=(const MeshletCuller &) = delete;
+};
@@ -0,0 +1,243 @@
+#include "meshoptimizer.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+MeshOptimizer::CacheStats MeshOptimizer::analyzeVertexCache(const GLuint * indices, size_t nIndices, size_t nVertices,
+                                                            int cacheSize) {
+    // A vertex is in the FIFO if it entered less than cacheSize misses ago
+    std::vector<size_t> entered(nVertices, 0);
+    std::vector<bool> used(nVertices, false);
+    size_t misses = 0, usedVertices = 0;
+
+    for( size_t i = 0; i < nIndices; i++ ) {
+        GLuint v = indices[i];
+        if( !used[v] ) {
+            used[v] = true;
+            usedVertices++;
+        } else if( misses - entered[v] < (size_t)cacheSize ) {
+            continue;
+        }
+        entered[v] = misses;
+        misses++;
+    }
+
+    CacheStats stats;
+    stats.acmr = nIndices ? (float)misses / (nIndices / 3) : 0.0f;
+    stats.atvr = usedVertices ? (float)misses / usedVertices : 0.0f;
+    return stats;
+}
+
+std::vector<size_t> MeshOptimizer::optimizeVertexCache(std::vector<GLuint> & indices, size_t nVertices, int cacheSize) {
+    size_t nTris = indices.size() / 3;
+    std::vector<size_t> clusters;
+    if( nTris == 0 ) return clusters;
+
+    // Triangles of every vertex (counting sort into one array)
+    std::vector<GLuint> live(nVertices, 0);
+    for( size_t i = 0; i < nTris * 3; i++ ) live[indices[i]]++;
+    std::vector<size_t> adjStart(nVertices + 1, 0);
+    for( size_t v = 0; v < nVertices; v++ ) adjStart[v + 1] = adjStart[v] + live[v];
+    std::vector<GLuint> adj(adjStart[nVertices]);
+    {
+        std::vector<size_t> fill(adjStart.begin(), adjStart.end() - 1);
+        for( size_t i = 0; i < nTris * 3; i++ ) adj[fill[indices[i]]++] = (GLuint)(i / 3);
+    }
+
+    std::vector<size_t> cacheTime(nVertices, 0);
+    std::vector<bool> emitted(nTris, false);
+    std::vector<GLuint> deadEnd;
+    std::vector<GLuint> candidates;
+    std::vector<GLuint> out;
+    out.reserve(nTris * 3);
+
+    size_t time = cacheSize + 1;
+    size_t cursor = 0;          // next vertex to try when everything else is dead
+    long fan = 0;               // current fanning vertex
+    clusters.push_back(0);
+
+    while( fan >= 0 ) {
+        // Emit all live triangles around the fanning vertex
+        candidates.clear();
+        for( size_t a = adjStart[fan]; a < adjStart[fan + 1]; a++ ) {
+            GLuint t = adj[a];
+            if( emitted[t] ) continue;
+            emitted[t] = true;
+            for( int k = 0; k < 3; k++ ) {
+                GLuint v = indices[3 * t + k];
+                out.push_back(v);
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                if( time - cacheTime[v] > (size_t)cacheSize ) cacheTime[v] = time++;
+            }
+        }
+
+        // Next fan: the candidate that stays in the cache longest while
+        // still having triangles left, if fanning it won't evict itself
+        long next = -1;
+        long best = -1;
+        for( GLuint v : candidates ) {
+            if( live[v] == 0 ) continue;
+            long priority = 0;
+            if( (long)(time - cacheTime[v]) + 2 * (long)live[v] <= cacheSize ) priority = (long)(time - cacheTime[v]);
+            if( priority > best ) {
+                best = priority;
+                next = v;
+            }
+        }
+
+        if( next < 0 ) {
+            // Dead end: try recently used vertices, then scan forward
+            while( !deadEnd.empty() && next < 0 ) {
+                GLuint v = deadEnd.back();
+                deadEnd.pop_back();
+                if( live[v] > 0 ) next = v;
+            }
+            while( next < 0 && cursor < nVertices ) {
+                if( live[cursor] > 0 ) next = (long)cursor;
+                cursor++;
+            }
+            if( next >= 0 && out.size() / 3 < nTris ) clusters.push_back(out.size() / 3);
+        }
+        fan = next;
+    }
+
+    indices.swap(out);
+    return clusters;
+}
+
+namespace {
+    // Add soft boundaries to the clusters: triangles where all three vertices
+    // miss the cache, so starting a new cluster there costs nothing
+    std::vector<size_t> splitClusters(const std::vector<GLuint> & indices, const std::vector<size_t> & clusters,
+                                      size_t nVertices, float threshold) {
+        const size_t MIN_CLUSTER = 64;
+        size_t nTris = indices.size() / 3;
+        MeshOptimizer::CacheStats stats = MeshOptimizer::analyzeVertexCache(indices.data(), indices.size(), nVertices);
+        float maxAcmr = threshold * stats.acmr;
+
+        std::vector<size_t> entered(nVertices, 0);
+        std::vector<bool> used(nVertices, false);
+        size_t misses = 0;
+
+        std::vector<size_t> split;
+        for( size_t c = 0; c < clusters.size(); c++ ) {
+            size_t end = (c + 1 < clusters.size()) ? clusters[c + 1] : nTris;
+            size_t start = clusters[c], startMisses = misses;
+            split.push_back(start);
+
+            for( size_t t = clusters[c]; t < end; t++ ) {
+                int triMisses = 0;
+                for( int k = 0; k < 3; k++ ) {
+                    GLuint v = indices[3 * t + k];
+                    if( used[v] && misses - entered[v] < (size_t)MeshOptimizer::CACHE_SIZE ) continue;
+                    used[v] = true;
+                    entered[v] = misses++;
+                    triMisses++;
+                }
+                size_t size = t - start;
+                if( triMisses == 3 && size >= MIN_CLUSTER &&
+                    (float)(misses - 3 - startMisses) / size <= maxAcmr ) {
+                    split.push_back(t);
+                    start = t;
+                    startMisses = misses - 3;
+                }
+            }
+        }
+        return split;
+    }
+}
+
+void MeshOptimizer::optimizeOverdraw(std::vector<GLuint> & indices, const std::vector<size_t> & hardClusters,
+                                     const GLfloat * points, size_t nVertices, float threshold) {
+    size_t nTris = indices.size() / 3;
+    if( nTris == 0 || nVertices == 0 ) return;
+
+    std::vector<size_t> clusters = splitClusters(indices, hardClusters, nVertices, threshold);
+    if( clusters.size() < 2 ) return;
+
+    auto point = [points](GLuint v) { return glm::vec3(points[3*v], points[3*v+1], points[3*v+2]); };
+
+    glm::vec3 meshCenter(0.0f);
+    for( size_t v = 0; v < nVertices; v++ ) meshCenter += point((GLuint)v);
+    meshCenter /= (float)nVertices;
+
+    struct Cluster {
+        size_t begin, end;
+        float score;
+    };
+    std::vector<Cluster> order;
+    order.reserve(clusters.size());
+
+    for( size_t c = 0; c < clusters.size(); c++ ) {
+        Cluster cl;
+        cl.begin = clusters[c];
+        cl.end = (c + 1 < clusters.size()) ? clusters[c + 1] : nTris;
+
+        // Area weighted centroid and normal of the cluster
+        glm::vec3 centroid(0.0f), normal(0.0f);
+        float area = 0.0f;
+        for( size_t t = cl.begin; t < cl.end; t++ ) {
+            glm::vec3 p0 = point(indices[3*t]), p1 = point(indices[3*t+1]), p2 = point(indices[3*t+2]);
+            glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+            float a = glm::length(n);
+            centroid += (p0 + p1 + p2) * (a / 3.0f);
+            normal += n;
+            area += a;
+        }
+        if( area > 0.0f ) centroid /= area;
+        float len = glm::length(normal);
+        cl.score = len > 0.0f ? glm::dot(centroid - meshCenter, normal / len) : 0.0f;
+        order.push_back(cl);
+    }
+
+    std::stable_sort(order.begin(), order.end(),
+                     [](const Cluster & a, const Cluster & b) { return a.score > b.score; });
+
+    std::vector<GLuint> out;
+    out.reserve(indices.size());
+    for( const Cluster & cl : order )
+        out.insert(out.end(), indices.begin() + 3 * cl.begin, indices.begin() + 3 * cl.end);
+    indices.swap(out);
+}
+
+std::vector<GLuint> MeshOptimizer::optimizeVertexFetch(std::vector<GLuint> & indices, size_t nVertices) {
+    std::vector<GLuint> remap(nVertices, NOT_USED);
+    GLuint next = 0;
+    for( GLuint & idx : indices ) {
+        if( remap[idx] == NOT_USED ) remap[idx] = next++;
+        idx = remap[idx];
+    }
+    return remap;
+}
+
+void MeshOptimizer::remapVertices(std::vector<GLfloat> & attribute, int components, const std::vector<GLuint> & remap) {
+    size_t count = 0;
+    for( GLuint r : remap )
+        if( r != NOT_USED ) count = std::max(count, (size_t)r + 1);
+
+    std::vector<GLfloat> out(count * components);
+    for( size_t v = 0; v < remap.size(); v++ ) {
+        if( remap[v] == NOT_USED ) continue;
+        std::copy(attribute.begin() + v * components, attribute.begin() + (v + 1) * components,
+                  out.begin() + remap[v] * components);
+    }
+    attribute.swap(out);
+}
+
+void MeshOptimizer::optimize(std::vector<GLuint> & indices, std::vector<GLfloat> & points,
+                             std::vector<GLfloat> & normals, std::vector<GLfloat> * texCoords,
+                             std::vector<GLfloat> * tangents, bool overdraw) {
+    size_t nVertices = points.size() / 3;
+    std::vector<size_t> clusters = optimizeVertexCache(indices, nVertices);
+    if( overdraw ) optimizeOverdraw(indices, clusters, points.data(), nVertices);
+
+    std::vector<GLuint> remap = optimizeVertexFetch(indices, nVertices);
+    remapVertices(points, 3, remap);
+    remapVertices(normals, 3, remap);
+    if( texCoords != nullptr && !texCoords->empty() ) remapVertices(*texCoords, 2, remap);
+    if( tangents != nullptr && !tangents->empty() ) remapVertices(*tangents, 4, remap);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "cookbookogl.h"
+
+// Index and vertex reordering for indexed triangle lists (GL_TRIANGLES):
+//  - vertex cache: Tipsify (Sander, Nehab, Barczak 2007)
+//  - overdraw: the Tipsify clusters, outward facing ones first
+//  - vertex fetch: vertices renumbered in the order they are first used
+class MeshOptimizer {
+public:
+    // Cache size assumed by the reordering and the statistics
+    static const int CACHE_SIZE = 16;
+
+    struct CacheStats {
+        float acmr;     // average cache miss ratio: transformed vertices per triangle
+        float atvr;     // average transform to vertex ratio: 1.0 is optimal
+    };
+
+    // Simulated FIFO post-transform cache
+    static CacheStats analyzeVertexCache(const GLuint * indices, size_t nIndices, size_t nVertices,
+                                         int cacheSize = CACHE_SIZE);
+
+    // Reorder the triangles for the vertex cache. Returns the first
+    // triangle of every cluster (where Tipsify had to restart), for
+    // optimizeOverdraw.
+    static std::vector<size_t> optimizeVertexCache(std::vector<GLuint> & indices, size_t nVertices,
+                                                   int cacheSize = CACHE_SIZE);
+
+    // Reorder the clusters so those on the outside of the mesh and facing
+    // away from its center come first; they tend to occlude the rest from
+    // any direction. points holds 3 floats per vertex. Clusters are split
+    // further where the cache restarts anyway, as long as the ACMR of the
+    // cluster stays within threshold times that of the whole mesh.
+    static void optimizeOverdraw(std::vector<GLuint> & indices, const std::vector<size_t> & clusters,
+                                 const GLfloat * points, size_t nVertices, float threshold = 1.05f);
+
+    // Renumber the vertices in order of first use. Returns remap[old] = new,
+    // or NOT_USED for vertices no triangle refers to.
+    static const GLuint NOT_USED = 0xffffffffu;
+    static std::vector<GLuint> optimizeVertexFetch(std::vector<GLuint> & indices, size_t nVertices);
+
+    // Apply a remap from optimizeVertexFetch to an attribute array with the
+    // given number of components per vertex
+    static void remapVertices(std::vector<GLfloat> & attribute, int components, const std::vector<GLuint> & remap);
+
+    // All of the above. texCoords and tangents may be null or empty.
+    static void optimize(std::vector<GLuint> & indices, std::vector<GLfloat> & points,
+                         std::vector<GLfloat> & normals, std::vector<GLfloat> * texCoords,
+                         std::vector<GLfloat> * tangents, bool overdraw = true);
+};
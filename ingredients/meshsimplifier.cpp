@@ -0,0 +1,272 @@
+#include "meshsimplifier.h"
+#include "meshoptimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+namespace {
+    // Sum of squared distances to a set of planes, weighted by triangle area.
+    // The weight is kept so the error can be reported as a distance.
+    struct Quadric {
+        double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2, w;
+
+        Quadric() : a2(0), ab(0), ac(0), ad(0), b2(0), bc(0), bd(0), c2(0), cd(0), d2(0), w(0) { }
+
+        Quadric(const glm::dvec3 & n, double d, double weight) {
+            a2 = n.x * n.x * weight; ab = n.x * n.y * weight; ac = n.x * n.z * weight; ad = n.x * d * weight;
+            b2 = n.y * n.y * weight; bc = n.y * n.z * weight; bd = n.y * d * weight;
+            c2 = n.z * n.z * weight; cd = n.z * d * weight;
+            d2 = d * d * weight;
+            w = weight;
+        }
+
+        Quadric & operator+=(const Quadric & q) {
+            a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+            b2 += q.b2; bc += q.bc; bd += q.bd;
+            c2 += q.c2; cd += q.cd; d2 += q.d2;
+            w += q.w;
+            return *this;
+        }
+
+        // Mean squared distance of p to the planes
+        double error(const glm::vec3 & p) const {
+            double x = p.x, y = p.y, z = p.z;
+            double e = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x +
+                       b2 * y * y + 2 * bc * y * z + 2 * bd * y +
+                       c2 * z * z + 2 * cd * z + d2;
+            return w > 0.0 ? std::max(0.0, e / w) : 0.0;
+        }
+    };
+
+    struct Collapse {
+        GLuint from, to;
+        double cost;
+    };
+
+    class Simplifier {
+    public:
+        Simplifier(const std::vector<GLuint> & indices, const GLfloat * points, size_t nVertices);
+
+        // Collapse until at most targetTris triangles are left. Returns false
+        // when no further collapse was possible.
+        bool run(size_t targetTris);
+
+        const std::vector<GLuint> & getIndices() const { return indices; }
+        size_t triangleCount() const { return indices.size() / 3; }
+        float getError() const { return (float)std::sqrt(maxCost); }
+
+    private:
+        std::vector<GLuint> indices;
+        std::vector<glm::vec3> positions;
+        std::vector<Quadric> quadrics;
+        std::vector<bool> locked;
+        double maxCost;
+
+        // Rebuilt every pass
+        std::vector<size_t> adjStart;
+        std::vector<GLuint> adj;
+        std::vector<uint32_t> stamp;
+        uint32_t stampValue;
+
+        void buildAdjacency();
+        bool pass(size_t removeTris);
+        bool canCollapse(GLuint from, GLuint to);
+    };
+
+    Simplifier::Simplifier(const std::vector<GLuint> & idx, const GLfloat * points, size_t nVertices)
+        : indices(idx), positions(nVertices), quadrics(nVertices), locked(nVertices, false), maxCost(0.0),
+          stamp(nVertices, 0), stampValue(0) {
+
+        for( size_t v = 0; v < nVertices; v++ )
+            positions[v] = glm::vec3(points[3*v], points[3*v+1], points[3*v+2]);
+
+        for( size_t t = 0; t < indices.size() / 3; t++ ) {
+            glm::dvec3 p0(positions[indices[3*t]]), p1(positions[indices[3*t+1]]), p2(positions[indices[3*t+2]]);
+            glm::dvec3 n = glm::cross(p1 - p0, p2 - p0);
+            double area = glm::length(n);
+            if( area == 0.0 ) continue;
+            n /= area;
+            Quadric q(n, -glm::dot(n, p0), area);
+            for( int k = 0; k < 3; k++ ) quadrics[indices[3*t+k]] += q;
+        }
+
+        // Open edges appear in a single triangle; keep their vertices in place
+        std::vector<uint64_t> edges;
+        edges.reserve(indices.size());
+        for( size_t t = 0; t < indices.size() / 3; t++ ) {
+            for( int k = 0; k < 3; k++ ) {
+                GLuint a = indices[3*t+k], b = indices[3*t+(k+1)%3];
+                edges.push_back((uint64_t)std::min(a, b) << 32 | std::max(a, b));
+            }
+        }
+        std::sort(edges.begin(), edges.end());
+        for( size_t i = 0; i < edges.size(); ) {
+            size_t j = i + 1;
+            while( j < edges.size() && edges[j] == edges[i] ) j++;
+            if( j - i == 1 ) {
+                locked[edges[i] >> 32] = true;
+                locked[edges[i] & 0xffffffffu] = true;
+            }
+            i = j;
+        }
+    }
+
+    void Simplifier::buildAdjacency() {
+        size_t nVertices = positions.size();
+        adjStart.assign(nVertices + 1, 0);
+        for( GLuint v : indices ) adjStart[v + 1]++;
+        for( size_t v = 0; v < nVertices; v++ ) adjStart[v + 1] += adjStart[v];
+        adj.resize(indices.size());
+        std::vector<size_t> fill(adjStart.begin(), adjStart.end() - 1);
+        for( size_t i = 0; i < indices.size(); i++ ) adj[fill[indices[i]]++] = (GLuint)(i / 3);
+    }
+
+    bool Simplifier::canCollapse(GLuint from, GLuint to) {
+        // Link condition: the only vertices next to both are the ones
+        // opposite the shared triangles, otherwise the surface pinches
+        stampValue += 2;
+        int shared = 0;
+        for( size_t a = adjStart[from]; a < adjStart[from + 1]; a++ ) {
+            const GLuint * tri = &indices[3 * adj[a]];
+            bool hasTo = tri[0] == to || tri[1] == to || tri[2] == to;
+            if( hasTo ) shared++;
+            for( int k = 0; k < 3; k++ )
+                if( tri[k] != from && tri[k] != to ) stamp[tri[k]] = stampValue - 1;
+        }
+        int common = 0;
+        for( size_t a = adjStart[to]; a < adjStart[to + 1]; a++ ) {
+            const GLuint * tri = &indices[3 * adj[a]];
+            for( int k = 0; k < 3; k++ ) {
+                if( stamp[tri[k]] == stampValue - 1 ) {
+                    stamp[tri[k]] = stampValue;
+                    common++;
+                }
+            }
+        }
+        if( shared == 0 || common != shared ) return false;
+
+        // No triangle around from may flip or degenerate when it moves
+        const glm::vec3 & target = positions[to];
+        for( size_t a = adjStart[from]; a < adjStart[from + 1]; a++ ) {
+            const GLuint * tri = &indices[3 * adj[a]];
+            if( tri[0] == to || tri[1] == to || tri[2] == to ) continue;
+            glm::vec3 p[3], q[3];
+            for( int k = 0; k < 3; k++ ) {
+                p[k] = positions[tri[k]];
+                q[k] = tri[k] == from ? target : p[k];
+            }
+            glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+            glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+            if( glm::dot(before, after) <= 0.25f * glm::length(before) * glm::length(after) ) return false;
+        }
+        return true;
+    }
+
+    bool Simplifier::pass(size_t removeTris) {
+        buildAdjacency();
+
+        // Each edge once: interior edges are a->b in one triangle and b->a
+        // in the other
+        std::vector<Collapse> collapses;
+        collapses.reserve(indices.size() / 2);
+        for( size_t t = 0; t < indices.size() / 3; t++ ) {
+            for( int k = 0; k < 3; k++ ) {
+                GLuint a = indices[3*t+k], b = indices[3*t+(k+1)%3];
+                if( a > b || (locked[a] && locked[b]) ) continue;
+                Quadric q = quadrics[a];
+                q += quadrics[b];
+                double costA = locked[a] ? HUGE_VAL : q.error(positions[b]);
+                double costB = locked[b] ? HUGE_VAL : q.error(positions[a]);
+                if( costA <= costB ) collapses.push_back({ a, b, costA });
+                else collapses.push_back({ b, a, costB });
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(),
+                  [](const Collapse & x, const Collapse & y) { return x.cost < y.cost; });
+
+        // Independent collapses only: nothing around a collapsed vertex moves
+        // again in this pass, so the checks above stay valid
+        std::vector<GLuint> remap(positions.size());
+        for( size_t v = 0; v < remap.size(); v++ ) remap[v] = (GLuint)v;
+        std::vector<bool> touched(positions.size(), false);
+        size_t removed = 0;
+        bool any = false;
+
+        for( const Collapse & c : collapses ) {
+            if( removed >= removeTris ) break;
+            if( touched[c.from] || touched[c.to] ) continue;
+            if( !canCollapse(c.from, c.to) ) continue;
+
+            remap[c.from] = c.to;
+            quadrics[c.to] += quadrics[c.from];
+            maxCost = std::max(maxCost, c.cost);
+            any = true;
+            for( size_t a = adjStart[c.from]; a < adjStart[c.from + 1]; a++ ) {
+                const GLuint * tri = &indices[3 * adj[a]];
+                if( tri[0] == c.to || tri[1] == c.to || tri[2] == c.to ) removed++;
+                for( int k = 0; k < 3; k++ ) touched[tri[k]] = true;
+            }
+        }
+        if( !any ) return false;
+
+        size_t out = 0;
+        for( size_t t = 0; t < indices.size() / 3; t++ ) {
+            GLuint a = remap[indices[3*t]], b = remap[indices[3*t+1]], c = remap[indices[3*t+2]];
+            if( a == b || b == c || a == c ) continue;
+            indices[out++] = a;
+            indices[out++] = b;
+            indices[out++] = c;
+        }
+        indices.resize(out);
+        return true;
+    }
+
+    bool Simplifier::run(size_t targetTris) {
+        while( triangleCount() > targetTris )
+            if( !pass(triangleCount() - targetTris) ) return false;
+        return true;
+    }
+}
+
+std::vector<GLuint> MeshSimplifier::simplify(const std::vector<GLuint> & indices, const GLfloat * points,
+                                             size_t nVertices, size_t targetIndices, float * error) {
+    Simplifier s(indices, points, nVertices);
+    s.run(targetIndices / 3);
+    if( error != nullptr ) *error = s.getError();
+    return s.getIndices();
+}
+
+std::vector<LodLevel> MeshSimplifier::buildLodChain(std::vector<GLuint> & indices, const GLfloat * points,
+                                                    size_t nVertices, const std::vector<float> & ratios) {
+    std::vector<LodLevel> levels;
+    levels.push_back({ 0, (GLuint)indices.size(), 0.0f });
+    if( ratios.size() < 2 || indices.empty() ) {
+        levels.resize(std::max<size_t>(ratios.size(), 1), levels[0]);
+        return levels;
+    }
+
+    size_t nTris = indices.size() / 3;
+    Simplifier s(indices, points, nVertices);
+    std::vector<GLuint> all = indices;
+    bool stuck = false;
+
+    for( size_t i = 1; i < ratios.size(); i++ ) {
+        if( !stuck ) stuck = !s.run((size_t)(ratios[i] * nTris));
+
+        const LodLevel & prev = levels.back();
+        if( s.getIndices().size() >= prev.nIndices ) {
+            levels.push_back(prev);
+            continue;
+        }
+        std::vector<GLuint> level = s.getIndices();
+        MeshOptimizer::optimizeVertexCache(level, nVertices);
+        levels.push_back({ (GLuint)all.size(), (GLuint)level.size(), s.getError() });
+        all.insert(all.end(), level.begin(), level.end());
+    }
+
+    indices.swap(all);
+    return levels;
+}
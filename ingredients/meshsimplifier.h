@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "cookbookogl.h"
+
+// One level of detail: a range of the index buffer. All levels of a mesh
+// share its vertex buffer.
+struct LodLevel {
+    GLuint firstIndex;
+    GLuint nIndices;
+    float error;        // approximate object space distance to the full mesh, 0 for level 0
+};
+
+// Quadric error metric simplification (Garland, Heckbert 1997) of indexed
+// triangle lists by collapsing edges onto existing vertices, so the result
+// can reuse the original vertex buffer. Vertices on open edges, which
+// includes the seams where attributes are split, are never moved.
+class MeshSimplifier {
+public:
+    // Collapse edges until at most targetIndices indices are left, or no
+    // collapse is possible without folding the surface. error receives the
+    // error of the result, see LodLevel.
+    static std::vector<GLuint> simplify(const std::vector<GLuint> & indices, const GLfloat * points,
+                                        size_t nVertices, size_t targetIndices, float * error = nullptr);
+
+    // Simplify to each of ratios (fractions of the triangle count, the first
+    // one 1.0 and descending) in one run. indices is replaced by all levels
+    // back to back; levels after the first are reordered for the vertex cache.
+    // Returns one level per ratio. A level that ends up no smaller than the
+    // one before it shares its range.
+    static std::vector<LodLevel> buildLodChain(std::vector<GLuint> & indices, const GLfloat * points,
+                                               size_t nVertices, const std::vector<float> & ratios);
+};
@@ -1,5 +1,8 @@
 #include "objmesh.h"
-#include "utils.h"
+#include "mappedfile.h"
+#include "threadpool.h"
+#include "meshoptimizer.h"
+#include "meshsimplifier.h"
 
 using std::string;
 using glm::vec3;
@@ -10,157 +13,824 @@ using glm::vec2;
 using std::cout;
 using std::cerr;
 using std::endl;
-#include <fstream>
-using std::ifstream;
-#include <sstream>
-using std::istringstream;
+#include <cstring>
+#include <cstdio>
+#include <charconv>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+#include <cfloat>
+#include <random>
+#include <filesystem>
 #include <map>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+namespace {
+    MeshOptimization loadOptimization = MeshOptimization::VERTEX_CACHE_AND_OVERDRAW;
+}
 
 ObjMesh::ObjMesh() : drawAdj(false)
 { }
 
-void ObjMesh::render() const {
-    if( drawAdj ) {
-        glBindVertexArray(vao);
-        glDrawElements(GL_TRIANGLES_ADJACENCY, nVerts, GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
-    } else {
-        TriangleMesh::render();
-    }
+void ObjMesh::setLoadOptimization( MeshOptimization o ) {
+    loadOptimization = o;
+}
+
+MeshOptimization ObjMesh::getLoadOptimization() {
+    return loadOptimization;
 }
 
 
 std::unique_ptr<ObjMesh> ObjMesh::load( const char * fileName, bool center, bool genTangents ) {
+    return loadWithOptions(fileName, (center ? LOAD_CENTER : 0) | (genTangents ? LOAD_TANGENTS : 0));
+}
+
+std::unique_ptr<ObjMesh> ObjMesh::loadWithAdjacency( const char * fileName, bool center ) {
+    return loadWithOptions(fileName, (center ? LOAD_CENTER : 0) | LOAD_ADJACENCY);
+}
+
+std::unique_ptr<ObjMesh> ObjMesh::loadWithMeshlets( const char * fileName, bool center ) {
+    return loadWithOptions(fileName, center ? LOAD_CENTER : 0, true);
+}
+
+std::unique_ptr<ObjMesh> ObjMesh::loadWithOptions( const char * fileName, unsigned options, bool withMeshlets ) {
+
+    switch( loadOptimization ) {
+        case MeshOptimization::VERTEX_CACHE_AND_OVERDRAW: options |= LOAD_OPTIMIZE | LOAD_OPTIMIZE_OVERDRAW; break;
+        case MeshOptimization::VERTEX_CACHE: options |= LOAD_OPTIMIZE; break;
+        case MeshOptimization::NONE: break;
+    }
 
     std::unique_ptr<ObjMesh> mesh(new ObjMesh());
+    mesh->drawAdj = (options & LOAD_ADJACENCY) != 0;
+    if( mesh->drawAdj ) mesh->primitive = GL_TRIANGLES_ADJACENCY;
+
+    auto start = std::chrono::steady_clock::now();
+    size_t nVertices;
+    bool fromCache;
+
+    CachedMesh cached;
+    if( openCache(fileName, options, cached) ) {
+        // Straight from the mapping into the GL buffers
+        mesh->bbox = cached.bbox;
+        mesh->initBuffers(cached.indices, cached.nIndices, cached.points, cached.normals, cached.nVertices,
+                          cached.texCoords, cached.tangents);
+        mesh->setLodLevels(cached.lods);
+        if( withMeshlets )
+            mesh->meshlets = buildMeshlets(cached.indices, cached.lods[0].nIndices, cached.points, cached.nVertices);
+        nVertices = cached.nVertices;
+        fromCache = true;
+    } else {
+        GlMeshData glMesh;
+        buildGlMesh(fileName, options, glMesh, mesh->bbox);
+
+        // Load into VAO, already optimized by buildGlMesh
+        mesh->initBuffers(
+                glMesh.faces.data(), glMesh.faces.size(), glMesh.points.data(), glMesh.normals.data(),
+                glMesh.points.size() / 3,
+                glMesh.texCoords.empty() ? nullptr : glMesh.texCoords.data(),
+                glMesh.tangents.empty() ? nullptr : glMesh.tangents.data()
+        );
+        mesh->setLodLevels(glMesh.lods);
+        if( withMeshlets )
+            mesh->meshlets = buildMeshlets(glMesh.faces.data(), glMesh.lods[0].nIndices, glMesh.points.data(),
+                                           glMesh.points.size() / 3);
+        saveCache(fileName, options, glMesh, mesh->bbox);
+        nVertices = glMesh.points.size() / 3;
+        fromCache = false;
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    cout << "Loaded mesh from: " << fileName
+         << " vertices = " << nVertices
+         << " triangles = " << (mesh->nVerts / 3)
+         << " (" << (fromCache ? "cache" : "parsed") << ", " << ms << " ms)" << endl;
+    if( ! mesh->drawAdj ) cout << "    " << mesh->bbox.toString() << endl;
+
+    return mesh;
+}
 
+void ObjMesh::buildGlMesh( const char * fileName, unsigned options, GlMeshData & glMesh, Aabb & bbox ) {
     ObjMeshData meshData;
-    meshData.load(fileName, mesh->bbox);
+    meshData.load(fileName, bbox);
 
     // Generate normals
     meshData.generateNormalsIfNeeded();
 
     // Generate tangents?
-    if( genTangents ) meshData.generateTangents();
+    if( (options & LOAD_TANGENTS) && !(options & LOAD_ADJACENCY) ) meshData.generateTangents();
 
     // Convert to GL format
-    GlMeshData glMesh;
     meshData.toGlMesh(glMesh);
 
-    if( center ) glMesh.center(mesh->bbox);
+    if( options & LOAD_CENTER ) glMesh.center(bbox);
 
-    // Load into VAO
-    mesh->initBuffers(
-            & (glMesh.faces), & glMesh.points, & glMesh.normals,
-            glMesh.texCoords.empty() ? nullptr : (& glMesh.texCoords),
-            glMesh.tangents.empty() ? nullptr : (& glMesh.tangents)
-    );
+    // On plain triangles, before they are expanded to the adjacency format
+    if( options & LOAD_OPTIMIZE )
+        MeshOptimizer::optimize(glMesh.faces, glMesh.points, glMesh.normals, &glMesh.texCoords, &glMesh.tangents,
+                                (options & LOAD_OPTIMIZE_OVERDRAW) != 0);
 
-    cout << "Loaded mesh from: " << fileName
-         << " vertices = " << (glMesh.points.size() / 3)
-         << " triangles = " << (glMesh.faces.size() / 3) 
-		 << endl << "    " << mesh->bbox.toString() << endl;
+    if( options & LOAD_ADJACENCY ) {
+        glMesh.convertFacesToAdjancencyFormat();
+        glMesh.lods.assign(1, LodLevel{ 0, (GLuint)glMesh.faces.size(), 0.0f });
+    } else {
+        glMesh.lods = MeshSimplifier::buildLodChain(glMesh.faces, glMesh.points.data(), glMesh.points.size() / 3,
+                                                    lodRatios(options));
+    }
+}
 
-    return mesh;
+namespace {
+    const int MAX_CACHED_LODS = 8;
+
+    // Layout of a .meshcache file: this header, then the index array (all
+    // LOD levels), then points (3 floats per vertex), normals (3), texcoords
+    // (2, if CACHE_HAS_TEXCOORDS) and tangents (4, if CACHE_HAS_TANGENTS).
+    // All arrays are 4-byte values, so they stay aligned in a mapping.
+    struct MeshCacheHeader {
+        char magic[4];          // "OBJC"
+        uint32_t version;
+        uint64_t sourceSize;    // of the OBJ file
+        int64_t sourceMtime;
+        uint32_t options;       // ObjMesh::LoadOptions
+        uint32_t flags;
+        uint32_t nIndices;
+        uint32_t nVertices;
+        float bboxMin[3];
+        float bboxMax[3];
+        uint32_t nLods;
+        float lodRatios[MAX_CACHED_LODS];   // the ratios asked for, part of the cache key
+        LodLevel lods[MAX_CACHED_LODS];
+    };
+
+    const uint32_t MESH_CACHE_VERSION = 2;
+    const uint32_t CACHE_HAS_TEXCOORDS = 1;
+    const uint32_t CACHE_HAS_TANGENTS = 2;
+
+    bool sourceStamp(const char * fileName, uint64_t & size, int64_t & mtime) {
+        std::error_code ec;
+        size = (uint64_t)std::filesystem::file_size(fileName, ec);
+        if( ec ) return false;
+        auto time = std::filesystem::last_write_time(fileName, ec);
+        if( ec ) return false;
+        mtime = (int64_t)time.time_since_epoch().count();
+        return true;
+    }
 }
 
-std::unique_ptr<ObjMesh> ObjMesh::loadWithAdjacency( const char * fileName, bool center ) {
+std::vector<float> ObjMesh::lodRatios( unsigned options ) {
+    const std::vector<float> & ratios = getDefaultLodRatios();
+    if( (options & LOAD_ADJACENCY) || ratios.empty() ) return std::vector<float>(1, 1.0f);
+    // No more than the cache has room for
+    return std::vector<float>(ratios.begin(), ratios.begin() + std::min<size_t>(ratios.size(), MAX_CACHED_LODS));
+}
 
-    std::unique_ptr<ObjMesh> mesh(new ObjMesh());
+// The options and the LOD ratios are in the name as well as in the header,
+// so loads that differ in them keep caches of their own instead of
+// overwriting each other's
+std::string ObjMesh::cacheFileName( const char * fileName, unsigned options ) {
+    uint32_t hash = 2166136261u;    // FNV-1a over the ratio bits
+    for( float r : lodRatios(options) ) {
+        uint32_t bits;
+        memcpy(&bits, &r, sizeof(bits));
+        for( int b = 0; b < 4; b++ ) hash = (hash ^ ((bits >> (8 * b)) & 0xff)) * 16777619u;
+    }
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%u-%08x.meshcache", options, hash);
+    return std::string(fileName) + suffix;
+}
 
-    ObjMeshData meshData;
-    meshData.load(fileName, mesh->bbox);
+bool ObjMesh::openCache( const char * fileName, unsigned options, CachedMesh & cached ) {
+    uint64_t size;
+    int64_t mtime;
+    if( !sourceStamp(fileName, size, mtime) ) return false;
+    if( !cached.file.open(cacheFileName(fileName, options).c_str()) ) return false;
+
+    MeshCacheHeader header;
+    if( cached.file.size() < sizeof(header) ) return false;
+    memcpy(&header, cached.file.data(), sizeof(header));
+    std::vector<float> ratios = lodRatios(options);
+    if( memcmp(header.magic, "OBJC", 4) != 0 || header.version != MESH_CACHE_VERSION ||
+        header.sourceSize != size || header.sourceMtime != mtime || header.options != options ||
+        header.nLods != ratios.size() || !std::equal(ratios.begin(), ratios.end(), header.lodRatios) ) {
+        cached.file.close();
+        return false;
+    }
+    for( uint32_t i = 0; i < header.nLods; i++ ) {
+        if( (uint64_t)header.lods[i].firstIndex + header.lods[i].nIndices > header.nIndices ) {
+            cached.file.close();
+            return false;
+        }
+    }
 
-    // Generate normals
-    meshData.generateNormalsIfNeeded();
+    size_t floatsPerVertex = 6 + ((header.flags & CACHE_HAS_TEXCOORDS) ? 2 : 0) + ((header.flags & CACHE_HAS_TANGENTS) ? 4 : 0);
+    size_t expected = sizeof(header) + header.nIndices * sizeof(GLuint) + header.nVertices * floatsPerVertex * sizeof(GLfloat);
+    if( cached.file.size() < expected ) {
+        cached.file.close();
+        return false;
+    }
 
-    // Convert to GL format
-    GlMeshData glMesh;
-    meshData.toGlMesh(glMesh);
+    const char * p = cached.file.data() + sizeof(header);
+    cached.nIndices = header.nIndices;
+    cached.nVertices = header.nVertices;
+    cached.indices = reinterpret_cast<const GLuint *>(p);
+    p += header.nIndices * sizeof(GLuint);
+    cached.points = reinterpret_cast<const GLfloat *>(p);
+    p += header.nVertices * 3 * sizeof(GLfloat);
+    cached.normals = reinterpret_cast<const GLfloat *>(p);
+    p += header.nVertices * 3 * sizeof(GLfloat);
+    cached.texCoords = nullptr;
+    if( header.flags & CACHE_HAS_TEXCOORDS ) {
+        cached.texCoords = reinterpret_cast<const GLfloat *>(p);
+        p += header.nVertices * 2 * sizeof(GLfloat);
+    }
+    cached.tangents = nullptr;
+    if( header.flags & CACHE_HAS_TANGENTS ) cached.tangents = reinterpret_cast<const GLfloat *>(p);
 
-    if( center ) glMesh.center(mesh->bbox);
+    cached.lods.assign(header.lods, header.lods + header.nLods);
+    cached.bbox.min = glm::vec3(header.bboxMin[0], header.bboxMin[1], header.bboxMin[2]);
+    cached.bbox.max = glm::vec3(header.bboxMax[0], header.bboxMax[1], header.bboxMax[2]);
+    return true;
+}
 
-    mesh->drawAdj = true;
-    glMesh.convertFacesToAdjancencyFormat();
+void ObjMesh::saveCache( const char * fileName, unsigned options, const GlMeshData & glMesh, const Aabb & bbox ) {
+    MeshCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    if( !sourceStamp(fileName, header.sourceSize, header.sourceMtime) ) return;
+    memcpy(header.magic, "OBJC", 4);
+    header.version = MESH_CACHE_VERSION;
+    header.options = options;
+    header.flags = (glMesh.texCoords.empty() ? 0 : CACHE_HAS_TEXCOORDS) | (glMesh.tangents.empty() ? 0 : CACHE_HAS_TANGENTS);
+    header.nIndices = (uint32_t)glMesh.faces.size();
+    header.nVertices = (uint32_t)(glMesh.points.size() / 3);
+    for( int i = 0; i < 3; i++ ) {
+        header.bboxMin[i] = bbox.min[i];
+        header.bboxMax[i] = bbox.max[i];
+    }
+    std::vector<float> ratios = lodRatios(options);
+    header.nLods = (uint32_t)ratios.size();
+    for( uint32_t i = 0; i < header.nLods; i++ ) {
+        header.lodRatios[i] = ratios[i];
+        header.lods[i] = glMesh.lods[i];
+    }
 
-    // Load into VAO
-    mesh->initBuffers(
-            & (glMesh.faces), & glMesh.points, & glMesh.normals,
-            glMesh.texCoords.empty() ? nullptr : (& glMesh.texCoords),
-            glMesh.tangents.empty() ? nullptr : (& glMesh.tangents)
-    );
+    // Write to a temporary and rename, so a reader never maps half a file
+    std::string cacheName = cacheFileName(fileName, options);
+    std::string tmpName = cacheName + ".tmp";
+    FILE * fp = fopen(tmpName.c_str(), "wb");
+    if( fp == NULL ) {
+        cerr << "Unable to write mesh cache: " << cacheName << endl;
+        return;
+    }
 
-    cout << "Loaded mesh from: " << fileName
-         << " vertices = " << (glMesh.points.size() / 3)
-         << " triangles = " << (glMesh.faces.size() / 3) << endl;
+    auto writeArray = [fp](const auto & v) {
+        return v.empty() || fwrite(v.data(), sizeof(v[0]), v.size(), fp) == v.size();
+    };
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+              writeArray(glMesh.faces) && writeArray(glMesh.points) && writeArray(glMesh.normals) &&
+              writeArray(glMesh.texCoords) && writeArray(glMesh.tangents);
+    ok = (fclose(fp) == 0) && ok;
+
+    std::error_code ec;
+    if( ok ) std::filesystem::rename(tmpName, cacheName, ec);
+    if( !ok || ec ) {
+        cerr << "Unable to write mesh cache: " << cacheName << endl;
+        std::filesystem::remove(tmpName, ec);
+    }
+}
 
-    return mesh;
+void ObjMesh::benchmarkCache( const char * fileName, bool genTangents ) {
+    unsigned options = genTangents ? LOAD_TANGENTS : 0;
+    std::error_code ec;
+    std::filesystem::remove(cacheFileName(fileName, options), ec);
+
+    // Cold: the whole OBJ pipeline, then writing the cache
+    auto start = std::chrono::steady_clock::now();
+    GlMeshData glMesh;
+    Aabb bbox;
+    buildGlMesh(fileName, options, glMesh, bbox);
+    double parseMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    saveCache(fileName, options, glMesh, bbox);
+    double saveMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    // Warm: map the cache and touch every page, as the GL upload would
+    start = std::chrono::steady_clock::now();
+    CachedMesh cached;
+    if( !openCache(fileName, options, cached) ) {
+        cerr << "Mesh cache was not written" << endl;
+        return;
+    }
+    double sum = 0.0;
+    for( GLuint i = 0; i < cached.nIndices; i++ ) sum += cached.indices[i];
+    for( GLuint i = 0; i < cached.nVertices * 3; i++ ) sum += cached.points[i] + cached.normals[i];
+    double warmMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    bool same = cached.nIndices == glMesh.faces.size() &&
+                memcmp(cached.indices, glMesh.faces.data(), glMesh.faces.size() * sizeof(GLuint)) == 0 &&
+                memcmp(cached.points, glMesh.points.data(), glMesh.points.size() * sizeof(GLfloat)) == 0 &&
+                memcmp(cached.normals, glMesh.normals.data(), glMesh.normals.size() * sizeof(GLfloat)) == 0;
+
+    printf("%s: %u vertices, %zu triangles\n", fileName, cached.nVertices, glMesh.faces.size() / 3);
+    printf("cold (parse + process): %.1f ms, writing the cache: %.1f ms\n", parseMs, saveMs);
+    printf("warm (mapped cache):    %.1f ms (%.0fx)%s\n", warmMs, parseMs / warmMs,
+           same ? "" : "  (MISMATCH)");
+    // Keep the reads from being optimised away
+    volatile double sink = sum;
+    (void)sink;
 }
 
-void ObjMesh::ObjMeshData::load(const char * fileName, Aabb & bbox) {
-	ifstream objStream(fileName, std::ios::in);
+namespace {
+    // Token separators, as the old istream based parser saw them
+    inline bool isObjSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    inline const char * skipObjSpace(const char * p, const char * end) {
+        while( p < end && isObjSpace(*p) ) p++;
+        return p;
+    }
+
+    inline const char * skipObjToken(const char * p, const char * end) {
+        while( p < end && !isObjSpace(*p) ) p++;
+        return p;
+    }
+
+    // Parse a number at p (after any whitespace) and move p past it
+    template <typename T>
+    bool parseObjNumber(const char * & p, const char * end, T & value) {
+        p = skipObjSpace(p, end);
+        // from_chars doesn't accept a leading '+'
+        if( p < end && *p == '+' ) p++;
+        std::from_chars_result res = std::from_chars(p, end, value);
+        if( res.ec != std::errc() ) return false;
+        p = res.ptr;
+        return true;
+    }
+
+    // 1-based or negative (relative to count) OBJ index to a 0-based one
+    inline int parseObjIndex(const char * p, const char * end, size_t count) {
+        int idx;
+        if( !parseObjNumber(p, end, idx) ) return -1;
+        if( idx < 0 ) return idx + (int)count;
+        return idx - 1;
+    }
+
+    enum ObjLineType { OBJ_OTHER, OBJ_POINT, OBJ_TEXCOORD, OBJ_NORMAL, OBJ_FACE, OBJ_LINE_TYPES };
+
+    // Call fn(type, args, argsEnd) for every line in [p, end), with comments
+    // removed and args pointing just past the keyword
+    template <typename LineFn>
+    void forEachObjLine(const char * p, const char * end, LineFn fn) {
+        while (p < end) {
+            const char * eol = static_cast<const char *>(memchr(p, '\n', end - p));
+            if (eol == nullptr) eol = end;
+            const char * next = eol < end ? eol + 1 : end;
+
+            // Remove comment if it exists
+            const char * hash = static_cast<const char *>(memchr(p, '#', eol - p));
+            if (hash != nullptr) eol = hash;
+
+            p = skipObjSpace(p, eol);
+            const char * tokenEnd = skipObjToken(p, eol);
+            size_t tokenLen = tokenEnd - p;
+
+            ObjLineType type = OBJ_OTHER;
+            if (tokenLen == 1 && p[0] == 'v') type = OBJ_POINT;
+            else if (tokenLen == 2 && p[0] == 'v' && p[1] == 't') type = OBJ_TEXCOORD;
+            else if (tokenLen == 2 && p[0] == 'v' && p[1] == 'n') type = OBJ_NORMAL;
+            else if (tokenLen == 1 && p[0] == 'f') type = OBJ_FACE;
+            fn(type, tokenEnd, eol);
+
+            p = next;
+        }
+    }
+
+    // Chunks smaller than this aren't worth a task
+    const size_t MIN_OBJ_CHUNK_BYTES = 1 << 20;
+
+    double elapsedMs(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Vertex keys for toGlMesh. The (point, texcoord, normal) index triple
+    // is stored +1 so that a missing index (-1) becomes 0. It packs into 64
+    // bits while every index fits in 21 bits, otherwise it takes 96.
+    const size_t PACKED_KEY_LIMIT = (size_t(1) << 21) - 1;
 
-	if (!objStream) {
+    struct VertexKey96 {
+        uint32_t p, t, n;
+        bool operator==(const VertexKey96 & other) const {
+            return p == other.p && t == other.t && n == other.n;
+        }
+    };
+
+    inline uint64_t mixBits(uint64_t x) {
+        // splitmix64 finalizer
+        x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ull;
+        x ^= x >> 27; x *= 0x94d049bb133111ebull;
+        x ^= x >> 31;
+        return x;
+    }
+    inline uint64_t hashKey(uint64_t key) { return mixBits(key); }
+    inline uint64_t hashKey(const VertexKey96 & key) {
+        return mixBits(((uint64_t)key.p << 32 | key.t) ^ mixBits(key.n));
+    }
+
+    // Open addressing map (linear probing) from a vertex key to its GL index.
+    // Kept at most half full; it only rehashes when the initial estimate
+    // was too small.
+    template <typename Key>
+    class VertexKeyMap {
+    public:
+        explicit VertexKeyMap(size_t expected) : count(0) {
+            size_t capacity = 16;
+            while( capacity < expected * 2 ) capacity *= 2;
+            slots.assign(capacity, Slot{Key(), EMPTY});
+        }
+
+        // The index already stored for key, or value after inserting it
+        GLuint insert(const Key & key, GLuint value) {
+            if( (count + 1) * 2 > slots.size() ) grow();
+            size_t mask = slots.size() - 1;
+            for( size_t i = hashKey(key) & mask;; i = (i + 1) & mask ) {
+                Slot & slot = slots[i];
+                if( slot.value == EMPTY ) {
+                    slot.key = key;
+                    slot.value = value;
+                    count++;
+                    return value;
+                }
+                if( slot.key == key ) return slot.value;
+            }
+        }
+
+    private:
+        static const GLuint EMPTY = 0xffffffffu;
+        struct Slot {
+            Key key;
+            GLuint value;
+        };
+        std::vector<Slot> slots;
+        size_t count;
+
+        void grow() {
+            std::vector<Slot> old(slots.size() * 2, Slot{Key(), EMPTY});
+            old.swap(slots);
+            size_t mask = slots.size() - 1;
+            for( const Slot & slot : old ) {
+                if( slot.value == EMPTY ) continue;
+                size_t i = hashKey(slot.key) & mask;
+                while( slots[i].value != EMPTY ) i = (i + 1) & mask;
+                slots[i] = slot;
+            }
+        }
+    };
+
+    // Assign GL indices in first-use order; emit(vert) is called for every
+    // new vertex and returns its index
+    template <typename Key, typename Vert, typename MakeKey, typename Emit>
+    void dedupVertices(const std::vector<Vert> & faces, size_t expected, MakeKey makeKey, Emit emit,
+                       std::vector<GLuint> & indices) {
+        VertexKeyMap<Key> vertexMap(expected);
+        GLuint nextIdx = 0;
+        for( const Vert & vert : faces ) {
+            GLuint idx = vertexMap.insert(makeKey(vert), nextIdx);
+            if( idx == nextIdx ) {
+                emit(vert);
+                nextIdx++;
+            }
+            indices.push_back(idx);
+        }
+    }
+}
+
+void ObjMesh::ObjMeshData::load(const char * fileName, Aabb & bbox, ThreadPool * pool) {
+	MappedFile file;
+	if (!file.open(fileName)) {
 		cerr << "Unable to open OBJ file: " << fileName << endl;
 		exit(1);
 	}
-
-	bbox.reset();
-	string line, token;
-	getline(objStream, line);
-	while (!objStream.eof()) {
-		// Remove comment if it exists
-		size_t pos = line.find_first_of("#");
-		if (pos != std::string::npos) {
-			line = line.substr(0, pos);
+	if (pool == nullptr) pool = &ThreadPool::shared();
+
+	// The file is parsed straight out of the mapping in chunks that start and
+	// end on line boundaries. A few chunks per thread even out the load.
+	struct Chunk {
+		const char * begin;
+		const char * end;
+		size_t count[OBJ_LINE_TYPES];
+		size_t base[OBJ_LINE_TYPES];   // elements in all earlier chunks
+		std::vector<ObjVertex> faces;
+		Aabb bbox;
+	};
+
+	const char * data = file.data();
+	const char * dataEnd = data + file.size();
+	size_t nChunks = std::min<size_t>(pool->size() * 4, file.size() / MIN_OBJ_CHUNK_BYTES);
+	if (nChunks == 0) nChunks = 1;
+
+	std::vector<Chunk> chunks(nChunks);
+	const char * start = data;
+	for (size_t c = 0; c < nChunks; c++) {
+		const char * stop = dataEnd;
+		if (c + 1 < nChunks) {
+			stop = std::max(start, data + file.size() / nChunks * (c + 1));
+			const char * eol = static_cast<const char *>(memchr(stop, '\n', dataEnd - stop));
+			stop = eol ? eol + 1 : dataEnd;
 		}
-		Utils::trimString(line);
-
-		if (line.length() > 0) {
-			istringstream lineStream(line);
-
-			lineStream >> token;
+		chunks[c].begin = start;
+		chunks[c].end = stop;
+		start = stop;
+	}
 
-			if (token == "v") {
-				float x, y, z;
-				lineStream >> x >> y >> z;
-				glm::vec3 p(x, y, z);
-				points.push_back(p);
-				bbox.add(p);
+	// First pass: count the v/vt/vn lines of each chunk. Negative face
+	// indices refer to the elements read so far, so every chunk needs the
+	// totals of the chunks before it.
+	pool->parallelFor(nChunks, [&](size_t c) {
+		Chunk & chunk = chunks[c];
+		std::fill(chunk.count, chunk.count + OBJ_LINE_TYPES, 0);
+		forEachObjLine(chunk.begin, chunk.end, [&](ObjLineType type, const char *, const char *) {
+			chunk.count[type]++;
+		});
+	});
+
+	size_t total[OBJ_LINE_TYPES] = { 0, points.size(), texCoords.size(), normals.size(), 0 };
+	for (Chunk & chunk : chunks) {
+		for (int t = 0; t < OBJ_LINE_TYPES; t++) {
+			chunk.base[t] = total[t];
+			total[t] += chunk.count[t];
+		}
+	}
+	points.resize(total[OBJ_POINT]);
+	texCoords.resize(total[OBJ_TEXCOORD]);
+	normals.resize(total[OBJ_NORMAL]);
+
+	// Second pass: vertex data goes straight to its final place, faces are
+	// collected per chunk
+	pool->parallelFor(nChunks, [&](size_t c) {
+		Chunk & chunk = chunks[c];
+		size_t nPoints = chunk.base[OBJ_POINT];
+		size_t nTexCoords = chunk.base[OBJ_TEXCOORD];
+		size_t nNormals = chunk.base[OBJ_NORMAL];
+
+		forEachObjLine(chunk.begin, chunk.end, [&](ObjLineType type, const char * p, const char * eol) {
+			if (type == OBJ_POINT) {
+				glm::vec3 & pt = points[nPoints++];
+				parseObjNumber(p, eol, pt.x);
+				parseObjNumber(p, eol, pt.y);
+				parseObjNumber(p, eol, pt.z);
+				chunk.bbox.add(pt);
 			}
-			else if (token == "vt") {
+			else if (type == OBJ_TEXCOORD) {
 				// Process texture coordinate
-				float s, t;
-				lineStream >> s >> t;
-				texCoords.push_back(vec2(s, t));
+				vec2 & tc = texCoords[nTexCoords++];
+				parseObjNumber(p, eol, tc.x);
+				parseObjNumber(p, eol, tc.y);
 			}
-			else if (token == "vn") {
-				float x, y, z;
-				lineStream >> x >> y >> z;
-				normals.push_back(vec3(x, y, z));
+			else if (type == OBJ_NORMAL) {
+				vec3 & n = normals[nNormals++];
+				parseObjNumber(p, eol, n.x);
+				parseObjNumber(p, eol, n.y);
+				parseObjNumber(p, eol, n.z);
 			}
-			else if (token == "f") {
-				std::vector<std::string> parts;
-				while (lineStream.good()) {
-					std::string s;
-					lineStream >> s;
-					parts.push_back(s);
-				}
-
-				// Triangulate as a triangle fan
-				if (parts.size() > 2) {
-					ObjVertex firstVert(parts[0], this);
-					for (int i = 2; i < parts.size(); i++) {
-						faces.push_back(firstVert);
-						faces.push_back(ObjVertex(parts[i - 1], this));
-						faces.push_back(ObjVertex(parts[i], this));
+			else if (type == OBJ_FACE) {
+				// Triangulate as a triangle fan while walking the vertex tokens
+				ObjVertex firstVert, prevVert;
+				int count = 0;
+				p = skipObjSpace(p, eol);
+				while (p < eol) {
+					const char * tokenEnd = skipObjToken(p, eol);
+					ObjVertex vert(p, tokenEnd, nPoints, nTexCoords, nNormals);
+					if (count == 0) {
+						firstVert = vert;
+					} else if (count >= 2) {
+						chunk.faces.push_back(firstVert);
+						chunk.faces.push_back(prevVert);
+						chunk.faces.push_back(vert);
 					}
+					prevVert = vert;
+					count++;
+					p = skipObjSpace(tokenEnd, eol);
 				}
 			}
+		});
+	});
+
+	// Merge the faces in file order
+	size_t nFaces = faces.size();
+	std::vector<size_t> faceBase(nChunks);
+	for (size_t c = 0; c < nChunks; c++) {
+		faceBase[c] = nFaces;
+		nFaces += chunks[c].faces.size();
+	}
+	faces.resize(nFaces);
+	pool->parallelFor(nChunks, [&](size_t c) {
+		std::copy(chunks[c].faces.begin(), chunks[c].faces.end(), faces.begin() + faceBase[c]);
+	});
+
+	bbox.reset();
+	for (Chunk & chunk : chunks) bbox.add(chunk.bbox);
+}
+
+void ObjMesh::benchmarkLoading(const char * fileName) {
+	std::vector<unsigned> threadCounts;
+	unsigned maxThreads = std::max(1u, std::thread::hardware_concurrency());
+	for (unsigned n = 1; n < maxThreads; n *= 2) threadCounts.push_back(n);
+	threadCounts.push_back(maxThreads);
+
+	// Warm the page cache so the first row isn't measuring the disk
+	ObjMeshData reference;
+	Aabb referenceBox;
+	{
+		ThreadPool pool(maxThreads);
+		reference.load(fileName, referenceBox, &pool);
+	}
+
+	cout << "Loading " << fileName << ": " << reference.points.size() << " points, "
+	     << reference.faces.size() / 3 << " triangles" << endl;
+	printf("%8s %12s %9s\n", "threads", "load ms", "speedup");
+
+	double singleMs = 0.0;
+	for (unsigned n : threadCounts) {
+		ThreadPool pool(n);
+		ObjMeshData meshData;
+		Aabb box;
+		auto start = std::chrono::steady_clock::now();
+		meshData.load(fileName, box, &pool);
+		double ms = elapsedMs(start);
+		if (n == 1) singleMs = ms;
+
+		bool same = meshData.points == reference.points && meshData.faces.size() == reference.faces.size() &&
+		            memcmp(meshData.faces.data(), reference.faces.data(), reference.faces.size() * sizeof(ObjMeshData::ObjVertex)) == 0;
+		printf("%8u %12.1f %8.2fx%s\n", n, ms, singleMs / ms, same ? "" : "  (MISMATCH)");
+	}
+
+	// Vertex deduplication: the packed key hash map against the std::map of
+	// "p/t/n" strings it replaced
+	reference.generateNormalsIfNeeded();
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<GLuint> stringFaces;
+	std::vector<GLfloat> stringPoints;
+	{
+		std::map<std::string, GLuint> vertexMap;
+		for( auto & vert : reference.faces ) {
+			auto vertStr = vert.str();
+			auto it = vertexMap.find(vertStr);
+			if( it == vertexMap.end() ) {
+				auto vIdx = stringPoints.size() / 3;
+				auto & pt = reference.points[ vert.pIdx ];
+				stringPoints.push_back( pt.x );
+				stringPoints.push_back( pt.y );
+				stringPoints.push_back( pt.z );
+				stringFaces.push_back((GLuint)vIdx);
+				vertexMap[vertStr] = (GLuint)vIdx;
+			} else {
+				stringFaces.push_back(it->second);
+			}
+		}
+	}
+	double stringMs = elapsedMs(start);
+
+	start = std::chrono::steady_clock::now();
+	GlMeshData glMesh;
+	reference.toGlMesh(glMesh);
+	double hashMs = elapsedMs(start);
+
+	bool same = glMesh.faces == stringFaces && glMesh.points == stringPoints;
+	printf("vertex dedup: %zu GL vertices, string map %.1f ms, hash map %.1f ms (%.1fx)%s\n",
+	       glMesh.points.size() / 3, stringMs, hashMs, stringMs / hashMs, same ? "" : "  (MISMATCH)");
+}
+
+namespace {
+	// Largest difference between two arrays of unit vector components, in
+	// units of FLT_EPSILON (the spacing of floats just below 1). Matching NaNs
+	// (from degenerate faces) count as equal.
+	float maxDifference(const float * a, const float * b, size_t n) {
+		float worst = 0.0f;
+		for (size_t i = 0; i < n; i++) {
+			if (std::isnan(a[i]) || std::isnan(b[i])) {
+				if (std::isnan(a[i]) != std::isnan(b[i])) return HUGE_VALF;
+				continue;
+			}
+			worst = std::max(worst, std::fabs(a[i] - b[i]) / FLT_EPSILON);
+		}
+		return worst;
+	}
+}
+
+void ObjMesh::benchmarkNormals(const char * fileName) {
+	const float TOLERANCE = 4.0f;     // in FLT_EPSILON
+
+	unsigned maxThreads = std::max(1u, std::thread::hardware_concurrency());
+	ObjMeshData base;
+	Aabb box;
+	{
+		ThreadPool pool(maxThreads);
+		base.load(fileName, box, &pool);
+	}
+	base.normals.clear();
+
+	bool withTangents = !base.texCoords.empty();
+	for (auto & v : base.faces)
+		withTangents = withTangents && v.tcIdx >= 0 && (size_t)v.tcIdx < base.texCoords.size();
+
+	cout << "Normals for " << fileName << ": " << base.points.size() << " points, "
+	     << base.faces.size() / 3 << " triangles" << (withTangents ? "" : " (no tangents, missing texture coordinates)") << endl;
+
+	ObjMeshData serial = base;
+	auto start = std::chrono::steady_clock::now();
+	serial.generateNormalsSerial();
+	double serialNormalMs = elapsedMs(start);
+	double serialTangentMs = 0.0;
+	if (withTangents) {
+		start = std::chrono::steady_clock::now();
+		serial.generateTangentsSerial();
+		serialTangentMs = elapsedMs(start);
+	}
+	printf("%8s %12s %12s %9s %6s\n", "threads", "normals ms", "tangents ms", "speedup", "eps");
+	printf("%8s %12.1f %12.1f\n", "serial", serialNormalMs, serialTangentMs);
+
+	std::vector<unsigned> threadCounts;
+	for (unsigned n = 1; n < maxThreads; n *= 2) threadCounts.push_back(n);
+	threadCounts.push_back(maxThreads);
+
+	for (unsigned n : threadCounts) {
+		ThreadPool pool(n);
+		ObjMeshData meshData = base;
+		start = std::chrono::steady_clock::now();
+		meshData.generateNormalsIfNeeded(&pool);
+		double normalMs = elapsedMs(start);
+		double tangentMs = 0.0;
+		if (withTangents) {
+			start = std::chrono::steady_clock::now();
+			meshData.generateTangents(&pool);
+			tangentMs = elapsedMs(start);
+		}
+
+		float diff = maxDifference(&meshData.normals[0].x, &serial.normals[0].x, 3 * serial.normals.size());
+		if (withTangents)
+			diff = std::max(diff, maxDifference(&meshData.tangents[0].x, &serial.tangents[0].x, 4 * serial.tangents.size()));
+		bool same = diff <= TOLERANCE && meshData.faces.size() == serial.faces.size() &&
+		            memcmp(meshData.faces.data(), serial.faces.data(), serial.faces.size() * sizeof(ObjMeshData::ObjVertex)) == 0;
+		printf("%8u %12.1f %12.1f %8.2fx %6.1f%s\n", n, normalMs, tangentMs,
+		       (serialNormalMs + serialTangentMs) / (normalMs + tangentMs), diff, same ? "" : "  (MISMATCH)");
+	}
+}
+
+void ObjMesh::benchmarkAdjacency(size_t maxTriangles) {
+	// Random triangles over few vertices: lots of non-manifold edges,
+	// repeated triangles and degenerate ones
+	std::mt19937 rng(1234);
+	int checked = 0, mismatches = 0;
+	for (int n = 16; n <= 4096; n *= 2) {
+		for (int round = 0; round < 4; round++) {
+			GlMeshData quadratic, hashed;
+			std::uniform_int_distribution<GLuint> vert(0, (GLuint)(n / 4 + round));
+			for (int i = 0; i < 3 * n; i++) quadratic.faces.push_back(vert(rng));
+			hashed.faces = quadratic.faces;
+
+			quadratic.convertFacesToAdjancencyFormatQuadratic();
+			hashed.convertFacesToAdjancencyFormat();
+			checked++;
+			if (quadratic.faces != hashed.faces) mismatches++;
+		}
+	}
+	printf("adjacency: %d random meshes of 16 to 4096 triangles, %d mismatches\n", checked, mismatches);
+
+	// Timing on closed grids (a torus topology, so every edge is shared)
+	printf("%12s %14s %14s\n", "triangles", "quadratic ms", "edge hash ms");
+	for (size_t side = 32; 2 * side * side <= maxTriangles; side *= 2) {
+		GlMeshData quadratic, hashed;
+		for (GLuint i = 0; i < side; i++) {
+			for (GLuint j = 0; j < side; j++) {
+				GLuint i1 = (GLuint)((i + 1) % side), j1 = (GLuint)((j + 1) % side);
+				GLuint tri[6] = { i*(GLuint)side + j, i1*(GLuint)side + j, i1*(GLuint)side + j1,
+				                  i*(GLuint)side + j, i1*(GLuint)side + j1, i*(GLuint)side + j1 };
+				hashed.faces.insert(hashed.faces.end(), tri, tri + 6);
+			}
+		}
+		size_t nTris = hashed.faces.size() / 3;
+
+		// The quadratic builder takes minutes beyond this
+		char quadraticMs[32] = "-";
+		bool same = true;
+		if (nTris <= 32768) {
+			quadratic.faces = hashed.faces;
+			auto start = std::chrono::steady_clock::now();
+			quadratic.convertFacesToAdjancencyFormatQuadratic();
+			sprintf(quadraticMs, "%.1f", elapsedMs(start));
 		}
-		getline(objStream, line);
+
+		auto start = std::chrono::steady_clock::now();
+		hashed.convertFacesToAdjancencyFormat();
+		double hashMs = elapsedMs(start);
+
+		if (!quadratic.faces.empty()) same = quadratic.faces == hashed.faces;
+		printf("%12zu %14s %14.1f%s\n", nTris, quadraticMs, hashMs, same ? "" : "  (MISMATCH)");
 	}
-	objStream.close();
 }
 
 void ObjMesh::GlMeshData::center( Aabb & bbox ) {
@@ -181,26 +851,188 @@ void ObjMesh::GlMeshData::center( Aabb & bbox ) {
     bbox.min = bbox.min - center;
 }
 
-ObjMesh::ObjMeshData::ObjVertex::ObjVertex(std::string &vertString, ObjMeshData * mesh) : pIdx(-1), nIdx(-1), tcIdx(-1) {
-    size_t slash1, slash2;
-    slash1 = vertString.find("/");
-    pIdx = std::stoi(vertString.substr(0, slash1));
-	if (pIdx < 0) pIdx += mesh->points.size();
-	else pIdx--;
-    if (slash1 != string::npos) {
-        slash2 = vertString.find("/", slash1 + 1);
-        if (slash2 > slash1 + 1) {
-            tcIdx = std::stoi(vertString.substr(slash1 + 1, slash2 - slash1 - 1));
-			if (tcIdx < 0) tcIdx += mesh->texCoords.size();
-			else tcIdx--;
+ObjMesh::ObjMeshData::ObjVertex::ObjVertex(const char * str, const char * end, size_t nPoints, size_t nTexCoords, size_t nNormals) : pIdx(-1), nIdx(-1), tcIdx(-1) {
+    const char * slash1 = static_cast<const char *>(memchr(str, '/', end - str));
+    pIdx = parseObjIndex(str, slash1 ? slash1 : end, nPoints);
+    if (slash1 != nullptr) {
+        const char * slash2 = static_cast<const char *>(memchr(slash1 + 1, '/', end - slash1 - 1));
+        if (slash2 == nullptr || slash2 > slash1 + 1) {
+            tcIdx = parseObjIndex(slash1 + 1, slash2 ? slash2 : end, nTexCoords);
+        }
+        // With "p/t" the whole token is read again here, like the
+        // std::string parser did
+        nIdx = parseObjIndex(slash2 ? slash2 + 1 : str, end, nNormals);
+    }
+}
+
+namespace {
+    const size_t NORMAL_BATCH = 16384;
+
+    // Corners (indices into faces) around every point, in face order:
+    // point p has corners[start[p]] .. corners[start[p+1]-1]. Gathering over
+    // these adds the face vectors of a point in the same order as a serial
+    // scatter over the faces, so the sums come out bit for bit the same.
+    struct PointCorners {
+        std::vector<GLuint> start;
+        std::vector<GLuint> corners;
+    };
+
+    template <typename Vertex>
+    void buildPointCorners(const std::vector<Vertex> & faces, size_t nCorners, size_t nPoints, PointCorners & pc) {
+        pc.start.assign(nPoints + 1, 0);
+        for( size_t c = 0; c < nCorners; c++ ) pc.start[faces[c].pIdx + 1]++;
+        for( size_t p = 0; p < nPoints; p++ ) pc.start[p + 1] += pc.start[p];
+        pc.corners.resize(nCorners);
+        std::vector<GLuint> fill(pc.start.begin(), pc.start.end() - 1);
+        for( size_t c = 0; c < nCorners; c++ ) pc.corners[fill[faces[c].pIdx]++] = (GLuint)c;
+    }
+
+    // Run fn(begin, end) over [0, count) in batches on the pool
+    template <typename Fn>
+    void forBatches(ThreadPool * pool, size_t count, Fn fn) {
+        pool->parallelFor((count + NORMAL_BATCH - 1) / NORMAL_BATCH, [&](size_t b) {
+            fn(b * NORMAL_BATCH, std::min(count, (b + 1) * NORMAL_BATCH));
+        });
+    }
+
+    // Normalize n vectors stored as separate x, y and z arrays. Same
+    // operations as glm::normalize (v * (1 / sqrt(dot(v, v)))), four at a time
+    // where SSE2 is available; both are correctly rounded, so the results
+    // match the scalar path.
+    void normalizeSoA(float * x, float * y, float * z, size_t n) {
+        size_t i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+        const __m128 one = _mm_set1_ps(1.0f);
+        for( ; i + 4 <= n; i += 4 ) {
+            __m128 vx = _mm_loadu_ps(x + i), vy = _mm_loadu_ps(y + i), vz = _mm_loadu_ps(z + i);
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz));
+            __m128 inv = _mm_div_ps(one, _mm_sqrt_ps(d));
+            _mm_storeu_ps(x + i, _mm_mul_ps(vx, inv));
+            _mm_storeu_ps(y + i, _mm_mul_ps(vy, inv));
+            _mm_storeu_ps(z + i, _mm_mul_ps(vz, inv));
+        }
+#endif
+        for( ; i < n; i++ ) {
+            float inv = 1.0f / std::sqrt(x[i] * x[i] + y[i] * y[i] + z[i] * z[i]);
+            x[i] *= inv;
+            y[i] *= inv;
+            z[i] *= inv;
         }
-        nIdx = std::stoi(vertString.substr(slash2 + 1));
-		if (nIdx < 0) nIdx += mesh->normals.size();
-		else nIdx--;
     }
+
+    // Structure of arrays for the normalization pass
+    struct Vec3Planes {
+        std::vector<float> x, y, z;
+
+        explicit Vec3Planes(size_t n) : x(n), y(n), z(n) { }
+        void set(size_t i, const vec3 & v) { x[i] = v.x; y[i] = v.y; z[i] = v.z; }
+        vec3 get(size_t i) const { return vec3(x[i], y[i], z[i]); }
+        void normalize(size_t begin, size_t end) { normalizeSoA(&x[begin], &y[begin], &z[begin], end - begin); }
+    };
 }
 
-void ObjMesh::ObjMeshData::generateNormalsIfNeeded() {
+void ObjMesh::ObjMeshData::generateNormalsIfNeeded(ThreadPool * pool) {
+    if( normals.size() != 0 ) return;
+    if( pool == nullptr ) pool = &ThreadPool::shared();
+    // The gather costs about twice the scatter; it only pays off in parallel
+    if( pool->size() <= 1 ) {
+        generateNormalsSerial();
+        return;
+    }
+
+    size_t nFaces = faces.size() / 3;
+    std::vector<vec3> faceNormals(nFaces);
+    forBatches(pool, nFaces, [&](size_t begin, size_t end) {
+        for( size_t f = begin; f < end; f++ ) {
+            ObjVertex * v = &faces[3 * f];
+            const vec3 & p1 = points[v[0].pIdx];
+            faceNormals[f] = glm::normalize(glm::cross(points[v[1].pIdx] - p1, points[v[2].pIdx] - p1));
+
+            // Set the normal index to be the same as the point index
+            for( int k = 0; k < 3; k++ ) v[k].nIdx = v[k].pIdx;
+        }
+    });
+
+    PointCorners pc;
+    buildPointCorners(faces, 3 * nFaces, points.size(), pc);
+
+    Vec3Planes sums(points.size());
+    forBatches(pool, points.size(), [&](size_t begin, size_t end) {
+        for( size_t p = begin; p < end; p++ ) {
+            vec3 n(0.0f);
+            for( GLuint c = pc.start[p]; c < pc.start[p + 1]; c++ ) n += faceNormals[pc.corners[c] / 3];
+            sums.set(p, n);
+        }
+        sums.normalize(begin, end);
+    });
+
+    normals.resize(points.size());
+    forBatches(pool, points.size(), [&](size_t begin, size_t end) {
+        for( size_t p = begin; p < end; p++ ) normals[p] = sums.get(p);
+    });
+}
+
+void ObjMesh::ObjMeshData::generateTangents(ThreadPool * pool) {
+    if( pool == nullptr ) pool = &ThreadPool::shared();
+    if( pool->size() <= 1 ) {
+        generateTangentsSerial();
+        return;
+    }
+
+    size_t nFaces = faces.size() / 3;
+    std::vector<vec3> faceTan1(nFaces), faceTan2(nFaces);
+    forBatches(pool, nFaces, [&](size_t begin, size_t end) {
+        for( size_t f = begin; f < end; f++ ) {
+            const ObjVertex * v = &faces[3 * f];
+            const vec3 &p1 = points[v[0].pIdx];
+            const vec3 &p2 = points[v[1].pIdx];
+            const vec3 &p3 = points[v[2].pIdx];
+
+            const vec2 &tc1 = texCoords[v[0].tcIdx];
+            const vec2 &tc2 = texCoords[v[1].tcIdx];
+            const vec2 &tc3 = texCoords[v[2].tcIdx];
+
+            vec3 q1 = p2 - p1;
+            vec3 q2 = p3 - p1;
+            float s1 = tc2.x - tc1.x, s2 = tc3.x - tc1.x;
+            float t1 = tc2.y - tc1.y, t2 = tc3.y - tc1.y;
+            float r = 1.0f / (s1 * t2 - s2 * t1);
+            faceTan1[f] = vec3( (t2*q1.x - t1*q2.x) * r,
+                                (t2*q1.y - t1*q2.y) * r,
+                                (t2*q1.z - t1*q2.z) * r);
+            faceTan2[f] = vec3( (s1*q2.x - s2*q1.x) * r,
+                                (s1*q2.y - s2*q1.y) * r,
+                                (s1*q2.z - s2*q1.z) * r);
+        }
+    });
+
+    PointCorners pc;
+    buildPointCorners(faces, 3 * nFaces, points.size(), pc);
+
+    // Gram-Schmidt orthogonalize against the normal, then normalize
+    Vec3Planes tan(points.size());
+    std::vector<float> handedness(points.size());
+    forBatches(pool, points.size(), [&](size_t begin, size_t end) {
+        for( size_t p = begin; p < end; p++ ) {
+            vec3 t1(0.0f), t2(0.0f);
+            for( GLuint c = pc.start[p]; c < pc.start[p + 1]; c++ ) {
+                t1 += faceTan1[pc.corners[c] / 3];
+                t2 += faceTan2[pc.corners[c] / 3];
+            }
+            const vec3 &n = normals[p];
+            tan.set(p, t1 - (glm::dot(n,t1) * n));
+            handedness[p] = (glm::dot( glm::cross(n,t1), t2 ) < 0.0f) ? -1.0f : 1.0f;
+        }
+        tan.normalize(begin, end);
+    });
+
+    tangents.resize(points.size());
+    forBatches(pool, points.size(), [&](size_t begin, size_t end) {
+        for( size_t p = begin; p < end; p++ ) tangents[p] = glm::vec4(tan.get(p), handedness[p]);
+    });
+}
+
+void ObjMesh::ObjMeshData::generateNormalsSerial() {
     if( normals.size() != 0 ) return;
 
     normals.resize(points.size());
@@ -229,7 +1061,7 @@ void ObjMesh::ObjMeshData::generateNormalsIfNeeded() {
     }
 }
 
-void ObjMesh::ObjMeshData::generateTangents() {
+void ObjMesh::ObjMeshData::generateTangentsSerial() {
     std::vector<vec3> tan1Accum(points.size());
     std::vector<vec3> tan2Accum(points.size());
     tangents.resize(points.size());
@@ -280,47 +1112,161 @@ void ObjMesh::ObjMeshData::generateTangents() {
 void ObjMesh::ObjMeshData::toGlMesh(GlMeshData & data) {
     data.clear();
 
-    std::map<std::string, GLuint> vertexMap;
-    for( auto & vert : faces ) {
-        auto vertStr = vert.str();
-        auto it = vertexMap.find(vertStr);
-        if( it == vertexMap.end() ) {
-            auto vIdx = data.points.size() / 3;
-
-            auto & pt = points[ vert.pIdx ];
-            data.points.push_back( pt.x );
-            data.points.push_back( pt.y );
-            data.points.push_back( pt.z );
-
-            auto & n = normals[ vert.nIdx ];
-            data.normals.push_back( n.x );
-            data.normals.push_back( n.y );
-            data.normals.push_back( n.z );
-
-            if( ! texCoords.empty() ) {
-                auto & tc = texCoords[ vert.tcIdx ];
-                data.texCoords.push_back( tc.x );
-                data.texCoords.push_back( tc.y );
-            }
+    // Most meshes end up with about one GL vertex per position
+    size_t expected = std::max(points.size(), std::max(normals.size(), texCoords.size()));
+    data.points.reserve(expected * 3);
+    data.normals.reserve(expected * 3);
+    if( ! texCoords.empty() ) data.texCoords.reserve(expected * 2);
+    if( ! tangents.empty() ) data.tangents.reserve(expected * 4);
+    data.faces.reserve(faces.size());
+
+    auto emit = [&](const ObjVertex & vert) {
+        auto & pt = points[ vert.pIdx ];
+        data.points.push_back( pt.x );
+        data.points.push_back( pt.y );
+        data.points.push_back( pt.z );
+
+        auto & n = normals[ vert.nIdx ];
+        data.normals.push_back( n.x );
+        data.normals.push_back( n.y );
+        data.normals.push_back( n.z );
+
+        if( ! texCoords.empty() ) {
+            auto & tc = texCoords[ vert.tcIdx ];
+            data.texCoords.push_back( tc.x );
+            data.texCoords.push_back( tc.y );
+        }
 
-            if( ! tangents.empty() ) {
-                // We use the point index for tangents
-                auto & tang = tangents[ vert.pIdx ];
-                data.tangents.push_back( tang.x );
-                data.tangents.push_back( tang.y );
-                data.tangents.push_back( tang.z );
-                data.tangents.push_back( tang.w );
+        if( ! tangents.empty() ) {
+            // We use the point index for tangents
+            auto & tang = tangents[ vert.pIdx ];
+            data.tangents.push_back( tang.x );
+            data.tangents.push_back( tang.y );
+            data.tangents.push_back( tang.z );
+            data.tangents.push_back( tang.w );
+        }
+    };
+
+    if( points.size() < PACKED_KEY_LIMIT && texCoords.size() < PACKED_KEY_LIMIT && normals.size() < PACKED_KEY_LIMIT ) {
+        auto makeKey = [](const ObjVertex & v) {
+            return (uint64_t)(uint32_t)(v.pIdx + 1) | (uint64_t)(uint32_t)(v.tcIdx + 1) << 21 |
+                   (uint64_t)(uint32_t)(v.nIdx + 1) << 42;
+        };
+        dedupVertices<uint64_t>(faces, expected, makeKey, emit, data.faces);
+    } else {
+        auto makeKey = [](const ObjVertex & v) {
+            return VertexKey96{ (uint32_t)(v.pIdx + 1), (uint32_t)(v.tcIdx + 1), (uint32_t)(v.nIdx + 1) };
+        };
+        dedupVertices<VertexKey96>(faces, expected, makeKey, emit, data.faces);
+    }
+}
+
+namespace {
+    // Open addressing table from an undirected edge to the last two
+    // occurrences (corner index 3*triangle + edge) that came from different
+    // triangles. Occurrences have to be added in increasing order.
+    class EdgeTable {
+    public:
+        static const GLuint NONE = 0xffffffffu;
+
+        struct Entry {
+            uint64_t key;
+            GLuint last;        // most recent occurrence
+            GLuint other;       // most recent occurrence from another triangle
+        };
+
+        explicit EdgeTable(size_t expected) {
+            size_t capacity = 16;
+            while( capacity < expected * 2 ) capacity *= 2;
+            entries.assign(capacity, Entry{0, NONE, NONE});
+        }
+
+        void add(uint64_t key, GLuint corner) {
+            Entry & e = slot(key);
+            if( e.last == NONE ) {
+                e.key = key;
+            } else if( e.last / 3 != corner / 3 ) {
+                e.other = e.last;
             }
+            e.last = corner;
+        }
+
+        const Entry & find(uint64_t key) const {
+            return const_cast<EdgeTable *>(this)->slot(key);
+        }
 
-            data.faces.push_back((GLuint)vIdx);
-            vertexMap[vertStr] = (GLuint)vIdx;
-        } else {
-            data.faces.push_back(it->second);
+    private:
+        std::vector<Entry> entries;
+
+        // Slot holding key, or the empty slot where it would go
+        Entry & slot(uint64_t key) {
+            size_t mask = entries.size() - 1;
+            size_t i = mixBits(key) & mask;
+            while( entries[i].last != NONE && entries[i].key != key ) i = (i + 1) & mask;
+            return entries[i];
         }
+    };
+
+    inline uint64_t edgeKey(GLuint a, GLuint b) {
+        return a < b ? ((uint64_t)a << 32 | b) : ((uint64_t)b << 32 | a);
     }
 }
 
-void ObjMesh::GlMeshData::convertFacesToAdjancencyFormat()
+// Linear time version of the quadratic builder below, with the same output.
+// The quadratic one lets later matches overwrite earlier ones, so each edge
+// ends up with the opposite vertex of the highest numbered other triangle
+// sharing it (its highest numbered matching edge, for degenerate
+// triangles). That is exactly the most recent occurrence from another
+// triangle in the edge table, which also makes non-manifold edges
+// deterministic. Edges are partitioned by hash so the tables build in
+// parallel without locking.
+void ObjMesh::GlMeshData::convertFacesToAdjancencyFormat(ThreadPool * pool)
+{
+    if( pool == nullptr ) pool = &ThreadPool::shared();
+
+    size_t nCorners = faces.size() - faces.size() % 3;
+    size_t nParts = nCorners < 3 * 65536 ? 1 : pool->size();
+
+    auto cornerKey = [this](size_t corner) {
+        size_t tri = corner - corner % 3;
+        return edgeKey(faces[corner], faces[tri + (corner + 1) % 3]);
+    };
+
+    std::vector<EdgeTable> tables;
+    tables.reserve(nParts);
+    for( size_t p = 0; p < nParts; p++ ) tables.emplace_back(nCorners / nParts + 1);
+
+    pool->parallelFor(nParts, [&](size_t part) {
+        EdgeTable & table = tables[part];
+        for( size_t c = 0; c < nCorners; c++ ) {
+            uint64_t key = cornerKey(c);
+            if( mixBits(key) % nParts == part ) table.add(key, (GLuint)c);
+        }
+    });
+
+    // Elements with adjacency info
+    std::vector<GLuint> elAdj(nCorners * 2);
+    const size_t BATCH = 16384;
+    pool->parallelFor((nCorners + BATCH - 1) / BATCH, [&](size_t b) {
+        size_t end = std::min(nCorners, (b + 1) * BATCH);
+        for( size_t c = b * BATCH; c < end; c++ ) {
+            size_t tri = c - c % 3;
+            uint64_t key = cornerKey(c);
+            const EdgeTable::Entry & e = tables[mixBits(key) % nParts].find(key);
+
+            GLuint match = (e.last / 3 != c / 3) ? e.last : e.other;
+            // Outside edges point back at the triangle's own opposite vertex
+            GLuint adj = (match == EdgeTable::NONE) ? faces[tri + (c + 2) % 3]
+                                                    : faces[match - match % 3 + (match + 2) % 3];
+            elAdj[c * 2] = faces[c];
+            elAdj[c * 2 + 1] = adj;
+        }
+    });
+
+    faces.swap(elAdj);
+}
+
+void ObjMesh::GlMeshData::convertFacesToAdjancencyFormatQuadratic()
 {
     // Elements with adjacency info
     std::vector<GLuint> elAdj(faces.size() * 2);
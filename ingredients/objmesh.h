@@ -3,26 +3,62 @@
 #include "trianglemesh.h"
 #include "cookbookogl.h"
 #include "aabb.h"
+#include "mappedfile.h"
+#include "meshlets.h"
 
 #include <vector>
 #include <glm/glm.hpp>
 #include <string>
 #include <memory>
 
+class ThreadPool;
+
 class ObjMesh : public TriangleMesh {
 private:
     bool drawAdj;
 
 public:
+    // Both loaders keep a binary cache of the final mesh next to the OBJ
+    // file (fileName + ".<options>-<LOD ratio hash>.meshcache"), used while
+    // the OBJ's size and mtime stay the same. Loads with other options or
+    // ratios get a cache of their own. The mesh is reordered as set by
+    // setLoadOptimization() and gets the LOD chain set by
+    // TriangleMesh::setDefaultLodRatios() (not with adjacency) before it is
+    // cached.
     static std::unique_ptr<ObjMesh> load(const char * fileName, bool center = false, bool genTangents = false);
     static std::unique_ptr<ObjMesh> loadWithAdjacency(const char * fileName, bool center = false);
+    // Also splits the full detail level into meshlets, for MeshletCuller
+    static std::unique_ptr<ObjMesh> loadWithMeshlets(const char * fileName, bool center = false);
+
+    const std::vector<Meshlet> & getMeshlets() const { return meshlets; }
+
+    // Reordering for OBJ files loaded after this call. Unlike the procedural
+    // meshes (TriangleMesh::setMeshOptimization) the default is
+    // VERTEX_CACHE_AND_OVERDRAW: scanned meshes come in poor orders, and the
+    // cost is paid once, when the cache is written.
+    static void setLoadOptimization(MeshOptimization o);
+    static MeshOptimization getLoadOptimization();
+
+    // Load fileName with 1, 2, 4, ... threads up to one per hardware thread
+    // and print the load times
+    static void benchmarkLoading(const char * fileName);
+
+    // Time normal and tangent generation, serial against the thread pool,
+    // and check the parallel results against the serial ones
+    static void benchmarkNormals(const char * fileName);
+
+    // Check the edge hash adjacency builder against the quadratic one on
+    // small random meshes and time it on grids of up to maxTriangles
+    static void benchmarkAdjacency(size_t maxTriangles);
 
-    void render() const override;
+    // Time a cold load (OBJ parse, no cache) against a warm one (mapped cache)
+    static void benchmarkCache(const char * fileName, bool genTangents = false);
 
 protected:
     ObjMesh();
 
     Aabb bbox;
+    std::vector<Meshlet> meshlets;
 
     // Helper classes used for loading
     class GlMeshData {
@@ -32,6 +68,7 @@ protected:
         std::vector <GLfloat> texCoords;
         std::vector <GLuint> faces;
         std::vector <GLfloat> tangents;
+        std::vector <LodLevel> lods;
 
         void clear() {
             points.clear();
@@ -39,11 +76,47 @@ protected:
             texCoords.clear();
             faces.clear();
             tangents.clear();
+            lods.clear();
         }
         void center(Aabb & bbox);
-        void convertFacesToAdjancencyFormat();
+        // Runs on pool (the shared pool if null)
+        void convertFacesToAdjancencyFormat(ThreadPool * pool = nullptr);
+        // The original O(n^2) builder, kept as the reference for testing
+        void convertFacesToAdjancencyFormatQuadratic();
     };
 
+    // Load options, part of the cache key
+    enum LoadOptions {
+        LOAD_CENTER = 1,
+        LOAD_TANGENTS = 2,
+        LOAD_ADJACENCY = 4,
+        LOAD_OPTIMIZE = 8,              // MeshOptimizer vertex cache and fetch order
+        LOAD_OPTIMIZE_OVERDRAW = 16
+    };
+
+    // Arrays of a cache file, pointing into its mapping
+    struct CachedMesh {
+        MappedFile file;
+        const GLuint * indices;
+        const GLfloat * points;
+        const GLfloat * normals;
+        const GLfloat * texCoords;   // null if the mesh has none
+        const GLfloat * tangents;    // null if the mesh has none
+        GLuint nIndices;
+        GLuint nVertices;
+        std::vector<LodLevel> lods;
+        Aabb bbox;
+    };
+
+    static std::unique_ptr<ObjMesh> loadWithOptions(const char * fileName, unsigned options, bool buildMeshlets = false);
+    // The OBJ to GL mesh pipeline
+    static void buildGlMesh(const char * fileName, unsigned options, GlMeshData & glMesh, Aabb & bbox);
+    // The LOD ratios a load builds: none with adjacency
+    static std::vector<float> lodRatios(unsigned options);
+    static std::string cacheFileName(const char * fileName, unsigned options);
+    static bool openCache(const char * fileName, unsigned options, CachedMesh & cached);
+    static void saveCache(const char * fileName, unsigned options, const GlMeshData & glMesh, const Aabb & bbox);
+
     class ObjMeshData {
     public:
         class ObjVertex {
@@ -58,7 +131,9 @@ protected:
                 tcIdx = -1;
             }
 
-            ObjVertex(std::string &vertString, ObjMeshData * mesh);
+            // Parse a "p", "p/t", "p//n" or "p/t/n" face token. Negative
+            // indices are relative to the element counts given.
+            ObjVertex(const char * str, const char * end, size_t nPoints, size_t nTexCoords, size_t nNormals);
             std::string str() {
                 return std::to_string(pIdx) + "/" + std::to_string(tcIdx) + "/" + std::to_string(nIdx);
             }
@@ -72,9 +147,14 @@ protected:
 
         ObjMeshData() { }
 
-        void generateNormalsIfNeeded();
-        void generateTangents();
-        void load( const char * fileName, Aabb & bbox );
+        // Both run on pool (the shared pool if null)
+        void generateNormalsIfNeeded(ThreadPool * pool = nullptr);
+        void generateTangents(ThreadPool * pool = nullptr);
+        // The original serial loops, kept as the reference for testing
+        void generateNormalsSerial();
+        void generateTangentsSerial();
+        // Parses the file in chunks on pool (the shared pool if null)
+        void load( const char * fileName, Aabb & bbox, ThreadPool * pool = nullptr );
         void toGlMesh(GlMeshData & data);
     };
 };
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+// Float to the small float texel formats, rounding to nearest. Values
+// beyond the range clamp to the largest finite value and NaN becomes 0.
+
+namespace packedfloat {
+    // Magnitude of a positive float as a float with a 5 bit exponent (bias
+    // 15) and the given number of mantissa bits, the layout shared by half,
+    // 11 and 10 bit floats
+    inline uint32_t roundMagnitude(float a, int mantissaBits) {
+        uint32_t maxFinite = (30u << mantissaBits) | ((1u << mantissaBits) - 1);
+        uint32_t u;
+        memcpy(&u, &a, sizeof(u));
+        int exponent = (int)(u >> 23) - 127 + 15;
+        uint32_t mantissa = u & 0x7fffff;
+        int shift = 23 - mantissaBits;
+        if( exponent <= 0 ) {
+            // Subnormal
+            if( exponent < -mantissaBits ) return 0;
+            mantissa |= 0x800000;
+            shift += 1 - exponent;
+            exponent = 0;
+        }
+        if( exponent > 30 ) return maxFinite;
+        uint32_t r = ((uint32_t)exponent << mantissaBits) | (mantissa >> shift);
+        uint32_t rest = mantissa & ((1u << shift) - 1), half = 1u << (shift - 1);
+        if( rest > half || (rest == half && (r & 1)) ) r++;
+        return std::min(r, maxFinite);
+    }
+}
+
+// IEEE half float (GL_HALF_FLOAT)
+inline uint16_t floatToHalf(float f) {
+    uint16_t sign = std::signbit(f) ? 0x8000 : 0;
+    float a = std::fabs(f);
+    if( !(a > 0.0f) ) return a == 0.0f ? sign : 0;     // zero or NaN
+    return sign | (uint16_t)packedfloat::roundMagnitude(a, 10);
+}
+
+// GL_R11F_G11F_B10F as GL_UNSIGNED_INT_10F_11F_11F_REV: red in the low 11
+// bits. The formats have no sign; negative values become 0.
+inline uint32_t packR11G11B10F(float r, float g, float b) {
+    auto bits = [](float f, int mantissaBits) {
+        return f > 0.0f ? packedfloat::roundMagnitude(f, mantissaBits) : 0u;
+    };
+    return bits(r, 6) | (bits(g, 6) << 11) | (bits(b, 5) << 22);
+}
@@ -1,9 +1,10 @@
 #ifndef SKYBOX_H
 #define SKYBOX_H
 
-#include "trianglemesh.h"
+#include "staticmesh.h"
 
-class SkyBox : public TriangleMesh
+// Uploaded from StaticMeshGenerator::skyBox, without heap allocations
+class SkyBox : public StaticMesh
 {
 public:
     SkyBox(float size = 50.0f);
@@ -1,11 +1,12 @@
 #include "sphere.h"
+#include "threadpool.h"
 
 #include <cstdio>
 #include <cmath>
 
 #include <glm/gtc/constants.hpp>
 
-Sphere::Sphere(float radius, GLuint nSlices, GLuint nStacks)
+Sphere::Sphere(float radius, GLuint nSlices, GLuint nStacks, ThreadPool * pool)
 {
     int nVerts = (nSlices+1) * (nStacks + 1);
     int elements = (nSlices * 2 * (nStacks-1) ) * 3;
@@ -19,21 +20,22 @@ Sphere::Sphere(float radius, GLuint nSlices, GLuint nStacks)
     // Elements
     std::vector<GLuint> el(elements);
 
-	// Generate positions and normals
-	GLfloat theta, phi;
+    if( pool == nullptr ) pool = &ThreadPool::shared();
+    uploadPool = pool;
+
+	// Generate positions and normals, a slice of nStacks + 1 vertices at a time
 	GLfloat thetaFac = glm::two_pi<float>() / nSlices;
 	GLfloat phiFac = glm::pi<float>() / nStacks;
-	GLfloat nx, ny, nz, s, t;
-	GLuint idx = 0, tIdx = 0;
-	for( GLuint i = 0; i <= nSlices; i++ ) {
-		theta = i * thetaFac;
-                s = (GLfloat)i / nSlices;
+	pool->parallelFor(nSlices + 1, [&](size_t i) {
+		GLfloat theta = i * thetaFac;
+		GLfloat s = (GLfloat)i / nSlices;
+		GLuint idx = (GLuint)i * (nStacks + 1) * 3, tIdx = (GLuint)i * (nStacks + 1) * 2;
 		for( GLuint j = 0; j <= nStacks; j++ ) {
-			phi = j * phiFac;
-                        t = (GLfloat)j / nStacks;
-			nx = sinf(phi) * cosf(theta);
-			ny = sinf(phi) * sinf(theta);
-			nz = cosf(phi);
+			GLfloat phi = j * phiFac;
+			GLfloat t = (GLfloat)j / nStacks;
+			GLfloat nx = sinf(phi) * cosf(theta);
+			GLfloat ny = sinf(phi) * sinf(theta);
+			GLfloat nz = cosf(phi);
 			p[idx] = radius * nx; p[idx+1] = radius * ny; p[idx+2] = radius * nz;
 			n[idx] = nx; n[idx+1] = ny; n[idx+2] = nz;
 			idx += 3;
@@ -42,13 +44,14 @@ Sphere::Sphere(float radius, GLuint nSlices, GLuint nStacks)
 			tex[tIdx+1] = t;
 			tIdx += 2;
 		}
-	}
+	});
 
-	// Generate the element list
-	idx = 0;
-	for( GLuint i = 0; i < nSlices; i++ ) {
-		GLuint stackStart = i * (nStacks + 1);
-		GLuint nextStackStart = (i+1) * (nStacks+1);
+	// Generate the element list: a single triangle at either pole and two
+	// for every other stack, so each slice owns 6 * (nStacks - 1) elements
+	pool->parallelFor(nSlices, [&](size_t i) {
+		GLuint idx = (GLuint)i * 6 * (nStacks - 1);
+		GLuint stackStart = (GLuint)i * (nStacks + 1);
+		GLuint nextStackStart = ((GLuint)i+1) * (nStacks+1);
 		for( GLuint j = 0; j < nStacks; j++ ) {
 			if( j == 0 ) {
 				el[idx] = stackStart;
@@ -70,7 +73,7 @@ Sphere::Sphere(float radius, GLuint nSlices, GLuint nStacks)
 				idx += 6;
 			}
 		}
-	}
+	});
 
 	initBuffers(&el, &p, &n, &tex);
 }
@@ -3,8 +3,12 @@
 #include "trianglemesh.h"
 #include "cookbookogl.h"
 
+class ThreadPool;
+
 class Sphere : public TriangleMesh
 {
 public:
-    Sphere(float rad, GLuint sl, GLuint st);
+    // The slices are generated, and the vertices written, in parallel on pool
+    // (the shared pool if null)
+    Sphere(float rad, GLuint sl, GLuint st, ThreadPool * pool = nullptr);
 };
@@ -0,0 +1,258 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+
+#include "cookbookogl.h"
+#include "trianglemesh.h"
+
+// Vertex and index data of a mesh whose size is fixed at compile time, as
+// made by the StaticMeshGenerator functions. Declared constexpr (at namespace
+// scope or static) the data is computed by the compiler and stored in
+// read-only memory, e.g.
+//     static constexpr auto SPHERE = StaticMeshGenerator::sphere<16, 8>(1.0f);
+//     StaticMesh sphere(SPHERE);
+// Called with run time arguments the same functions fill an object on the
+// stack, still without touching the heap.
+template <size_t Vertices, size_t Indices, bool TexCoords = true, bool Tangents = false>
+struct StaticMeshData {
+    static constexpr size_t VERTICES = Vertices;
+    static constexpr size_t INDICES = Indices;
+
+    std::array<GLfloat, 3 * Vertices> points;
+    std::array<GLfloat, 3 * Vertices> normals;
+    std::array<GLfloat, TexCoords ? 2 * Vertices : 0> texCoords;
+    std::array<GLfloat, Tangents ? 4 * Vertices : 0> tangents;
+    std::array<GLuint, Indices> indices;
+};
+
+// constexpr versions of the Cube, SkyBox, Plane, Sphere and Torus
+// constructors, with the same vertex order. The resolution is a template
+// parameter, so keep it low: the compiler evaluates every vertex.
+class StaticMeshGenerator {
+public:
+    using CubeData = StaticMeshData<24, 36>;
+    using SkyBoxData = StaticMeshData<24, 36, false>;
+    template <size_t XDivs, size_t ZDivs>
+    using PlaneData = StaticMeshData<(XDivs + 1) * (ZDivs + 1), 6 * XDivs * ZDivs, true, true>;
+    template <size_t Slices, size_t Stacks>
+    using SphereData = StaticMeshData<(Slices + 1) * (Stacks + 1), 6 * Slices * (Stacks - 1)>;
+    template <size_t Sides, size_t Rings>
+    using TorusData = StaticMeshData<Sides * (Rings + 1), 6 * Sides * Rings>;
+
+    static constexpr CubeData cube(GLfloat side = 1.0f) {
+        CubeData d{};
+        GLfloat side2 = side / 2.0f;
+        for( size_t i = 0; i < 72; i++ ) d.points[i] = side2 * CUBE_CORNERS[i];
+        for( size_t f = 0; f < 6; f++ ) {
+            for( size_t v = 0; v < 4; v++ ) {
+                for( size_t i = 0; i < 3; i++ ) d.normals[(4 * f + v) * 3 + i] = CUBE_NORMALS[3 * f + i];
+                d.texCoords[(4 * f + v) * 2] = v == 1 || v == 2 ? 1.0f : 0.0f;
+                d.texCoords[(4 * f + v) * 2 + 1] = v >= 2 ? 1.0f : 0.0f;
+            }
+            faceIndices(d.indices, f, false);
+        }
+        return d;
+    }
+
+    // The cube seen from inside; normals are left zero as a sky box is not shaded
+    static constexpr SkyBoxData skyBox(float size = 50.0f) {
+        SkyBoxData d{};
+        float side2 = size * 0.5f;
+        for( size_t i = 0; i < 72; i++ ) d.points[i] = side2 * CUBE_CORNERS[i];
+        for( size_t f = 0; f < 6; f++ ) faceIndices(d.indices, f, true);
+        return d;
+    }
+
+    template <size_t XDivs, size_t ZDivs>
+    static constexpr PlaneData<XDivs, ZDivs> plane(float xsize, float zsize, float smax = 1.0f, float tmax = 1.0f) {
+        static_assert(XDivs > 0 && ZDivs > 0, "a plane needs at least one division");
+        PlaneData<XDivs, ZDivs> d{};
+        size_t vidx = 0, tidx = 0;
+        for( size_t i = 0; i <= ZDivs; i++ ) {
+            float z = zsize / ZDivs * i - zsize / 2.0f;
+            for( size_t j = 0; j <= XDivs; j++ ) {
+                d.points[vidx] = xsize / XDivs * j - xsize / 2.0f;
+                d.points[vidx + 2] = z;
+                d.normals[vidx + 1] = 1.0f;
+                d.texCoords[tidx] = smax / XDivs * j;
+                d.texCoords[tidx + 1] = tmax / ZDivs * (ZDivs - i);
+                vidx += 3;
+                tidx += 2;
+            }
+        }
+        for( size_t v = 0; v < PlaneData<XDivs, ZDivs>::VERTICES; v++ ) {
+            d.tangents[4 * v] = 1.0f;
+            d.tangents[4 * v + 3] = 1.0f;
+        }
+
+        size_t idx = 0;
+        for( size_t i = 0; i < ZDivs; i++ ) {
+            GLuint rowStart = (GLuint)(i * (XDivs + 1));
+            GLuint nextRowStart = (GLuint)((i + 1) * (XDivs + 1));
+            for( GLuint j = 0; j < XDivs; j++ ) {
+                d.indices[idx] = rowStart + j;
+                d.indices[idx + 1] = nextRowStart + j;
+                d.indices[idx + 2] = nextRowStart + j + 1;
+                d.indices[idx + 3] = rowStart + j;
+                d.indices[idx + 4] = nextRowStart + j + 1;
+                d.indices[idx + 5] = rowStart + j + 1;
+                idx += 6;
+            }
+        }
+        return d;
+    }
+
+    template <size_t Slices, size_t Stacks>
+    static constexpr SphereData<Slices, Stacks> sphere(float radius) {
+        static_assert(Slices > 0 && Stacks > 1, "a sphere needs a slice and two stacks");
+        SphereData<Slices, Stacks> d{};
+        size_t idx = 0, tIdx = 0;
+        for( size_t i = 0; i <= Slices; i++ ) {
+            double theta = 2.0 * PI / Slices * i;
+            for( size_t j = 0; j <= Stacks; j++ ) {
+                double phi = PI / Stacks * j;
+                GLfloat n[3] = { (GLfloat)(sine(phi) * cosine(theta)), (GLfloat)(sine(phi) * sine(theta)),
+                                 (GLfloat)cosine(phi) };
+                for( size_t k = 0; k < 3; k++ ) {
+                    d.points[idx + k] = radius * n[k];
+                    d.normals[idx + k] = n[k];
+                }
+                idx += 3;
+                d.texCoords[tIdx] = (GLfloat)i / Slices;
+                d.texCoords[tIdx + 1] = (GLfloat)j / Stacks;
+                tIdx += 2;
+            }
+        }
+
+        // One triangle at either pole, two for every other stack
+        idx = 0;
+        for( GLuint i = 0; i < Slices; i++ ) {
+            GLuint stackStart = i * (Stacks + 1);
+            GLuint nextStackStart = (i + 1) * (Stacks + 1);
+            for( GLuint j = 0; j < Stacks; j++ ) {
+                if( j == 0 ) {
+                    setIndices(d.indices, idx, stackStart, stackStart + 1, nextStackStart + 1);
+                } else if( j == Stacks - 1 ) {
+                    setIndices(d.indices, idx, stackStart + j, stackStart + j + 1, nextStackStart + j);
+                } else {
+                    setIndices(d.indices, idx, stackStart + j, stackStart + j + 1, nextStackStart + j + 1);
+                    setIndices(d.indices, idx, nextStackStart + j, stackStart + j, nextStackStart + j + 1);
+                }
+            }
+        }
+        return d;
+    }
+
+    template <size_t Sides, size_t Rings>
+    static constexpr TorusData<Sides, Rings> torus(GLfloat outerRadius, GLfloat innerRadius) {
+        static_assert(Sides > 0 && Rings > 0, "a torus needs a side and a ring");
+        TorusData<Sides, Rings> d{};
+        size_t idx = 0, tidx = 0;
+        for( size_t ring = 0; ring <= Rings; ring++ ) {
+            double u = 2.0 * PI / Rings * ring;
+            double cu = cosine(u), su = sine(u);
+            for( size_t side = 0; side < Sides; side++ ) {
+                double v = 2.0 * PI / Sides * side;
+                double cv = cosine(v), sv = sine(v);
+                double r = outerRadius + innerRadius * cv;
+                d.points[idx] = (GLfloat)(r * cu);
+                d.points[idx + 1] = (GLfloat)(r * su);
+                d.points[idx + 2] = (GLfloat)(innerRadius * sv);
+                // Already unit length
+                d.normals[idx] = (GLfloat)(cv * cu);
+                d.normals[idx + 1] = (GLfloat)(cv * su);
+                d.normals[idx + 2] = (GLfloat)sv;
+                d.texCoords[tidx] = (GLfloat)ring / Rings;
+                d.texCoords[tidx + 1] = (GLfloat)side / Sides;
+                idx += 3;
+                tidx += 2;
+            }
+        }
+
+        idx = 0;
+        for( GLuint ring = 0; ring < Rings; ring++ ) {
+            GLuint ringStart = ring * Sides;
+            GLuint nextRingStart = (ring + 1) * Sides;
+            for( GLuint side = 0; side < Sides; side++ ) {
+                GLuint nextSide = (side + 1) % Sides;
+                setIndices(d.indices, idx, ringStart + side, nextRingStart + side, nextRingStart + nextSide);
+                setIndices(d.indices, idx, ringStart + side, nextRingStart + nextSide, ringStart + nextSide);
+            }
+        }
+        return d;
+    }
+
+private:
+    static constexpr double PI = 3.14159265358979323846;
+
+    // Corners of the front, right, back, left, bottom and top faces of a cube
+    // with side 2, counter-clockwise from outside
+    static constexpr GLfloat CUBE_CORNERS[72] = {
+        -1, -1,  1,   1, -1,  1,   1,  1,  1,  -1,  1,  1,
+         1, -1,  1,   1, -1, -1,   1,  1, -1,   1,  1,  1,
+        -1, -1, -1,  -1,  1, -1,   1,  1, -1,   1, -1, -1,
+        -1, -1,  1,  -1,  1,  1,  -1,  1, -1,  -1, -1, -1,
+        -1, -1,  1,  -1, -1, -1,   1, -1, -1,   1, -1,  1,
+        -1,  1,  1,   1,  1,  1,   1,  1, -1,  -1,  1, -1
+    };
+    static constexpr GLfloat CUBE_NORMALS[18] = {
+         0,  0,  1,   1,  0,  0,   0,  0, -1,  -1,  0,  0,   0, -1,  0,   0,  1,  0
+    };
+
+    // The std:: functions are not constexpr in C++17. Taylor series around
+    // zero after reducing to [-pi, pi], good to about 1e-13.
+    static constexpr double sine(double x) {
+        long long turns = (long long)(x / (2.0 * PI) + (x < 0.0 ? -0.5 : 0.5));
+        x -= turns * 2.0 * PI;
+        double term = x, sum = x;
+        for( int i = 1; i < 13; i++ ) {
+            term *= -x * x / ((2 * i) * (2 * i + 1));
+            sum += term;
+        }
+        return sum;
+    }
+    static constexpr double cosine(double x) { return sine(x + PI / 2.0); }
+
+    template <size_t N>
+    static constexpr void setIndices(std::array<GLuint, N> & indices, size_t & idx, GLuint a, GLuint b, GLuint c) {
+        indices[idx] = a;
+        indices[idx + 1] = b;
+        indices[idx + 2] = c;
+        idx += 3;
+    }
+
+    // Two triangles for the quad of face f, wound the other way when seen from inside
+    template <size_t N>
+    static constexpr void faceIndices(std::array<GLuint, N> & indices, size_t f, bool inside) {
+        GLuint base = (GLuint)(4 * f);
+        size_t idx = 6 * f;
+        if( inside ) {
+            setIndices(indices, idx, base, base + 2, base + 1);
+            setIndices(indices, idx, base, base + 3, base + 2);
+        } else {
+            setIndices(indices, idx, base, base + 1, base + 2);
+            setIndices(indices, idx, base, base + 2, base + 3);
+        }
+    }
+};
+
+// A TriangleMesh uploaded straight from StaticMeshData. Unlike the
+// std::vector based constructors this skips MeshOptimizer and the LOD chain,
+// which do little for meshes this small.
+class StaticMesh : public TriangleMesh {
+public:
+    template <size_t V, size_t I, bool T, bool G>
+    explicit StaticMesh(const StaticMeshData<V, I, T, G> & data) {
+        upload(data);
+    }
+
+protected:
+    StaticMesh() { }
+
+    template <size_t V, size_t I, bool T, bool G>
+    void upload(const StaticMeshData<V, I, T, G> & data) {
+        initBuffers(data.indices.data(), I, data.points.data(), data.normals.data(), V,
+                    T ? data.texCoords.data() : nullptr, G ? data.tangents.data() : nullptr);
+    }
+};
@@ -1,5 +1,6 @@
 #include "teapot.h"
 #include "teapotdata.h"
+#include "threadpool.h"
 #include "cookbookogl.h"
 
 #include <cstdio>
@@ -10,7 +11,7 @@ using glm::mat4;
 using glm::mat3;
 using glm::vec4;
 
-Teapot::Teapot(int grid, const mat4 & lidTransform)
+Teapot::Teapot(int grid, const mat4 & lidTransform, ThreadPool * pool)
 {
     int verts = 32 * (grid + 1) * (grid + 1);
     int faces = grid * grid * 32;
@@ -19,9 +20,10 @@ Teapot::Teapot(int grid, const mat4 & lidTransform)
     std::vector<GLfloat> tc( verts * 2 );
     std::vector<GLuint> el( faces * 6 );
 
-    generatePatches( p, n, tc, el, grid );
+    generatePatches( p, n, tc, el, grid, pool );
     moveLid(grid, p, lidTransform);
 
+    uploadPool = pool;
     initBuffers(&el, &p, &n, &tc);
 }
 
@@ -30,34 +32,45 @@ void Teapot::generatePatches(
         std::vector<GLfloat> & n,
         std::vector<GLfloat> & tc,
         std::vector<GLuint> & el,
-        int grid)
+        int grid, ThreadPool * pool)
 {
     std::vector<GLfloat> B(4*(grid+1));  // Pre-computed Bernstein basis functions
     std::vector<GLfloat> dB(4*(grid+1)); // Pre-computed derivitives of basis functions
 
-    int idx = 0, elIndex = 0, tcIndex = 0;
-
     // Pre-compute the basis functions  (Bernstein polynomials)
     // and their derivatives
     computeBasisFunctions(B, dB, grid);
 
-    // Build each patch
+    // List the patches
+    std::vector<PatchInstance> patches;
     // The rim
-    buildPatchReflect(0, B, dB, p, n, tc, el, idx, elIndex, tcIndex, grid, true, true);
+    buildPatchReflect(0, patches, true, true);
     // The body
-    buildPatchReflect(1, B, dB, p, n, tc, el, idx, elIndex, tcIndex, grid, true, true);
-    buildPatchReflect(2, B, dB, p, n, tc, el, idx, elIndex, tcIndex, grid, true, true);
+    buildPatchReflect(1, patches, true, true);
+    buildPatchReflect(2, patches, true, true);
     // The lid
-    buildPatchReflect(3, B, dB, p, n, tc, el, idx, elIndex, tcIndex, grid, true, true);
-    buildPatchReflect(4, B, dB, p, n, tc, el, idx, elIndex, tcIndex, grid, true, true);
+    buildPatchReflect(3, patches, true, true);
+    buildPatchReflect(4, patches, true, true);
     // The bottom
-    buildPatchReflect(5, B, dB, p, n, tc, el, idx, elIndex, tcIndex, grid, true, true);
+    buildPatchReflect(5, patches, true, true);
     // The handle
-    buildPatchReflect(6, B, dB, p, n, tc, el, idx, elIndex, tcIndex, grid, false, true);
-    buildPatchReflect(7, B, dB, p, n, tc, el, idx, elIndex, tcIndex, grid, false, true);
+    buildPatchReflect(6, patches, false, true);
+    buildPatchReflect(7, patches, false, true);
     // The spout
-    buildPatchReflect(8, B, dB, p, n, tc, el, idx, elIndex, tcIndex, grid, false, true);
-    buildPatchReflect(9, B, dB, p, n, tc, el, idx, elIndex, tcIndex, grid, false, true);
+    buildPatchReflect(8, patches, false, true);
+    buildPatchReflect(9, patches, false, true);
+
+    // Build each patch
+    if( pool == nullptr ) pool = &ThreadPool::shared();
+    int patchVerts = (grid + 1) * (grid + 1);
+    pool->parallelFor(patches.size(), [&](size_t k) {
+        const PatchInstance & inst = patches[k];
+        vec3 patch[4][4];
+        getPatch(inst.patchNum, patch, inst.reverseV);
+        buildPatch(patch, B, dB, p.data() + k * patchVerts * 3, n.data() + k * patchVerts * 3,
+                   tc.data() + k * patchVerts * 2, el.data() + k * grid * grid * 6,
+                   (int)k * patchVerts, grid, inst.reflect, inst.invertNormal);
+    });
 }
 
 void Teapot::moveLid(int grid, std::vector<GLfloat> & p, const mat4 & lidTransform) {
@@ -75,56 +88,44 @@ void Teapot::moveLid(int grid, std::vector<GLfloat> & p, const mat4 & lidTransfo
     }
 }
 
-void Teapot::buildPatchReflect(int patchNum,
-                               std::vector<GLfloat> & B, std::vector<GLfloat> & dB,
-                               std::vector<GLfloat> & v, std::vector<GLfloat> & n,
-                               std::vector<GLfloat> & tc, std::vector<GLuint> & el,
-                               int &index, int &elIndex, int &tcIndex, int grid,
+void Teapot::buildPatchReflect(int patchNum, std::vector<PatchInstance> & patches,
                                bool reflectX, bool reflectY)
 {
-    vec3 patch[4][4];
-    vec3 patchRevV[4][4];
-    getPatch(patchNum, patch, false);
-    getPatch(patchNum, patchRevV, true);
-
     // Patch without modification
-    buildPatch(patch, B, dB, v, n, tc, el,
-               index, elIndex, tcIndex, grid, mat3(1.0f), true);
+    patches.push_back({ patchNum, false, mat3(1.0f), true });
 
     // Patch reflected in x
     if( reflectX ) {
-        buildPatch(patchRevV, B, dB, v, n, tc, el,
-                   index, elIndex, tcIndex, grid, mat3(vec3(-1.0f, 0.0f, 0.0f),
-                                              vec3(0.0f, 1.0f, 0.0f),
-                                              vec3(0.0f, 0.0f, 1.0f) ), false );
+        patches.push_back({ patchNum, true, mat3(vec3(-1.0f, 0.0f, 0.0f),
+                                                 vec3(0.0f, 1.0f, 0.0f),
+                                                 vec3(0.0f, 0.0f, 1.0f) ), false });
     }
 
     // Patch reflected in y
     if( reflectY ) {
-        buildPatch(patchRevV, B, dB, v, n, tc, el,
-                   index, elIndex, tcIndex, grid, mat3(vec3(1.0f, 0.0f, 0.0f),
-                                              vec3(0.0f, -1.0f, 0.0f),
-                                              vec3(0.0f, 0.0f, 1.0f) ), false );
+        patches.push_back({ patchNum, true, mat3(vec3(1.0f, 0.0f, 0.0f),
+                                                 vec3(0.0f, -1.0f, 0.0f),
+                                                 vec3(0.0f, 0.0f, 1.0f) ), false });
     }
 
     // Patch reflected in x and y
     if( reflectX && reflectY ) {
-        buildPatch(patch, B, dB, v, n, tc, el,
-                   index, elIndex, tcIndex, grid, mat3(vec3(-1.0f, 0.0f, 0.0f),
-                                              vec3(0.0f, -1.0f, 0.0f),
-                                              vec3(0.0f, 0.0f, 1.0f) ), true );
+        patches.push_back({ patchNum, false, mat3(vec3(-1.0f, 0.0f, 0.0f),
+                                                  vec3(0.0f, -1.0f, 0.0f),
+                                                  vec3(0.0f, 0.0f, 1.0f) ), true });
     }
 }
 
+// Writes the (grid+1)^2 vertices from v, n and tc on, and the grid^2 * 6
+// elements from el on; startIndex is the index of the first vertex
 void Teapot::buildPatch(vec3 patch[][4],
-                        std::vector<GLfloat> & B, std::vector<GLfloat> & dB,
-                        std::vector<GLfloat> & v, std::vector<GLfloat> & n,
-                        std::vector<GLfloat> & tc, std::vector<GLuint> & el,
-                        int &index, int &elIndex, int &tcIndex, int grid, mat3 reflect,
+                        const std::vector<GLfloat> & B, const std::vector<GLfloat> & dB,
+                        GLfloat * v, GLfloat * n, GLfloat * tc, GLuint * el,
+                        int startIndex, int grid, mat3 reflect,
                         bool invertNormal)
 {
-    int startIndex = index / 3;
     float tcFactor = 1.0f / grid;
+    int index = 0, tcIndex = 0, elIndex = 0;
 
     for( int i = 0; i <= grid; i++ )
     {
@@ -213,7 +214,7 @@ void Teapot::computeBasisFunctions( std::vector<GLfloat> & B, std::vector<GLfloa
 }
 
 
-vec3 Teapot::evaluate( int gridU, int gridV, std::vector<GLfloat> & B, vec3 patch[][4] )
+vec3 Teapot::evaluate( int gridU, int gridV, const std::vector<GLfloat> & B, vec3 patch[][4] )
 {
     vec3 p(0.0f,0.0f,0.0f);
     for( int i = 0; i < 4; i++) {
@@ -224,7 +225,7 @@ vec3 Teapot::evaluate( int gridU, int gridV, std::vector<GLfloat> & B, vec3 patc
     return p;
 }
 
-vec3 Teapot::evaluateNormal( int gridU, int gridV, std::vector<GLfloat> & B, std::vector<GLfloat> & dB, vec3 patch[][4] )
+vec3 Teapot::evaluateNormal( int gridU, int gridV, const std::vector<GLfloat> & B, const std::vector<GLfloat> & dB, vec3 patch[][4] )
 {
     vec3 du(0.0f,0.0f,0.0f);
     vec3 dv(0.0f,0.0f,0.0f);
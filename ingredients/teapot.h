@@ -3,34 +3,43 @@
 #include "trianglemesh.h"
 #include <glm/glm.hpp>
 
+class ThreadPool;
+
 class Teapot : public TriangleMesh
 {
 private:
     //unsigned int faces;
 
+    // One of the 32 patches of the mesh: a patch of TeapotData, possibly
+    // mirrored. Patch k owns vertices k * (grid+1)^2 on and elements
+    // k * grid^2 * 6 on, so they can be built in any order.
+    struct PatchInstance {
+        int patchNum;
+        bool reverseV;
+        glm::mat3 reflect;
+        bool invertNormal;
+    };
+
     void generatePatches(std::vector<GLfloat> & p,
                          std::vector<GLfloat> & n,
                          std::vector<GLfloat> & tc,
-                         std::vector<GLuint> & el, int grid);
-    void buildPatchReflect(int patchNum,
-                           std::vector<GLfloat> & B, std::vector<GLfloat> & dB,
-                           std::vector<GLfloat> & v, std::vector<GLfloat> & n,
-                           std::vector<GLfloat> & tc, std::vector<GLuint> & el,
-                           int &index, int &elIndex, int &tcIndex, int grid,
-                           bool reflectX, bool reflectY);
+                         std::vector<GLuint> & el, int grid, ThreadPool * pool);
+    static void buildPatchReflect(int patchNum, std::vector<PatchInstance> & patches,
+                                  bool reflectX, bool reflectY);
     void buildPatch(glm::vec3 patch[][4],
-                    std::vector<GLfloat> & B, std::vector<GLfloat> & dB,
-                    std::vector<GLfloat> & v, std::vector<GLfloat> & n,
-                    std::vector<GLfloat> & tc, std::vector<GLuint> & el,
-                    int &index, int &elIndex, int &tcIndex, int grid, glm::mat3 reflect,
+                    const std::vector<GLfloat> & B, const std::vector<GLfloat> & dB,
+                    GLfloat * v, GLfloat * n, GLfloat * tc, GLuint * el,
+                    int startIndex, int grid, glm::mat3 reflect,
                     bool invertNormal);
     void getPatch( int patchNum, glm::vec3 patch[][4], bool reverseV );
 
     void computeBasisFunctions( std::vector<GLfloat> & B, std::vector<GLfloat> & dB, int grid );
-    glm::vec3 evaluate( int gridU, int gridV, std::vector<GLfloat> & B, glm::vec3 patch[][4] );
-    glm::vec3 evaluateNormal(  int gridU, int gridV, std::vector<GLfloat> & B, std::vector<GLfloat> & dB, glm::vec3 patch[][4] );
+    glm::vec3 evaluate( int gridU, int gridV, const std::vector<GLfloat> & B, glm::vec3 patch[][4] );
+    glm::vec3 evaluateNormal(  int gridU, int gridV, const std::vector<GLfloat> & B, const std::vector<GLfloat> & dB, glm::vec3 patch[][4] );
     void moveLid(int grid, std::vector<GLfloat> & p, const glm::mat4 & lidTransform);
 
 public:
-    Teapot(int grid, const glm::mat4& lidTransform);
+    // The 32 patches are generated, and the vertices written, in parallel on
+    // pool (the shared pool if null)
+    Teapot(int grid, const glm::mat4& lidTransform, ThreadPool * pool = nullptr);
 };
@@ -1,6 +1,336 @@
 #include "texture.h"
 #include "stb/stb_image.h"
 #include "glutils.h"
+#include "threadpool.h"
+#include "mappedfile.h"
+#include "packedfloat.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <type_traits>
+#include <vector>
+
+namespace {
+    const char * CUBE_SUFFIXES[] = { "posx", "negx", "posy", "negy", "posz", "negz" };
+
+    // Block compressed texture file (.sotx). Laid out like KTX2 minus the
+    // data format descriptor: the header, one entry per mip level, then the
+    // levels from largest to smallest, each holding all faces back to back.
+    struct TextureFileHeader {
+        char magic[4];          // "SOTX"
+        uint32_t version;
+        uint32_t codec;         // TextureCodec
+        uint32_t width, height;
+        uint32_t faces;         // 1, or 6 for a cube map in GL face order
+        uint32_t levels;
+        uint32_t reserved;
+        uint64_t sourceSize;    // total size and newest modification time of
+        int64_t sourceMtime;    // the source images, to detect a stale file
+    };
+
+    struct TextureLevelEntry {
+        uint64_t offset;        // from the start of the file
+        uint64_t faceBytes;
+    };
+
+    const uint32_t TEXTURE_FILE_VERSION = 1;
+
+    GLenum compressedFormat(TextureCodec codec) {
+        switch( codec ) {
+            case TextureCodec::BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+            case TextureCodec::BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+            case TextureCodec::BC5: return GL_COMPRESSED_RG_RGTC2;
+            case TextureCodec::BC6H: return GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT;
+        }
+        return 0;
+    }
+
+    bool sourceStamp(const std::vector<std::string> & sources, uint64_t & size, int64_t & mtime) {
+        size = 0;
+        mtime = 0;
+        for( const std::string & name : sources ) {
+            std::error_code ec;
+            size += (uint64_t)std::filesystem::file_size(name, ec);
+            if( ec ) return false;
+            auto time = std::filesystem::last_write_time(name, ec);
+            if( ec ) return false;
+            mtime = std::max(mtime, (int64_t)time.time_since_epoch().count());
+        }
+        return true;
+    }
+
+    // 2x2 box filter to the next mip level; odd edges repeat the last texel
+    template <typename T>
+    std::vector<T> downsample(const std::vector<T> & src, int w, int h, int channels) {
+        int dw = std::max(w / 2, 1), dh = std::max(h / 2, 1);
+        std::vector<T> dst((size_t)dw * dh * channels);
+        for( int y = 0; y < dh; y++ ) {
+            int y0 = std::min(2 * y, h - 1), y1 = std::min(2 * y + 1, h - 1);
+            for( int x = 0; x < dw; x++ ) {
+                int x0 = std::min(2 * x, w - 1), x1 = std::min(2 * x + 1, w - 1);
+                for( int c = 0; c < channels; c++ ) {
+                    float sum = (float)src[((size_t)y0 * w + x0) * channels + c] + (float)src[((size_t)y0 * w + x1) * channels + c] +
+                                (float)src[((size_t)y1 * w + x0) * channels + c] + (float)src[((size_t)y1 * w + x1) * channels + c];
+                    dst[((size_t)y * dw + x) * channels + c] = std::is_integral<T>::value ? (T)(sum * 0.25f + 0.5f) : (T)(sum * 0.25f);
+                }
+            }
+        }
+        return dst;
+    }
+
+    // One source image: RGBA8 for BC1/BC3/BC5, float RGB for BC6H
+    struct SourceImage {
+        int width, height;
+        std::vector<uint8_t> ldr;
+        std::vector<float> hdr;
+    };
+
+    bool readSource(const std::string & name, bool hdr, bool flip, SourceImage & image) {
+        if( hdr ) {
+            float * data = stbi_loadf(name.c_str(), &image.width, &image.height, NULL, 3);
+            if( data == nullptr ) return false;
+            size_t rowFloats = (size_t)image.width * 3;
+            image.hdr.resize(rowFloats * image.height);
+            for( int y = 0; y < image.height; y++ ) {
+                int src = flip ? image.height - 1 - y : y;
+                memcpy(&image.hdr[y * rowFloats], data + src * rowFloats, rowFloats * sizeof(float));
+            }
+            stbi_image_free(data);
+        } else {
+            unsigned char * data = Texture::loadPixels(name, image.width, image.height, flip);
+            if( data == nullptr ) return false;
+            image.ldr.assign(data, data + (size_t)image.width * image.height * 4);
+            Texture::deletePixels(data);
+        }
+        return true;
+    }
+
+    bool writeCompressed(const std::string & fileName, const std::vector<std::string> & sources, TextureCodec codec, bool flip) {
+        TextureFileHeader header;
+        memset(&header, 0, sizeof(header));
+        if( !sourceStamp(sources, header.sourceSize, header.sourceMtime) ) {
+            fprintf(stderr, "Unable to read texture: %s\n", sources[0].c_str());
+            return false;
+        }
+
+        bool hdr = codec == TextureCodec::BC6H;
+        std::vector<SourceImage> images(sources.size());
+        std::vector<char> ok(sources.size());
+        ThreadPool::shared().parallelFor(sources.size(), [&](size_t i) {
+            ok[i] = readSource(sources[i], hdr, flip, images[i]);
+        });
+        for( size_t i = 0; i < sources.size(); i++ ) {
+            if( !ok[i] || images[i].width != images[0].width || images[i].height != images[0].height ) {
+                fprintf(stderr, "Unable to read texture (or size differs): %s\n", sources[i].c_str());
+                return false;
+            }
+        }
+
+        memcpy(header.magic, "SOTX", 4);
+        header.version = TEXTURE_FILE_VERSION;
+        header.codec = (uint32_t)codec;
+        header.width = (uint32_t)images[0].width;
+        header.height = (uint32_t)images[0].height;
+        header.faces = (uint32_t)sources.size();
+        header.levels = (uint32_t)Texture::mipLevels(images[0].width, images[0].height);
+
+        std::vector<TextureLevelEntry> entries(header.levels);
+        std::vector<std::vector<uint8_t>> blocks;
+        uint64_t offset = sizeof(header) + header.levels * sizeof(TextureLevelEntry);
+        int w = images[0].width, h = images[0].height;
+        for( uint32_t level = 0; level < header.levels; level++ ) {
+            entries[level].offset = offset;
+            entries[level].faceBytes = BlockCompressor::imageBytes(codec, w, h);
+            for( SourceImage & image : images ) {
+                if( level > 0 ) {
+                    if( hdr ) image.hdr = downsample(image.hdr, image.width, image.height, 3);
+                    else image.ldr = downsample(image.ldr, image.width, image.height, 4);
+                    image.width = w;
+                    image.height = h;
+                }
+                blocks.push_back(hdr ? BlockCompressor::compressHdr(image.hdr.data(), w, h)
+                                     : BlockCompressor::compress(codec, image.ldr.data(), w, h));
+                offset += entries[level].faceBytes;
+            }
+            w = std::max(w / 2, 1);
+            h = std::max(h / 2, 1);
+        }
+
+        // Write to a temporary and rename, so a reader never maps half a file
+        std::string tmpName = fileName + ".tmp";
+        FILE * fp = fopen(tmpName.c_str(), "wb");
+        if( fp == NULL ) {
+            fprintf(stderr, "Unable to write texture: %s\n", fileName.c_str());
+            return false;
+        }
+        bool written = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+                       fwrite(entries.data(), sizeof(TextureLevelEntry), entries.size(), fp) == entries.size();
+        for( const std::vector<uint8_t> & b : blocks )
+            written = written && fwrite(b.data(), 1, b.size(), fp) == b.size();
+        written = (fclose(fp) == 0) && written;
+
+        std::error_code ec;
+        if( written ) std::filesystem::rename(tmpName, fileName, ec);
+        if( !written || ec ) {
+            fprintf(stderr, "Unable to write texture: %s\n", fileName.c_str());
+            std::filesystem::remove(tmpName, ec);
+            return false;
+        }
+        return true;
+    }
+
+    // Map fileName if it is a complete, current encoding of the sources
+    bool openCompressed(const std::string & fileName, const std::vector<std::string> & sources, TextureCodec codec,
+                        MappedFile & file, TextureFileHeader & header) {
+        uint64_t size;
+        int64_t mtime;
+        if( !sourceStamp(sources, size, mtime) ) return false;
+        if( !file.open(fileName.c_str()) ) return false;
+
+        if( file.size() >= sizeof(header) ) memcpy(&header, file.data(), sizeof(header));
+        bool ok = file.size() >= sizeof(header) && memcmp(header.magic, "SOTX", 4) == 0 &&
+                  header.version == TEXTURE_FILE_VERSION && header.codec == (uint32_t)codec &&
+                  header.faces == sources.size() && header.sourceSize == size && header.sourceMtime == mtime &&
+                  header.levels == (uint32_t)Texture::mipLevels(header.width, header.height) &&
+                  file.size() >= sizeof(header) + header.levels * sizeof(TextureLevelEntry);
+        const TextureLevelEntry * entries = reinterpret_cast<const TextureLevelEntry *>(file.data() + sizeof(header));
+        for( uint32_t level = 0; ok && level < header.levels; level++ )
+            ok = entries[level].offset + entries[level].faceBytes * header.faces <= file.size();
+        if( !ok ) file.close();
+        return ok;
+    }
+
+    GLuint loadCompressedFile(const std::string & fileName, const std::vector<std::string> & sources, TextureCodec codec, bool flip) {
+        MappedFile file;
+        TextureFileHeader header;
+        if( !openCompressed(fileName, sources, codec, file, header) ) {
+            if( !writeCompressed(fileName, sources, codec, flip) ) return 0;
+            if( !openCompressed(fileName, sources, codec, file, header) ) return 0;
+        }
+
+        GLenum target = header.faces == 6 ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+        GLenum format = compressedFormat(codec);
+        GLuint tex;
+        glGenTextures(1, &tex);
+        glBindTexture(target, tex);
+        glTexStorage2D(target, header.levels, format, header.width, header.height);
+
+        const TextureLevelEntry * entries = reinterpret_cast<const TextureLevelEntry *>(file.data() + sizeof(header));
+        int w = header.width, h = header.height;
+        for( uint32_t level = 0; level < header.levels; level++ ) {
+            const char * data = file.data() + entries[level].offset;
+            for( uint32_t face = 0; face < header.faces; face++ ) {
+                GLenum faceTarget = header.faces == 6 ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + face : GL_TEXTURE_2D;
+                glCompressedTexSubImage2D(faceTarget, level, 0, 0, w, h, format, (GLsizei)entries[level].faceBytes,
+                                          data + face * entries[level].faceBytes);
+            }
+            w = std::max(w / 2, 1);
+            h = std::max(h / 2, 1);
+        }
+
+        glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        if( target == GL_TEXTURE_CUBE_MAP ) {
+            glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        }
+        return tex;
+    }
+
+    std::vector<std::string> cubeMapSources(const std::string & baseName, const std::string & extension) {
+        std::vector<std::string> sources;
+        for( const char * suffix : CUBE_SUFFIXES ) sources.push_back(baseName + "_" + suffix + extension);
+        return sources;
+    }
+}
+
+int Texture::mipLevels( int width, int height ) {
+    int levels = 1;
+    for( int size = std::max(width, height); size > 1; size /= 2 ) levels++;
+    return levels;
+}
+
+bool Texture::isSupported( TextureCodec codec ) {
+    switch( codec ) {
+        case TextureCodec::BC1:
+        case TextureCodec::BC3: return GLAD_GL_EXT_texture_compression_s3tc != 0;
+        case TextureCodec::BC5: return true;
+        case TextureCodec::BC6H: return GLAD_GL_VERSION_4_2 || GLAD_GL_ARB_texture_compression_bptc;
+    }
+    return false;
+}
+
+// The packed texels are never larger than the floats they come from, so
+// converting front to back only overwrites values that were already read.
+size_t Texture::packHdrPixels( float * rgb, size_t texels, HdrFormat format ) {
+    unsigned char * out = reinterpret_cast<unsigned char *>(rgb);
+    switch( format ) {
+        case HdrFormat::RGB32F:
+            return 3 * sizeof(float);
+        case HdrFormat::RGB16F:
+            for( size_t i = 0; i < 3 * texels; i++ ) {
+                uint16_t half = floatToHalf(rgb[i]);
+                memcpy(out + i * sizeof(half), &half, sizeof(half));
+            }
+            return 3 * sizeof(uint16_t);
+        case HdrFormat::R11G11B10F:
+            for( size_t i = 0; i < texels; i++ ) {
+                uint32_t packed = packR11G11B10F(rgb[3*i], rgb[3*i+1], rgb[3*i+2]);
+                memcpy(out + i * sizeof(packed), &packed, sizeof(packed));
+            }
+            return sizeof(uint32_t);
+    }
+    return 0;
+}
+
+GLenum Texture::hdrInternalFormat( HdrFormat format ) {
+    switch( format ) {
+        case HdrFormat::RGB32F: return GL_RGB32F;
+        case HdrFormat::RGB16F: return GL_RGB16F;
+        case HdrFormat::R11G11B10F: return GL_R11F_G11F_B10F;
+    }
+    return 0;
+}
+
+GLenum Texture::hdrPixelType( HdrFormat format ) {
+    switch( format ) {
+        case HdrFormat::RGB32F: return GL_FLOAT;
+        case HdrFormat::RGB16F: return GL_HALF_FLOAT;
+        case HdrFormat::R11G11B10F: return GL_UNSIGNED_INT_10F_11F_11F_REV;
+    }
+    return 0;
+}
+
+std::string Texture::compressedFileName( const std::string & fName ) {
+    return fName + ".sotx";
+}
+
+std::string Texture::compressedCubeMapFileName( const std::string & baseName, const std::string & extension ) {
+    return baseName + "_cube" + extension + ".sotx";
+}
+
+bool Texture::buildCompressed( const std::string & fName, TextureCodec codec ) {
+    return writeCompressed(compressedFileName(fName), std::vector<std::string>(1, fName), codec, true);
+}
+
+bool Texture::buildCompressedCubeMap( const std::string & baseName, const std::string & extension, TextureCodec codec ) {
+    return writeCompressed(compressedCubeMapFileName(baseName, extension), cubeMapSources(baseName, extension), codec, false);
+}
+
+GLuint Texture::loadCompressed( const std::string & fName, TextureCodec codec ) {
+    if( !isSupported(codec) ) return loadTexture(fName);
+    return loadCompressedFile(compressedFileName(fName), std::vector<std::string>(1, fName), codec, true);
+}
+
+GLuint Texture::loadCompressedCubeMap( const std::string & baseName, const std::string & extension, TextureCodec codec ) {
+    if( !isSupported(codec) )
+        return codec == TextureCodec::BC6H ? loadHdrCubeMap(baseName) : loadCubeMap(baseName, extension);
+    return loadCompressedFile(compressedCubeMapFileName(baseName, extension), cubeMapSources(baseName, extension), codec, false);
+}
 
 /*static*/
 GLuint Texture::loadTexture( const std::string & fName ) {
@@ -10,11 +340,12 @@ GLuint Texture::loadTexture( const std::string & fName ) {
     if( data != nullptr ) {
         glGenTextures(1, &tex);
         glBindTexture(GL_TEXTURE_2D, tex);
-        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+        glTexStorage2D(GL_TEXTURE_2D, mipLevels(width, height), GL_RGBA8, width, height);
         glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, data);
+        glGenerateMipmap(GL_TEXTURE_2D);
 
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 
         Texture::deletePixels(data);
     }
@@ -26,40 +357,47 @@ void Texture::deletePixels(unsigned char *data) {
     stbi_image_free(data);
 }
 
+// stb_image's flip flag is process wide, so setting it would race with
+// decodes on other threads. It stays off and rows are flipped here instead.
 unsigned char *Texture::loadPixels(const std::string &fName, int & width, int & height, bool flip) {
     int bytesPerPix;
-    stbi_set_flip_vertically_on_load(flip);
     unsigned char *data = stbi_load(fName.c_str(), &width, &height, &bytesPerPix, 4);
+    if( data != nullptr && flip ) {
+        size_t rowBytes = (size_t)width * 4;
+        std::vector<unsigned char> row(rowBytes);
+        for( int y = 0; y < height / 2; y++ ) {
+            unsigned char * a = data + y * rowBytes;
+            unsigned char * b = data + (height - 1 - y) * rowBytes;
+            memcpy(row.data(), a, rowBytes);
+            memcpy(a, b, rowBytes);
+            memcpy(b, row.data(), rowBytes);
+        }
+    }
     return data;
 }
 
 GLuint Texture::loadCubeMap(const std::string &baseName, const std::string &extension) {
+    // Decode the faces in parallel, upload them here
+    GLubyte * data[6];
+    GLint w[6], h[6];
+    ThreadPool::shared().parallelFor(6, [&](size_t i) {
+        data[i] = Texture::loadPixels(baseName + "_" + CUBE_SUFFIXES[i] + extension, w[i], h[i], false);
+    });
+
     GLuint texID;
     glGenTextures(1, &texID);
     glBindTexture(GL_TEXTURE_CUBE_MAP, texID);
 
-    const char * suffixes[] = { "posx", "negx", "posy", "negy", "posz", "negz" };
-    GLint w, h;
-
-    // Load the first one to get width/height
-    std::string texName = baseName + "_" + suffixes[0] + extension;
-    GLubyte * data = Texture::loadPixels(texName, w, h, false);
-
     // Allocate immutable storage for the whole cube map texture
-    glTexStorage2D(GL_TEXTURE_CUBE_MAP, 1, GL_RGBA8, w, h);
-    glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, 0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, data);
-    stbi_image_free(data);
-
-    // Load the other 5 cube-map faces
-    for( int i = 1; i < 6; i++ ) {
-        std::string texName = baseName + "_" + suffixes[i] + extension;
-        data = Texture::loadPixels(texName, w, h, false);
-        glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, 0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, data);
-        stbi_image_free(data);
+    glTexStorage2D(GL_TEXTURE_CUBE_MAP, mipLevels(w[0], h[0]), GL_RGBA8, w[0], h[0]);
+    for( int i = 0; i < 6; i++ ) {
+        glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, 0, 0, w[i], h[i], GL_RGBA, GL_UNSIGNED_BYTE, data[i]);
+        stbi_image_free(data[i]);
     }
+    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
 
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
@@ -67,38 +405,35 @@ GLuint Texture::loadCubeMap(const std::string &baseName, const std::string &exte
     return texID;
 }
 
-GLuint Texture::loadHdrCubeMap(const std::string &baseName) {
+GLuint Texture::loadHdrCubeMap(const std::string &baseName, HdrFormat format) {
+    float * data[6];
+    GLint w[6], h[6];
+    ThreadPool::shared().parallelFor(6, [&](size_t i) {
+        std::string texName = baseName + "_" + CUBE_SUFFIXES[i] + ".hdr";
+        data[i] = stbi_loadf(texName.c_str(), &w[i], &h[i], NULL, 3);
+        if( data[i] != nullptr ) packHdrPixels(data[i], (size_t)w[i] * h[i], format);
+    });
+
     GLuint texID;
     glGenTextures(1, &texID);
     glBindTexture(GL_TEXTURE_CUBE_MAP, texID);
 
-    const char * suffixes[] = { "posx", "negx", "posy", "negy", "posz", "negz" };
-    GLint w, h;
-
-    // Load the first one to get width/height
-    std::string texName = baseName + "_" + suffixes[0] + ".hdr";
-    float * data = stbi_loadf(texName.c_str(), &w, &h, NULL, 3);
-
     // Allocate immutable storage for the whole cube map texture
-    glTexStorage2D(GL_TEXTURE_CUBE_MAP, 1, GL_RGB32F, w, h);
-    glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, 0, 0, w, h, GL_RGB, GL_FLOAT, data);
-    stbi_image_free(data);
-
-    // Load the other 5 cube-map faces
-    for( int i = 1; i < 6; i++ ) {
-        std::string texName = baseName + "_" + suffixes[i] + ".hdr";
-        data = stbi_loadf(texName.c_str(), &w, &h, NULL, 3);
-        glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, 0, 0, w, h, GL_RGB, GL_FLOAT, data);
-        stbi_image_free(data);
+    glTexStorage2D(GL_TEXTURE_CUBE_MAP, mipLevels(w[0], h[0]), hdrInternalFormat(format), w[0], h[0]);
+    // RGB16F rows are not always a multiple of 4 bytes
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for( int i = 0; i < 6; i++ ) {
+        glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, 0, 0, w[i], h[i], GL_RGB, hdrPixelType(format), data[i]);
+        stbi_image_free(data[i]);
     }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
 
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
     return texID;
 }
-
-
@@ -1,12 +1,50 @@
+#pragma once
 
 #include "cookbookogl.h"
+#include "blockcompressor.h"
+#include <cstddef>
+#include <cstdint>
 #include <string>
 
+// Storage of HDR textures. RGB32F keeps the decoded floats, 12 bytes per
+// texel. RGB16F takes 6 (drivers commonly pad it to 8). R11G11B10F packs a
+// texel into 4 bytes with 6 and 5 bit mantissas and no sign, which is
+// plenty for sky light.
+enum class HdrFormat : uint32_t { RGB32F, RGB16F, R11G11B10F };
+
+// Textures get a full mip chain and trilinear filtering.
 class Texture {
 public:
     static GLuint loadTexture( const std::string & fName );
     static GLuint loadCubeMap(const std::string & baseName, const std::string & extention = ".png");
-    static GLuint loadHdrCubeMap( const std::string & baseName );
+    // Faces are decoded and converted to the format on the thread pool
+    static GLuint loadHdrCubeMap( const std::string & baseName, HdrFormat format = HdrFormat::R11G11B10F );
     static unsigned char * loadPixels( const std::string & fName, int & w, int & h, bool flip = true );
     static void deletePixels( unsigned char * );
-};
\ No newline at end of file
+
+    // Convert float RGB texels in place to the GL_RGB pixel data of the format
+    // (see hdrPixelType). Returns the bytes per texel.
+    static size_t packHdrPixels( float * rgb, size_t texels, HdrFormat format );
+    static GLenum hdrInternalFormat( HdrFormat format );
+    static GLenum hdrPixelType( HdrFormat format );
+
+    // Levels of a full mip chain down to 1x1
+    static int mipLevels( int width, int height );
+
+    // Block compressed textures, uploaded straight from a .sotx file (see
+    // compressedFileName) that is built from the source images when it is
+    // missing or stale. BC6H decodes the sources as HDR. Without GL support
+    // for the codec these load the uncompressed texture instead.
+    static GLuint loadCompressed( const std::string & fName, TextureCodec codec );
+    static GLuint loadCompressedCubeMap( const std::string & baseName, const std::string & extension, TextureCodec codec );
+
+    // Build the .sotx file ahead of time. No GL needed.
+    static bool buildCompressed( const std::string & fName, TextureCodec codec );
+    static bool buildCompressedCubeMap( const std::string & baseName, const std::string & extension, TextureCodec codec );
+
+    // fName.sotx, or baseName_cube<extension>.sotx for cube maps
+    static std::string compressedFileName( const std::string & fName );
+    static std::string compressedCubeMapFileName( const std::string & baseName, const std::string & extension );
+
+    static bool isSupported( TextureCodec codec );
+};
@@ -0,0 +1,270 @@
+#include "textureloader.h"
+#include "texture.h"
+#include "threadpool.h"
+#include "stb/stb_image.h"
+
+#include <cstring>
+
+namespace {
+    const char * CUBE_SUFFIXES[] = { "posx", "negx", "posy", "negy", "posz", "negz" };
+    const size_t STAGING_ALIGNMENT = 16;
+
+    void setSampling(GLenum target) {
+        glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        if( target == GL_TEXTURE_CUBE_MAP ) {
+            glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        }
+    }
+}
+
+TextureLoader::TextureLoader(ThreadPool * p, size_t stagingBytes)
+    : pool(p != nullptr ? p : &ThreadPool::shared()), placeholder2D(0), placeholderCube(0), pendingImages(0),
+      decoding(0), stagingBuffer(0), staging(nullptr), stagingSize(stagingBytes), stagingHead(0),
+      batchBegin(SIZE_MAX) {
+
+    const GLubyte grey[4] = { 128, 128, 128, 255 };
+    glGenTextures(1, &placeholder2D);
+    glBindTexture(GL_TEXTURE_2D, placeholder2D);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, 1, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+    setSampling(GL_TEXTURE_2D);
+
+    glGenTextures(1, &placeholderCube);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, placeholderCube);
+    glTexStorage2D(GL_TEXTURE_CUBE_MAP, 1, GL_RGBA8, 1, 1);
+    for( int i = 0; i < 6; i++ )
+        glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, 0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+    setSampling(GL_TEXTURE_CUBE_MAP);
+
+    // Coherent, so writes through the pointer need no flush before the upload
+    if( stagingSize > 0 && (GLAD_GL_VERSION_4_4 || GLAD_GL_ARB_buffer_storage) ) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glGenBuffers(1, &stagingBuffer);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, stagingBuffer);
+        glBufferStorage(GL_PIXEL_UNPACK_BUFFER, stagingSize, nullptr, flags);
+        staging = (unsigned char *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, stagingSize, flags);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+}
+
+TextureLoader::~TextureLoader() {
+    // The decode tasks hold on to this
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [this] { return decoding == 0; });
+    }
+    for( const Decoded & d : decoded ) stbi_image_free(d.pixels);
+    for( const Decoded & d : waiting ) stbi_image_free(d.pixels);
+
+    for( const StagingBatch & b : batches ) glDeleteSync(b.fence);
+    if( stagingBuffer != 0 ) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, stagingBuffer);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glDeleteBuffers(1, &stagingBuffer);
+    }
+
+    for( const Entry & e : entries )
+        if( e.texture != 0 ) glDeleteTextures(1, &e.texture);
+    glDeleteTextures(1, &placeholder2D);
+    glDeleteTextures(1, &placeholderCube);
+}
+
+TextureLoader::Handle TextureLoader::load(const std::string & fName) {
+    Handle h = addEntry(GL_TEXTURE_2D, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 1);
+    decode(h, 0, fName, true, false, HdrFormat::RGB32F);
+    return h;
+}
+
+TextureLoader::Handle TextureLoader::loadCubeMap(const std::string & baseName, const std::string & extension) {
+    Handle h = addEntry(GL_TEXTURE_CUBE_MAP, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 6);
+    for( int i = 0; i < 6; i++ )
+        decode(h, i, baseName + "_" + CUBE_SUFFIXES[i] + extension, false, false, HdrFormat::RGB32F);
+    return h;
+}
+
+TextureLoader::Handle TextureLoader::loadHdrCubeMap(const std::string & baseName, HdrFormat format) {
+    Handle h = addEntry(GL_TEXTURE_CUBE_MAP, Texture::hdrInternalFormat(format), GL_RGB, Texture::hdrPixelType(format), 6);
+    for( int i = 0; i < 6; i++ )
+        decode(h, i, baseName + "_" + CUBE_SUFFIXES[i] + ".hdr", false, true, format);
+    return h;
+}
+
+GLuint TextureLoader::get(Handle h) const {
+    const Entry & e = entries[h];
+    if( isReady(h) ) return e.texture;
+    return e.target == GL_TEXTURE_CUBE_MAP ? placeholderCube : placeholder2D;
+}
+
+bool TextureLoader::isReady(Handle h) const {
+    const Entry & e = entries[h];
+    return e.imagesLeft == 0 && !e.failed;
+}
+
+bool TextureLoader::hasFailed(Handle h) const {
+    return entries[h].failed;
+}
+
+TextureLoader::Handle TextureLoader::addEntry(GLenum target, GLenum internalFormat, GLenum format, GLenum type, int images) {
+    Entry e = { target, 0, internalFormat, format, type, 0, 0, images, false };
+    entries.push_back(e);
+    pendingImages += images;
+    return (Handle)entries.size() - 1;
+}
+
+void TextureLoader::decode(Handle h, int face, const std::string & fName, bool flip, bool hdr, HdrFormat format) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        decoding++;
+    }
+    pool->submit([this, h, face, fName, flip, hdr, format] {
+        Decoded d = { h, face, 0, 0, nullptr, 0 };
+        if( hdr ) {
+            float * rgb = stbi_loadf(fName.c_str(), &d.width, &d.height, NULL, 3);
+            if( rgb != nullptr ) d.bytes = (size_t)d.width * d.height * Texture::packHdrPixels(rgb, (size_t)d.width * d.height, format);
+            d.pixels = rgb;
+        } else {
+            d.pixels = Texture::loadPixels(fName, d.width, d.height, flip);
+            d.bytes = (size_t)d.width * d.height * 4;
+        }
+        // Notify under the lock: once it is released the destructor may run,
+        // and the task must not touch this any more
+        std::lock_guard<std::mutex> lock(mutex);
+        decoded.push_back(d);
+        decoding--;
+        cond.notify_all();
+    });
+}
+
+int TextureLoader::update(size_t maxBytes) {
+    retireStaging(false);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        waiting.insert(waiting.end(), decoded.begin(), decoded.end());
+        decoded.clear();
+    }
+
+    int uploaded = 0;
+    size_t bytes = 0;
+    while( !waiting.empty() ) {
+        const Decoded & d = waiting.front();
+        Entry & e = entries[d.handle];
+        if( uploaded > 0 && bytes + d.bytes > maxBytes ) break;
+
+        // Cube faces must all have the size of the first one to arrive
+        bool ok = d.pixels != nullptr && !e.failed &&
+                  (e.texture == 0 || (d.width == e.width && d.height == e.height));
+        if( ok ) {
+            size_t offset;
+            if( staging != nullptr && d.bytes <= stagingSize ) {
+                // Full until the GPU is done with older uploads; next frame
+                if( !allocateStaging(d.bytes, offset) ) break;
+                memcpy(staging + offset, d.pixels, d.bytes);
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, stagingBuffer);
+                upload(d, (const GLvoid *)offset);
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            } else {
+                upload(d, d.pixels);
+            }
+            bytes += d.bytes;
+            uploaded++;
+        } else {
+            e.failed = true;
+        }
+
+        stbi_image_free(d.pixels);
+        e.imagesLeft--;
+        pendingImages--;
+        if( e.imagesLeft == 0 && e.failed && e.texture != 0 ) {
+            glDeleteTextures(1, &e.texture);
+            e.texture = 0;
+        } else if( e.imagesLeft == 0 && !e.failed ) {
+            glBindTexture(e.target, e.texture);
+            glGenerateMipmap(e.target);
+        }
+        waiting.pop_front();
+    }
+
+    if( batchBegin != SIZE_MAX ) {
+        batches.push_back({ batchBegin, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) });
+        batchBegin = SIZE_MAX;
+    }
+    return uploaded;
+}
+
+void TextureLoader::finish() {
+    while( pendingImages > 0 ) {
+        update();
+        if( pendingImages == 0 ) break;
+
+        if( !waiting.empty() ) {
+            // Out of staging space
+            retireStaging(true);
+        } else {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [this] { return !decoded.empty(); });
+        }
+    }
+}
+
+void TextureLoader::upload(const Decoded & d, const void * pixels) {
+    Entry & e = entries[d.handle];
+    if( e.texture == 0 ) {
+        glGenTextures(1, &e.texture);
+        glBindTexture(e.target, e.texture);
+        glTexStorage2D(e.target, Texture::mipLevels(d.width, d.height), e.internalFormat, d.width, d.height);
+        setSampling(e.target);
+        e.width = d.width;
+        e.height = d.height;
+    }
+
+    GLenum target = e.target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + d.face : e.target;
+    glBindTexture(e.target, e.texture);
+    // RGB16F rows are not always a multiple of 4 bytes
+    if( e.type == GL_HALF_FLOAT ) glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(target, 0, 0, 0, d.width, d.height, e.format, e.type, pixels);
+    if( e.type == GL_HALF_FLOAT ) glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+// Free the staging space of batches the GPU has finished with. With wait,
+// block until at least the oldest one is free.
+void TextureLoader::retireStaging(bool wait) {
+    while( !batches.empty() ) {
+        GLsync fence = batches.front().fence;
+        GLenum status = glClientWaitSync(fence, 0, 0);
+        while( wait && status == GL_TIMEOUT_EXPIRED )
+            status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000); // 1 ms
+        if( status == GL_TIMEOUT_EXPIRED ) break;
+
+        glDeleteSync(fence);
+        batches.pop_front();
+        wait = false;
+    }
+}
+
+// Ring allocation: live staging runs from the oldest batch to stagingHead,
+// possibly wrapping around the end. The head never catches up with the tail
+// from behind, so head == tail only when the ring is empty.
+bool TextureLoader::allocateStaging(size_t bytes, size_t & offset) {
+    bool empty = batches.empty() && batchBegin == SIZE_MAX;
+    size_t tail = batches.empty() ? batchBegin : batches.front().begin;
+    size_t head = (stagingHead + STAGING_ALIGNMENT - 1) & ~(STAGING_ALIGNMENT - 1);
+
+    if( empty ) {
+        offset = 0;
+    } else if( head >= tail ) {
+        if( head + bytes <= stagingSize ) offset = head;
+        else if( bytes < tail ) offset = 0;
+        else return false;
+    } else {
+        if( head + bytes < tail ) offset = head;
+        else return false;
+    }
+
+    if( batchBegin == SIZE_MAX ) batchBegin = offset;
+    stagingHead = offset + bytes;
+    return true;
+}
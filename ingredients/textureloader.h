@@ -0,0 +1,107 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "cookbookogl.h"
+#include "texture.h"
+
+class ThreadPool;
+
+// Loads textures without stalling the GL thread. Images are decoded on a
+// thread pool; update(), called once per frame on the GL thread, copies the
+// decoded pixels into a persistently mapped pixel unpack buffer and uploads
+// them from there (GL 4.4 or ARB_buffer_storage, plain uploads from client
+// memory otherwise). Until a texture has landed get() returns a 1x1 grey
+// placeholder of the same target, so handles can be bound right away.
+//
+// The loader owns its textures; they are deleted with it.
+class TextureLoader {
+public:
+    typedef int Handle;
+
+    // stagingBytes is the size of the unpack ring. Images larger than the
+    // ring are uploaded from client memory.
+    explicit TextureLoader(ThreadPool * pool = nullptr, size_t stagingBytes = 32 << 20);
+    ~TextureLoader();
+
+    // Same formats, mip chains and sampling as the Texture functions of the
+    // same name
+    Handle load(const std::string & fName);
+    Handle loadCubeMap(const std::string & baseName, const std::string & extension = ".png");
+    Handle loadHdrCubeMap(const std::string & baseName, HdrFormat format = HdrFormat::R11G11B10F);
+
+    // The texture, or the placeholder while it is loading or if it failed
+    GLuint get(Handle h) const;
+    bool isReady(Handle h) const;
+    bool hasFailed(Handle h) const;
+    // Images decoded or being decoded that have not been uploaded yet
+    int getPendingCount() const { return pendingImages; }
+
+    // Upload decoded images, at most maxBytes of them (at least one image per
+    // call). Returns the number of images uploaded.
+    int update(size_t maxBytes = SIZE_MAX);
+    // Block until everything requested so far has been uploaded
+    void finish();
+
+    bool hasPersistentStaging() const { return staging != nullptr; }
+
+private:
+    struct Entry {
+        GLenum target;
+        GLuint texture;         // 0 until the first image arrives
+        GLenum internalFormat, format, type;
+        int width, height;
+        int imagesLeft;
+        bool failed;
+    };
+
+    // Produced by the decode tasks
+    struct Decoded {
+        Handle handle;
+        int face;               // 0 for 2D textures
+        int width, height;
+        void * pixels;          // from stb_image (HDR converted in place), null if decoding failed
+        size_t bytes;
+    };
+
+    // Staging space handed out since the fence was inserted
+    struct StagingBatch {
+        size_t begin;
+        GLsync fence;
+    };
+
+    ThreadPool * pool;
+    std::vector<Entry> entries;
+    GLuint placeholder2D, placeholderCube;
+    int pendingImages;
+
+    // Shared with the decode tasks, guarded by mutex
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<Decoded> decoded;
+    int decoding;
+
+    // GL thread only: decoded images waiting for staging space, and the ring
+    std::deque<Decoded> waiting;
+    GLuint stagingBuffer;
+    unsigned char * staging;
+    size_t stagingSize;
+    size_t stagingHead;
+    size_t batchBegin;          // SIZE_MAX if nothing was staged since the last fence
+    std::deque<StagingBatch> batches;
+
+    Handle addEntry(GLenum target, GLenum internalFormat, GLenum format, GLenum type, int images);
+    void decode(Handle h, int face, const std::string & fName, bool flip, bool hdr, HdrFormat format);
+    void retireStaging(bool wait);
+    bool allocateStaging(size_t bytes, size_t & offset);
+    void upload(const Decoded & d, const void * pixels);
+
+    TextureLoader(const TextureLoader &) = delete;
+    TextureLoader & operator=(const TextureLoader &) = delete;
+};
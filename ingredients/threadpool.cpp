@@ -0,0 +1,97 @@
+#include "threadpool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+ThreadPool::ThreadPool(unsigned threads) : stopping(false) {
+    if( threads == 0 ) threads = std::thread::hardware_concurrency();
+    if( threads == 0 ) threads = 1;
+
+    workers.reserve(threads);
+    for( unsigned i = 0; i < threads; i++ )
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cond.notify_all();
+    for( std::thread & t : workers ) t.join();
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+    }
+    cond.notify_one();
+}
+
+void ThreadPool::workerLoop() {
+    for( ;; ) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [this] { return stopping || !tasks.empty(); });
+            // Finish what is queued before shutting down
+            if( tasks.empty() ) return;
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)> & fn) {
+    if( count == 0 ) return;
+    if( count == 1 ) {
+        fn(0);
+        return;
+    }
+
+    // Helpers may start after all the work is done (or never, if every
+    // worker is busy), so the shared state is reference counted and the
+    // caller only waits for the work items, not for the helpers.
+    struct State {
+        std::atomic<size_t> next;
+        std::atomic<size_t> done;
+        size_t count;
+        const std::function<void(size_t)> * fn;
+        std::mutex mutex;
+        std::condition_variable cond;
+    };
+    std::shared_ptr<State> state = std::make_shared<State>();
+    state->next = 0;
+    state->done = 0;
+    state->count = count;
+    state->fn = &fn;
+
+    auto run = [](State & s) {
+        size_t i;
+        while( (i = s.next.fetch_add(1)) < s.count ) {
+            (*s.fn)(i);
+            if( s.done.fetch_add(1) + 1 == s.count ) {
+                std::lock_guard<std::mutex> lock(s.mutex);
+                s.cond.notify_all();
+            }
+        }
+    };
+
+    // The caller counts as one of the size() threads
+    size_t helpers = std::min<size_t>(workers.size(), count) - 1;
+    for( size_t h = 0; h < helpers; h++ )
+        submit([state, run] { run(*state); });
+
+    run(*state);
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->cond.wait(lock, [&] { return state->done.load() == count; });
+}
+
+ThreadPool & ThreadPool::shared() {
+    static ThreadPool pool;
+    return pool;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads fed from a single FIFO queue. Used for loading
+// and generating data off the GL thread; none of the tasks may call GL.
+class ThreadPool {
+public:
+    // 0 threads means one per hardware thread
+    explicit ThreadPool(unsigned threads = 0);
+    ~ThreadPool();
+
+    unsigned size() const { return (unsigned)workers.size(); }
+
+    // Queue a task; it runs on one of the workers at some later point
+    void submit(std::function<void()> task);
+
+    // Run fn(i) for every i in [0, count) and wait until all calls returned.
+    // The calling thread takes part (using at most size() threads in total),
+    // so this is safe to call from a task.
+    void parallelFor(size_t count, const std::function<void(size_t)> & fn);
+
+    // Process wide pool with one worker per hardware thread
+    static ThreadPool & shared();
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool stopping;
+
+    void workerLoop();
+
+    // Make it non-copyable.
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool & operator=(const ThreadPool &) = delete;
+};
@@ -1,10 +1,11 @@
 #include "torus.h"
+#include "threadpool.h"
 #include "cookbookogl.h"
 #include <cstdio>
 #include <cmath>
 #include <glm/gtc/constants.hpp>
 
-Torus::Torus(GLfloat outerRadius, GLfloat innerRadius, GLuint nsides, GLuint nrings)
+Torus::Torus(GLfloat outerRadius, GLfloat innerRadius, GLuint nsides, GLuint nrings, ThreadPool * pool)
 {
     GLuint faces = nsides * nrings;
     int nVerts  = nsides * (nrings+1);   // One extra ring to duplicate first ring
@@ -18,14 +19,17 @@ Torus::Torus(GLfloat outerRadius, GLfloat innerRadius, GLuint nsides, GLuint nri
     // Elements
     std::vector<GLuint> el(6 * faces);
 
-    // Generate the vertex data
+    if( pool == nullptr ) pool = &ThreadPool::shared();
+    uploadPool = pool;
+
+    // Generate the vertex data, a ring of nsides vertices at a time
     float ringFactor = glm::two_pi<float>() / nrings;
 	float sideFactor = glm::two_pi<float>() / nsides;
-    int idx = 0, tidx = 0;
-    for( GLuint ring = 0; ring <= nrings; ring++ ) {
+    pool->parallelFor(nrings + 1, [&](size_t ring) {
         float u = ring * ringFactor;
         float cu = cos(u);
         float su = sin(u);
+        size_t idx = ring * nsides * 3, tidx = ring * nsides * 2;
         for( GLuint side = 0; side < nsides; side++ ) {
             float v = side * sideFactor;
             float cv = cos(v);
@@ -49,12 +53,12 @@ Torus::Torus(GLfloat outerRadius, GLfloat innerRadius, GLuint nsides, GLuint nri
             n[idx+2] /= len;
             idx += 3;
         }
-    }
+    });
 
-    idx = 0;
-    for( GLuint ring = 0; ring < nrings; ring++ ) {
-        GLuint ringStart = ring * nsides;
-        GLuint nextRingStart = (ring + 1) * nsides;
+    pool->parallelFor(nrings, [&](size_t ring) {
+        GLuint ringStart = (GLuint)ring * nsides;
+        GLuint nextRingStart = ((GLuint)ring + 1) * nsides;
+        size_t idx = ring * nsides * 6;
         for( GLuint side = 0; side < nsides; side++ ) {
             int nextSide = (side+1) % nsides;
             // The quad
@@ -66,8 +70,7 @@ Torus::Torus(GLfloat outerRadius, GLfloat innerRadius, GLuint nsides, GLuint nri
             el[idx+5] = (ringStart + nextSide);
             idx += 6;
         }
-    }
+    });
 
     initBuffers(&el, &p, &n, &tex);
 }
-
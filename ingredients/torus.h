@@ -3,8 +3,12 @@
 #include "trianglemesh.h"
 #include "cookbookogl.h"
 
+class ThreadPool;
+
 class Torus : public TriangleMesh
 {
 public:
-    Torus(GLfloat outerRadius, GLfloat innerRadius, GLuint nsides, GLuint nrings);
+    // The rings are generated, and the vertices written, in parallel on pool
+    // (the shared pool if null)
+    Torus(GLfloat outerRadius, GLfloat innerRadius, GLuint nsides, GLuint nrings, ThreadPool * pool = nullptr);
 };
@@ -1,4 +1,92 @@
 #include "trianglemesh.h"
+#include "meshoptimizer.h"
+#include "packedfloat.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace {
+    VertexFormat defaultFormat;
+    MeshOptimization meshOptimization = MeshOptimization::NONE;
+    std::vector<float> lodRatios(1, 1.0f);
+    MeshArena * defaultArena = nullptr;
+
+    GLuint packSnorm(float v, int bits) {
+        int maxValue = (1 << (bits - 1)) - 1;
+        int i = (int)std::lround(std::min(1.0f, std::max(-1.0f, v)) * maxValue);
+        return (GLuint)i & ((1u << bits) - 1);
+    }
+
+    // x, y, z in the low 30 bits, w in the top two (GL_INT_2_10_10_10_REV)
+    GLuint packSnorm1010102(float x, float y, float z, float w) {
+        return packSnorm(x, 10) | packSnorm(y, 10) << 10 | packSnorm(z, 10) << 20 | packSnorm(w, 2) << 30;
+    }}
+
+TriangleMesh::TriangleMesh() : nVerts(0), vao(0), format(defaultFormat), vertexBytes(0),
+                               positionOffset(0.0f), positionScale(1.0f), primitive(GL_TRIANGLES), hasTexCoords(false),
+                               arena(defaultArena), baseVertex(0), firstIndex(0), uploadPool(nullptr)
+{
+    if( arena != nullptr ) format.interleaved = true;
+}
+
+void TriangleMesh::setDefaultArena(MeshArena * a) {
+    defaultArena = a;
+}
+
+MeshArena * TriangleMesh::getDefaultArena() {
+    return defaultArena;
+}
+
+void TriangleMesh::setDefaultVertexFormat(const VertexFormat & f) {
+    defaultFormat = f;
+}
+
+const VertexFormat & TriangleMesh::getDefaultVertexFormat() {
+    return defaultFormat;
+}
+
+void TriangleMesh::setMeshOptimization(MeshOptimization o) {
+    meshOptimization = o;
+}
+
+MeshOptimization TriangleMesh::getMeshOptimization() {
+    return meshOptimization;
+}
+
+void TriangleMesh::setDefaultLodRatios(const std::vector<float> & ratios) {
+    lodRatios = ratios;
+}
+
+const std::vector<float> & TriangleMesh::getDefaultLodRatios() {
+    return lodRatios;
+}
+
+float TriangleMesh::pixelsPerUnit(float distance, float fovy, int viewportHeight) {
+    return viewportHeight / (2.0f * std::max(distance, 1e-6f) * std::tan(0.5f * fovy));
+}
+
+void TriangleMesh::setLodLevels(const std::vector<LodLevel> & levels) {
+    lods = levels;
+    nVerts = lods.empty() ? 0 : lods[0].nIndices;
+}
+
+int TriangleMesh::selectLod(float pixelsPerUnit, float maxPixelError) const {
+    for( int i = (int)lods.size() - 1; i > 0; i-- )
+        if( lods[i].error * pixelsPerUnit <= maxPixelError ) return i;
+    return 0;
+}
+
+glm::mat4 TriangleMesh::getPositionTransform() const {
+    glm::mat4 m(1.0f);
+    for( int i = 0; i < 3; i++ ) {
+        m[i][i] = positionScale[i];
+        m[3][i] = positionOffset[i];
+    }
+    return m;
+}
 
 void TriangleMesh::initBuffers(
         std::vector<GLuint> * indices,
@@ -8,48 +96,99 @@ void TriangleMesh::initBuffers(
         std::vector<GLfloat> * tangents
 ) {
 
+    // Must have data for indices, points, and normals
+    if( indices == nullptr || points == nullptr || normals == nullptr ) {
+        if( ! buffers.empty() ) deleteBuffers();
+        return;
+    }
+
+    if( meshOptimization != MeshOptimization::NONE )
+        MeshOptimizer::optimize(*indices, *points, *normals, texCoords, tangents,
+                                meshOptimization == MeshOptimization::VERTEX_CACHE_AND_OVERDRAW);
+
+    // The levels share the (possibly remapped) vertices of the full mesh
+    std::vector<LodLevel> levels = MeshSimplifier::buildLodChain(*indices, points->data(), points->size() / 3, lodRatios);
+
+    initBuffers(indices->data(), indices->size(), points->data(), normals->data(), points->size() / 3,
+                texCoords ? texCoords->data() : nullptr,
+                tangents ? tangents->data() : nullptr);
+    setLodLevels(levels);
+}
+
+void TriangleMesh::initBuffers(
+        const GLuint * indices, size_t nIndices,
+        const GLfloat * points, const GLfloat * normals, size_t nVertices,
+        const GLfloat * texCoords,
+        const GLfloat * tangents
+) {
+
     if( ! buffers.empty() ) deleteBuffers();
 
     // Must have data for indices, points, and normals
     if( indices == nullptr || points == nullptr || normals == nullptr )
         return;
 
-    nVerts = (GLuint)indices->size();
+    nVerts = (GLuint)nIndices;
+    hasTexCoords = texCoords != nullptr;
+    lods.assign(1, LodLevel{ 0, nVerts, 0.0f });
+    positionOffset = glm::vec3(0.0f);
+    positionScale = glm::vec3(1.0f);
+
+    if( arena != nullptr ) {
+        initInArena(indices, nIndices, points, normals, nVertices, texCoords, tangents);
+        return;
+    }
 
-    GLuint indexBuf = 0, posBuf = 0, normBuf = 0, tcBuf = 0, tangentBuf = 0;
+    GLuint indexBuf = 0;
     glGenBuffers(1, &indexBuf);
     buffers.push_back(indexBuf);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuf);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices->size() * sizeof(GLuint), indices->data(), GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, nIndices * sizeof(GLuint), indices, GL_STATIC_DRAW);
+
+    glGenVertexArrays( 1, &vao );
+    glBindVertexArray(vao);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuf);
+
+    if( format.interleaved )
+        initInterleaved(points, normals, nVertices, texCoords, tangents);
+    else
+        initSeparate(points, normals, nVertices, texCoords, tangents);
+
+    glBindVertexArray(0);
+}
+
+void TriangleMesh::initSeparate(
+        const GLfloat * points, const GLfloat * normals, size_t nVertices,
+        const GLfloat * texCoords, const GLfloat * tangents
+) {
+    GLuint posBuf = 0, normBuf = 0, tcBuf = 0, tangentBuf = 0;
 
     glGenBuffers(1, &posBuf);
     buffers.push_back(posBuf);
     glBindBuffer(GL_ARRAY_BUFFER, posBuf);
-    glBufferData(GL_ARRAY_BUFFER, points->size() * sizeof(GLfloat), points->data(), GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, nVertices * 3 * sizeof(GLfloat), points, GL_STATIC_DRAW);
 
     glGenBuffers(1, &normBuf);
     buffers.push_back(normBuf);
     glBindBuffer(GL_ARRAY_BUFFER, normBuf);
-    glBufferData(GL_ARRAY_BUFFER, normals->size() * sizeof(GLfloat), normals->data(), GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, nVertices * 3 * sizeof(GLfloat), normals, GL_STATIC_DRAW);
 
     if( texCoords != nullptr ) {
         glGenBuffers(1, &tcBuf);
         buffers.push_back(tcBuf);
         glBindBuffer(GL_ARRAY_BUFFER, tcBuf);
-        glBufferData(GL_ARRAY_BUFFER, texCoords->size() * sizeof(GLfloat), texCoords->data(), GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, nVertices * 2 * sizeof(GLfloat), texCoords, GL_STATIC_DRAW);
     }
 
     if( tangents != nullptr ) {
         glGenBuffers(1, &tangentBuf);
         buffers.push_back(tangentBuf);
         glBindBuffer(GL_ARRAY_BUFFER, tangentBuf);
-        glBufferData(GL_ARRAY_BUFFER, tangents->size() * sizeof(GLfloat), tangents->data(), GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, nVertices * 4 * sizeof(GLfloat), tangents, GL_STATIC_DRAW);
     }
 
-    glGenVertexArrays( 1, &vao );
-    glBindVertexArray(vao);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuf);
+    vertexBytes = nVertices * (3 + 3 + (texCoords ? 2 : 0) + (tangents ? 4 : 0)) * sizeof(GLfloat);
 
     // Position
     glBindBuffer(GL_ARRAY_BUFFER, posBuf);
@@ -73,23 +212,225 @@ void TriangleMesh::initBuffers(
         glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, 0, 0);
         glEnableVertexAttribArray(3);  // Tangents
     }
+}
 
-    glBindVertexArray(0);
+TriangleMesh::InterleavedLayout TriangleMesh::interleavedLayout(bool texCoords, bool tangents) const {
+    // Attribute offsets within a vertex; everything stays 4-byte aligned
+    InterleavedLayout l;
+    l.texCoords = texCoords;
+    l.tangents = tangents;
+    l.posOffset = 0;
+    l.normOffset = l.posOffset + (format.quantizePositions ? 4 * sizeof(GLshort) : 3 * sizeof(GLfloat));
+    l.tcOffset = l.normOffset + (format.packNormals ? sizeof(GLuint) : 3 * sizeof(GLfloat));
+    l.tangentOffset = l.tcOffset + (!texCoords ? 0 : format.halfTexCoords ? 2 * sizeof(GLushort) : 2 * sizeof(GLfloat));
+    l.stride = l.tangentOffset + (!tangents ? 0 : format.packNormals ? sizeof(GLuint) : 4 * sizeof(GLfloat));
+    return l;
+}
+
+void TriangleMesh::computePositionTransform(const GLfloat * points, size_t nVertices) {
+    if( !format.quantizePositions || nVertices == 0 ) return;
+
+    glm::vec3 lo(points[0], points[1], points[2]), hi = lo;
+    for( size_t v = 0; v < nVertices; v++ ) {
+        glm::vec3 p(points[3*v], points[3*v+1], points[3*v+2]);
+        lo = glm::min(lo, p);
+        hi = glm::max(hi, p);
+    }
+    positionOffset = 0.5f * (lo + hi);
+    positionScale = 0.5f * (hi - lo);
+    for( int i = 0; i < 3; i++ )
+        if( positionScale[i] <= 0.0f ) positionScale[i] = 1.0f;
+}
+
+// The vertices are written in parallel chunks straight into the mapped
+// buffer; workers only touch memory, never GL
+void TriangleMesh::fillInterleaved(
+        const InterleavedLayout & l, unsigned char * data, const GLfloat * points,
+        const GLfloat * normals, size_t nVertices, const GLfloat * texCoords,
+        const GLfloat * tangents
+) const {
+    const size_t CHUNK_VERTICES = 16384;
+    size_t chunks = (nVertices + CHUNK_VERTICES - 1) / CHUNK_VERTICES;
+    ThreadPool * pool = uploadPool != nullptr ? uploadPool : &ThreadPool::shared();
+    pool->parallelFor(chunks, [&](size_t c) {
+        size_t end = std::min(nVertices, (c + 1) * CHUNK_VERTICES);
+        for( size_t v = c * CHUNK_VERTICES; v < end; v++ ) {
+            unsigned char * dst = data + v * l.stride;
+
+            if( format.quantizePositions ) {
+                GLshort q[4] = { 0, 0, 0, 0 };
+                for( int i = 0; i < 3; i++ )
+                    q[i] = (GLshort)packSnorm((points[3*v+i] - positionOffset[i]) / positionScale[i], 16);
+                memcpy(dst + l.posOffset, q, sizeof(q));
+            } else {
+                memcpy(dst + l.posOffset, points + 3*v, 3 * sizeof(GLfloat));
+            }
+
+            if( format.packNormals ) {
+                GLuint n = packSnorm1010102(normals[3*v], normals[3*v+1], normals[3*v+2], 0.0f);
+                memcpy(dst + l.normOffset, &n, sizeof(n));
+            } else {
+                memcpy(dst + l.normOffset, normals + 3*v, 3 * sizeof(GLfloat));
+            }
+
+            if( texCoords != nullptr ) {
+                if( format.halfTexCoords ) {
+                    GLushort tc[2] = { floatToHalf(texCoords[2*v]), floatToHalf(texCoords[2*v+1]) };
+                    memcpy(dst + l.tcOffset, tc, sizeof(tc));
+                } else {
+                    memcpy(dst + l.tcOffset, texCoords + 2*v, 2 * sizeof(GLfloat));
+                }
+            }
+
+            if( tangents != nullptr ) {
+                if( format.packNormals ) {
+                    GLuint t = packSnorm1010102(tangents[4*v], tangents[4*v+1], tangents[4*v+2], tangents[4*v+3]);
+                    memcpy(dst + l.tangentOffset, &t, sizeof(t));
+                } else {
+                    memcpy(dst + l.tangentOffset, tangents + 4*v, 4 * sizeof(GLfloat));
+                }
+            }
+        }
+    });
+}
+
+void TriangleMesh::setInterleavedAttributes(const InterleavedLayout & l, GLuint vertexBuf) const {
+    // Separate attribute formats (GL 4.3) where available, so the buffer is
+    // bound once; plain attribute pointers otherwise (e.g. GL 4.1 on macOS)
+    bool attribFormat = GLAD_GL_VERSION_4_3 != 0;
+    if( attribFormat ) glBindVertexBuffer(0, vertexBuf, 0, (GLsizei)l.stride);
+    else glBindBuffer(GL_ARRAY_BUFFER, vertexBuf);
+    auto attrib = [&](GLuint location, GLint size, GLenum type, GLboolean normalized, size_t offset) {
+        if( attribFormat ) {
+            glVertexAttribFormat(location, size, type, normalized, (GLuint)offset);
+            glVertexAttribBinding(location, 0);
+        } else {
+            glVertexAttribPointer(location, size, type, normalized, (GLsizei)l.stride, (const void *)offset);
+        }
+        glEnableVertexAttribArray(location);
+    };
+
+    if( format.quantizePositions ) attrib(0, 3, GL_SHORT, GL_TRUE, l.posOffset);
+    else attrib(0, 3, GL_FLOAT, GL_FALSE, l.posOffset);
+
+    if( format.packNormals ) attrib(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, l.normOffset);
+    else attrib(1, 3, GL_FLOAT, GL_FALSE, l.normOffset);
+
+    if( l.texCoords ) {
+        if( format.halfTexCoords ) attrib(2, 2, GL_HALF_FLOAT, GL_FALSE, l.tcOffset);
+        else attrib(2, 2, GL_FLOAT, GL_FALSE, l.tcOffset);
+    }
+
+    if( l.tangents ) {
+        if( format.packNormals ) attrib(3, 4, GL_INT_2_10_10_10_REV, GL_TRUE, l.tangentOffset);
+        else attrib(3, 4, GL_FLOAT, GL_FALSE, l.tangentOffset);
+    }
+}
+
+void TriangleMesh::initInterleaved(
+        const GLfloat * points, const GLfloat * normals, size_t nVertices,
+        const GLfloat * texCoords, const GLfloat * tangents
+) {
+    InterleavedLayout layout = interleavedLayout(texCoords != nullptr, tangents != nullptr);
+    computePositionTransform(points, nVertices);
+
+    size_t bytes = layout.stride * nVertices;
+    GLuint vertexBuf = 0;
+    glGenBuffers(1, &vertexBuf);
+    buffers.push_back(vertexBuf);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBuf);
+    glBufferData(GL_ARRAY_BUFFER, bytes, NULL, GL_STATIC_DRAW);
+    void * mapped = bytes > 0 ? glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT) : nullptr;
+    if( mapped != nullptr ) fillInterleaved(layout, (unsigned char *)mapped, points, normals, nVertices, texCoords, tangents);
+    // An unmap can fail if the memory was lost meanwhile; go through a copy then
+    if( mapped == nullptr || glUnmapBuffer(GL_ARRAY_BUFFER) == GL_FALSE ) {
+        std::vector<unsigned char> data(bytes);
+        fillInterleaved(layout, data.data(), points, normals, nVertices, texCoords, tangents);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, data.data());
+    }
+    vertexBytes = bytes;
+
+    setInterleavedAttributes(layout, vertexBuf);
+}
+
+void TriangleMesh::initInArena(
+        const GLuint * indices, size_t nIndices,
+        const GLfloat * points, const GLfloat * normals, size_t nVertices,
+        const GLfloat * texCoords, const GLfloat * tangents
+) {
+    InterleavedLayout layout = interleavedLayout(texCoords != nullptr, tangents != nullptr);
+    computePositionTransform(points, nVertices);
+
+    // Meshes share a block when their vertices look the same
+    GLuint key = (format.quantizePositions ? 1u : 0u) | (format.packNormals ? 2u : 0u) |
+                 (format.halfTexCoords ? 4u : 0u) | (layout.texCoords ? 8u : 0u) | (layout.tangents ? 16u : 0u);
+    arenaRange = arena->allocate(key, (GLsizei)layout.stride, nVertices, nIndices, [&](GLuint vertexBuf) {
+        setInterleavedAttributes(layout, vertexBuf);
+    });
+    vao = arena->getVao(arenaRange.block);
+    baseVertex = (GLint)arenaRange.firstVertex;
+    firstIndex = arenaRange.firstIndex;
+    buffers.push_back(arena->getIndexBuffer(arenaRange.block));
+    buffers.push_back(arena->getVertexBuffer(arenaRange.block));
+
+    // Through the copy target: binding the element buffer would change the
+    // VAO that is bound
+    glBindBuffer(GL_COPY_WRITE_BUFFER, arena->getIndexBuffer(arenaRange.block));
+    glBufferSubData(GL_COPY_WRITE_BUFFER, firstIndex * sizeof(GLuint), nIndices * sizeof(GLuint), indices);
+
+    size_t bytes = layout.stride * nVertices;
+    glBindBuffer(GL_COPY_WRITE_BUFFER, arena->getVertexBuffer(arenaRange.block));
+    void * mapped = bytes > 0 ? glMapBufferRange(GL_COPY_WRITE_BUFFER, baseVertex * layout.stride, bytes,
+                                                 GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT) : nullptr;
+    if( mapped != nullptr ) fillInterleaved(layout, (unsigned char *)mapped, points, normals, nVertices, texCoords, tangents);
+    if( mapped == nullptr || glUnmapBuffer(GL_COPY_WRITE_BUFFER) == GL_FALSE ) {
+        std::vector<unsigned char> data(bytes);
+        fillInterleaved(layout, data.data(), points, normals, nVertices, texCoords, tangents);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, baseVertex * layout.stride, bytes, data.data());
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    vertexBytes = bytes;
 }
 
 void TriangleMesh::render() const {
-    if(vao == 0) return;
+    render(0);
+}
+
+void TriangleMesh::render(int lodLevel) const {
+    if(vao == 0 || lods.empty()) return;
 
+    const LodLevel & lod = lods[std::min(std::max(lodLevel, 0), (int)lods.size() - 1)];
     glBindVertexArray(vao);
-    glDrawElements(GL_TRIANGLES, nVerts, GL_UNSIGNED_INT, 0);
+    glDrawElementsBaseVertex(primitive, lod.nIndices, GL_UNSIGNED_INT,
+                             (const GLvoid *)((firstIndex + lod.firstIndex) * sizeof(GLuint)), baseVertex);
     glBindVertexArray(0);
 }
 
+DrawElementsIndirectCommand TriangleMesh::getDrawCommand(int lodLevel, GLuint instances, GLuint baseInstance) const {
+    DrawElementsIndirectCommand cmd = { 0, instances, firstIndex, baseVertex, baseInstance };
+    if( lods.empty() ) return cmd;
+    const LodLevel & lod = lods[std::min(std::max(lodLevel, 0), (int)lods.size() - 1)];
+    cmd.count = lod.nIndices;
+    cmd.firstIndex += lod.firstIndex;
+    return cmd;
+}
+
 TriangleMesh::~TriangleMesh() {
     deleteBuffers();
 }
 
 void TriangleMesh::deleteBuffers() {
+    hasTexCoords = false;
+    if( arenaRange.block >= 0 ) {
+        // The buffers and the VAO stay with the arena
+        arena->release(arenaRange);
+        buffers.clear();
+        vao = 0;
+        baseVertex = 0;
+        firstIndex = 0;
+        return;
+    }
+
     if( buffers.size() > 0 ) {
         glDeleteBuffers( (GLsizei)buffers.size(), buffers.data() );
         buffers.clear();
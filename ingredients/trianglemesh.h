@@ -1,9 +1,41 @@
 #pragma once
 
 #include <vector>
+#include <glm/glm.hpp>
 
 #include "cookbookogl.h"
 #include "drawable.h"
+#include "mesharena.h"
+#include "meshsimplifier.h"
+
+class ThreadPool;
+
+// Vertex layout used by TriangleMesh::initBuffers. The default is one float
+// buffer per attribute; the packed formats need interleaved.
+struct VertexFormat {
+    bool interleaved;        // a single buffer with the attributes of a vertex side by side
+    bool packNormals;        // normals and tangents as GL_INT_2_10_10_10_REV
+    bool halfTexCoords;      // texture coordinates as half floats
+    bool quantizePositions;  // positions as 16-bit snorm within the mesh's AABB, see
+                             // TriangleMesh::getPositionTransform()
+
+    VertexFormat() : interleaved(false), packNormals(false), halfTexCoords(false), quantizePositions(false) { }
+
+    // Interleaved with packed normals/tangents and half float texcoords
+    static VertexFormat compact(bool quantizePositions = false) {
+        VertexFormat f;
+        f.interleaved = f.packNormals = f.halfTexCoords = true;
+        f.quantizePositions = quantizePositions;
+        return f;
+    }
+};
+
+// Reordering applied to indexed meshes before upload, see MeshOptimizer
+enum class MeshOptimization {
+    NONE,
+    VERTEX_CACHE,                   // vertex cache order and vertex fetch remap
+    VERTEX_CACHE_AND_OVERDRAW       // additionally outward facing clusters first
+};
 
 class TriangleMesh : public Drawable {
 
@@ -12,9 +44,33 @@ protected:
     GLuint nVerts;     // Number of vertices
     GLuint vao;        // The Vertex Array Object
 
-    // Vertex buffers
+    // Vertex buffers: the index buffer, then one per attribute or a single
+    // interleaved one
     std::vector<GLuint> buffers;
 
+    VertexFormat format;
+    size_t vertexBytes;                 // size of the vertex data on the GPU
+    glm::vec3 positionOffset, positionScale;
+
+    GLenum primitive;                   // GL_TRIANGLES, or with adjacency
+    bool hasTexCoords;                  // uploaded by the last initBuffers
+    std::vector<LodLevel> lods;         // lods[0] is the full mesh
+
+    // With an arena the buffers and the VAO are the arena's, shared with
+    // other meshes, and the mesh starts at baseVertex and firstIndex
+    MeshArena * arena;
+    MeshArena::Range arenaRange;
+    GLint baseVertex;
+    GLuint firstIndex;
+
+    // Pool the interleaved vertices are written on (the shared pool if
+    // null); constructors that take a pool set it before initBuffers
+    ThreadPool * uploadPool;
+
+    TriangleMesh();
+
+    // Reorders the caller's vectors in place as set by setMeshOptimization()
+    // (not at all by default), then builds the LOD chain and uploads them
     virtual void initBuffers(
             std::vector<GLuint> * indices,
             std::vector<GLfloat> * points,
@@ -23,15 +79,100 @@ protected:
             std::vector<GLfloat> * tangents = nullptr
             );
 
+    // Same from plain arrays (e.g. a mapped file): nIndices indices and
+    // nVertices vertices for every attribute given. Unlike the overload above
+    // this uploads the arrays as they are, without optimization or LODs;
+    // call setLodLevels() after it if the indices hold a LOD chain.
+    void initBuffers(
+            const GLuint * indices, size_t nIndices,
+            const GLfloat * points, const GLfloat * normals, size_t nVertices,
+            const GLfloat * texCoords = nullptr,
+            const GLfloat * tangents = nullptr
+            );
+
+    void setLodLevels(const std::vector<LodLevel> & levels);
+
     virtual void deleteBuffers();
 
+private:
+    // Byte offsets of the attributes of an interleaved vertex
+    struct InterleavedLayout {
+        size_t posOffset, normOffset, tcOffset, tangentOffset, stride;
+        bool texCoords, tangents;
+    };
+
+    void initSeparate(const GLfloat * points, const GLfloat * normals, size_t nVertices,
+                      const GLfloat * texCoords, const GLfloat * tangents);
+    void initInterleaved(const GLfloat * points, const GLfloat * normals, size_t nVertices,
+                         const GLfloat * texCoords, const GLfloat * tangents);
+    void initInArena(const GLuint * indices, size_t nIndices,
+                     const GLfloat * points, const GLfloat * normals, size_t nVertices,
+                     const GLfloat * texCoords, const GLfloat * tangents);
+
+    InterleavedLayout interleavedLayout(bool texCoords, bool tangents) const;
+    void computePositionTransform(const GLfloat * points, size_t nVertices);
+    void fillInterleaved(const InterleavedLayout & layout, unsigned char * data, const GLfloat * points,
+                         const GLfloat * normals, size_t nVertices, const GLfloat * texCoords,
+                         const GLfloat * tangents) const;
+    // Attribute setup for the bound VAO, reading the vertex buffer from offset 0
+    void setInterleavedAttributes(const InterleavedLayout & layout, GLuint vertexBuffer) const;
+
 public:
     virtual ~TriangleMesh();
     virtual void render() const;
     GLuint getVao() const { return vao; }
+    GLenum getPrimitive() const { return primitive; }
+
+    // Draw one level of detail, clamped to the levels there are
+    void render(int lodLevel) const;
+    // The same draw as an indirect command, e.g. for MeshBatch
+    DrawElementsIndirectCommand getDrawCommand(int lodLevel = 0, GLuint instances = 1, GLuint baseInstance = 0) const;
+    int getLodCount() const { return (int)lods.size(); }
+    const LodLevel & getLod(int lodLevel) const { return lods[lodLevel]; }
+
+    // The coarsest level whose error covers at most maxPixelError pixels,
+    // given how many pixels one object space unit covers at the mesh
+    int selectLod(float pixelsPerUnit, float maxPixelError = 1.0f) const;
+    // Pixels per unit at distance from a perspective camera
+    static float pixelsPerUnit(float distance, float fovy, int viewportHeight);
+
+    // Fractions of the triangle count to build LODs for in meshes created
+    // after this call, starting with 1.0. The default is { 1.0 }, no LODs.
+    static void setDefaultLodRatios(const std::vector<float> & ratios);
+    static const std::vector<float> & getDefaultLodRatios();
+
+    // Format used by meshes created after this call
+    static void setDefaultVertexFormat(const VertexFormat & f);
+    static const VertexFormat & getDefaultVertexFormat();
+
+    // Reordering done by initBuffers for meshes created after this call.
+    // The default is NONE; ObjMesh has a setting of its own.
+    static void setMeshOptimization(MeshOptimization o);
+    static MeshOptimization getMeshOptimization();
+
+    // Meshes created after this call are suballocated from arena (nullptr,
+    // the default, gives every mesh its own buffers and VAO). They are always
+    // interleaved, with the packing of the default format. The arena must
+    // outlive the meshes.
+    static void setDefaultArena(MeshArena * arena);
+    static MeshArena * getDefaultArena();
+    MeshArena * getArena() const { return arenaRange.block >= 0 ? arena : nullptr; }
+    // Where the mesh starts in its buffers, 0 without an arena
+    GLint getBaseVertex() const { return baseVertex; }
+    GLuint getFirstIndex() const { return firstIndex; }
+
+    const VertexFormat & getVertexFormat() const { return format; }
+    size_t getVertexBytes() const { return vertexBytes; }
+    // Maps the stored positions to object space. Identity unless positions
+    // are quantized; multiply it into the model matrix then.
+    glm::mat4 getPositionTransform() const;
+
+    // In an arena these are the arena's buffers, see getBaseVertex()
     GLuint getElementBuffer() { return buffers[0]; }
+    // With an interleaved format these all return the one vertex buffer
     GLuint getPositionBuffer() { return buffers[1]; }
-    GLuint getNormalBuffer() { return buffers[2]; }
-    GLuint getTcBuffer() { if( buffers.size() > 3) return buffers[3]; else return 0; }
+    GLuint getNormalBuffer() { return format.interleaved ? buffers[1] : buffers[2]; }
+    // 0 when the mesh has no texture coordinates
+    GLuint getTcBuffer() { if( !hasTexCoords ) return 0; return format.interleaved ? buffers[1] : buffers[3]; }
     GLuint getNumVerts() { return nVerts; }
 };
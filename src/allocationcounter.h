@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstddef>
+
+// Calls of the global operator new (and so of every std container
+// allocation) since the program started, on all threads. Counted by
+// replacement operators in allocationcounter.cpp.
+size_t heapAllocationCount();
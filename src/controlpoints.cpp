@@ -0,0 +1,119 @@
+#include "controlpoints.h"
+
+#include <cstdio>
+
+namespace {
+    // Cube corners (w = 0), then the point itself as the tip of du (w = 1)
+    // and of dv (w = 2); the shader moves the tips along the derivatives
+    const GLfloat TEMPLATE[] = {
+        -1, -1, -1, 0,   1, -1, -1, 0,   1,  1, -1, 0,  -1,  1, -1, 0,
+        -1, -1,  1, 0,   1, -1,  1, 0,   1,  1,  1, 0,  -1,  1,  1, 0,
+         0,  0,  0, 0,   0,  0,  0, 1,   0,  0,  0, 2
+    };
+    // The 12 cube edges, then the two lines from the point to the tips.
+    // Points only draws the edges.
+    const GLuint LINES[] = {
+        0, 1,  1, 2,  2, 3,  3, 0,
+        4, 5,  5, 6,  6, 7,  7, 4,
+        0, 4,  1, 5,  2, 6,  3, 7,
+        8, 9,  8, 10
+    };
+    const GLsizei EDGE_INDICES = 24;
+    const GLsizei ALL_INDICES = sizeof(LINES) / sizeof(LINES[0]);
+}
+
+ControlPointView::ControlPointView() :
+    program(0), vao(0), vertexBuffer(0), indexBuffer(0), patchTexture(0),
+    mvpLoc(-1), gridSizeLoc(-1), markerSizeLoc(-1), vectorScaleLoc(-1), maxTexels(0), warnedTruncated(false),
+    markerSize(2.0f), vectorScale(0.4f)
+{ }
+
+ControlPointView::~ControlPointView() {
+    destroy();
+}
+
+void ControlPointView::init(GLuint prog) {
+    destroy();
+    program = prog;
+
+    // Looked up once; the old per-point loop asked for them every draw
+    mvpLoc = glGetUniformLocation(program, "MVP");
+    gridSizeLoc = glGetUniformLocation(program, "GridSize");
+    markerSizeLoc = glGetUniformLocation(program, "MarkerSize");
+    vectorScaleLoc = glGetUniformLocation(program, "VectorScale");
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "Patches"), TEXTURE_UNIT);
+    glUseProgram(0);
+
+    GLuint buffers[2];
+    glGenBuffers(2, buffers);
+    vertexBuffer = buffers[0];
+    indexBuffer = buffers[1];
+
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(TEMPLATE), TEMPLATE, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(LINES), LINES, GL_STATIC_DRAW);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glGenTextures(1, &patchTexture);
+    // Only 65536 texels (about 5400 patches) are guaranteed
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+    warnedTruncated = false;
+}
+
+void ControlPointView::destroy() {
+    if( program != 0 ) glDeleteProgram(program);
+    if( vao != 0 ) glDeleteVertexArrays(1, &vao);
+    if( vertexBuffer != 0 ) {
+        GLuint buffers[2] = { vertexBuffer, indexBuffer };
+        glDeleteBuffers(2, buffers);
+    }
+    if( patchTexture != 0 ) glDeleteTextures(1, &patchTexture);
+    program = vao = vertexBuffer = indexBuffer = patchTexture = 0;
+}
+
+void ControlPointView::render(Mode mode, GLuint patchBuffer, GLsizei patchCount, int gridM, int gridN,
+                              const glm::mat4 & mvp) {
+    if( mode == OFF || program == 0 || patchCount <= 0 ) return;
+
+    bool grid = gridM > 1 && gridN > 1 && (GLsizei)(gridM - 1) * (gridN - 1) == patchCount;
+    GLsizei instances = grid ? gridM * gridN : patchCount * 4;
+
+    // Fetches past the buffer texture size read zero and would pile the
+    // markers up at the origin: draw the points of the patches that fit,
+    // whole rows of them on a grid
+    GLsizei fitPatches = (GLsizei)(maxTexels / 12);
+    if( patchCount > fitPatches ) {
+        instances = grid ? fitPatches / (gridN - 1) * gridN : fitPatches * 4;
+        if( !warnedTruncated ) {
+            fprintf(stderr, "Control points: %d patches, a buffer texture holds %d; showing %d points\n",
+                    (int)patchCount, (int)fitPatches, (int)instances);
+            warnedTruncated = true;
+        }
+        if( instances <= 0 ) return;
+    }
+
+    // Rebinding is cheap and follows the frame ring to this frame's buffer
+    glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, patchTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGB32F, patchBuffer);
+
+    glUseProgram(program);
+    glUniformMatrix4fv(mvpLoc, 1, GL_FALSE, &mvp[0][0]);
+    glUniform2i(gridSizeLoc, grid ? gridM : 0, grid ? gridN : 0);
+    glUniform1f(markerSizeLoc, markerSize);
+    glUniform1f(vectorScaleLoc, vectorScale);
+
+    glBindVertexArray(vao);
+    glDrawElementsInstanced(GL_LINES, mode == POINTS ? EDGE_INDICES : ALL_INDICES, GL_UNSIGNED_INT, 0, instances);
+    glBindVertexArray(0);
+
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glActiveTexture(GL_TEXTURE0);
+}
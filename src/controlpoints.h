@@ -0,0 +1,52 @@
+#pragma once
+
+#include "cookbookogl.h"
+
+#include <glm/glm.hpp>
+
+// Debug view of the control points: a small wireframe cube on every point
+// and, optionally, its du and dv as lines. Everything comes from one
+// glDrawElementsInstanced, one instance per point, with the points read in
+// the vertex shader straight from the patch buffer the water draws from
+// (through a buffer texture), so nothing is copied or rebuilt per frame and
+// the cost does not depend on how the grid was made.
+class ControlPointView {
+public:
+    enum Mode { OFF, POINTS, POINTS_AND_DERIVATIVES, MODE_COUNT };
+
+    // The patch buffer is sampled from this texture unit
+    static const GLuint TEXTURE_UNIT = 5;
+
+    ControlPointView();
+    ~ControlPointView();
+
+    // program is linked from shader/controlPointVertex.glsl and
+    // shader/controlPointFragment.glsl; the view takes it over
+    void init(GLuint program);
+    void destroy();
+    bool isInitialized() const { return program != 0; }
+
+    // Half the cube side, and the factor the derivatives are drawn at
+    void setMarkerSize(float size) { markerSize = size; }
+    void setVectorScale(float scale) { vectorScale = scale; }
+
+    // patchBuffer holds patchCount patches of 12 vec3. When they form one
+    // gridM x gridN grid each point is drawn once; pass 0, 0 otherwise
+    // (streamed tiles) and every patch draws its four corners. Only the
+    // patches within GL_MAX_TEXTURE_BUFFER_SIZE are shown, with a warning
+    // the first time some are left out.
+    void render(Mode mode, GLuint patchBuffer, GLsizei patchCount, int gridM, int gridN, const glm::mat4 & mvp);
+
+private:
+    GLuint program;
+    GLuint vao, vertexBuffer, indexBuffer;
+    GLuint patchTexture;
+    GLint mvpLoc, gridSizeLoc, markerSizeLoc, vectorScaleLoc;
+    GLint maxTexels;                // GL_MAX_TEXTURE_BUFFER_SIZE
+    bool warnedTruncated;
+    float markerSize, vectorScale;
+
+    // Non-copyable: owns GL objects.
+    ControlPointView(const ControlPointView &) = delete;
+    ControlPointView & operator=(const ControlPointView &) = delete;
+};
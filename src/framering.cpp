@@ -0,0 +1,130 @@
+#include "framering.h"
+
+#include <cstdio>
+
+#include <chrono>
+#include <cstring>
+
+FrameRing::FrameRing() : current(0), patchBytes(0), uniformBytes(0) {
+    memset(slots, 0, sizeof(slots));
+}
+
+FrameRing::~FrameRing() {
+    destroy();
+}
+
+void FrameRing::init(GLsizeiptr pBytes, GLsizeiptr uBytes) {
+    destroy();
+
+    patchBytes = pBytes;
+    uniformBytes = uBytes;
+
+    for( int i = 0; i < FRAMES_IN_FLIGHT; i++ ) {
+        Slot & s = slots[i];
+
+        glGenBuffers(1, &s.patchBuf);
+        glBindBuffer(GL_ARRAY_BUFFER, s.patchBuf);
+        glBufferData(GL_ARRAY_BUFFER, patchBytes, NULL, GL_STREAM_DRAW);
+
+        glGenBuffers(1, &s.uniformBuf);
+        glBindBuffer(GL_UNIFORM_BUFFER, s.uniformBuf);
+        glBufferData(GL_UNIFORM_BUFFER, uniformBytes, NULL, GL_STREAM_DRAW);
+
+        glGenVertexArrays(1, &s.vao);
+        glBindVertexArray(s.vao);
+        glBindBuffer(GL_ARRAY_BUFFER, s.patchBuf);
+        glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, 0, 0 );
+        glEnableVertexAttribArray(0);
+        glBindVertexArray(0);
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    current = 0;
+    resetWaitStats();
+}
+
+void FrameRing::destroy() {
+    for( int i = 0; i < FRAMES_IN_FLIGHT; i++ ) {
+        Slot & s = slots[i];
+        if( s.fence != 0 ) glDeleteSync(s.fence);
+        if( s.vao != 0 ) glDeleteVertexArrays(1, &s.vao);
+        if( s.patchBuf != 0 ) glDeleteBuffers(1, &s.patchBuf);
+        if( s.uniformBuf != 0 ) glDeleteBuffers(1, &s.uniformBuf);
+        s.fence = 0;
+        s.vao = s.patchBuf = s.uniformBuf = 0;
+    }
+}
+
+int FrameRing::begin() {
+    Slot & s = slots[current];
+    if( s.fence == 0 ) return current;
+
+    auto start = std::chrono::steady_clock::now();
+
+    // Poll first; only flush and block if the GPU is still busy with this slot.
+    GLenum status = glClientWaitSync(s.fence, 0, 0);
+    while( status == GL_TIMEOUT_EXPIRED ) {
+        status = glClientWaitSync(s.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000); // 1 ms
+    }
+    if( status == GL_WAIT_FAILED ) {
+        fprintf(stderr, "glClientWaitSync failed on frame slot %d\n", current);
+    }
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    s.waitMs += ms;
+    if( ms > s.maxWaitMs ) s.maxWaitMs = ms;
+    s.waits++;
+
+    glDeleteSync(s.fence);
+    s.fence = 0;
+
+    return current;
+}
+
+void FrameRing::end() {
+    Slot & s = slots[current];
+    s.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    current = (current + 1) % FRAMES_IN_FLIGHT;
+}
+
+void * FrameRing::mapPatches() {
+    glBindBuffer(GL_ARRAY_BUFFER, slots[current].patchBuf);
+    return glMapBufferRange(GL_ARRAY_BUFFER, 0, patchBytes,
+                            GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+}
+
+void FrameRing::unmapPatches() {
+    glBindBuffer(GL_ARRAY_BUFFER, slots[current].patchBuf);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+}
+
+void FrameRing::writeUniforms(const void * data, GLsizeiptr size) {
+    glBindBuffer(GL_UNIFORM_BUFFER, slots[current].uniformBuf);
+    void * dst = glMapBufferRange(GL_UNIFORM_BUFFER, 0, size,
+                                  GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+    if( dst != nullptr ) {
+        memcpy(dst, data, size);
+        glUnmapBuffer(GL_UNIFORM_BUFFER);
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void FrameRing::bindUniforms(GLuint bindingPoint) const {
+    glBindBufferBase(GL_UNIFORM_BUFFER, bindingPoint, slots[current].uniformBuf);
+}
+
+double FrameRing::getAverageWaitMs(int slot) const {
+    const Slot & s = slots[slot];
+    return s.waits > 0 ? s.waitMs / s.waits : 0.0;
+}
+
+double FrameRing::getMaxWaitMs(int slot) const {
+    return slots[slot].maxWaitMs;
+}
+
+void FrameRing::resetWaitStats() {
+    for( int i = 0; i < FRAMES_IN_FLIGHT; i++ ) {
+        slots[i].waitMs = 0.0;
+        slots[i].maxWaitMs = 0.0;
+        slots[i].waits = 0;
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "cookbookogl.h"
+
+// Ring of per-frame GPU resources so that the CPU can record frame N+1 while
+// the GPU is still executing frame N. Every slot owns its own patch buffer,
+// uniform buffer and VAO, and is guarded by a fence that is inserted after the
+// slot's draw calls have been submitted.
+class FrameRing {
+public:
+    static const int FRAMES_IN_FLIGHT = 3;
+
+    FrameRing();
+    ~FrameRing();
+
+    // Allocate all slots. The VAO of each slot sources attribute 0 (vec3) from
+    // that slot's patch buffer.
+    void init(GLsizeiptr patchBytes, GLsizeiptr uniformBytes);
+    void destroy();
+
+    // Wait until the GPU has finished with the current slot and make it
+    // available for writing. Returns the slot index.
+    int begin();
+    // Insert the fence for the current slot and advance to the next one.
+    void end();
+
+    // Unsynchronized maps: safe because begin() already waited on the fence.
+    void * mapPatches();
+    void unmapPatches();
+    void writeUniforms(const void * data, GLsizeiptr size);
+
+    void bindUniforms(GLuint bindingPoint) const;
+    GLuint getVao() const { return slots[current].vao; }
+    GLuint getPatchBuffer() const { return slots[current].patchBuf; }
+    GLsizeiptr getPatchBytes() const { return patchBytes; }
+
+    // Fence wait instrumentation, accumulated since the last reset.
+    double getAverageWaitMs(int slot) const;
+    double getMaxWaitMs(int slot) const;
+    void resetWaitStats();
+
+private:
+    struct Slot {
+        GLuint patchBuf;
+        GLuint uniformBuf;
+        GLuint vao;
+        GLsync fence;
+
+        double waitMs;
+        double maxWaitMs;
+        int waits;
+    };
+
+    Slot slots[FRAMES_IN_FLIGHT];
+    int current;
+    GLsizeiptr patchBytes;
+    GLsizeiptr uniformBytes;
+
+    // Non-copyable: owns GL objects.
+    FrameRing(const FrameRing &) = delete;
+    FrameRing & operator=(const FrameRing &) = delete;
+};
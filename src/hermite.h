@@ -0,0 +1,17 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// CPU evaluation of the F-surface Hermite patches. The math lives in
+// shader/hermite.glsl, which the water TES includes as well, so both sides
+// evaluate exactly the same expressions.
+namespace hermite {
+    using glm::vec3;
+    using glm::vec4;
+    using glm::mat4;
+    using glm::dot;
+
+#define HERMITE_FN inline
+#include "shader/hermite.glsl"
+#undef HERMITE_FN
+}
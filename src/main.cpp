@@ -6,8 +6,24 @@
 #include <string>
 #include <vector>
 #include <math.h>
-
-#include "cube.h"
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+#include "allocationcounter.h"
+#include "controlpoints.h"
+#include "environmentmap.h"
+#include "framering.h"
+#include "hermite.h"
+#include "meshbench.h"
+#include "objmesh.h"
+#include "spscqueue.h"
+#include "skybox.h"
+#include "surface.h"
+#include "teapotpatch.h"
+#include "texture.h"
+#include "tilestream.h"
+#include "waterreflections.h"
 
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/constants.hpp>
@@ -20,10 +36,10 @@ using glm::mat4;
 using glm::mat3;
 using std::vector;
 
+// Input and camera state below is only touched by the main thread
 int tessLevel;
 
 GLuint program;
-GLuint pointProgram;
 
 vec3 cameraPos;
 vec3 lookAtPoint = vec3(0,0,0);
@@ -34,6 +50,7 @@ float camRotSpeed = 2.5f;
 float mouseXSpeed = 0.2f;
 float mouseYSpeed = 1.0f;
 
+// Frame timing, owned by the render thread
 int lastTime;
 int nFrames;
 
@@ -41,14 +58,97 @@ float tPrev, t, deltaT;
 
 bool gLeftPressed = false;
 bool centerModel = false;
-
-vec3 **controlPoints;
-vec3 **du, **dv;
+bool wireframe = false;
+int controlPoints = ControlPointView::OFF; // G cycles off, points, points with du/dv
+
+SurfaceGrid surface; // control points, generated or loaded from surfaceFile
+const char *surfaceFile = NULL;
+
+// HDR cube map (<skyBaseName>_posx.hdr ...) the water reflects; without it
+// the water only gets a flat ambient term
+const char *skyBaseName = NULL;
+
+// --reflections: planar reflection of the scene in the water, kept within
+// this many GPU ms by scaling its resolution. 0 turns it off.
+WaterReflections waterReflections;
+float reflectionBudgetMs = 0.0f;
+const float NEAR_PLANE = 1.0f;
+const float FAR_PLANE = 1000.0f;
+
+// Out-of-core height field streamed from tileFile instead of the surface grid
+TileStream tileStream;
+const char *tileFile = NULL;
+size_t tileBudgetMB = 256;
 int M = 50;
 int N = 50; // the dimensions of the control points matrix for a total of MxN control points
 
-GLuint buf = 0;
-GLuint vao = 0;
+// Per-frame patch and uniform buffers, fenced so CPU work on the next frame
+// overlaps GPU execution of the previous ones.
+FrameRing frameRing;
+// Number of frame slots that still hold stale patch data
+int patchUploadsPending = 0;
+bool cpuWaves = false;
+
+// std140 layout of the FrameData uniform block shared by the water shaders
+struct FrameUniforms {
+    mat4 MVP;
+    mat4 ModelViewMatrix;
+    mat4 ViewportMatrix;
+    vec4 NormalMatrix[3]; // mat3 columns are padded to vec4
+    float time;
+    int TessLevel;
+    int FixedTessLevel;   // > 0 overrides the distance based levels in the TCS
+    float pad;
+};
+const GLuint FRAME_DATA_BINDING = 0;
+
+// Camera and settings state owned by the main thread (input + simulation).
+// The render thread only ever sees snapshots of it.
+struct RenderSettings {
+    vec3 cameraPos;
+    vec3 lookAtPoint;
+    int tessLevel;
+    bool centerModel;
+    bool cpuWaves;
+    bool wireframe;
+    int controlPoints;
+    int width, height;
+};
+
+// Statistics published by the render thread for the window title
+struct FrameStats {
+    double fps;
+    double fenceAvgMs[FrameRing::FRAMES_IN_FLIGHT];
+    double fenceMaxMs[FrameRing::FRAMES_IN_FLIGHT];
+    bool tiled;
+    TileStream::Metrics tiles;
+    bool reflecting;
+    float reflectionScale;
+    double reflectionMs;
+};
+
+SpscQueue<RenderSettings, 16> settingsQueue; // main -> render
+SpscQueue<FrameStats, 4> statsQueue;         // render -> main
+std::atomic<bool> renderRunning(true);
+
+// --bench-tes: GPU time of the water pass at a fixed tessellation level, with
+// the matrix form TES against the old scalar one
+int benchTesFrames = 0;
+const int BENCH_TES_LEVEL = 16;
+const int BENCH_TES_WARMUP = 30;
+
+// --bench-vertex, --bench-optimize, --bench-lod, --bench-meshlets,
+// --bench-generation, --bench-static, --bench-arena, --bench-teapot, --bench-textures: benchmarks that only need a context, run on the main thread
+void (*benchMesh)(const char *objFile) = NULL;
+const char *benchObjFile = NULL;
+
+struct TessBenchmark {
+    GLuint programs[2];     // matrix form, scalar
+    GLuint queries[2];      // GL_TIME_ELAPSED, GL_PRIMITIVES_GENERATED
+    double gpuMs[2];
+    GLuint64 primitives[2];
+    int frame;
+};
 
 void readShader(const char* fname, char *source)
 {
@@ -68,6 +168,23 @@ void readShader(const char* fname, char *source)
 	}
 }
 
+// Insert the shared source fname right after the #version line of source
+void includeShader(char *source, const char *fname)
+{
+	char *include = (char *)malloc(sizeof(char)*20000);
+	include[0]='\0';
+	readShader(fname, include);
+
+	char *body = strstr(source, "#version");
+	body = body ? strchr(body, '\n') : NULL;
+	body = body ? body + 1 : source;
+
+	size_t len = strlen(include);
+	memmove(body + len, body, strlen(body) + 1);
+	memcpy(body, include, len);
+	free(include);
+}
+
 unsigned int loadShader(const char *source, unsigned int mode)
 {
 	GLuint id;
@@ -85,51 +202,32 @@ unsigned int loadShader(const char *source, unsigned int mode)
 	return id;
 }
 
-void initShaders()
+// Build the water program with the given tessellation evaluation shader
+GLuint createWaterProgram(const char *tesFile)
 {
-	char *vsSource, *fsSource, *gsSource, *tcsSource, *tesSource, *pointVSource, *pointFSource;
-	GLuint vs,fs,gs,tcs,tes,pointV,pointF;
+	char *vsSource, *fsSource, *gsSource, *tcsSource, *tesSource;
+	GLuint vs,fs,gs,tcs,tes;
 
 	vsSource = (char *)malloc(sizeof(char)*20000);
 	fsSource = (char *)malloc(sizeof(char)*20000);
 	gsSource = (char *)malloc(sizeof(char)*20000);
 	tcsSource = (char *)malloc(sizeof(char)*20000);
-	tesSource = (char *)malloc(sizeof(char)*20000);
-    pointVSource = (char *)malloc(sizeof(char)*20000);
-	pointFSource = (char *)malloc(sizeof(char)*20000);
-
+	tesSource = (char *)malloc(sizeof(char)*30000);
 
 	vsSource[0]='\0';
 	fsSource[0]='\0';
 	gsSource[0]='\0';
 	tcsSource[0]='\0';
 	tesSource[0]='\0';
-    pointVSource[0]='\0';
-	pointFSource[0]='\0';
 
-    pointProgram = glCreateProgram();
-
-    readShader("shader/pointShader.vs", pointVSource);
-    readShader("shader/pointShader.fs", pointFSource);
-
-    pointV = loadShader(pointVSource,GL_VERTEX_SHADER);
-    pointF = loadShader(pointFSource,GL_FRAGMENT_SHADER);
-
-    glAttachShader(pointProgram,pointV);
-    glAttachShader(pointProgram,pointF);
-    
-    glLinkProgram(pointProgram);
-
-    glUseProgram(pointProgram);
-
-
-	program = glCreateProgram();
+	GLuint prog = glCreateProgram();
 
 	readShader("shader/waterVertex.glsl",vsSource);
 	readShader("shader/waterFragment.glsl",fsSource);
 	readShader("shader/waterGeometry.glsl",gsSource);
 	readShader("shader/waterTessC.glsl",tcsSource);
-	readShader("shader/waterTessE.glsl",tesSource);
+	readShader(tesFile,tesSource);
+	includeShader(tesSource,"shader/hermite.glsl");
 
 	vs = loadShader(vsSource,GL_VERTEX_SHADER);
 	fs = loadShader(fsSource,GL_FRAGMENT_SHADER);
@@ -137,17 +235,85 @@ void initShaders()
 	tcs = loadShader(tcsSource,GL_TESS_CONTROL_SHADER);
 	tes = loadShader(tesSource,GL_TESS_EVALUATION_SHADER);
 
-	glAttachShader(program,vs);
-	glAttachShader(program,fs);
-	glAttachShader(program,gs);
-	glAttachShader(program,tcs);
-	glAttachShader(program,tes);
+	glAttachShader(prog,vs);
+	glAttachShader(prog,fs);
+	glAttachShader(prog,gs);
+	glAttachShader(prog,tcs);
+	glAttachShader(prog,tes);
+
+	glLinkProgram(prog);
+
+	glUseProgram(prog);
+
+	glUniformBlockBinding(prog, glGetUniformBlockIndex(prog, "FrameData"), FRAME_DATA_BINDING);
+
+	glUniform1f(glGetUniformLocation(prog,"LineWidth"), 0.8f);
+	glUniform4f(glGetUniformLocation(prog,"LineColor"), 0.05f,0.0f,0.05f,1.0f);
+	glUniform4f(glGetUniformLocation(prog,"LightPosition"), 0.0f,1.0f,0.0f,0.0f);
+	glUniform3f(glGetUniformLocation(prog,"LightIntensity"), 1.0f,1.0f,1.0f);
+	glUniform3f(glGetUniformLocation(prog,"Kd"), 0.9f,0.9f,1.0f);
+	// Sky lighting, off until setEnvironmentUniforms()
+	glUniform1i(glGetUniformLocation(prog,"UseEnvironment"), 0);
+	glUniform1i(glGetUniformLocation(prog,"SpecularMap"), 0);
+	glUniform1i(glGetUniformLocation(prog,"BrdfLut"), 1);
+	// Planar reflection, off until setReflectionUniforms()
+	glUniform1i(glGetUniformLocation(prog,"UseReflection"), 0);
+	glUniform1i(glGetUniformLocation(prog,"ReflectionMap"), 2);
+	glUniform1i(glGetUniformLocation(prog,"RefractionDepth"), 3);
+
+	free(vsSource);
+	free(fsSource);
+	free(gsSource);
+	free(tcsSource);
+	free(tesSource);
+
+	return prog;
+}
 
-	glLinkProgram(program);
+// Light a water program with the baked sky. The specular cube and BRDF table
+// are expected on texture units 0 and 1.
+static void setEnvironmentUniforms(GLuint prog, const EnvironmentMap &env)
+{
+	glUseProgram(prog);
+	glUniform1i(glGetUniformLocation(prog,"UseEnvironment"), 1);
+	glUniform1f(glGetUniformLocation(prog,"SpecularMaxLod"), (float)(env.getSpecularLevels() - 1));
+	glUniform3fv(glGetUniformLocation(prog,"IrradianceSH"), 9, &env.getIrradianceSH()[0].x);
+}
 
-	glUseProgram(program);
+// Sample the WaterReflections targets, expected on texture units 2 and 3
+static void setReflectionUniforms(GLuint prog)
+{
+	glUseProgram(prog);
+	glUniform1i(glGetUniformLocation(prog,"UseReflection"), 1);
+	glUniform2f(glGetUniformLocation(prog,"DepthRange"), NEAR_PLANE, FAR_PLANE);
+	glUniform1f(glGetUniformLocation(prog,"ReflectionDistortion"), 0.02f);
+	glUniform1f(glGetUniformLocation(prog,"FoamWidth"), 1.5f);
+}
 
-	
+// Program for the objects around the water; the tessellation stages are optional
+static GLuint createSceneProgram(const char *vsFile, const char *fsFile,
+                                 const char *tcsFile = NULL, const char *tesFile = NULL)
+{
+	const char *files[4] = { vsFile, fsFile, tcsFile, tesFile };
+	const GLenum stages[4] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER, GL_TESS_CONTROL_SHADER, GL_TESS_EVALUATION_SHADER };
+
+	GLuint prog = glCreateProgram();
+	char *source = (char *)malloc(sizeof(char)*20000);
+	for (int i=0;i<4;i++) {
+		if (files[i] == NULL) continue;
+		source[0]='\0';
+		readShader(files[i], source);
+		glAttachShader(prog, loadShader(source, stages[i]));
+	}
+	glLinkProgram(prog);
+
+	free(source);
+	return prog;
+}
+
+void initShaders()
+{
+	program = createWaterProgram("shader/waterTessE.glsl");
 }
 
 static void error_callback(int error, const char* description)
@@ -155,111 +321,58 @@ static void error_callback(int error, const char* description)
     fprintf(stderr, "Error: %s\n", description);
 }
 
-void findDerivatives()
+static GLfloat *putVec3(GLfloat *dst, const vec3 &v)
 {
-	int i,j;
-	float udist = 2.0; // a single patch covers 0<=u<=1, the derivatives are computed using the previous patch and the next patch
-					   // given a total distance of 2.0 in the parameter space
-	float vdist = 2.0;
-	for (i=0;i<M;i++)
-		for (j=0;j<N;j++)
-		{
-			dv[i][j].x=dv[i][j].y=dv[i][j].z=0;
-			du[i][j].x=du[i][j].y=du[i][j].z=0;
-		}
-	for (i=0;i<M;i++)
-		for (j=1;j<N-1;j++) // partial derivatives are approximated using differences
-		{
-			dv[i][j].x=(controlPoints[i][j+1].x-controlPoints[i][j-1].x)/vdist;
-			dv[i][j].y=(controlPoints[i][j+1].y-controlPoints[i][j-1].y)/vdist;
-			dv[i][j].z=(controlPoints[i][j+1].z-controlPoints[i][j-1].z)/vdist;
-		
-		}
-
-	for (j=0;j<N;j++)
-		for (i=1;i<M-1;i++) // partial derivatives are approximated using differences
-		{
-			du[i][j].x=(controlPoints[i+1][j].x-controlPoints[i-1][j].x)/udist;
-			du[i][j].y=(controlPoints[i+1][j].y-controlPoints[i-1][j].y)/udist;
-			du[i][j].z=(controlPoints[i+1][j].z-controlPoints[i-1][j].z)/udist;
-		}
-
+    dst[0] = v.x;
+    dst[1] = v.y;
+    dst[2] = v.z;
+    return dst + 3;
 }
 
-void wavIt(float t){
-    vector<GLfloat> patchData;
-
-    for (int i=0;i<M-1;i++) {
-        for (int j=0;j<N-1;j++) {
-        controlPoints[i][j].y = 4*sin(i + t) + 2*sin(j+t)*cos(j+t);
-        }
-    }
+size_t patchDataSize()
+{
+    return (size_t)(M-1)*(N-1)*12*3;
+}
 
-    findDerivatives();
-    int index = 0;
+// Write the patch data for the whole surface into dst. In an F-surface patch we have
+// 4 control points and 8 partial derivatives (du and dv) in these control points
+// making a total of 12 vec3 info per patch. The derivatives are computed on the fly
+// from the grid, so a mapped surface file goes straight into the (mapped) GL buffer.
+void fillPatchData(GLfloat *dst)
+{
     for (int i=0;i<M-1;i++) {
         for (int j=0;j<N-1;j++) {
             // control points
-            patchData.push_back(controlPoints[i][j].x);
-            patchData.push_back(controlPoints[i][j].y);
-            patchData.push_back(controlPoints[i][j].z);
-            index+=3;
-            patchData.push_back(controlPoints[i+1][j].x);
-            patchData.push_back(controlPoints[i+1][j].y);
-            patchData.push_back(controlPoints[i+1][j].z);
-            index+=3;
-            patchData.push_back(controlPoints[i+1][j+1].x);
-            patchData.push_back(controlPoints[i+1][j+1].y);
-            patchData.push_back(controlPoints[i+1][j+1].z);
-            index+=3;
-            patchData.push_back(controlPoints[i][j+1].x);
-            patchData.push_back(controlPoints[i][j+1].y);
-            patchData.push_back(controlPoints[i][j+1].z);
-            index+=3;
+            dst = putVec3(dst, surface.point(i,j));
+            dst = putVec3(dst, surface.point(i+1,j));
+            dst = putVec3(dst, surface.point(i+1,j+1));
+            dst = putVec3(dst, surface.point(i,j+1));
 
             // now partial derivatives du
-            patchData.push_back(du[i][j].x);
-            patchData.push_back(du[i][j].y);
-            patchData.push_back(du[i][j].z);
-            index+=3;
-            patchData.push_back(du[i+1][j].x);
-            patchData.push_back(du[i+1][j].y);
-            patchData.push_back(du[i+1][j].z);
-            index+=3;
-            patchData.push_back(du[i+1][j+1].x);
-            patchData.push_back(du[i+1][j+1].y);
-            patchData.push_back(du[i+1][j+1].z);
-            index+=3;
-            patchData.push_back(du[i][j+1].x);
-            patchData.push_back(du[i][j+1].y);
-            patchData.push_back(du[i][j+1].z);
-            index+=3;
+            dst = putVec3(dst, surface.derivativeU(i,j));
+            dst = putVec3(dst, surface.derivativeU(i+1,j));
+            dst = putVec3(dst, surface.derivativeU(i+1,j+1));
+            dst = putVec3(dst, surface.derivativeU(i,j+1));
 
             // now partial derivatives dv
-            patchData.push_back(dv[i][j].x);
-            patchData.push_back(dv[i][j].y);
-            patchData.push_back(dv[i][j].z);
-            index+=3;
-            patchData.push_back(dv[i+1][j].x);
-            patchData.push_back(dv[i+1][j].y);
-            patchData.push_back(dv[i+1][j].z);
-            index+=3;
-            patchData.push_back(dv[i+1][j+1].x);
-            patchData.push_back(dv[i+1][j+1].y);
-            patchData.push_back(dv[i+1][j+1].z);
-            index+=3;
-            patchData.push_back(dv[i][j+1].x);
-            patchData.push_back(dv[i][j+1].y);
-            patchData.push_back(dv[i][j+1].z);
-            index+=3;
-
+            dst = putVec3(dst, surface.derivativeV(i,j));
+            dst = putVec3(dst, surface.derivativeV(i+1,j));
+            dst = putVec3(dst, surface.derivativeV(i+1,j+1));
+            dst = putVec3(dst, surface.derivativeV(i,j+1));
         }
     }
+}
 
+// Animate the control points on the CPU. The patch data itself is written into
+// the per-frame patch buffers by the render loop.
+void wavIt(float t){
+    for (int i=0;i<M-1;i++) {
+        for (int j=0;j<N-1;j++) {
+        surface.y[i*N+j] = 4*sin(i + t) + 2*sin(j+t)*cos(j+t);
+        }
+    }
 
-    glBindBuffer(GL_ARRAY_BUFFER, buf);
-    glBufferData(GL_ARRAY_BUFFER, patchData.size() * sizeof(float), patchData.data(), GL_STATIC_DRAW);
-
+    patchUploadsPending = FrameRing::FRAMES_IN_FLIGHT;
 }
 
 static void rotateCam(float a){
@@ -303,51 +416,99 @@ static void key_callback(GLFWwindow* window, int key, int scancode, int action,
         centerModel = !centerModel;
     }
 
-    if(key==GLFW_KEY_P) glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);//controlling if things are rendered wireframe or not
-    if(key==GLFW_KEY_L) glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    if(key == GLFW_KEY_V && action == GLFW_PRESS){
+        cpuWaves = !cpuWaves; // animate the control points on the CPU
+    }
+
+    if(key==GLFW_KEY_P) wireframe = true;//controlling if things are rendered wireframe or not
+    if(key==GLFW_KEY_L) wireframe = false;
+
+    if(key == GLFW_KEY_G && action == GLFW_PRESS){
+        controlPoints = (controlPoints + 1) % ControlPointView::MODE_COUNT;
+    }
 
 
 }
 
-void showFPS(GLFWwindow* window) {
+// Render thread: count frames and publish the statistics once per second
+void countFrame() {
         double currentTime = glfwGetTime();
         double delta = currentTime - lastTime;
-	    char ss[500] = {};
-		std::string wTitle = "Stylized Water";
         nFrames++;
         if ( delta >= 1.0 ){ // If last update was more than 1 sec ago
-            double fps = ((double)(nFrames)) / delta;
-            sprintf(ss,"%s running at %lf FPS",wTitle.c_str(),fps);
-            glfwSetWindowTitle(window, ss);
+            FrameStats stats;
+            stats.fps = ((double)(nFrames)) / delta;
+            for (int i=0;i<FrameRing::FRAMES_IN_FLIGHT;i++) {
+                stats.fenceAvgMs[i] = frameRing.getAverageWaitMs(i);
+                stats.fenceMaxMs[i] = frameRing.getMaxWaitMs(i);
+            }
+            frameRing.resetWaitStats();
+            stats.tiled = tileStream.isOpen();
+            if (stats.tiled) stats.tiles = tileStream.getMetrics();
+            stats.reflecting = waterReflections.isInitialized();
+            stats.reflectionScale = waterReflections.getScale();
+            stats.reflectionMs = waterReflections.getGpuMs();
+            statsQueue.push(stats);
             nFrames = 0;
             lastTime = currentTime;
         }
 }
 
+// Main thread: the window title can only be changed from here
+void updateTitle(GLFWwindow* window) {
+        FrameStats stats;
+        if (!statsQueue.popLatest(stats)) return;
 
-void createSurface(float step)
+	    char ss[500] = {};
+		std::string wTitle = "Stylized Water";
+        int len = sprintf(ss,"%s running at %lf FPS | fence wait ms (avg/max):",wTitle.c_str(),stats.fps);
+        for (int i=0;i<FrameRing::FRAMES_IN_FLIGHT;i++)
+            len += sprintf(ss+len," %.2f/%.2f",stats.fenceAvgMs[i],stats.fenceMaxMs[i]);
+        if (stats.tiled) {
+            const TileStream::Metrics &m = stats.tiles;
+            len += sprintf(ss+len," | tiles %d drawn, %d resident (%.0f/%.0f MB), %d queued, io ms %.1f/%.1f",
+                           m.drawnTiles, m.residentTiles, m.residentBytes/(1024.0*1024.0), m.budgetBytes/(1024.0*1024.0),
+                           m.queuedTiles, m.avgIoMs, m.maxIoMs);
+        }
+        if (stats.reflecting)
+            len += sprintf(ss+len," | reflections at %.0f%% in %.2f ms", stats.reflectionScale*100.0f, stats.reflectionMs);
+        glfwSetWindowTitle(window, ss);
+}
+
+RenderSettings snapshotSettings(GLFWwindow* window)
 {
+    RenderSettings settings;
+    settings.cameraPos = cameraPos;
+    settings.lookAtPoint = lookAtPoint;
+    settings.tessLevel = tessLevel;
+    settings.centerModel = centerModel;
+    settings.cpuWaves = cpuWaves;
+    settings.wireframe = wireframe;
+    settings.controlPoints = controlPoints;
+    glfwGetFramebufferSize(window, &settings.width, &settings.height);
+    return settings;
+}
 
-	controlPoints = (vec3 **)malloc(sizeof(vec3*)*(M));
-	du = (vec3 **)malloc(sizeof(vec3*)*(M));
-	dv = (vec3 **)malloc(sizeof(vec3*)*(M));
-	for (int i=0;i<M;i++)
-	{
-		controlPoints[i] = (vec3 *)malloc(sizeof(vec3)*(N));
-		du[i] = (vec3 *)malloc(sizeof(vec3)*(N));
-		dv[i] = (vec3 *)malloc(sizeof(vec3)*(N));
-	}
-    for(int i = 0; i<M; i++){
-        for(int j = 0; j<N; j++){
-            controlPoints[i][j] = vec3(step*i, 0, step*j);
+
+void createSurface(float step)
+{
+    if (surfaceFile != NULL) {
+        auto start = std::chrono::steady_clock::now();
+        if (!surface.load(surfaceFile)) {
+            fprintf(stderr, "Falling back to a generated surface.\n");
+            surfaceFile = NULL;
+        } else {
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            printf("Surface %s loaded in %.2f ms%s.\n", surfaceFile, ms, surface.isMapped() ? " (mapped)" : "");
         }
     }
+    if (surfaceFile == NULL)
+        surface.createFlat(M, N, step);
 
-    printf("%dx%d control points created.\n",M,N);
-
-	findDerivatives();
+    M = surface.M;
+    N = surface.N;
 
-    printf("Derivatives computed.\n");
+    printf("%dx%d control points created.\n",M,N);
 }
 
 void rotateCamera(GLFWwindow* window, double xpos, double ypos)
@@ -396,40 +557,114 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
     }
 }
 
-int main(void)
+// Reference for the matrix form: the per-component blending code the TES used before
+static vec3 hermitePatchScalar(const vec3 cp[12], float u, float v)
 {
+    float f1u = 2*u*u*u-3*u*u+1, f2u = -2*u*u*u+3*u*u, f3u = u*u*u-2*u*u+u, f4u = u*u*u-u*u;
+    float f1v = 2*v*v*v-3*v*v+1, f2v = -2*v*v*v+3*v*v, f3v = v*v*v-2*v*v+v, f4v = v*v*v-v*v;
+
+    vec3 b1 = cp[0]*f1v + cp[3]*f2v + cp[8]*f3v + cp[11]*f4v;
+    vec3 b2 = cp[1]*f1v + cp[2]*f2v + cp[9]*f3v + cp[10]*f4v;
+    vec3 b3 = cp[4]*f1v + cp[7]*f2v;
+    vec3 b4 = cp[5]*f1v + cp[6]*f2v;
+    return f1u*b1 + f2u*b2 + f3u*b3 + f4u*b4;
+}
 
-    GLFWwindow* window;
-
-    int i,j,c;
-
-    GLint mvp_location,time_location;
+// Evaluate random patches with the shared hermite.glsl code on the CPU and
+// compare against the scalar formulation
+static void checkHermiteMatrixForm()
+{
+    float maxError = 0.0f;
+    for (int patch=0;patch<1000;patch++) {
+        vec3 cp[12];
+        for (int k=0;k<12;k++)
+            cp[k] = glm::linearRand(vec3(-100.0f), vec3(100.0f));
+        for (int i=0;i<=BENCH_TES_LEVEL;i++) {
+            for (int j=0;j<=BENCH_TES_LEVEL;j++) {
+                float u = (float)i/BENCH_TES_LEVEL, v = (float)j/BENCH_TES_LEVEL;
+                vec3 d = hermite::hermitePatch(cp, u, v) - hermitePatchScalar(cp, u, v);
+                maxError = glm::max(maxError, glm::max(fabsf(d.x), glm::max(fabsf(d.y), fabsf(d.z))));
+            }
+        }
+    }
+    printf("Hermite matrix form vs scalar on the CPU: max abs error %g\n", maxError);
+}
 
-	lastTime = 0;
-	nFrames = 0;
+static void reportTessBenchmark(const TessBenchmark &bench, int patches)
+{
+    const char *names[2] = { "matrix", "scalar" };
+    printf("TES benchmark: %d patches at tessellation level %d, %d frames each\n",
+           patches, BENCH_TES_LEVEL, benchTesFrames);
+    printf("%8s %12s %14s %12s\n", "TES", "GPU ms", "triangles", "Mtri/s");
+    for (int v=0;v<2;v++) {
+        double ms = bench.gpuMs[v] / benchTesFrames;
+        double tris = (double)bench.primitives[v] / benchTesFrames;
+        printf("%8s %12.3f %14.0f %12.1f\n", names[v], ms, tris, tris / (ms * 1000.0));
+    }
+    printf("speedup: %.2fx\n", bench.gpuMs[1] / bench.gpuMs[0]);
+}
 
-    glfwSetErrorCallback(error_callback);
-    if (!glfwInit())
-        exit(EXIT_FAILURE);
+// What the water reflects: the sky when there is one and, with reflections
+// on, a teapot standing in the water. The teapot is tessellated on the GPU
+// from its Bezier patches, to a level that follows its size on screen.
+struct SceneObjects {
+    GLuint teapotProgram, skyProgram;
+    GLuint skyMap;          // 0 without --sky
+    TeapotPatch *teapot;    // NULL without --reflections
+    SkyBox *skyBox;
+    mat4 teapotModel;
+};
+
+enum ScenePass {
+    SCENE_WINDOW,           // gamma corrected
+    SCENE_REFLECTION,       // linear, into the RGBA16F target
+    SCENE_DEPTH             // refraction depth: no sky, no colour target
+};
+
+// width and height are those of the target drawn into
+static void drawScene(const SceneObjects &scene, const mat4 &view, const mat4 &projection, ScenePass pass,
+                      int width, int height)
+{
+    if (scene.teapot != NULL) {
+        GLuint prog = scene.teapotProgram;
+        glUseProgram(prog);
+        glUniformMatrix4fv(glGetUniformLocation(prog,"projection"), 1, GL_FALSE, &projection[0][0]);
+        glUniformMatrix4fv(glGetUniformLocation(prog,"view"), 1, GL_FALSE, &view[0][0]);
+        glUniformMatrix4fv(glGetUniformLocation(prog,"model"), 1, GL_FALSE, &scene.teapotModel[0][0]);
+        glUniform2f(glGetUniformLocation(prog,"ViewportSize"), (float)width, (float)height);
+        glUniform1i(glGetUniformLocation(prog,"Gamma"), pass == SCENE_WINDOW);
+        scene.teapot->render();
+    }
+    if (scene.skyMap != 0 && pass != SCENE_DEPTH) {
+        GLuint prog = scene.skyProgram;
+        glUseProgram(prog);
+        glUniformMatrix4fv(glGetUniformLocation(prog,"projection"), 1, GL_FALSE, &projection[0][0]);
+        glUniformMatrix4fv(glGetUniformLocation(prog,"view"), 1, GL_FALSE, &view[0][0]);
+        glUniform1i(glGetUniformLocation(prog,"Gamma"), pass == SCENE_WINDOW);
+        // Drawn last on the far plane, so only where nothing else is
+        glDepthMask(GL_FALSE);
+        scene.skyBox->render();
+        glDepthMask(GL_TRUE);
+    }
+}
 
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
+// Mean height of the control points: the plane the reflection mirrors about
+static float waterLevel()
+{
+    if (tileStream.isOpen() || M < 1 || N < 1) return 0.0f;
+    double sum = 0.0;
+    for (int i=0;i<M;i++)
+        for (int j=0;j<N;j++)
+            sum += surface.point(i,j).y;
+    return (float)(sum / ((double)M * N));
+}
 
-    window = glfwCreateWindow(800, 600, "Stylized Water", NULL, NULL);
-    if (!window)
-    {
-        glfwTerminate();
-        exit(EXIT_FAILURE);
-    }
-    glfwSetKeyCallback(window, key_callback);
+// Render thread: owns the GL context. Camera and settings arrive as snapshots
+// through settingsQueue, so input handling never waits on a frame.
+void renderLoop(GLFWwindow* window)
+{
     glfwMakeContextCurrent(window);
 
-    glfwSetMouseButtonCallback(window, mouse_button_callback);
-    glfwSetCursorPosCallback(window, rotateCamera);
-
     glfwSwapInterval(1);
 
 	gladLoadGL();
@@ -451,112 +686,97 @@ int main(void)
 	
     initShaders();
 
-	Cube cube = Cube(1.0);
+    ControlPointView controlPointView;
+    controlPointView.init(createSceneProgram("shader/controlPointVertex.glsl", "shader/controlPointFragment.glsl"));
+
+    // Prefiltered sky for the water reflections, baked once and cached
+    EnvironmentMap environment;
+    bool skyLit = false;
+    if (skyBaseName != NULL) {
+        glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+        skyLit = environment.load(skyBaseName);
+    }
+    if (skyLit) {
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, environment.getSpecular());
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, environment.getBrdfLut());
+        glActiveTexture(GL_TEXTURE0);
+        setEnvironmentUniforms(program, environment);
+    }
+
+    SceneObjects scene = {};
+    scene.teapotProgram = createSceneProgram("shader/teapotVertex.glsl", "shader/sceneFragment.glsl",
+                                             "shader/teapotTessC.glsl", "shader/teapotTessE.glsl");
+    scene.skyProgram = createSceneProgram("shader/skyVertex.glsl", "shader/skyFragment.glsl");
+    glUseProgram(scene.teapotProgram);
+    glUniform1f(glGetUniformLocation(scene.teapotProgram,"EdgePixels"), 8.0f);
+    glUniform1f(glGetUniformLocation(scene.teapotProgram,"MaxTessLevel"), 64.0f);
+    glUniform3f(glGetUniformLocation(scene.teapotProgram,"Kd"), 0.8f,0.45f,0.3f);
+    glUniform3f(glGetUniformLocation(scene.teapotProgram,"LightDirection"), 0.4f,1.0f,0.3f);
+    glUniform3f(glGetUniformLocation(scene.teapotProgram,"LightIntensity"), 1.0f,1.0f,1.0f);
+    glUniform3f(glGetUniformLocation(scene.teapotProgram,"Ambient"), 0.15f,0.15f,0.15f);
+    glUseProgram(scene.skyProgram);
+    glUniform1i(glGetUniformLocation(scene.skyProgram,"SkyMap"), 4);
+    if (skyLit) {
+        scene.skyMap = Texture::loadHdrCubeMap(skyBaseName);
+        scene.skyBox = new SkyBox(2.0f);
+        glActiveTexture(GL_TEXTURE4);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, scene.skyMap);
+        glActiveTexture(GL_TEXTURE0);
+    }
 
     glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LEQUAL); // the sky box lies on the far plane
 
     // setup buffers and send control points
 
     // In an F-surface patch we have 4 control points and 8 partial derivatives (du and dv) in these control points
     // making a total of 12 vec3 info per patch
 
-    vector<GLfloat> patchData;
-
-    createSurface(50);
-
-    int index = 0;
-    for (i=0;i<M-1;i++) {
-        for (j=0;j<N-1;j++) {
-            // control points
-            patchData.push_back(controlPoints[i][j].x);
-            patchData.push_back(controlPoints[i][j].y);
-            patchData.push_back(controlPoints[i][j].z);
-            index+=3;
-            patchData.push_back(controlPoints[i+1][j].x);
-            patchData.push_back(controlPoints[i+1][j].y);
-            patchData.push_back(controlPoints[i+1][j].z);
-            index+=3;
-            patchData.push_back(controlPoints[i+1][j+1].x);
-            patchData.push_back(controlPoints[i+1][j+1].y);
-            patchData.push_back(controlPoints[i+1][j+1].z);
-            index+=3;
-            patchData.push_back(controlPoints[i][j+1].x);
-            patchData.push_back(controlPoints[i][j+1].y);
-            patchData.push_back(controlPoints[i][j+1].z);
-            index+=3;
-
-            // now partial derivatives du
-            patchData.push_back(du[i][j].x);
-            patchData.push_back(du[i][j].y);
-            patchData.push_back(du[i][j].z);
-            index+=3;
-            patchData.push_back(du[i+1][j].x);
-            patchData.push_back(du[i+1][j].y);
-            patchData.push_back(du[i+1][j].z);
-            index+=3;
-            patchData.push_back(du[i+1][j+1].x);
-            patchData.push_back(du[i+1][j+1].y);
-            patchData.push_back(du[i+1][j+1].z);
-            index+=3;
-            patchData.push_back(du[i][j+1].x);
-            patchData.push_back(du[i][j+1].y);
-            patchData.push_back(du[i][j+1].z);
-            index+=3;
-
-            // now partial derivatives dv
-            patchData.push_back(dv[i][j].x);
-            patchData.push_back(dv[i][j].y);
-            patchData.push_back(dv[i][j].z);
-            index+=3;
-            patchData.push_back(dv[i+1][j].x);
-            patchData.push_back(dv[i+1][j].y);
-            patchData.push_back(dv[i+1][j].z);
-            index+=3;
-            patchData.push_back(dv[i+1][j+1].x);
-            patchData.push_back(dv[i+1][j+1].y);
-            patchData.push_back(dv[i+1][j+1].z);
-            index+=3;
-            patchData.push_back(dv[i][j+1].x);
-            patchData.push_back(dv[i][j+1].y);
-            patchData.push_back(dv[i][j+1].z);
-            index+=3;
-
-        }
+    size_t maxPatchFloats;
+    if (tileFile != NULL && tileStream.open(tileFile, tileBudgetMB * 1024 * 1024)) {
+        // Tiles are re-selected every frame, so the patch buffers are sized for
+        // the most tiles that can be drawn at once
+        maxPatchFloats = tileStream.getMaxPatchCount() * 12 * 3;
+    } else {
+        createSurface(50);
+        maxPatchFloats = patchDataSize();
     }
 
-    printf("size = %d\n",patchData.size());
-
-    
-    glGenBuffers(1, &buf);
-
-    glBindBuffer(GL_ARRAY_BUFFER, buf);
-    glBufferData(GL_ARRAY_BUFFER, patchData.size() * sizeof(float), patchData.data(), GL_STATIC_DRAW);
-
-    glGenVertexArrays( 1, &vao );
-    glBindVertexArray(vao);
-    glBindBuffer(GL_ARRAY_BUFFER, buf);
-    glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, 0, 0 );
-    glEnableVertexAttribArray(0);
+    printf("size = %zu\n",maxPatchFloats);
+
+    // Every in-flight frame gets its own copy of the patch data and the frame uniforms
+    frameRing.init(maxPatchFloats * sizeof(GLfloat), sizeof(FrameUniforms));
+    patchUploadsPending = FrameRing::FRAMES_IN_FLIGHT;
+    GLsizei patchVertices = (M-1)*(N-1)*12;
+
+    float reflectionPlane = waterLevel();
+    if (reflectionBudgetMs > 0.0f) {
+        waterReflections.init(reflectionBudgetMs);
+        // The teapot stands on z = 0 with z up; sink the base a little
+        scene.teapot = new TeapotPatch();
+        scene.teapotModel = glm::translate(mat4(1.0f), vec3(60.0f, reflectionPlane - 6.0f, 60.0f)) *
+                            glm::rotate(mat4(1.0f), glm::radians(-90.0f), vec3(1.0f,0.0f,0.0f)) *
+                            glm::scale(mat4(1.0f), vec3(8.0f));
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, waterReflections.getReflection());
+        glActiveTexture(GL_TEXTURE3);
+        glBindTexture(GL_TEXTURE_2D, waterReflections.getRefractionDepth());
+        glActiveTexture(GL_TEXTURE0);
+        setReflectionUniforms(program);
+    }
 
-    glBindVertexArray(0);
+    vec3 lastCameraPos = vec3(0.0f);
+    vec3 cameraVelocity = vec3(0.0f);
 
     glPatchParameteri(GL_PATCH_VERTICES, 12); // 4 control points with 2 partial derivatives (du and dv) at each control point
 
 	float angle = 0;
-    tessLevel = 8;
 	
    
     mat4 mvp,view,projection,model;
 
-    mvp_location = glGetUniformLocation(program,"MVP");
-
-    glUniform1i(glGetUniformLocation(program,"TessLevel"), tessLevel);
-    glUniform1f(glGetUniformLocation(program,"LineWidth"), 0.8f);
-    glUniform4f(glGetUniformLocation(program,"LineColor"), 0.05f,0.0f,0.05f,1.0f);
-    glUniform4f(glGetUniformLocation(program,"LightPosition"), 0.0f,1.0f,0.0f,0.0f);
-    glUniform3f(glGetUniformLocation(program,"LightIntensity"), 1.0f,1.0f,1.0f);
-    glUniform3f(glGetUniformLocation(program,"Kd"), 0.9f,0.9f,1.0f);
-
 	glClearColor(0.5,0.5,0.5,1.0);
 
 	float rotSpeed;
@@ -565,16 +785,53 @@ int main(void)
 
     tPrev = 0;
     rotSpeed = glm::pi<float>()/8.0f;
-	
-    cameraPos = vec3(-40,120,-40);
 
+    // Everything up to here, on all threads (see --bench-static for the meshes)
+    printf("Heap allocations at startup: %zu\n", heapAllocationCount());
+
+    TessBenchmark bench = {};
+    if (benchTesFrames > 0) {
+        checkHermiteMatrixForm();
+        bench.programs[0] = program;
+        bench.programs[1] = createWaterProgram("shader/waterTessE_scalar.glsl");
+        if (skyLit) setEnvironmentUniforms(bench.programs[1], environment);
+        if (waterReflections.isInitialized()) setReflectionUniforms(bench.programs[1]);
+        glGenQueries(2, bench.queries);
+        glfwSwapInterval(0);
+    }
 
-    while (!glfwWindowShouldClose(window))
+    // main() pushes the first snapshot before starting this thread
+    RenderSettings settings;
+    settingsQueue.pop(settings);
+    bool wireframe = false;
+
+    while (renderRunning.load())
     {
-        float ratio;
-        int width, height;
-        glfwGetFramebufferSize(window, &width, &height);
-        glViewport(0, 0, width, height);
+        // Only the newest camera/settings state matters
+        settingsQueue.popLatest(settings);
+
+        GLuint drawProgram = program;
+        int benchVariant = 0;
+        bool benchMeasure = false;
+        if (benchTesFrames > 0) {
+            int perVariant = BENCH_TES_WARMUP + benchTesFrames;
+            benchVariant = bench.frame / perVariant;
+            if (benchVariant == 2) {
+                reportTessBenchmark(bench, patchVertices / 12);
+                glfwSetWindowShouldClose(window, GLFW_TRUE);
+                break;
+            }
+            drawProgram = bench.programs[benchVariant];
+            benchMeasure = bench.frame % perVariant >= BENCH_TES_WARMUP;
+            bench.frame++;
+        }
+
+        if (settings.wireframe != wireframe) {
+            wireframe = settings.wireframe; //controlling if things are rendered wireframe or not
+            glPolygonMode(GL_FRONT_AND_BACK, wireframe ? GL_LINE : GL_FILL);
+        }
+
+        int width = settings.width, height = settings.height;
 
         float w2 = width / 2.0f;
         float h2 = height / 2.0f;
@@ -583,8 +840,6 @@ int main(void)
                      vec4(0.0f,0.0f,1.0f,0.0f),
                      vec4(w2+0, h2+0, 0.0f, 1.0f));
 
-        glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
-
 		t = float(glfwGetTime());
 		deltaT = t - tPrev;
     	if(tPrev == 0.0f) deltaT = 0.0f;
@@ -595,16 +850,15 @@ int main(void)
 
         
         // cameraPos = vec3(50*2.0f * cos(angle), 60+1.5f, 50*2.0f * sin(angle));
-        camZVec = glm::normalize(lookAtPoint- cameraPos);
-        view = glm::lookAt(cameraPos, lookAtPoint, vec3(0.0f,1.0f,0.0f));
+        view = glm::lookAt(settings.cameraPos, settings.lookAtPoint, vec3(0.0f,1.0f,0.0f));
 
         model = mat4(1.0f);
-        if(centerModel){
+        if(settings.centerModel){
             model = glm::translate(model, vec3(-800.0f,0.0f,-800.0f));
         }
         //model = glm::rotate(model,glm::radians(-90.0f), vec3(1.0f,0.0f,0.0f));
 
-    	projection = glm::perspective(glm::radians(60.0f), (float)width/height, 1.0f, 1000.0f);
+    	projection = glm::perspective(glm::radians(60.0f), (float)width/height, NEAR_PLANE, FAR_PLANE);
 
     	mvp = projection * view * model;
 
@@ -612,46 +866,315 @@ int main(void)
         mat3 nm = mat3( vec3(mv[0]), vec3(mv[1]), vec3(mv[2]) );
 
 
-        // wavIt(t);
-        glUseProgram(program);
+        // Wait until the GPU is done with this slot before touching its buffers
+        frameRing.begin();
+
+        if (tileStream.isOpen()) {
+            // Camera in surface space; its smoothed velocity drives the prefetch
+            vec3 camSurface = vec3(glm::inverse(model) * vec4(settings.cameraPos, 1.0f));
+            if (deltaT > 0.0f)
+                cameraVelocity = glm::mix(cameraVelocity, (camSurface - lastCameraPos) / deltaT, 0.1f);
+            lastCameraPos = camSurface;
+
+            tileStream.update(camSurface, cameraVelocity);
+            GLfloat *patches = (GLfloat *)frameRing.mapPatches();
+            if (patches != NULL) {
+                patchVertices = (GLsizei)tileStream.fillPatchData(patches) * 12;
+                frameRing.unmapPatches();
+            }
+        } else {
+            if (settings.cpuWaves) wavIt(t);
+        }
+        if (patchUploadsPending > 0 && !tileStream.isOpen()) {
+            GLfloat *patches = (GLfloat *)frameRing.mapPatches();
+            if (patches != NULL) {
+                fillPatchData(patches);
+                frameRing.unmapPatches();
+            }
+            patchUploadsPending--;
+        }
 
-    	glUniformMatrix4fv(glGetUniformLocation(program,"ModelViewMatrix"), 1, GL_FALSE, &(mv)[0][0]);
-    	glUniformMatrix3fv(glGetUniformLocation(program,"NormalMatrix"), 1, GL_FALSE, &(nm)[0][0]);
-    	glUniformMatrix4fv(mvp_location, 1, GL_FALSE, &(mvp)[0][0]);
-    	glUniformMatrix4fv(glGetUniformLocation(program,"ViewportMatrix"), 1, GL_FALSE, &(viewport)[0][0]);
+        FrameUniforms frameUniforms;
+        frameUniforms.MVP = mvp;
+        frameUniforms.ModelViewMatrix = mv;
+        frameUniforms.ViewportMatrix = viewport;
+        for (int c=0;c<3;c++)
+            frameUniforms.NormalMatrix[c] = vec4(nm[c], 0.0f);
+        frameUniforms.time = t;
+        frameUniforms.TessLevel = settings.tessLevel;
+        frameUniforms.FixedTessLevel = benchTesFrames > 0 ? BENCH_TES_LEVEL : 0;
+        frameRing.writeUniforms(&frameUniforms, sizeof(FrameUniforms));
+
+        if (waterReflections.isInitialized()) {
+            // Everything above the water seen from below it, then the depth
+            // of everything without the water
+            waterReflections.beginFrame(width, height);
+            glClearColor(0.218,0.218,0.218,1.0); // the window's grey, linear
+            waterReflections.bindReflection();
+            mat4 mirrorView = view * WaterReflections::mirror(reflectionPlane);
+            mat4 mirrorProjection = WaterReflections::obliqueProjection(projection, mirrorView,
+                                                                        vec4(0.0f,1.0f,0.0f,-reflectionPlane));
+            drawScene(scene, mirrorView, mirrorProjection, SCENE_REFLECTION,
+                      waterReflections.getWidth(), waterReflections.getHeight());
+            waterReflections.bindRefraction();
+            drawScene(scene, view, projection, SCENE_DEPTH,
+                      waterReflections.getWidth(), waterReflections.getHeight());
+            waterReflections.endFrame();
+            glClearColor(0.5,0.5,0.5,1.0);
+        }
 
-        glUniform1f(glGetUniformLocation(program, "time"), t);
+        glViewport(0, 0, width, height);
+        glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
 
-        glUniform1i(glGetUniformLocation(program,"TessLevel"), tessLevel);
+        glUseProgram(drawProgram);
+        frameRing.bindUniforms(FRAME_DATA_BINDING);
 
         glPatchParameteri(GL_PATCH_VERTICES, 12);
 
-        glBindVertexArray(vao);
-        glDrawArrays(GL_PATCHES, 0, ((M-1)*(N-1)*12));
+        if (benchMeasure) {
+            glBeginQuery(GL_TIME_ELAPSED, bench.queries[0]);
+            glBeginQuery(GL_PRIMITIVES_GENERATED, bench.queries[1]);
+        }
+
+        glBindVertexArray(frameRing.getVao());
+        glDrawArrays(GL_PATCHES, 0, patchVertices);
         glBindVertexArray(0);
 
+        if (benchMeasure) {
+            glEndQuery(GL_TIME_ELAPSED);
+            glEndQuery(GL_PRIMITIVES_GENERATED);
+            // Waiting here serialises the frames, which is fine for a benchmark
+            GLuint64 ns, primitives;
+            glGetQueryObjectui64v(bench.queries[0], GL_QUERY_RESULT, &ns);
+            glGetQueryObjectui64v(bench.queries[1], GL_QUERY_RESULT, &primitives);
+            bench.gpuMs[benchVariant] += ns / 1.0e6;
+            bench.primitives[benchVariant] += primitives;
+        }
+
+        // Read from this frame's patch buffer, so it goes before the fence
+        controlPointView.render((ControlPointView::Mode)settings.controlPoints, frameRing.getPatchBuffer(),
+                                patchVertices / 12, tileStream.isOpen() ? 0 : M, tileStream.isOpen() ? 0 : N, mvp);
 
+        frameRing.end();
 
-        // glUseProgram(pointProgram);
-        // glUniformMatrix4fv(glGetUniformLocation(pointProgram,"projection"), 1, GL_FALSE, &(projection[0][0]));
-        // glUniformMatrix4fv(glGetUniformLocation(pointProgram,"view"), 1, GL_FALSE, &(view[0][0]));
-        // for (i=0;i<M;i++) {
-        //     for (j=0;j<N;j++) {
-        //         model = glm::translate(glm::mat4(1.0), controlPoints[i][j]);
-        //         glUniformMatrix4fv(glGetUniformLocation(pointProgram,"model"), 1, GL_FALSE, &(model[0][0]));
-        //         cube.render();
-        //     }
-        // }
+        drawScene(scene, view, projection, SCENE_WINDOW, width, height);
 
 
-		showFPS(window);
+		countFrame();
 
         glfwSwapBuffers(window);
-        glfwPollEvents();
     }
-	
+
+    if (benchTesFrames > 0) {
+        glDeleteQueries(2, bench.queries);
+        glDeleteProgram(bench.programs[1]);
+    }
+
+    delete scene.teapot;
+    delete scene.skyBox;
+    glDeleteTextures(1, &scene.skyMap);
+    glDeleteProgram(scene.teapotProgram);
+    glDeleteProgram(scene.skyProgram);
+    waterReflections.destroy();
+    controlPointView.destroy();
+    tileStream.close();
+    environment.release();
+    frameRing.destroy();
+    glfwMakeContextCurrent(NULL);
+}
+
+static void usage(const char *prog)
+{
+    printf("usage: %s [surface.txt|surface.sotb]\n", prog);
+    printf("       %s --convert <in.txt|in.sotb> <out.txt|out.sotb>\n", prog);
+    printf("       %s --bench-surface [maxSize]\n", prog);
+    printf("       %s --bench-tes [frames]\n", prog);
+    printf("       %s --bench-obj <mesh.obj>\n", prog);
+    printf("       %s --bench-normals <mesh.obj>\n", prog);
+    printf("       %s --bench-adjacency [maxTriangles]\n", prog);
+    printf("       %s --bench-cache <mesh.obj>\n", prog);
+    printf("       %s --bench-vertex [mesh.obj]\n", prog);
+    printf("       %s --bench-optimize [mesh.obj]\n", prog);
+    printf("       %s --bench-lod [mesh.obj]\n", prog);
+    printf("       %s --bench-meshlets [mesh.obj]\n", prog);
+    printf("       %s --bench-generation [maxGrid]\n", prog);
+    printf("       %s --bench-static\n", prog);
+    printf("       %s --bench-arena [meshCount]\n", prog);
+    printf("       %s --bench-teapot\n", prog);
+    printf("       %s --bench-textures <cubeBaseName>\n", prog);
+    printf("       %s --tiles <surface.sott> [budgetMB]\n", prog);
+    printf("       %s --build-tiles <in.txt|in.sotb> <out.sott> [tileSize]\n", prog);
+    printf("       %s --build-texture <image> <bc1|bc3|bc5|bc6h>\n", prog);
+    printf("       %s --build-cubemap <baseName> <.png|.jpg|.hdr> <bc1|bc3|bc5|bc6h>\n", prog);
+    printf("       %s --build-ibl <baseName of .hdr faces>\n", prog);
+    printf("scene options, with any way of running the water:\n");
+    printf("       --sky <baseName of .hdr faces>   sky box and image based lighting\n");
+    printf("       --reflections <budgetMs>         planar reflections within budgetMs of GPU time\n");
+}
+
+static bool parseCodec(const char *name, TextureCodec &codec)
+{
+    const char *names[4] = { "bc1", "bc3", "bc5", "bc6h" };
+    for (int i = 0; i < 4; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            codec = (TextureCodec)i;
+            return true;
+        }
+    }
+    fprintf(stderr, "Unknown codec %s\n", name);
+    return false;
+}
+
+int main(int argc, char **argv)
+{
+    // Scene options can go anywhere; take them out before the modes below
+    int kept = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--sky") == 0 && i + 1 < argc)
+            skyBaseName = argv[++i];
+        else if (strcmp(argv[i], "--reflections") == 0 && i + 1 < argc)
+            reflectionBudgetMs = (float)atof(argv[++i]);
+        else
+            argv[kept++] = argv[i];
+    }
+    argc = kept;
+
+    if (argc > 1 && argv[1][0] == '-') {
+        if (strcmp(argv[1], "--convert") == 0 && argc == 4)
+            return SurfaceGrid::convert(argv[2], argv[3]) ? EXIT_SUCCESS : EXIT_FAILURE;
+        if (strcmp(argv[1], "--build-tiles") == 0 && argc >= 4) {
+            SurfaceGrid grid;
+            if (!grid.load(argv[2])) return EXIT_FAILURE;
+            return TileStream::build(grid, argv[3], argc > 4 ? atoi(argv[4]) : 33) ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        if (strcmp(argv[1], "--build-texture") == 0 && argc == 4) {
+            TextureCodec codec;
+            if (!parseCodec(argv[3], codec)) return EXIT_FAILURE;
+            return Texture::buildCompressed(argv[2], codec) ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        if (strcmp(argv[1], "--build-cubemap") == 0 && argc == 5) {
+            TextureCodec codec;
+            if (!parseCodec(argv[4], codec)) return EXIT_FAILURE;
+            return Texture::buildCompressedCubeMap(argv[2], argv[3], codec) ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        if (strcmp(argv[1], "--build-ibl") == 0 && argc == 3) {
+            return EnvironmentMap::bake(argv[2]) ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        if (strcmp(argv[1], "--tiles") == 0 && argc >= 3) {
+            tileFile = argv[2];
+            if (argc > 3) tileBudgetMB = (size_t)atoi(argv[3]);
+        } else if (strcmp(argv[1], "--bench-surface") == 0) {
+            benchmarkSurfaceLoading(argc > 2 ? atoi(argv[2]) : 4096);
+            return EXIT_SUCCESS;
+        } else if (strcmp(argv[1], "--bench-obj") == 0 && argc >= 3) {
+            ObjMesh::benchmarkLoading(argv[2]);
+            return EXIT_SUCCESS;
+        } else if (strcmp(argv[1], "--bench-normals") == 0 && argc >= 3) {
+            ObjMesh::benchmarkNormals(argv[2]);
+            return EXIT_SUCCESS;
+        } else if (strcmp(argv[1], "--bench-adjacency") == 0) {
+            ObjMesh::benchmarkAdjacency(argc > 2 ? (size_t)atol(argv[2]) : (1 << 21));
+            return EXIT_SUCCESS;
+        } else if (strcmp(argv[1], "--bench-cache") == 0 && argc >= 3) {
+            ObjMesh::benchmarkCache(argv[2]);
+            return EXIT_SUCCESS;
+        } else if (strcmp(argv[1], "--bench-vertex") == 0) {
+            benchMesh = benchmarkVertexFormats;
+            if (argc > 2) benchObjFile = argv[2];
+        } else if (strcmp(argv[1], "--bench-optimize") == 0) {
+            benchMesh = benchmarkMeshOptimization;
+            if (argc > 2) benchObjFile = argv[2];
+        } else if (strcmp(argv[1], "--bench-lod") == 0) {
+            benchMesh = benchmarkLodChain;
+            if (argc > 2) benchObjFile = argv[2];
+        } else if (strcmp(argv[1], "--bench-meshlets") == 0) {
+            benchMesh = benchmarkMeshlets;
+            if (argc > 2) benchObjFile = argv[2];
+        } else if (strcmp(argv[1], "--bench-generation") == 0) {
+            benchMesh = benchmarkMeshGeneration;
+            if (argc > 2) benchObjFile = argv[2];
+        } else if (strcmp(argv[1], "--bench-static") == 0) {
+            benchMesh = benchmarkStaticMeshes;
+        } else if (strcmp(argv[1], "--bench-arena") == 0) {
+            benchMesh = benchmarkMeshArena;
+            if (argc > 2) benchObjFile = argv[2];
+        } else if (strcmp(argv[1], "--bench-teapot") == 0) {
+            benchMesh = benchmarkTeapotTessellation;
+        } else if (strcmp(argv[1], "--bench-textures") == 0 && argc >= 3) {
+            benchMesh = benchmarkTextureLoading;
+            benchObjFile = argv[2];
+        } else if (strcmp(argv[1], "--bench-tes") == 0) {
+            benchTesFrames = argc > 2 ? atoi(argv[2]) : 200;
+            if (benchTesFrames < 1) benchTesFrames = 1;
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    } else if (argc > 1) {
+        surfaceFile = argv[1];
+    }
+
+    GLFWwindow* window;
+
+	lastTime = 0;
+	nFrames = 0;
+
+    glfwSetErrorCallback(error_callback);
+    if (!glfwInit())
+        exit(EXIT_FAILURE);
+
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
+
+    window = glfwCreateWindow(800, 600, "Stylized Water", NULL, NULL);
+    if (!window)
+    {
+        glfwTerminate();
+        exit(EXIT_FAILURE);
+    }
+    glfwSetKeyCallback(window, key_callback);
+
+    if (benchMesh) {
+        glfwMakeContextCurrent(window);
+        gladLoadGL();
+        benchMesh(benchObjFile);
+        glfwDestroyWindow(window);
+        glfwTerminate();
+        return EXIT_SUCCESS;
+    }
+
+    glfwSetMouseButtonCallback(window, mouse_button_callback);
+    glfwSetCursorPosCallback(window, rotateCamera);
+
+    tessLevel = 8;
+    cameraPos = vec3(-40,120,-40);
+    camZVec = glm::normalize(lookAtPoint- cameraPos);
+
+    // The render thread takes over the GL context; this thread keeps
+    // handling GLFW events and the camera simulation.
+    settingsQueue.push(snapshotSettings(window));
+    std::thread renderThread(renderLoop, window);
+
+    while (!glfwWindowShouldClose(window))
+    {
+        glfwWaitEventsTimeout(1.0/240.0);
+
+        camZVec = glm::normalize(lookAtPoint- cameraPos);
+
+        // If the queue is full the render thread is behind; the next
+        // iteration pushes an even newer snapshot anyway.
+        settingsQueue.push(snapshotSettings(window));
+
+        updateTitle(window);
+    }
+
+    renderRunning.store(false);
+    renderThread.join();
+
     glfwDestroyWindow(window);
     glfwTerminate();
     exit(EXIT_SUCCESS);
 }
-
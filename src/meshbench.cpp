@@ -0,0 +1,962 @@
+#include "meshbench.h"
+
+#include <glad/glad.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "allocationcounter.h"
+#include "cube.h"
+#include "environmentmap.h"
+#include "glslprogram.h"
+#include "mesharena.h"
+#include "meshlets.h"
+#include "meshoptimizer.h"
+#include "objmesh.h"
+#include "plane.h"
+#include "skybox.h"
+#include "sphere.h"
+#include "staticmesh.h"
+#include "teapot.h"
+#include "teapotpatch.h"
+#include "texture.h"
+#include "textureloader.h"
+#include "threadpool.h"
+#include "torus.h"
+#include "stb/stb_image.h"
+
+namespace {
+    // Reads every attribute so none of them can be skipped
+    const char *FETCH_VS =
+        "#version 410\n"
+        "layout(location=0) in vec3 VertexPosition;\n"
+        "layout(location=1) in vec3 VertexNormal;\n"
+        "layout(location=2) in vec2 VertexTexCoord;\n"
+        "layout(location=3) in vec4 VertexTangent;\n"
+        "uniform mat4 PositionTransform;\n"
+        "void main() {\n"
+        "    gl_Position = PositionTransform * vec4(VertexPosition, 1.0) +\n"
+        "        0.001 * (vec4(VertexNormal, 0.0) + vec4(VertexTexCoord, 0.0, 0.0) + VertexTangent);\n"
+        "}\n";
+    const char *FETCH_FS =
+        "#version 410\n"
+        "out vec4 FragColor;\n"
+        "void main() { FragColor = vec4(1.0); }\n";
+
+    // Depth tested with a fragment shader heavy enough for overdraw to show
+    const char *SHADE_VS =
+        "#version 410\n"
+        "layout(location=0) in vec3 VertexPosition;\n"
+        "layout(location=1) in vec3 VertexNormal;\n"
+        "uniform mat4 MVP;\n"
+        "out vec3 Normal;\n"
+        "void main() {\n"
+        "    Normal = VertexNormal;\n"
+        "    gl_Position = MVP * vec4(VertexPosition, 1.0);\n"
+        "}\n";
+    const char *SHADE_FS =
+        "#version 410\n"
+        "in vec3 Normal;\n"
+        "out vec4 FragColor;\n"
+        "void main() {\n"
+        "    vec3 c = normalize(Normal);\n"
+        "    for (int i = 0; i < 32; i++) c = abs(sin(c * 3.1 + vec3(0.1, 0.2, 0.3)));\n"
+        "    FragColor = vec4(c, 1.0);\n"
+        "}\n";
+
+    // SHADE_VS with a per object offset and scale (xyz, w) in an instanced
+    // attribute, picked by the draw's base instance
+    const char *OBJECT_VS =
+        "#version 410\n"
+        "layout(location=0) in vec3 VertexPosition;\n"
+        "layout(location=1) in vec3 VertexNormal;\n"
+        "layout(location=4) in vec4 ObjectOffset;\n"
+        "uniform mat4 MVP;\n"
+        "out vec3 Normal;\n"
+        "void main() {\n"
+        "    Normal = VertexNormal;\n"
+        "    gl_Position = MVP * vec4(VertexPosition * ObjectOffset.w + ObjectOffset.xyz, 1.0);\n"
+        "}\n";
+
+    // SHADE_FS for the tessellated teapot, whose normal comes out of the TES
+    const char *PATCH_FS =
+        "#version 410\n"
+        "in vec3 WorldNormal;\n"
+        "out vec4 FragColor;\n"
+        "void main() {\n"
+        "    vec3 c = normalize(WorldNormal);\n"
+        "    for (int i = 0; i < 32; i++) c = abs(sin(c * 3.1 + vec3(0.1, 0.2, 0.3)));\n"
+        "    FragColor = vec4(c, 1.0);\n"
+        "}\n";
+
+    const int WARMUP_DRAWS = 5;
+    const int TIMED_DRAWS = 50;
+
+    struct NamedFormat {
+        const char *name;
+        VertexFormat format;
+    };
+
+    // Average GPU time of one draw, with rasterization off so only the
+    // vertex stage is measured
+    double timeDraws(const TriangleMesh &mesh, GLSLProgram &prog, GLuint query)
+    {
+        prog.setUniform("PositionTransform", mesh.getPositionTransform());
+        glEnable(GL_RASTERIZER_DISCARD);
+        for (int i = 0; i < WARMUP_DRAWS; i++) mesh.render();
+
+        glBeginQuery(GL_TIME_ELAPSED, query);
+        for (int i = 0; i < TIMED_DRAWS; i++) mesh.render();
+        glEndQuery(GL_TIME_ELAPSED);
+        glDisable(GL_RASTERIZER_DISCARD);
+
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+        return ns / 1.0e6 / TIMED_DRAWS;
+    }
+
+    bool buildProgram(GLSLProgram &prog, const char *vs, const char *fs)
+    {
+        // As std::string: the const char * overload takes a file name
+        try {
+            prog.compileShader(std::string(vs), GLSLShader::VERTEX);
+            prog.compileShader(std::string(fs), GLSLShader::FRAGMENT);
+            prog.link();
+        } catch (GLSLProgramException &e) {
+            fprintf(stderr, "%s\n", e.what());
+            return false;
+        }
+        return true;
+    }
+
+    template <typename T>
+    std::vector<T> readBuffer(GLuint buffer)
+    {
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        GLint64 bytes = 0;
+        glGetBufferParameteri64v(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &bytes);
+        std::vector<T> data(bytes / sizeof(T));
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 0, data.size() * sizeof(T), data.data());
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        return data;
+    }
+
+    // Average GPU time of one depth tested draw into the default framebuffer,
+    // over three views. fit scales the mesh into the view volume.
+    double timeShaded(TriangleMesh &mesh, GLSLProgram &prog, GLuint query, const glm::mat4 &fit, int lod = 0)
+    {
+        glEnable(GL_DEPTH_TEST);
+        double ms = 0.0;
+        for (int view = 0; view < 3; view++) {
+            glm::mat4 rot = glm::rotate(glm::mat4(1.0f), 0.5f, glm::vec3(1.0f, 0.0f, 0.0f)) *
+                            glm::rotate(glm::mat4(1.0f), view * 2.1f, glm::vec3(0.0f, 1.0f, 0.0f));
+            prog.setUniform("MVP", rot * fit * mesh.getPositionTransform());
+
+            for (int i = 0; i < WARMUP_DRAWS; i++) {
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                mesh.render(lod);
+            }
+            // The clears are the same for every variant of a mesh
+            glBeginQuery(GL_TIME_ELAPSED, query);
+            for (int i = 0; i < TIMED_DRAWS; i++) {
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                mesh.render(lod);
+            }
+            glEndQuery(GL_TIME_ELAPSED);
+
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+            ms += ns / 1.0e6 / TIMED_DRAWS;
+        }
+        glDisable(GL_DEPTH_TEST);
+        return ms / 3.0;
+    }
+
+    // Average GPU time of draw(), which has to clear what it needs
+    double timeGpu(GLuint query, const std::function<void()> &draw)
+    {
+        for (int i = 0; i < WARMUP_DRAWS; i++) draw();
+        glBeginQuery(GL_TIME_ELAPSED, query);
+        for (int i = 0; i < TIMED_DRAWS; i++) draw();
+        glEndQuery(GL_TIME_ELAPSED);
+
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+        return ns / 1.0e6 / TIMED_DRAWS;
+    }
+
+    // Scale that fits the mesh into the view volume, from its float positions
+    glm::mat4 fitMesh(TriangleMesh &mesh)
+    {
+        std::vector<GLfloat> points = readBuffer<GLfloat>(mesh.getPositionBuffer());
+        float extent = 0.0f;
+        for (GLfloat p : points) extent = glm::max(extent, glm::abs(p));
+        return glm::scale(glm::mat4(1.0f), glm::vec3(extent > 0.0f ? 0.9f / extent : 1.0f));
+    }
+
+    std::unique_ptr<TriangleMesh> createBenchMesh(int m, const char *objFile)
+    {
+        if (m == 0) return std::unique_ptr<TriangleMesh>(new Teapot(64, glm::mat4(1.0f)));
+        if (m == 1) return std::unique_ptr<TriangleMesh>(new Torus(0.7f, 0.3f, 512, 512));
+        if (m == 2) return std::unique_ptr<TriangleMesh>(new Sphere(1.0f, 512, 512));
+        return ObjMesh::load(objFile);
+    }
+
+    // The path Cube and SkyBox used to take: the data copied into vectors,
+    // then optimized and uploaded by the std::vector initBuffers
+    class VectorMesh : public TriangleMesh {
+    public:
+        template <size_t V, size_t I, bool T, bool G>
+        explicit VectorMesh(const StaticMeshData<V, I, T, G> &d)
+        {
+            std::vector<GLuint> el(d.indices.begin(), d.indices.end());
+            std::vector<GLfloat> p(d.points.begin(), d.points.end());
+            std::vector<GLfloat> n(d.normals.begin(), d.normals.end());
+            std::vector<GLfloat> tc(d.texCoords.begin(), d.texCoords.end());
+            std::vector<GLfloat> tang(d.tangents.begin(), d.tangents.end());
+            initBuffers(&el, &p, &n, T ? &tc : nullptr, G ? &tang : nullptr);
+        }
+    };
+}
+
+void benchmarkVertexFormats(const char *objFile)
+{
+    GLSLProgram prog;
+    if (!buildProgram(prog, FETCH_VS, FETCH_FS)) return;
+    prog.use();
+
+    GLuint query;
+    glGenQueries(1, &query);
+
+    NamedFormat formats[4] = {
+        { "separate float", VertexFormat() },
+        { "interleaved float", VertexFormat() },
+        { "packed", VertexFormat::compact(false) },
+        { "packed + snorm16 pos", VertexFormat::compact(true) },
+    };
+    formats[1].format.interleaved = true;
+
+    const char *meshes[4] = { "teapot", "torus", "sphere", objFile };
+    int nMeshes = objFile ? 4 : 3;
+
+    VertexFormat saved = TriangleMesh::getDefaultVertexFormat();
+    printf("%-24s %-22s %10s %8s %12s\n", "mesh", "format", "vertex KB", "saved", "ms / draw");
+    for (int m = 0; m < nMeshes; m++) {
+        size_t baseBytes = 0;
+        for (const NamedFormat &f : formats) {
+            TriangleMesh::setDefaultVertexFormat(f.format);
+            std::unique_ptr<TriangleMesh> mesh = createBenchMesh(m, objFile);
+
+            size_t bytes = mesh->getVertexBytes();
+            if (baseBytes == 0) baseBytes = bytes;
+            double ms = timeDraws(*mesh, prog, query);
+            printf("%-24s %-22s %10.0f %7.0f%% %12.3f\n", meshes[m], f.name, bytes / 1024.0,
+                   100.0 * (1.0 - (double)bytes / baseBytes), ms);
+        }
+    }
+    TriangleMesh::setDefaultVertexFormat(saved);
+
+    glDeleteQueries(1, &query);
+}
+
+void benchmarkMeshOptimization(const char *objFile)
+{
+    GLSLProgram fetchProg, shadeProg;
+    if (!buildProgram(fetchProg, FETCH_VS, FETCH_FS) || !buildProgram(shadeProg, SHADE_VS, SHADE_FS)) return;
+
+    GLuint query;
+    glGenQueries(1, &query);
+
+    struct NamedOptimization {
+        const char *name;
+        MeshOptimization optimization;
+    };
+    const NamedOptimization variants[3] = {
+        { "none", MeshOptimization::NONE },
+        { "vertex cache", MeshOptimization::VERTEX_CACHE },
+        { "vertex cache + overdraw", MeshOptimization::VERTEX_CACHE_AND_OVERDRAW },
+    };
+
+    const char *meshes[4] = { "teapot", "torus", "sphere", objFile };
+    int nMeshes = objFile ? 4 : 3;
+
+    // Float positions in their own buffer, so they can be read back for the fit
+    VertexFormat savedFormat = TriangleMesh::getDefaultVertexFormat();
+    MeshOptimization savedOptimization = TriangleMesh::getMeshOptimization();
+    MeshOptimization savedLoadOptimization = ObjMesh::getLoadOptimization();
+    TriangleMesh::setDefaultVertexFormat(VertexFormat());
+
+    printf("FIFO cache of %d vertices, %d draws per timing\n", MeshOptimizer::CACHE_SIZE, TIMED_DRAWS);
+    printf("%-24s %-24s %7s %7s %12s %12s\n", "mesh", "order", "ACMR", "ATVR", "vertex ms", "shaded ms");
+    for (int m = 0; m < nMeshes; m++) {
+        double baseVertexMs = 0.0, baseShadedMs = 0.0;
+        for (const NamedOptimization &v : variants) {
+            TriangleMesh::setMeshOptimization(v.optimization);
+            ObjMesh::setLoadOptimization(v.optimization);
+            std::unique_ptr<TriangleMesh> mesh = createBenchMesh(m, objFile);
+
+            std::vector<GLuint> indices = readBuffer<GLuint>(mesh->getElementBuffer());
+            std::vector<GLfloat> points = readBuffer<GLfloat>(mesh->getPositionBuffer());
+            MeshOptimizer::CacheStats stats =
+                MeshOptimizer::analyzeVertexCache(indices.data(), indices.size(), points.size() / 3);
+
+            glm::mat4 fit = fitMesh(*mesh);
+
+            fetchProg.use();
+            double vertexMs = timeDraws(*mesh, fetchProg, query);
+            shadeProg.use();
+            double shadedMs = timeShaded(*mesh, shadeProg, query, fit);
+
+            if (v.optimization == MeshOptimization::NONE) {
+                baseVertexMs = vertexMs;
+                baseShadedMs = shadedMs;
+                printf("%-24s %-24s %7.3f %7.3f %12.3f %12.3f\n", meshes[m], v.name, stats.acmr, stats.atvr,
+                       vertexMs, shadedMs);
+            } else {
+                printf("%-24s %-24s %7.3f %7.3f %6.3f %+4.0f%% %6.3f %+4.0f%%\n", meshes[m], v.name,
+                       stats.acmr, stats.atvr, vertexMs, 100.0 * (vertexMs / baseVertexMs - 1.0),
+                       shadedMs, 100.0 * (shadedMs / baseShadedMs - 1.0));
+            }
+        }
+    }
+    ObjMesh::setLoadOptimization(savedLoadOptimization);
+    TriangleMesh::setMeshOptimization(savedOptimization);
+    TriangleMesh::setDefaultVertexFormat(savedFormat);
+
+    glDeleteQueries(1, &query);
+}
+
+void benchmarkLodChain(const char *objFile)
+{
+    GLSLProgram shadeProg;
+    if (!buildProgram(shadeProg, SHADE_VS, SHADE_FS)) return;
+    shadeProg.use();
+
+    GLuint query;
+    glGenQueries(1, &query);
+
+    const char *meshes[4] = { "teapot", "torus", "sphere", objFile };
+    int nMeshes = objFile ? 4 : 3;
+    const float distances[4] = { 2.0f, 8.0f, 32.0f, 128.0f };
+    const float FOVY = glm::radians(60.0f);
+    const int VIEWPORT_HEIGHT = 600;
+
+    // Every mesh reordered, as the OBJ loader does by default
+    VertexFormat savedFormat = TriangleMesh::getDefaultVertexFormat();
+    MeshOptimization savedOptimization = TriangleMesh::getMeshOptimization();
+    std::vector<float> savedRatios = TriangleMesh::getDefaultLodRatios();
+    TriangleMesh::setDefaultVertexFormat(VertexFormat());
+    TriangleMesh::setMeshOptimization(MeshOptimization::VERTEX_CACHE_AND_OVERDRAW);
+    TriangleMesh::setDefaultLodRatios({ 1.0f, 0.5f, 0.25f, 0.1f });
+
+    for (int m = 0; m < nMeshes; m++) {
+        auto start = std::chrono::steady_clock::now();
+        std::unique_ptr<TriangleMesh> mesh = createBenchMesh(m, objFile);
+        double buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        glm::mat4 fit = fitMesh(*mesh);
+
+        printf("%s: built in %.0f ms\n", meshes[m], buildMs);
+        printf("  %5s %10s %8s %12s %12s\n", "level", "triangles", "%", "error", "shaded ms");
+        GLuint fullIndices = mesh->getLod(0).nIndices;
+        for (int lod = 0; lod < mesh->getLodCount(); lod++) {
+            const LodLevel &level = mesh->getLod(lod);
+            printf("  %5d %10u %7.1f%% %12.6f %12.3f\n", lod, level.nIndices / 3,
+                   100.0 * level.nIndices / fullIndices, level.error, timeShaded(*mesh, shadeProg, query, fit, lod));
+        }
+
+        printf("  selected at 60 deg, %d px, 1 px error:", VIEWPORT_HEIGHT);
+        for (float d : distances)
+            printf("  %g units -> %d", d, mesh->selectLod(TriangleMesh::pixelsPerUnit(d, FOVY, VIEWPORT_HEIGHT)));
+        printf("\n");
+    }
+    TriangleMesh::setDefaultLodRatios(savedRatios);
+    TriangleMesh::setMeshOptimization(savedOptimization);
+    TriangleMesh::setDefaultVertexFormat(savedFormat);
+
+    glDeleteQueries(1, &query);
+}
+
+void benchmarkMeshlets(const char *objFile)
+{
+    GLSLProgram shadeProg;
+    if (!buildProgram(shadeProg, SHADE_VS, SHADE_FS)) return;
+
+    GLuint query;
+    glGenQueries(1, &query);
+
+    // Meshlets take triangles in index order, so reorder the sphere as well
+    VertexFormat savedFormat = TriangleMesh::getDefaultVertexFormat();
+    MeshOptimization savedOptimization = TriangleMesh::getMeshOptimization();
+    TriangleMesh::setDefaultVertexFormat(VertexFormat());
+    TriangleMesh::setMeshOptimization(MeshOptimization::VERTEX_CACHE_AND_OVERDRAW);
+
+    std::unique_ptr<TriangleMesh> mesh;
+    std::vector<Meshlet> meshlets;
+    auto start = std::chrono::steady_clock::now();
+    if (objFile) {
+        std::unique_ptr<ObjMesh> obj = ObjMesh::loadWithMeshlets(objFile);
+        meshlets = obj->getMeshlets();
+        mesh = std::move(obj);
+    } else {
+        mesh.reset(new Sphere(1.0f, 1024, 1024));
+        std::vector<GLuint> indices = readBuffer<GLuint>(mesh->getElementBuffer());
+        std::vector<GLfloat> points = readBuffer<GLfloat>(mesh->getPositionBuffer());
+        meshlets = buildMeshlets(indices.data(), indices.size(), points.data(), points.size() / 3);
+    }
+    double loadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    TriangleMesh::setMeshOptimization(savedOptimization);
+    TriangleMesh::setDefaultVertexFormat(savedFormat);
+
+    std::unique_ptr<MeshletCuller> culler;
+    try {
+        culler.reset(new MeshletCuller(*mesh, meshlets));
+    } catch (GLSLProgramException &e) {
+        fprintf(stderr, "%s\n", e.what());
+        return;
+    }
+
+    size_t totalTris = mesh->getLod(0).nIndices / 3;
+    printf("%s: %zu triangles, %zu meshlets (%.1f triangles each), loaded in %.0f ms\n",
+           objFile ? objFile : "sphere", totalTris, meshlets.size(), (double)totalTris / meshlets.size(), loadMs);
+    printf("culling: %s\n", culler->hasCompute() ? "compute + glMultiDrawElementsIndirect" : "CPU + glMultiDrawElements (no GL 4.3)");
+
+    struct View {
+        const char *name;
+        glm::vec3 eye, target;
+    };
+    const View views[3] = {
+        { "whole mesh", glm::vec3(0.0f, 0.0f, 3.0f), glm::vec3(0.0f) },
+        { "close up", glm::vec3(0.0f, 0.3f, 1.25f), glm::vec3(0.0f, 0.6f, 0.0f) },
+        { "looking away", glm::vec3(0.0f, 0.0f, 3.0f), glm::vec3(0.0f, 0.0f, 6.0f) },
+    };
+    glm::mat4 fit = fitMesh(*mesh);
+    glm::mat4 projection = glm::perspective(glm::radians(60.0f), 4.0f / 3.0f, 0.05f, 100.0f);
+
+    glEnable(GL_DEPTH_TEST);
+    printf("%-14s %10s %10s %10s %12s %12s %12s\n", "view", "visible", "cpu check", "of all",
+           "full ms", "culled ms", "cpu cull ms");
+    for (const View &view : views) {
+        glm::mat4 modelView = glm::lookAt(view.eye, view.target, glm::vec3(0.0f, 1.0f, 0.0f)) * fit *
+                              mesh->getPositionTransform();
+        shadeProg.use();
+        shadeProg.setUniform("MVP", projection * modelView);
+
+        double fullMs = timeGpu(query, [&]() {
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            mesh->render();
+        });
+        double culledMs = timeGpu(query, [&]() {
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            culler->cull(modelView, projection);
+            shadeProg.use();
+            culler->render();
+        });
+        GLuint visible = culler->countVisible();
+
+        // The CPU path must agree; time its culling on the CPU side
+        culler->setUseCompute(false);
+        auto cpuStart = std::chrono::steady_clock::now();
+        culler->cull(modelView, projection);
+        double cpuMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - cpuStart).count();
+        GLuint cpuVisible = culler->countVisible();
+        culler->setUseCompute(true);
+
+        printf("%-14s %10u %10u %9.1f%% %12.3f %12.3f %12.3f\n", view.name, visible, cpuVisible,
+               100.0 * visible / meshlets.size(), fullMs, culledMs, cpuMs);
+    }
+    glDisable(GL_DEPTH_TEST);
+
+    glDeleteQueries(1, &query);
+}
+
+void benchmarkMeshGeneration(const char *maxGridArg)
+{
+    int maxGrid = maxGridArg ? atoi(maxGridArg) : 256;
+    if (maxGrid < 32) maxGrid = 32;
+
+    // Generation and upload only: no reordering (see --bench-optimize) or LODs
+    VertexFormat savedFormat = TriangleMesh::getDefaultVertexFormat();
+    MeshOptimization savedOptimization = TriangleMesh::getMeshOptimization();
+    std::vector<float> savedRatios = TriangleMesh::getDefaultLodRatios();
+    TriangleMesh::setDefaultVertexFormat(VertexFormat::compact());
+    TriangleMesh::setMeshOptimization(MeshOptimization::NONE);
+    TriangleMesh::setDefaultLodRatios({ 1.0f });
+
+    ThreadPool serial(1);
+    ThreadPool &parallel = ThreadPool::shared();
+
+    // Teapot patches are grid x grid, the torus and sphere get 4 * grid
+    // slices and stacks
+    auto create = [](int m, int grid, ThreadPool *pool) -> std::unique_ptr<TriangleMesh> {
+        if (m == 0) return std::unique_ptr<TriangleMesh>(new Teapot(grid, glm::mat4(1.0f), pool));
+        if (m == 1) return std::unique_ptr<TriangleMesh>(new Torus(0.7f, 0.3f, 4 * grid, 4 * grid, pool));
+        return std::unique_ptr<TriangleMesh>(new Sphere(1.0f, 4 * grid, 4 * grid, pool));
+    };
+    // Best of three, including the upload
+    auto timeCreate = [&](int m, int grid, ThreadPool *pool, std::unique_ptr<TriangleMesh> &mesh) {
+        double best = 0.0;
+        for (int run = 0; run < 3; run++) {
+            mesh.reset();
+            glFinish();
+            auto start = std::chrono::steady_clock::now();
+            mesh = create(m, grid, pool);
+            glFinish();
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            if (run == 0 || ms < best) best = ms;
+        }
+        return best;
+    };
+
+    const char *names[3] = { "teapot", "torus", "sphere" };
+    printf("Construction with packed interleaved vertices, serial against %u threads\n", parallel.size());
+    printf("(both fill the vertex buffer on the shared pool)\n");
+    printf("%-8s %12s %10s %12s %12s %9s\n", "mesh", "resolution", "vertices", "serial ms", "parallel ms", "speedup");
+    for (int m = 0; m < 3; m++) {
+        for (int grid = 32; grid <= maxGrid; grid *= 2) {
+            std::unique_ptr<TriangleMesh> a, b;
+            double serialMs = timeCreate(m, grid, &serial, a);
+            double parallelMs = timeCreate(m, grid, &parallel, b);
+            bool same = readBuffer<GLuint>(a->getElementBuffer()) == readBuffer<GLuint>(b->getElementBuffer()) &&
+                        readBuffer<unsigned char>(a->getPositionBuffer()) == readBuffer<unsigned char>(b->getPositionBuffer());
+
+            char resolution[32];
+            size_t vertices;
+            if (m == 0) {
+                snprintf(resolution, sizeof(resolution), "grid %d", grid);
+                vertices = 32 * (size_t)(grid + 1) * (grid + 1);
+            } else {
+                snprintf(resolution, sizeof(resolution), "%dx%d", 4 * grid, 4 * grid);
+                vertices = m == 1 ? (size_t)4 * grid * (4 * grid + 1) : (size_t)(4 * grid + 1) * (4 * grid + 1);
+            }
+            printf("%-8s %12s %10zu %12.1f %12.1f %8.2fx%s\n", names[m], resolution, vertices,
+                   serialMs, parallelMs, serialMs / parallelMs, same ? "" : "  (MISMATCH)");
+        }
+    }
+
+    TriangleMesh::setDefaultVertexFormat(savedFormat);
+    TriangleMesh::setMeshOptimization(savedOptimization);
+    TriangleMesh::setDefaultLodRatios(savedRatios);
+}
+
+void benchmarkStaticMeshes(const char *)
+{
+    // As small as the scene uses them
+    static constexpr auto PLANE = StaticMeshGenerator::plane<8, 8>(1.0f, 1.0f);
+    static constexpr auto SPHERE = StaticMeshGenerator::sphere<16, 8>(1.0f);
+    static constexpr auto TORUS = StaticMeshGenerator::torus<24, 12>(0.7f, 0.3f);
+
+    typedef std::function<TriangleMesh *()> Create;
+    struct Case {
+        const char *name;
+        Create runtime, compileTime;
+    };
+    const Case cases[5] = {
+        { "cube",
+          []() -> TriangleMesh * { return new VectorMesh(StaticMeshGenerator::cube(1.0f)); },
+          []() -> TriangleMesh * { return new Cube(1.0f); } },
+        { "sky box 2",
+          []() -> TriangleMesh * { return new VectorMesh(StaticMeshGenerator::skyBox(2.0f)); },
+          []() -> TriangleMesh * { return new SkyBox(2.0f); } },
+        { "plane 8x8",
+          []() -> TriangleMesh * { return new Plane(1.0f, 1.0f, 8, 8); },
+          []() -> TriangleMesh * { return new StaticMesh(PLANE); } },
+        { "sphere 16x8",
+          []() -> TriangleMesh * { return new Sphere(1.0f, 16, 8); },
+          []() -> TriangleMesh * { return new StaticMesh(SPHERE); } },
+        { "torus 24x12",
+          []() -> TriangleMesh * { return new Torus(0.7f, 0.3f, 24, 12); },
+          []() -> TriangleMesh * { return new StaticMesh(TORUS); } },
+    };
+
+    // Heap allocations of one construction, not counting the new of the
+    // mesh itself, and the best time of 20 including the upload
+    auto measure = [](const Create &create, size_t &allocations) {
+        double best = 0.0;
+        for (int run = 0; run < 20; run++) {
+            glFinish();
+            size_t before = heapAllocationCount();
+            auto start = std::chrono::steady_clock::now();
+            std::unique_ptr<TriangleMesh> mesh(create());
+            glFinish();
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            allocations = heapAllocationCount() - before - 1;
+            if (run == 0 || ms < best) best = ms;
+        }
+        return best;
+    };
+
+    printf("Construction from std::vector data built at run time against constexpr data\n");
+    printf("%-12s %9s %9s %10s %10s\n", "mesh", "allocs", "static", "ms", "static ms");
+    size_t total[2] = { 0, 0 };
+    for (const Case &c : cases) {
+        size_t runtimeAllocs = 0, staticAllocs = 0;
+        double runtimeMs = measure(c.runtime, runtimeAllocs);
+        double staticMs = measure(c.compileTime, staticAllocs);
+        total[0] += runtimeAllocs;
+        total[1] += staticAllocs;
+        printf("%-12s %9zu %9zu %10.3f %10.3f\n", c.name, runtimeAllocs, staticAllocs, runtimeMs, staticMs);
+    }
+    printf("%-12s %9zu %9zu\n", "total", total[0], total[1]);
+    printf("(what is left is TriangleMesh bookkeeping: its buffer and LOD lists)\n");
+}
+
+void benchmarkMeshArena(const char *countArg)
+{
+    int count = countArg ? atoi(countArg) : 1000;
+    if (count < 1) count = 1;
+    if (!GLAD_GL_VERSION_4_3) {
+        printf("The arena benchmark needs GL 4.3 (multi draw indirect)\n");
+        return;
+    }
+
+    GLSLProgram prog;
+    if (!buildProgram(prog, OBJECT_VS, SHADE_FS)) return;
+    prog.use();
+
+    static constexpr auto SPHERE = StaticMeshGenerator::sphere<16, 8>(1.0f);
+    static constexpr auto TORUS = StaticMeshGenerator::torus<24, 12>(0.7f, 0.3f);
+    auto create = [](int i) -> std::unique_ptr<TriangleMesh> {
+        if (i % 3 == 0) return std::unique_ptr<TriangleMesh>(new Cube(1.0f));
+        if (i % 3 == 1) return std::unique_ptr<TriangleMesh>(new StaticMesh(SPHERE));
+        return std::unique_ptr<TriangleMesh>(new StaticMesh(TORUS));
+    };
+
+    // Own buffers and VAO per mesh, then the same meshes in an arena. The
+    // arena is declared first so that it outlives its meshes.
+    MeshArena arena;
+    std::vector<std::unique_ptr<TriangleMesh>> separate, pooled;
+    for (int i = 0; i < count; i++) separate.push_back(create(i));
+    MeshArena *savedArena = TriangleMesh::getDefaultArena();
+    TriangleMesh::setDefaultArena(&arena);
+    for (int i = 0; i < count; i++) pooled.push_back(create(i));
+    TriangleMesh::setDefaultArena(savedArena);
+
+    // Objects on a square grid in [-1, 1]
+    int side = (int)ceil(sqrt((double)count));
+    float cell = 2.0f / side;
+    std::vector<glm::vec4> objects(count);
+    for (int i = 0; i < count; i++)
+        objects[i] = glm::vec4(-1.0f + cell * (i % side + 0.5f), -1.0f + cell * (i / side + 0.5f), 0.0f, 0.35f * cell);
+    GLuint objectBuffer;
+    glGenBuffers(1, &objectBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, objectBuffer);
+    glBufferData(GL_ARRAY_BUFFER, objects.size() * sizeof(glm::vec4), objects.data(), GL_STATIC_DRAW);
+    // Every VAO reads the object data as instance attribute 4
+    auto addObjectAttribute = [&](GLuint vao) {
+        glBindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, objectBuffer);
+        glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, 0, 0);
+        glVertexAttribDivisor(4, 1);
+        glEnableVertexAttribArray(4);
+    };
+    for (auto &m : separate) addObjectAttribute(m->getVao());
+    for (int b = 0; b < arena.getBlockCount(); b++) addObjectAttribute(arena.getVao(b));
+    glBindVertexArray(0);
+
+    MeshBatch batch;
+    for (auto &m : pooled) batch.add(*m);
+
+    prog.setUniform("MVP", glm::rotate(glm::mat4(1.0f), 0.3f, glm::vec3(1.0f, 0.0f, 0.0f)));
+
+    // Object i is instance i of a one instance draw
+    auto drawEach = [](std::vector<std::unique_ptr<TriangleMesh>> &meshes) {
+        for (size_t i = 0; i < meshes.size(); i++) {
+            DrawElementsIndirectCommand cmd = meshes[i]->getDrawCommand(0, 1, (GLuint)i);
+            glBindVertexArray(meshes[i]->getVao());
+            glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, cmd.count, GL_UNSIGNED_INT,
+                                                          (const GLvoid *)(cmd.firstIndex * sizeof(GLuint)),
+                                                          1, cmd.baseVertex, cmd.baseInstance);
+        }
+        glBindVertexArray(0);
+    };
+    const char *names[3] = { "own VAO per mesh", "arena, draw each", "arena, MeshBatch" };
+    std::function<void()> draws[3] = {
+        [&]() { drawEach(separate); },
+        [&]() { drawEach(pooled); },
+        [&]() { batch.render(); },
+    };
+    size_t drawCalls[3] = { (size_t)count, (size_t)count, batch.getDrawCalls() };
+    size_t vaos[3] = { (size_t)count, (size_t)arena.getBlockCount(), (size_t)arena.getBlockCount() };
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    GLuint query;
+    glGenQueries(1, &query);
+
+    printf("%d cubes, spheres and tori (%.1f KB of %.1f KB in %d arena blocks)\n", count,
+           arena.getUsedBytes() / 1024.0, arena.getCapacityBytes() / 1024.0, arena.getBlockCount());
+    printf("%-18s %8s %6s %12s %8s %6s\n", "path", "draws", "VAOs", "submit ms", "GPU ms", "image");
+    glEnable(GL_DEPTH_TEST);
+    std::vector<unsigned char> reference;
+    for (int p = 0; p < 3; p++) {
+        // CPU time to issue the draws, averaged and separate from the GPU time
+        for (int i = 0; i < WARMUP_DRAWS; i++) draws[p]();
+        glFinish();
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < TIMED_DRAWS; i++) draws[p]();
+        double submitMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / TIMED_DRAWS;
+        glFinish();
+
+        double gpuMs = timeGpu(query, [&]() {
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            draws[p]();
+        });
+
+        // Every path has to draw the same picture
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        draws[p]();
+        std::vector<unsigned char> image((size_t)viewport[2] * viewport[3] * 4);
+        glReadPixels(0, 0, viewport[2], viewport[3], GL_RGBA, GL_UNSIGNED_BYTE, image.data());
+        if (p == 0) reference = image;
+
+        printf("%-18s %8zu %6zu %12.3f %8.3f %6s\n", names[p], drawCalls[p], vaos[p], submitMs, gpuMs,
+               p == 0 ? "ref" : image == reference ? "same" : "DIFF");
+    }
+    glDisable(GL_DEPTH_TEST);
+
+    glDeleteQueries(1, &query);
+    glDeleteBuffers(1, &objectBuffer);
+}
+
+void benchmarkTeapotTessellation(const char *)
+{
+    GLSLProgram meshProg, patchProg;
+    if (!buildProgram(meshProg, SHADE_VS, SHADE_FS)) return;
+    try {
+        patchProg.compileShader("shader/teapotVertex.glsl", GLSLShader::VERTEX);
+        patchProg.compileShader("shader/teapotTessC.glsl", GLSLShader::TESS_CONTROL);
+        patchProg.compileShader("shader/teapotTessE.glsl", GLSLShader::TESS_EVALUATION);
+        patchProg.compileShader(std::string(PATCH_FS), GLSLShader::FRAGMENT);
+        patchProg.link();
+    } catch (GLSLProgramException &e) {
+        fprintf(stderr, "%s\n", e.what());
+        return;
+    }
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    const float EDGE_PIXELS = 8.0f;
+    patchProg.use();
+    patchProg.setUniform("ViewportSize", glm::vec2((float)viewport[2], (float)viewport[3]));
+    patchProg.setUniform("EdgePixels", EDGE_PIXELS);
+    patchProg.setUniform("MaxTessLevel", 64.0f);
+
+    std::unique_ptr<TriangleMesh> meshes[2] = {
+        std::unique_ptr<TriangleMesh>(new Teapot(16, glm::mat4(1.0f))),
+        std::unique_ptr<TriangleMesh>(new Teapot(64, glm::mat4(1.0f))),
+    };
+    TeapotPatch patches;
+    const char *names[3] = { "Teapot grid 16", "Teapot grid 64", "TeapotPatch" };
+    size_t bytes[3];
+    for (int m = 0; m < 2; m++) {
+        GLint64 indexBytes = 0;
+        glBindBuffer(GL_COPY_READ_BUFFER, meshes[m]->getElementBuffer());
+        glGetBufferParameteri64v(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &indexBytes);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        bytes[m] = meshes[m]->getVertexBytes() + (size_t)indexBytes;
+    }
+    bytes[2] = 32 * 16 * 3 * sizeof(GLfloat);
+
+    GLuint queries[2];
+    glGenQueries(2, queries);
+
+    // The teapot is about 6 units across
+    const float distances[3] = { 5.0f, 15.0f, 60.0f };
+    glm::mat4 model = glm::rotate(glm::mat4(1.0f), glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f)) *
+                      glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -1.5f));
+    glm::mat4 projection = glm::perspective(glm::radians(60.0f), (float)viewport[2] / viewport[3], 0.1f, 100.0f);
+
+    printf("Teapot at %dx%d, tessellated to %.0f pixel edges\n", viewport[2], viewport[3], EDGE_PIXELS);
+    printf("%-16s %10s", "path", "GPU KB");
+    for (float d : distances) printf("   %5.0f: %9s %8s", d, "triangles", "ms");
+    printf("\n");
+
+    glEnable(GL_DEPTH_TEST);
+    for (int m = 0; m < 3; m++) {
+        printf("%-16s %10.1f", names[m], bytes[m] / 1024.0);
+        for (float d : distances) {
+            glm::mat4 view = glm::lookAt(glm::vec3(0.0f, d * 0.3f, d), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+            std::function<void()> draw;
+            if (m < 2) {
+                meshProg.use();
+                meshProg.setUniform("MVP", projection * view * model * meshes[m]->getPositionTransform());
+                draw = [&]() { meshes[m]->render(); };
+            } else {
+                patchProg.use();
+                patchProg.setUniform("projection", projection);
+                patchProg.setUniform("view", view);
+                patchProg.setUniform("model", model);
+                draw = [&]() { patches.render(); };
+            }
+
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glBeginQuery(GL_PRIMITIVES_GENERATED, queries[1]);
+            draw();
+            glEndQuery(GL_PRIMITIVES_GENERATED);
+            GLuint64 triangles = 0;
+            glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &triangles);
+
+            double ms = timeGpu(queries[0], [&]() {
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                draw();
+            });
+            printf("          %9llu %8.3f", (unsigned long long)triangles, ms);
+        }
+        printf("\n");
+    }
+    glDisable(GL_DEPTH_TEST);
+
+    glDeleteQueries(2, queries);
+}
+
+void benchmarkTextureLoading(const char *baseName)
+{
+    if (!baseName) {
+        fprintf(stderr, "--bench-textures needs a cube map base name\n");
+        return;
+    }
+
+    // Face files are <baseName>_posx<ext> etc.
+    const char *extensions[3] = { ".png", ".jpg", ".hdr" };
+    const char *ext = NULL;
+    for (const char *e : extensions) {
+        FILE *f = fopen((std::string(baseName) + "_posx" + e).c_str(), "rb");
+        if (f) {
+            fclose(f);
+            ext = e;
+            break;
+        }
+    }
+    if (!ext) {
+        fprintf(stderr, "No %s_posx.png, .jpg or .hdr\n", baseName);
+        return;
+    }
+    bool hdr = strcmp(ext, ".hdr") == 0;
+    const char *suffixes[] = { "posx", "negx", "posy", "negy", "posz", "negz" };
+    typedef std::chrono::steady_clock Clock;
+    auto msSince = [](Clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    };
+
+    // What the old loaders did on the GL thread before uploading
+    auto start = Clock::now();
+    for (const char *s : suffixes) {
+        std::string name = std::string(baseName) + "_" + s + ext;
+        int w, h;
+        void *pixels = hdr ? (void *)stbi_loadf(name.c_str(), &w, &h, NULL, 3)
+                           : (void *)Texture::loadPixels(name, w, h, false);
+        stbi_image_free(pixels);
+    }
+    double serialMs = msSince(start);
+
+    start = Clock::now();
+    GLuint tex = hdr ? Texture::loadHdrCubeMap(baseName) : Texture::loadCubeMap(baseName, ext);
+    glFinish();
+    double syncMs = msSince(start);
+    glDeleteTextures(1, &tex);
+
+    // Frames keep going while the cube map loads; the handle is usable from
+    // the first one
+    start = Clock::now();
+    TextureLoader loader;
+    TextureLoader::Handle handle = hdr ? loader.loadHdrCubeMap(baseName) : loader.loadCubeMap(baseName, ext);
+    double handleMs = msSince(start);
+    int frames = 0;
+    double maxUpdateMs = 0.0;
+    while (loader.getPendingCount() > 0) {
+        auto updateStart = Clock::now();
+        loader.update();
+        maxUpdateMs = glm::max(maxUpdateMs, msSince(updateStart));
+        glBindTexture(GL_TEXTURE_CUBE_MAP, loader.get(handle));
+        glFinish();
+        frames++;
+    }
+    double readyMs = msSince(start);
+
+    // Block compressed with mips, from scratch (encode and write the .sotx
+    // file) and from the file
+    TextureCodec codec = hdr ? TextureCodec::BC6H : TextureCodec::BC1;
+    std::error_code ec;
+    std::filesystem::remove(Texture::compressedCubeMapFileName(baseName, ext), ec);
+    double compressedMs[2];
+    for (int run = 0; run < 2; run++) {
+        start = Clock::now();
+        tex = Texture::loadCompressedCubeMap(baseName, ext, codec);
+        glFinish();
+        compressedMs[run] = msSince(start);
+        glDeleteTextures(1, &tex);
+    }
+
+    int w, h;
+    Texture::deletePixels(Texture::loadPixels(std::string(baseName) + "_posx" + ext, w, h, false));
+    size_t texels = 0, packedBytes = 0;
+    for (int level = 0; level < Texture::mipLevels(w, h); level++) {
+        int lw = glm::max(w >> level, 1), lh = glm::max(h >> level, 1);
+        texels += (size_t)6 * lw * lh;
+        packedBytes += 6 * BlockCompressor::imageBytes(codec, lw, lh);
+    }
+    size_t plainBytes = texels * (hdr ? 12 : 4);
+
+    // HDR storage formats, and the IBL bake from scratch and from its cache
+    const HdrFormat hdrFormats[3] = { HdrFormat::RGB32F, HdrFormat::RGB16F, HdrFormat::R11G11B10F };
+    const char *hdrFormatNames[3] = { "RGB32F", "RGB16F", "R11G11B10F" };
+    const int hdrTexelBytes[3] = { 12, 6, 4 };
+    double hdrMs[3], iblMs[3];
+    bool iblOk = true;
+    if (hdr) {
+        for (int i = 0; i < 3; i++) {
+            start = Clock::now();
+            tex = Texture::loadHdrCubeMap(baseName, hdrFormats[i]);
+            glFinish();
+            hdrMs[i] = msSince(start);
+            glDeleteTextures(1, &tex);
+        }
+        // Cold on the CPU, cold with compute shaders (if there are any), warm
+        for (int run = 0; run < 3; run++) {
+            EnvironmentMap env;
+            env.setUseCompute(run == 1);
+            if (run == 1 && !env.hasCompute()) {
+                iblMs[run] = -1.0;
+                continue;
+            }
+            if (run < 2) std::filesystem::remove(EnvironmentMap::cacheFileName(baseName), ec);
+            start = Clock::now();
+            iblOk = env.load(baseName) && iblOk;
+            glFinish();
+            iblMs[run] = msSince(start);
+        }
+    }
+
+    printf("Cube map %s_*%s, staging through %s\n", baseName, ext,
+           loader.hasPersistentStaging() ? "a persistently mapped PBO" : "client memory");
+    printf("%-40s %10.1f ms\n", "serial decode only (old GL thread cost)", serialMs);
+    printf("%-40s %10.1f ms\n", "Texture::loadCubeMap (parallel decode)", syncMs);
+    printf("%-40s %10.1f ms\n", "TextureLoader: handle available", handleMs);
+    printf("%-40s %10.1f ms  (%d frames, longest update %.2f ms)%s\n", "TextureLoader: ready", readyMs,
+           frames, maxUpdateMs, loader.isReady(handle) ? "" : "  (FAILED)");
+    const char *codecName = hdr ? "BC6H" : "BC1";
+    if (!Texture::isSupported(codec)) printf("%s not supported, compressed rows are uncompressed\n", codecName);
+    printf("%-40s %10.1f ms\n", (std::string(codecName) + " first run (encode + write)").c_str(), compressedMs[0]);
+    printf("%-40s %10.1f ms\n", (std::string(codecName) + " from .sotx").c_str(), compressedMs[1]);
+    printf("VRAM with mips: %s %.1f MB, %s %.1f MB (%.1fx smaller)\n", hdr ? "RGB32F" : "RGBA8",
+           plainBytes / 1048576.0, codecName, packedBytes / 1048576.0, (double)plainBytes / packedBytes);
+    if (hdr) {
+        // RGB16F as stored; drivers may pad it to 8 bytes per texel
+        for (int i = 0; i < 3; i++)
+            printf("%-40s %10.1f ms  %8.1f MB\n", (std::string("Texture::loadHdrCubeMap ") + hdrFormatNames[i]).c_str(),
+                   hdrMs[i], texels * hdrTexelBytes[i] / 1048576.0);
+        printf("%-40s %10.1f ms%s\n", "IBL bake on the CPU (write cache)", iblMs[0], iblOk ? "" : "  (FAILED)");
+        if (iblMs[1] >= 0.0) printf("%-40s %10.1f ms\n", "IBL bake with compute (write cache)", iblMs[1]);
+        else printf("IBL bake with compute: no GL 4.3\n");
+        printf("%-40s %10.1f ms\n", "IBL from cache", iblMs[2]);
+    }
+}
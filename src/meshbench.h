@@ -0,0 +1,44 @@
+#pragma once
+
+// Mesh and texture benchmarks that need a current GL context. objFile may be null.
+
+// GPU memory and vertex fetch time of the TriangleMesh vertex formats for the
+// teapot, torus, sphere and (optionally) an OBJ mesh
+void benchmarkVertexFormats(const char * objFile);
+
+// Vertex cache statistics (ACMR/ATVR) and GPU time of the same meshes built
+// without optimization, in vertex cache order, and with overdraw ordering
+void benchmarkMeshOptimization(const char * objFile);
+
+// Triangle count, error and GPU time of every level of a 100/50/25/10% LOD
+// chain, and the level selectLod() picks at a few distances
+void benchmarkLodChain(const char * objFile);
+
+// Meshlet culling (frustum and normal cone) against drawing everything, for
+// a few views of a 2M triangle sphere or an OBJ mesh
+void benchmarkMeshlets(const char * objFile);
+
+// Construction time of the teapot, torus and sphere at rising resolution
+// (teapot grid 32 up to maxGrid, default 256; 4x that in slices and stacks),
+// generated serially and on the shared thread pool
+void benchmarkMeshGeneration(const char * maxGrid);
+
+// Heap allocations and construction time of the small cube, sky box,
+// plane, sphere and torus built from std::vector data against StaticMesh
+// data generated at compile time
+void benchmarkStaticMeshes(const char * unused);
+
+// count (default 1000) small meshes drawn one by one with their own VAOs,
+// one by one from a MeshArena, and as a single MeshBatch: draw calls, CPU
+// submission time and GPU time. Needs GL 4.3.
+void benchmarkMeshArena(const char * count);
+
+// GPU memory, triangle count and GPU time of the CPU tessellated Teapot
+// against TeapotPatch drawn through the adaptive tessellation shaders, at a
+// few distances. Reads the shaders from shader/.
+void benchmarkTeapotTessellation(const char * unused);
+
+// Startup cost of a cube map (<baseName>_posx.png etc., or .jpg/.hdr): the old
+// serial decode, Texture::loadCubeMap, TextureLoader with frames running
+// until it lands, and the BC1/BC6H compressed load with its VRAM saving
+void benchmarkTextureLoading(const char * baseName);
@@ -0,0 +1,12 @@
+#version 410
+
+// Lines take the kind of their last vertex: markers red, du green, dv blue
+flat in int Kind;
+
+layout (location = 0) out vec4 FragColor;
+
+void main()
+{
+    const vec3 colours[3] = vec3[3](vec3(1.0, 0.0, 0.0), vec3(0.0, 1.0, 0.0), vec3(0.0, 0.4, 1.0));
+    FragColor = vec4(colours[Kind], 1.0);
+}
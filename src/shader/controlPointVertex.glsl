@@ -0,0 +1,38 @@
+#version 410
+
+// One instance per control point, read straight from the frame's patch
+// buffer: 12 vec3 per patch, the 4 corners (i,j) (i+1,j) (i+1,j+1) (i,j+1),
+// then their du and their dv.
+layout (location = 0) in vec4 Template;  // xyz: marker corner; w: 0 marker, 1 du tip, 2 dv tip
+
+uniform samplerBuffer Patches;
+uniform mat4 MVP;
+uniform ivec2 GridSize;     // M, N; zero when the patches do not form one grid (tiles)
+uniform float MarkerSize;
+uniform float VectorScale;
+
+flat out int Kind;
+
+void main()
+{
+    int patchIndex, corner;
+    if (GridSize.x > 0) {
+        // Every point once: the last row and column are the far corners of
+        // the last patches
+        int i = gl_InstanceID / GridSize.y, j = gl_InstanceID % GridSize.y;
+        int pi = min(i, GridSize.x - 2), pj = min(j, GridSize.y - 2);
+        patchIndex = pi * (GridSize.y - 1) + pj;
+        corner = i > pi ? (j > pj ? 2 : 1) : (j > pj ? 3 : 0);
+    } else {
+        patchIndex = gl_InstanceID / 4;
+        corner = gl_InstanceID % 4;
+    }
+
+    int base = patchIndex * 12 + corner;
+    vec3 p = texelFetch(Patches, base).xyz;
+    Kind = int(Template.w);
+    if (Kind == 1) p += VectorScale * texelFetch(Patches, base + 4).xyz;
+    else if (Kind == 2) p += VectorScale * texelFetch(Patches, base + 8).xyz;
+    else p += MarkerSize * Template.xyz;
+    gl_Position = MVP * vec4(p, 1.0);
+}
@@ -0,0 +1,41 @@
+// Cubic Hermite patch evaluation in matrix form, shared by the water TES and the
+// CPU (src/hermite.h). It must stay in the subset of GLSL that also compiles as
+// C++ with glm: vec/mat types, float literals with an f suffix, plain functions.
+
+#ifndef HERMITE_FN
+#define HERMITE_FN
+#endif
+
+// Hermite blending functions f1..f4 as a matrix acting on (t^3, t^2, t, 1).
+// Column k holds the coefficients of the k-th power for f1..f4.
+const mat4 HERMITE_BASIS = mat4( 2.0f, -2.0f,  1.0f,  1.0f,
+                                -3.0f,  3.0f, -2.0f, -1.0f,
+                                 0.0f,  0.0f,  1.0f,  0.0f,
+                                 1.0f,  0.0f,  0.0f,  0.0f );
+
+HERMITE_FN vec4 hermiteBasis(float t)
+{
+    return HERMITE_BASIS * vec4(t*t*t, t*t, t, 1.0f);
+}
+
+// 4x4 geometry matrix of component c. cp holds the patch as uploaded:
+// p00 p10 p11 p01, du00 du10 du11 du01, dv00 dv10 dv11 dv01.
+// Rows pair with the u blending functions, columns with the v ones; the
+// twist terms are zero.
+HERMITE_FN mat4 hermiteGeometry(vec3 cp[12], int c)
+{
+    return mat4( cp[0][c], cp[1][c], cp[4][c], cp[5][c],
+                 cp[3][c], cp[2][c], cp[7][c], cp[6][c],
+                 cp[8][c], cp[9][c], 0.0f, 0.0f,
+                 cp[11][c], cp[10][c], 0.0f, 0.0f );
+}
+
+// Point on the patch: bu^T * G * bv for each component
+HERMITE_FN vec3 hermitePatch(vec3 cp[12], float u, float v)
+{
+    vec4 bu = hermiteBasis(u);
+    vec4 bv = hermiteBasis(v);
+    return vec3( dot(bu, hermiteGeometry(cp, 0) * bv),
+                 dot(bu, hermiteGeometry(cp, 1) * bv),
+                 dot(bu, hermiteGeometry(cp, 2) * bv) );
+}
@@ -1,8 +0,0 @@
-#version 400
-
-layout ( location = 0 ) out vec4 FragColor;
-
-void main()
-{
-    FragColor = vec4(1.0,0,0,1.0);
-}
@@ -0,0 +1,20 @@
+#version 400
+
+uniform vec3 Kd;
+uniform vec3 LightDirection;   // world space, towards the light
+uniform vec3 LightIntensity;
+uniform vec3 Ambient;
+uniform bool Gamma;            // false when rendering into a linear target
+
+in vec3 WorldNormal;
+
+layout ( location = 0 ) out vec4 FragColor;
+
+void main()
+{
+    vec3 n = normalize(WorldNormal);
+    if( !gl_FrontFacing ) n = -n;
+    vec3 color = Kd * (LightIntensity * max(dot(n, normalize(LightDirection)), 0.0) + Ambient);
+    if( Gamma ) color = pow( color, vec3(1.0/2.2) );
+    FragColor = vec4(color, 1.0);
+}
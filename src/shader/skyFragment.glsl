@@ -0,0 +1,15 @@
+#version 400
+
+uniform samplerCube SkyMap;
+uniform bool Gamma;            // false when rendering into a linear target
+
+in vec3 Direction;
+
+layout ( location = 0 ) out vec4 FragColor;
+
+void main()
+{
+    vec3 color = texture( SkyMap, Direction ).rgb;
+    if( Gamma ) color = pow( color, vec3(1.0/2.2) );
+    FragColor = vec4(color, 1.0);
+}
@@ -0,0 +1,16 @@
+#version 400
+
+layout (location = 0 ) in vec3 VertexPosition;
+
+uniform mat4 projection;
+uniform mat4 view;
+
+out vec3 Direction;
+
+void main()
+{
+    // Rotation only, and z = w puts the sky on the far plane
+    Direction = VertexPosition;
+    vec4 p = projection * mat4(mat3(view)) * vec4(VertexPosition, 1.0);
+    gl_Position = p.xyww;
+}
@@ -0,0 +1,61 @@
+#version 400
+
+// Bicubic Bezier patches of TeapotPatch: 16 control points, point (i, j)
+// at i * 4 + j. The outer levels follow the screen length of each edge, and
+// only depend on that edge's own control points, so two patches sharing an
+// edge always split it the same way.
+layout( vertices=16 ) out;
+
+uniform mat4 projection;
+uniform mat4 view;
+uniform mat4 model;
+
+uniform vec2 ViewportSize;      // pixels of the target drawn into
+uniform float EdgePixels;       // screen length of one tessellated segment
+uniform float MaxTessLevel;
+
+vec4 clipPos[16];
+
+vec2 toScreen( int i ) {
+  // Points behind the eye just get the finest level
+  return clipPos[i].xy / max(clipPos[i].w, 1e-3) * 0.5 * ViewportSize;
+}
+
+// Length of the control polygon of a boundary curve, summed the same way
+// whichever direction the neighbouring patch lists it in
+float edgeLevel( int i0, int i1, int i2, int i3 ) {
+  vec2 p0 = toScreen(i0), p1 = toScreen(i1), p2 = toScreen(i2), p3 = toScreen(i3);
+  precise float len = (distance(p0, p1) + distance(p2, p3)) + distance(p1, p2);
+  return clamp( len / EdgePixels, 1.0, MaxTessLevel );
+}
+
+void main()
+{
+    gl_out[gl_InvocationID].gl_Position = gl_in[gl_InvocationID].gl_Position;
+
+    if( gl_InvocationID == 0 ) {
+        mat4 mvp = projection * view * model;
+        // The patch lies within the hull of its control points: drop it
+        // when they are all outside the same clip plane
+        vec3 above = vec3(0.0), below = vec3(0.0);
+        for( int i = 0; i < 16; i++ ) {
+            clipPos[i] = mvp * gl_in[i].gl_Position;
+            above += vec3(greaterThan(clipPos[i].xyz, vec3(clipPos[i].w)));
+            below += vec3(lessThan(clipPos[i].xyz, vec3(-clipPos[i].w)));
+        }
+        if( any(equal(above, vec3(16.0))) || any(equal(below, vec3(16.0))) ) {
+            gl_TessLevelOuter[0] = gl_TessLevelOuter[1] = gl_TessLevelOuter[2] = gl_TessLevelOuter[3] = 0.0;
+            gl_TessLevelInner[0] = gl_TessLevelInner[1] = 0.0;
+            return;
+        }
+
+        // Edges u = 0, v = 0, u = 1 and v = 1
+        gl_TessLevelOuter[0] = edgeLevel(0, 1, 2, 3);
+        gl_TessLevelOuter[1] = edgeLevel(0, 4, 8, 12);
+        gl_TessLevelOuter[2] = edgeLevel(12, 13, 14, 15);
+        gl_TessLevelOuter[3] = edgeLevel(3, 7, 11, 15);
+
+        gl_TessLevelInner[0] = max(gl_TessLevelOuter[1], gl_TessLevelOuter[3]);
+        gl_TessLevelInner[1] = max(gl_TessLevelOuter[0], gl_TessLevelOuter[2]);
+    }
+}
@@ -0,0 +1,53 @@
+#version 400
+
+layout( quads, fractional_even_spacing, ccw ) in;
+
+uniform mat4 projection;
+uniform mat4 view;
+uniform mat4 model;
+
+out vec3 WorldNormal;
+
+// Cubic Bernstein polynomials and their derivatives at t
+void basis( float t, out vec4 b, out vec4 db ) {
+  float s = 1.0 - t;
+  b = vec4( s * s * s, 3.0 * s * s * t, 3.0 * s * t * t, t * t * t );
+  db = vec4( -3.0 * s * s, 3.0 * s * s - 6.0 * s * t, 6.0 * s * t - 3.0 * t * t, 3.0 * t * t );
+}
+
+// Position and unnormalized normal du x dv, which points out of the teapot
+void evaluate( vec2 uv, out vec3 p, out vec3 n ) {
+  vec4 bu, dbu, bv, dbv;
+  basis(uv.x, bu, dbu);
+  basis(uv.y, bv, dbv);
+
+  vec3 du = vec3(0.0), dv = vec3(0.0);
+  p = vec3(0.0);
+  for( int i = 0; i < 4; i++ ) {
+    // Row i as a curve in v, and its derivative
+    vec3 c = bv.x * gl_in[i*4].gl_Position.xyz + bv.y * gl_in[i*4+1].gl_Position.xyz +
+             bv.z * gl_in[i*4+2].gl_Position.xyz + bv.w * gl_in[i*4+3].gl_Position.xyz;
+    vec3 dc = dbv.x * gl_in[i*4].gl_Position.xyz + dbv.y * gl_in[i*4+1].gl_Position.xyz +
+              dbv.z * gl_in[i*4+2].gl_Position.xyz + dbv.w * gl_in[i*4+3].gl_Position.xyz;
+    p += bu[i] * c;
+    du += dbu[i] * c;
+    dv += bu[i] * dc;
+  }
+  n = cross(du, dv);
+}
+
+void main()
+{
+    vec3 p, n;
+    evaluate(gl_TessCoord.xy, p, n);
+    // Edges that collapse to a point (top of the lid, bottom) have no
+    // tangent there; take the normal from just inside the patch
+    if( dot(n, n) < 1e-12 ) {
+        vec3 q;
+        evaluate(mix(vec2(0.5), gl_TessCoord.xy, 0.999), q, n);
+    }
+
+    // The scene models only scale uniformly, rotate and translate
+    WorldNormal = mat3(model) * normalize(n);
+    gl_Position = projection * view * model * vec4(p, 1.0);
+}
@@ -8,10 +8,33 @@ uniform vec4 LightPosition;
 uniform vec3 LightIntensity;
 uniform vec3 Kd;
 
-uniform mat4 ModelViewMatrix;
-uniform mat3 NormalMatrix;
-
-uniform float time;
+// Image based lighting from EnvironmentMap: the GGX prefiltered sky, its
+// split sum BRDF table and the irradiance as 9 SH coefficients
+uniform bool UseEnvironment;
+uniform samplerCube SpecularMap;
+uniform sampler2D BrdfLut;
+uniform float SpecularMaxLod;      // levels - 1, level l holds roughness l / SpecularMaxLod
+uniform vec3 IrradianceSH[9];
+
+// Planar reflection and refraction depth from WaterReflections. Both cover
+// the window at a lower resolution, so gl_FragCoord addresses them.
+uniform bool UseReflection;
+uniform sampler2D ReflectionMap;
+uniform sampler2D RefractionDepth;
+uniform vec2 DepthRange;           // near and far plane of the projection
+uniform float ReflectionDistortion;
+uniform float FoamWidth;           // depth below the surface where objects get a foam ring
+
+// Per-frame uniforms, updated through the frame ring
+layout(std140) uniform FrameData {
+    mat4 MVP;
+    mat4 ModelViewMatrix;
+    mat4 ViewportMatrix;
+    mat3 NormalMatrix;
+    float time;
+    int TessLevel;
+    int FixedTessLevel;
+};
 
 noperspective in vec3 EdgeDistance;
 in vec3 Normal;
@@ -100,6 +123,51 @@ vec3 microfacetModel(vec3 position, vec3 n ) {
   return (diffuseBrdf + PI * specBrdf) * lightI * nDotL;
 }
 
+vec3 irradiance( vec3 n ) {
+  return IrradianceSH[0] * 0.282095
+       + IrradianceSH[1] * (0.488603 * n.y) + IrradianceSH[2] * (0.488603 * n.z) + IrradianceSH[3] * (0.488603 * n.x)
+       + IrradianceSH[4] * (1.092548 * n.x * n.y) + IrradianceSH[5] * (1.092548 * n.y * n.z)
+       + IrradianceSH[6] * (0.315392 * (3.0 * n.z * n.z - 1.0))
+       + IrradianceSH[7] * (1.092548 * n.x * n.z) + IrradianceSH[8] * (0.546274 * (n.x * n.x - n.y * n.y));
+}
+
+// Window position in the reflection targets. The reflection is offset
+// along the wave normal so it ripples.
+vec2 reflectionCoord( vec3 n ) {
+  vec2 windowSize = 2.0 * vec2(ViewportMatrix[0][0], ViewportMatrix[1][1]);
+  vec3 worldNormal = transpose(mat3(ModelViewMatrix)) * n;
+  return gl_FragCoord.xy / windowSize + worldNormal.xz * ReflectionDistortion;
+}
+
+float linearDepth( float depth ) {
+  float z = depth * 2.0 - 1.0;
+  return 2.0 * DepthRange.x * DepthRange.y / (DepthRange.y + DepthRange.x - z * (DepthRange.y - DepthRange.x));
+}
+
+// Sky light: one prefiltered fetch along the reflection and one table
+// fetch instead of integrating over the sky
+vec3 environmentModel( vec3 position, vec3 n ) {
+  // The model matrix only translates, so the transposed view rotation takes
+  // eye space directions to world space
+  mat3 eyeToWorld = transpose(mat3(ModelViewMatrix));
+  vec3 v = normalize( -position );
+  float nDotV = max( dot( n, v ), 1e-4 );
+  vec3 r = eyeToWorld * reflect( -v, n );
+
+  vec3 f0 = Material.Metal ? Material.Color : vec3(0.04);
+  vec2 scaleBias = texture( BrdfLut, vec2(nDotV, Material.Rough) ).rg;
+  // The planar reflection already holds the sky, and the objects in front of it
+  vec3 reflected = UseReflection ? texture( ReflectionMap, reflectionCoord( n ) ).rgb
+                                 : textureLod( SpecularMap, r, Material.Rough * SpecularMaxLod ).rgb;
+  vec3 specular = reflected * (f0 * scaleBias.x + scaleBias.y);
+
+  vec3 diffuse = vec3(0.0);
+  if( !Material.Metal ) {
+    diffuse = Material.Color * irradiance( eyeToWorld * n ) / PI;
+  }
+  return diffuse + specular;
+}
+
 float map(float value, float min1, float max1, float min2, float max2) {
   return min2 + (value - min1) * (max2 - min2) / (max1 - min1);
 }
@@ -147,8 +215,21 @@ void main()
     vec3 n = vec3(normalize(Normal));
     vec3 pos = vec3(Position);
 
+    if( UseReflection ) {
+      // Foam where an object is just below the surface
+      float below = linearDepth( texture( RefractionDepth, reflectionCoord( vec3(0.0) ) ).r ) - linearDepth( gl_FragCoord.z );
+      if( below < FoamWidth ) {
+        Material.Color = mix( vec3(0.9,0.9,1.0), Material.Color, max(below, 0.0) / FoamWidth );
+        Material.Rough = 0.2;
+      }
+    }
 
     vec3 ambient = c1 * 0.01;
+    if( UseEnvironment ) {
+      ambient = environmentModel(pos, n);
+    } else if( UseReflection ) {
+      ambient += texture( ReflectionMap, reflectionCoord( n ) ).rgb * schlickFresnel( max( dot( n, normalize( -pos ) ), 0.0 ) );
+    }
     surfaceColor = microfacetModel(pos, n) + ambient;
     // Gamma
     surfaceColor = pow( surfaceColor, vec3(1.0/2.2) );
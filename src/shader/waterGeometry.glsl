@@ -10,7 +10,16 @@ noperspective out vec3 EdgeDistance;
 out vec3 Normal;
 out vec4 Position;
 
-uniform mat4 ViewportMatrix;  // Viewport matrix
+// Per-frame uniforms, updated through the frame ring
+layout(std140) uniform FrameData {
+    mat4 MVP;
+    mat4 ModelViewMatrix;
+    mat4 ViewportMatrix;
+    mat3 NormalMatrix;
+    float time;
+    int TessLevel;
+    int FixedTessLevel;
+};
 
 void main()
 {
@@ -2,11 +2,19 @@
 
 layout( vertices=12 ) out;
 
-uniform int TessLevel;
 uniform mat4 view;
 uniform mat4 model;
 
-uniform mat4 ModelViewMatrix;
+// Per-frame uniforms, updated through the frame ring
+layout(std140) uniform FrameData {
+    mat4 MVP;
+    mat4 ModelViewMatrix;
+    mat4 ViewportMatrix;
+    mat3 NormalMatrix;
+    float time;
+    int TessLevel;
+    int FixedTessLevel;
+};
 
 void main()
 {
@@ -36,6 +44,11 @@ void main()
         float tessLevel2 = mix( MAX_TESS_LEVEL, MIN_TESS_LEVEL, min(distance01, distance11) );
         float tessLevel3 = mix( MAX_TESS_LEVEL, MIN_TESS_LEVEL, min(distance11, distance10) );
 
+        // uniform level for benchmarking
+        if (FixedTessLevel > 0) {
+            tessLevel0 = tessLevel1 = tessLevel2 = tessLevel3 = float(FixedTessLevel);
+        }
+
         // set the corresponding outer edge tessellation levels
         gl_TessLevelOuter[0] = tessLevel0;
         gl_TessLevelOuter[1] = tessLevel1;
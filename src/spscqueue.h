@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer
+// thread. Used to hand snapshots between the main (input/simulation) thread
+// and the render thread without either side ever blocking on the other.
+template <typename T, size_t Capacity>
+class SpscQueue {
+public:
+    SpscQueue() : head(0), tail(0) { }
+
+    // Producer side. Returns false if the queue is full.
+    bool push(const T & item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t next = (t + 1) % SLOTS;
+        if( next == head.load(std::memory_order_acquire) ) return false;
+
+        items[t] = item;
+        tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Returns false if the queue is empty.
+    bool pop(T & item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if( h == tail.load(std::memory_order_acquire) ) return false;
+
+        item = items[h];
+        head.store((h + 1) % SLOTS, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Drain the queue, keeping only the newest item.
+    bool popLatest(T & item) {
+        bool any = false;
+        while( pop(item) ) any = true;
+        return any;
+    }
+
+private:
+    // One slot is kept empty to tell a full queue from an empty one
+    static const size_t SLOTS = Capacity + 1;
+
+    T items[SLOTS];
+    // Keep the indices on separate cache lines so the two threads don't
+    // false-share when they update them.
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+};
@@ -0,0 +1,249 @@
+#include "surface.h"
+
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <charconv>
+#include <chrono>
+#include <string>
+
+SurfaceGrid::SurfaceGrid() : M(0), N(0), x(nullptr), y(nullptr), z(nullptr)
+{ }
+
+void SurfaceGrid::allocate(int m, int n) {
+    mapping.close();
+    M = m;
+    N = n;
+    size_t count = (size_t)M * N;
+    storage.assign(3 * count, 0.0f);
+    x = storage.data();
+    y = x + count;
+    z = y + count;
+}
+
+void SurfaceGrid::createFlat(int m, int n, float step) {
+    allocate(m, n);
+    for( int i = 0; i < M; i++ ) {
+        for( int j = 0; j < N; j++ ) {
+            int k = i * N + j;
+            x[k] = step * i;
+            y[k] = 0.0f;
+            z[k] = step * j;
+        }
+    }
+}
+
+namespace {
+    bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+    }
+
+    const char * skipSpace(const char * p, const char * end) {
+        while( p < end && isSpace(*p) ) p++;
+        return p;
+    }
+
+    template <typename T>
+    bool parseNumber(const char * & p, const char * end, T & value) {
+        p = skipSpace(p, end);
+        // from_chars doesn't accept a leading '+'
+        if( p < end && *p == '+' ) p++;
+        std::from_chars_result res = std::from_chars(p, end, value);
+        if( res.ec != std::errc() ) return false;
+        p = res.ptr;
+        return true;
+    }
+
+    bool endsWith(const char * str, const char * suffix) {
+        size_t n = strlen(str), m = strlen(suffix);
+        return n >= m && strcmp(str + n - m, suffix) == 0;
+    }
+
+    double elapsedMs(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+bool SurfaceGrid::loadText(const char * fileName) {
+    MappedFile file;
+    if( !file.open(fileName) ) {
+        fprintf(stderr, "Unable to open surface file: %s\n", fileName);
+        return false;
+    }
+
+    const char * p = file.data();
+    const char * end = p + file.size();
+
+    int m = 0, n = 0;
+    if( !parseNumber(p, end, m) || !parseNumber(p, end, n) || m < 2 || n < 2 ) {
+        fprintf(stderr, "Bad surface header in %s\n", fileName);
+        return false;
+    }
+
+    allocate(m, n);
+    size_t count = (size_t)M * N;
+    for( size_t k = 0; k < count; k++ ) {
+        if( !parseNumber(p, end, x[k]) || !parseNumber(p, end, y[k]) || !parseNumber(p, end, z[k]) ) {
+            fprintf(stderr, "Surface file %s ends after %zu of %zu control points\n", fileName, k, count);
+            createFlat(0, 0, 0.0f);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SurfaceGrid::saveText(const char * fileName) const {
+    FILE * fp = fopen(fileName, "wb");
+    if( fp == NULL ) {
+        fprintf(stderr, "Unable to write surface file: %s\n", fileName);
+        return false;
+    }
+
+    fprintf(fp, "%d %d\n", M, N);
+    char line[64];
+    for( int i = 0; i < M; i++ ) {
+        for( int j = 0; j < N; j++ ) {
+            int k = i * N + j;
+            float v[3] = { x[k], y[k], z[k] };
+            char * p = line;
+            for( int c = 0; c < 3; c++ ) {
+                p = std::to_chars(p, line + sizeof(line), v[c]).ptr;
+                *p++ = (c == 2 && j == N - 1) ? '\n' : ' ';
+            }
+            fwrite(line, 1, p - line, fp);
+        }
+    }
+    fclose(fp);
+    return true;
+}
+
+bool SurfaceGrid::loadBinary(const char * fileName) {
+    storage.clear();
+    M = N = 0;
+    x = y = z = nullptr;
+
+    if( !mapping.open(fileName, true) ) {
+        fprintf(stderr, "Unable to open surface file: %s\n", fileName);
+        return false;
+    }
+
+    SurfaceFileHeader header;
+    if( mapping.size() < sizeof(header) ) {
+        fprintf(stderr, "Surface file %s is too small\n", fileName);
+        mapping.close();
+        return false;
+    }
+    memcpy(&header, mapping.data(), sizeof(header));
+
+    // The sizes are untrusted: bound them before any arithmetic that could
+    // wrap, and compare in points so nothing is multiplied by the byte size
+    uint64_t points = (uint64_t)header.M * header.N;
+    if( memcmp(header.magic, "SOTS", 4) != 0 || header.version != BINARY_VERSION ||
+        header.M < 2 || header.N < 2 || header.M > INT_MAX || header.N > INT_MAX ||
+        points > (mapping.size() - sizeof(header)) / (3 * sizeof(float)) ) {
+        fprintf(stderr, "Surface file %s is not a version %u binary surface\n", fileName, BINARY_VERSION);
+        mapping.close();
+        return false;
+    }
+
+    // Point straight into the mapping; pages are only read when the patch
+    // data is written into the GL buffer.
+    size_t count = (size_t)points;
+    M = (int)header.M;
+    N = (int)header.N;
+    x = reinterpret_cast<float *>(mapping.data() + sizeof(header));
+    y = x + count;
+    z = y + count;
+    return true;
+}
+
+bool SurfaceGrid::saveBinary(const char * fileName) const {
+    FILE * fp = fopen(fileName, "wb");
+    if( fp == NULL ) {
+        fprintf(stderr, "Unable to write surface file: %s\n", fileName);
+        return false;
+    }
+
+    SurfaceFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "SOTS", 4);
+    header.version = BINARY_VERSION;
+    header.M = (uint32_t)M;
+    header.N = (uint32_t)N;
+
+    size_t count = (size_t)M * N;
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+              fwrite(x, sizeof(float), count, fp) == count &&
+              fwrite(y, sizeof(float), count, fp) == count &&
+              fwrite(z, sizeof(float), count, fp) == count;
+    fclose(fp);
+    if( !ok ) fprintf(stderr, "Error writing surface file: %s\n", fileName);
+    return ok;
+}
+
+bool SurfaceGrid::load(const char * fileName) {
+    return endsWith(fileName, ".sotb") ? loadBinary(fileName) : loadText(fileName);
+}
+
+bool SurfaceGrid::save(const char * fileName) const {
+    return endsWith(fileName, ".sotb") ? saveBinary(fileName) : saveText(fileName);
+}
+
+bool SurfaceGrid::convert(const char * inFile, const char * outFile) {
+    SurfaceGrid grid;
+    if( !grid.load(inFile) ) return false;
+    if( !grid.save(outFile) ) return false;
+    printf("Converted %dx%d surface %s -> %s\n", grid.M, grid.N, inFile, outFile);
+    return true;
+}
+
+void benchmarkSurfaceLoading(int maxSize) {
+    printf("%10s %12s %12s %12s %12s %9s\n", "grid", "text MB", "text ms", "binary MB", "binary ms", "speedup");
+
+    for( int size = 256; size <= maxSize; size *= 2 ) {
+        std::string textName = "bench_surface_" + std::to_string(size) + ".txt";
+        std::string binName = "bench_surface_" + std::to_string(size) + ".sotb";
+
+        {
+            SurfaceGrid grid;
+            grid.createFlat(size, size, 1.0f);
+            for( int k = 0; k < size * size; k++ )
+                grid.y[k] = 4.0f * sinf(grid.x[k] * 0.05f) + 2.0f * cosf(grid.z[k] * 0.03f);
+            if( !grid.saveText(textName.c_str()) || !grid.saveBinary(binName.c_str()) ) return;
+        }
+
+        // Sum every plane so that the lazily mapped binary pages get touched too
+        auto checksum = [](const SurfaceGrid & g) {
+            double sum = 0.0;
+            for( int k = 0; k < g.M * g.N; k++ ) sum += g.x[k] + g.y[k] + g.z[k];
+            return sum;
+        };
+
+        SurfaceGrid text, bin;
+        auto start = std::chrono::steady_clock::now();
+        bool ok = text.loadText(textName.c_str());
+        double textSum = checksum(text);
+        double textMs = elapsedMs(start);
+
+        start = std::chrono::steady_clock::now();
+        ok = ok && bin.loadBinary(binName.c_str());
+        double binSum = checksum(bin);
+        double binMs = elapsedMs(start);
+
+        FILE * fp = fopen(textName.c_str(), "rb");
+        fseek(fp, 0, SEEK_END);
+        double textMB = ftell(fp) / (1024.0 * 1024.0);
+        fclose(fp);
+        double binMB = (sizeof(SurfaceFileHeader) + 3.0 * size * size * sizeof(float)) / (1024.0 * 1024.0);
+
+        char label[32];
+        sprintf(label, "%dx%d", size, size);
+        printf("%10s %12.1f %12.1f %12.1f %12.1f %8.1fx%s\n", label, textMB, textMs, binMB, binMs,
+               textMs / binMs, (ok && textSum == binSum) ? "" : "  (MISMATCH)");
+
+        remove(textName.c_str());
+        remove(binName.c_str());
+    }
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "mappedfile.h"
+
+// On-disk header of the binary surface format (.sotb). It is followed by three
+// float32 planes of M*N values each: all x, then all y, then all z, with
+// control point (i,j) at index i*N + j. The header is 32 bytes so the planes
+// stay 16-byte aligned in a mapping.
+struct SurfaceFileHeader {
+    char magic[4];       // "SOTS"
+    uint32_t version;
+    uint32_t M;
+    uint32_t N;
+    uint32_t reserved[4];
+};
+
+// M x N grid of control points stored as structure-of-arrays. The planes either
+// live in memory or point straight into a mapped binary file.
+class SurfaceGrid {
+public:
+    static const uint32_t BINARY_VERSION = 1;
+
+    int M, N;
+    float * x;
+    float * y;
+    float * z;
+
+    SurfaceGrid();
+
+    // Flat grid in the xz plane with the given spacing
+    void createFlat(int m, int n, float step);
+
+    // Text format: "M N" header followed by M rows of N "x y z" triples
+    bool loadText(const char * fileName);
+    bool saveText(const char * fileName) const;
+
+    // Binary format: maps the file copy-on-write, nothing is read up front
+    bool loadBinary(const char * fileName);
+    bool saveBinary(const char * fileName) const;
+
+    // Picks the format from the extension (.sotb is binary, anything else text)
+    bool load(const char * fileName);
+    bool save(const char * fileName) const;
+    static bool convert(const char * inFile, const char * outFile);
+
+    bool isMapped() const { return mapping.isOpen(); }
+
+    glm::vec3 point(int i, int j) const {
+        int k = i * N + j;
+        return glm::vec3(x[k], y[k], z[k]);
+    }
+
+    // Partial derivatives approximated with central differences. A single
+    // patch covers 0<=u<=1, so the previous and next patch give a distance of
+    // 2.0 in parameter space. They are zero along the border of the grid.
+    glm::vec3 derivativeU(int i, int j) const {
+        if( i == 0 || i == M - 1 ) return glm::vec3(0.0f);
+        return (point(i+1, j) - point(i-1, j)) / 2.0f;
+    }
+    glm::vec3 derivativeV(int i, int j) const {
+        if( j == 0 || j == N - 1 ) return glm::vec3(0.0f);
+        return (point(i, j+1) - point(i, j-1)) / 2.0f;
+    }
+
+private:
+    std::vector<float> storage;
+    MappedFile mapping;
+
+    void allocate(int m, int n);
+
+    SurfaceGrid(const SurfaceGrid &) = delete;
+    SurfaceGrid & operator=(const SurfaceGrid &) = delete;
+};
+
+// Load-time benchmark for the text and binary formats on synthetic grids of
+// up to maxSize x maxSize control points.
+void benchmarkSurfaceLoading(int maxSize);
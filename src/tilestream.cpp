@@ -0,0 +1,465 @@
+#include "tilestream.h"
+#include "surface.h"
+
+#include <cstring>
+#include <algorithm>
+#include <limits>
+
+namespace {
+    // Refine a tile while the camera is closer than this many tile widths
+    const float LOD_FACTOR = 2.0f;
+    // Matches the far plane of the water projection
+    const float VIEW_DISTANCE = 1000.0f;
+    const size_t MAX_DRAW_TILES = 64;
+    // How far ahead along the motion vector tiles are prefetched
+    const float PREFETCH_SECONDS = 1.0f;
+    const size_t MAX_PREFETCH_QUEUE = 32;
+
+    bool seekTo(FILE * fp, uint64_t offset) {
+#ifdef _WIN32
+        return _fseeki64(fp, (__int64)offset, SEEK_SET) == 0;
+#else
+        return fseeko(fp, (off_t)offset, SEEK_SET) == 0;
+#endif
+    }
+
+    size_t levelStart(int level) {
+        return (((size_t)1 << (2 * level)) - 1) / 3;
+    }
+
+    float * putVec3(float * dst, const glm::vec3 & v) {
+        dst[0] = v.x;
+        dst[1] = v.y;
+        dst[2] = v.z;
+        return dst + 3;
+    }
+
+    double elapsedMs(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+TileStream::TileStream() : file(nullptr), tileBytes(0), budget(0), frame(0),
+                           ioMsTotal(0.0), ioCount(0), stopping(false) {
+    memset(&header, 0, sizeof(header));
+    memset(&metrics, 0, sizeof(metrics));
+}
+
+TileStream::~TileStream() {
+    close();
+}
+
+bool TileStream::open(const char * fileName, size_t budgetBytes) {
+    close();
+
+    file = fopen(fileName, "rb");
+    if( file == nullptr ) {
+        fprintf(stderr, "Unable to open tile file: %s\n", fileName);
+        return false;
+    }
+
+    if( fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, "SOTT", 4) != 0 ||
+        header.version != FILE_VERSION || header.levels == 0 || header.levels > MAX_LEVELS || header.tileSize < 2 ) {
+        fprintf(stderr, "%s is not a version %u tile file\n", fileName, FILE_VERSION);
+        fclose(file);
+        file = nullptr;
+        return false;
+    }
+
+    index.resize(levelStart(header.levels));
+    if( fread(index.data(), sizeof(TileIndexEntry), index.size(), file) != index.size() ) {
+        fprintf(stderr, "Tile index of %s is truncated\n", fileName);
+        fclose(file);
+        file = nullptr;
+        return false;
+    }
+
+    tileBytes = (size_t)(header.tileSize + 2) * (header.tileSize + 2) * sizeof(float);
+    budget = std::max(budgetBytes, tileBytes);
+    nodeState.assign(index.size(), ABSENT);
+    memset(&metrics, 0, sizeof(metrics));
+    metrics.budgetBytes = budget;
+    frame = 0;
+
+    stopping = false;
+    ioThread = std::thread(&TileStream::ioLoop, this);
+
+    printf("Tile file %s: %ux%u samples, %u levels of %ux%u tiles, cache budget %.1f MB\n",
+           fileName, header.M, header.N, header.levels, header.tileSize, header.tileSize,
+           budget / (1024.0 * 1024.0));
+
+    // The root is always needed as the last-resort fallback
+    request(0, false);
+    return true;
+}
+
+void TileStream::close() {
+    if( ioThread.joinable() ) {
+        {
+            std::lock_guard<std::mutex> lock(ioMutex);
+            stopping = true;
+        }
+        ioCond.notify_all();
+        ioThread.join();
+    }
+    if( file != nullptr ) fclose(file);
+    file = nullptr;
+
+    demandQueue.clear();
+    prefetchQueue.clear();
+    completed.clear();
+    cache.clear();
+    lru.clear();
+    selected.clear();
+    index.clear();
+    nodeState.clear();
+}
+
+// I/O thread: serve demand reads before prefetches
+void TileStream::ioLoop() {
+    std::unique_lock<std::mutex> lock(ioMutex);
+    while( true ) {
+        ioCond.wait(lock, [this] { return stopping || !demandQueue.empty() || !prefetchQueue.empty(); });
+        if( stopping ) break;
+
+        std::deque<Request> & queue = demandQueue.empty() ? prefetchQueue : demandQueue;
+        Completed done;
+        done.request = queue.front();
+        queue.pop_front();
+
+        lock.unlock();
+        if( !readTile(done.request.node, done.heights) ) done.heights.clear();
+        lock.lock();
+
+        completed.push_back(std::move(done));
+    }
+}
+
+bool TileStream::readTile(int node, std::vector<float> & heights) {
+    heights.resize(tileBytes / sizeof(float));
+    return seekTo(file, index[node].offset) && fread(heights.data(), tileBytes, 1, file) == 1;
+}
+
+void TileStream::collectCompleted() {
+    std::vector<Completed> done;
+    {
+        std::lock_guard<std::mutex> lock(ioMutex);
+        done.swap(completed);
+    }
+
+    for( Completed & c : done ) {
+        int node = c.request.node;
+        double ms = elapsedMs(c.request.queued);
+        ioMsTotal += ms;
+        ioCount++;
+        metrics.maxIoMs = std::max(metrics.maxIoMs, ms);
+
+        if( c.heights.empty() ) {
+            fprintf(stderr, "Failed to read tile %d, dropping it\n", node);
+            index[node].offset = 0;
+            nodeState[node] = ABSENT;
+            continue;
+        }
+
+        CacheEntry & entry = cache[node];
+        entry.heights.swap(c.heights);
+        entry.lastUsedFrame = 0;
+        // The root is pinned and never takes part in LRU eviction
+        entry.lruPos = (node == 0) ? lru.end() : lru.insert(lru.begin(), node);
+        nodeState[node] = RESIDENT;
+    }
+}
+
+void TileStream::request(int node, bool prefetch) {
+    if( nodeState[node] == RESIDENT ) return;
+
+    std::lock_guard<std::mutex> lock(ioMutex);
+    if( nodeState[node] == QUEUED ) {
+        // Promote a pending prefetch once the tile is actually wanted
+        if( !prefetch ) {
+            auto it = std::find_if(prefetchQueue.begin(), prefetchQueue.end(),
+                                   [node](const Request & r) { return r.node == node; });
+            if( it != prefetchQueue.end() ) {
+                demandQueue.push_back(*it);
+                prefetchQueue.erase(it);
+            }
+        }
+        return;
+    }
+    if( prefetch && prefetchQueue.size() >= MAX_PREFETCH_QUEUE ) return;
+
+    Request r;
+    r.node = node;
+    r.prefetch = prefetch;
+    r.queued = std::chrono::steady_clock::now();
+    (prefetch ? prefetchQueue : demandQueue).push_back(r);
+    nodeState[node] = QUEUED;
+    if( prefetch ) metrics.prefetches++;
+    ioCond.notify_one();
+}
+
+// Predictions from earlier frames are stale once the camera moved on
+void TileStream::dropStalePrefetches() {
+    std::lock_guard<std::mutex> lock(ioMutex);
+    for( const Request & r : prefetchQueue ) nodeState[r.node] = ABSENT;
+    prefetchQueue.clear();
+}
+
+int TileStream::nodeIndex(int level, int tx, int ty) const {
+    return (int)(levelStart(level) + ((size_t)tx << level) + ty);
+}
+
+bool TileStream::nodeExists(int level, int tx, int ty) const {
+    int tiles = 1 << level;
+    if( level >= (int)header.levels || tx < 0 || ty < 0 || tx >= tiles || ty >= tiles ) return false;
+    return index[nodeIndex(level, tx, ty)].offset != 0;
+}
+
+float TileStream::nodeWorldSize(int level) const {
+    return (header.tileSize - 1) * (float)(1 << (header.levels - 1 - level)) * header.spacing;
+}
+
+// Distance from pos to the tile's bounding box
+float TileStream::nodeDistance(int level, int tx, int ty, const glm::vec3 & pos) const {
+    const TileIndexEntry & e = index[nodeIndex(level, tx, ty)];
+    float size = nodeWorldSize(level);
+    glm::vec3 lo(header.originX + tx * size, e.minHeight, header.originZ + ty * size);
+    glm::vec3 hi(lo.x + size, e.maxHeight, lo.z + size);
+    glm::vec3 d = glm::max(glm::max(lo - pos, pos - hi), glm::vec3(0.0f));
+    return glm::length(d);
+}
+
+void TileStream::touch(int node) {
+    CacheEntry & entry = cache[node];
+    entry.lastUsedFrame = frame;
+    if( node != 0 ) lru.splice(lru.begin(), lru, entry.lruPos);
+}
+
+void TileStream::selectNode(int level, int tx, int ty, const glm::vec3 & pos, bool prefetchOnly) {
+    if( !nodeExists(level, tx, ty) ) return;
+    float dist = nodeDistance(level, tx, ty, pos);
+    if( dist > VIEW_DISTANCE ) return;
+
+    int node = nodeIndex(level, tx, ty);
+    bool refine = level + 1 < (int)header.levels && dist < LOD_FACTOR * nodeWorldSize(level);
+
+    if( prefetchOnly ) {
+        request(node, true);
+        if( refine ) {
+            for( int c = 0; c < 4; c++ )
+                selectNode(level + 1, 2 * tx + (c >> 1), 2 * ty + (c & 1), pos, true);
+        }
+        return;
+    }
+
+    // Resident ancestors stay warm, they are the fallback while children load
+    if( nodeState[node] == RESIDENT ) touch(node);
+
+    if( refine && selected.size() + 4 <= MAX_DRAW_TILES ) {
+        bool ready = true;
+        for( int c = 0; c < 4; c++ ) {
+            int cx = 2 * tx + (c >> 1), cy = 2 * ty + (c & 1);
+            if( !nodeExists(level + 1, cx, cy) || nodeDistance(level + 1, cx, cy, pos) > VIEW_DISTANCE ) continue;
+            int child = nodeIndex(level + 1, cx, cy);
+            if( nodeState[child] != RESIDENT ) {
+                ready = false;
+                metrics.misses++;
+                request(child, false);
+            }
+        }
+        if( ready ) {
+            for( int c = 0; c < 4; c++ )
+                selectNode(level + 1, 2 * tx + (c >> 1), 2 * ty + (c & 1), pos, false);
+            return;
+        }
+    }
+
+    // Draw this tile, either at the wanted detail or as a stand-in for its children
+    if( nodeState[node] != RESIDENT ) {
+        metrics.misses++;
+        request(node, false);
+    } else if( selected.size() < MAX_DRAW_TILES ) {
+        if( !refine ) metrics.hits++;
+        SelectedTile tile = { node, level, tx, ty };
+        selected.push_back(tile);
+    }
+}
+
+void TileStream::evict() {
+    while( cache.size() * tileBytes > budget && !lru.empty() ) {
+        int victim = lru.back();
+        CacheEntry & entry = cache[victim];
+        // Everything left was used this frame; the budget is too small for the view
+        if( entry.lastUsedFrame == frame ) break;
+
+        lru.pop_back();
+        cache.erase(victim);
+        nodeState[victim] = ABSENT;
+        metrics.evictions++;
+    }
+}
+
+void TileStream::update(const glm::vec3 & cameraPos, const glm::vec3 & cameraVelocity) {
+    if( file == nullptr ) return;
+
+    collectCompleted();
+    frame++;
+
+    selected.clear();
+    dropStalePrefetches();
+    selectNode(0, 0, 0, cameraPos, false);
+
+    // Warm the cache for where the camera is heading
+    if( glm::length(cameraVelocity) > 0.0f )
+        selectNode(0, 0, 0, cameraPos + cameraVelocity * PREFETCH_SECONDS, true);
+
+    evict();
+}
+
+size_t TileStream::getMaxPatchCount() const {
+    return MAX_DRAW_TILES * (header.tileSize - 1) * (header.tileSize - 1);
+}
+
+size_t TileStream::fillPatchData(float * dst) const {
+    const int ts = (int)header.tileSize;
+    const int stride = ts + 2;
+    size_t patches = 0;
+
+    for( const SelectedTile & tile : selected ) {
+        const std::vector<float> & h = cache.find(tile.node)->second.heights;
+        float step = (float)(1 << (header.levels - 1 - tile.level)) * header.spacing;
+        float x0 = header.originX + tile.tx * (ts - 1) * step;
+        float z0 = header.originZ + tile.ty * (ts - 1) * step;
+
+        // Sample (a,b) of the tile, -1 and ts address the apron
+        auto point = [&](int a, int b) {
+            return glm::vec3(x0 + a * step, h[(a + 1) * stride + (b + 1)], z0 + b * step);
+        };
+        auto derivU = [&](int a, int b) { return (point(a + 1, b) - point(a - 1, b)) / 2.0f; };
+        auto derivV = [&](int a, int b) { return (point(a, b + 1) - point(a, b - 1)) / 2.0f; };
+
+        for( int a = 0; a < ts - 1; a++ ) {
+            for( int b = 0; b < ts - 1; b++ ) {
+                dst = putVec3(dst, point(a, b));
+                dst = putVec3(dst, point(a + 1, b));
+                dst = putVec3(dst, point(a + 1, b + 1));
+                dst = putVec3(dst, point(a, b + 1));
+
+                dst = putVec3(dst, derivU(a, b));
+                dst = putVec3(dst, derivU(a + 1, b));
+                dst = putVec3(dst, derivU(a + 1, b + 1));
+                dst = putVec3(dst, derivU(a, b + 1));
+
+                dst = putVec3(dst, derivV(a, b));
+                dst = putVec3(dst, derivV(a + 1, b));
+                dst = putVec3(dst, derivV(a + 1, b + 1));
+                dst = putVec3(dst, derivV(a, b + 1));
+                patches++;
+            }
+        }
+    }
+    return patches;
+}
+
+TileStream::Metrics TileStream::getMetrics() {
+    metrics.residentTiles = (int)cache.size();
+    metrics.residentBytes = cache.size() * tileBytes;
+    metrics.drawnTiles = (int)selected.size();
+    {
+        std::lock_guard<std::mutex> lock(ioMutex);
+        metrics.queuedTiles = (int)(demandQueue.size() + prefetchQueue.size());
+    }
+    metrics.avgIoMs = ioCount > 0 ? ioMsTotal / ioCount : 0.0;
+
+    Metrics result = metrics;
+    ioMsTotal = 0.0;
+    ioCount = 0;
+    metrics.maxIoMs = 0.0;
+    return result;
+}
+
+bool TileStream::build(const SurfaceGrid & grid, const char * fileName, int tileSize) {
+    if( grid.M < 2 || grid.N < 2 || tileSize < 2 ) return false;
+
+    TileFileHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, "SOTT", 4);
+    hdr.version = FILE_VERSION;
+    hdr.tileSize = (uint32_t)tileSize;
+    hdr.M = (uint32_t)grid.M;
+    hdr.N = (uint32_t)grid.N;
+    hdr.originX = grid.x[0];
+    hdr.originZ = grid.z[0];
+    // The tiled format assumes a regular grid
+    hdr.spacing = grid.x[grid.N] - grid.x[0];
+
+    // Enough levels for the finest one to reach every sample
+    int maxSamples = std::max(grid.M, grid.N) - 1;
+    hdr.levels = 1;
+    while( hdr.levels <= MAX_LEVELS && ((int64_t)(tileSize - 1) << (hdr.levels - 1)) < maxSamples ) hdr.levels++;
+    if( hdr.levels > MAX_LEVELS ) {
+        int64_t minTileSize = (maxSamples + (1 << (MAX_LEVELS - 1)) - 1) / (1 << (MAX_LEVELS - 1)) + 1;
+        fprintf(stderr, "A %dx%d surface needs more than %u levels of %d sample tiles; use a tileSize of at least %lld\n",
+                grid.M, grid.N, MAX_LEVELS, tileSize, (long long)minTileSize);
+        return false;
+    }
+
+    FILE * fp = fopen(fileName, "wb");
+    if( fp == NULL ) {
+        fprintf(stderr, "Unable to write tile file: %s\n", fileName);
+        return false;
+    }
+
+    std::vector<TileIndexEntry> idx(levelStart(hdr.levels));
+    memset(idx.data(), 0, idx.size() * sizeof(TileIndexEntry));
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+    fwrite(idx.data(), sizeof(TileIndexEntry), idx.size(), fp);
+
+    uint64_t offset = sizeof(hdr) + idx.size() * sizeof(TileIndexEntry);
+    std::vector<float> heights((tileSize + 2) * (tileSize + 2));
+    int tiles = 0;
+
+    for( int level = 0; level < (int)hdr.levels; level++ ) {
+        int step = 1 << (hdr.levels - 1 - level);
+        int count = 1 << level;
+        for( int tx = 0; tx < count; tx++ ) {
+            for( int ty = 0; ty < count; ty++ ) {
+                int i0 = tx * (tileSize - 1) * step;
+                int j0 = ty * (tileSize - 1) * step;
+                if( i0 >= grid.M || j0 >= grid.N ) continue;
+
+                TileIndexEntry & e = idx[levelStart(level) + ((size_t)tx << level) + ty];
+                e.minHeight = std::numeric_limits<float>::max();
+                e.maxHeight = -std::numeric_limits<float>::max();
+
+                // Point-sample the grid, clamping at its edges
+                float * h = heights.data();
+                for( int a = -1; a <= tileSize; a++ ) {
+                    int i = std::min(std::max(i0 + a * step, 0), grid.M - 1);
+                    for( int b = -1; b <= tileSize; b++ ) {
+                        int j = std::min(std::max(j0 + b * step, 0), grid.N - 1);
+                        float y = grid.y[(size_t)i * grid.N + j];
+                        *h++ = y;
+                        if( a >= 0 && a < tileSize && b >= 0 && b < tileSize ) {
+                            e.minHeight = std::min(e.minHeight, y);
+                            e.maxHeight = std::max(e.maxHeight, y);
+                        }
+                    }
+                }
+
+                fwrite(heights.data(), sizeof(float), heights.size(), fp);
+                e.offset = offset;
+                offset += heights.size() * sizeof(float);
+                tiles++;
+            }
+        }
+    }
+
+    seekTo(fp, sizeof(hdr));
+    fwrite(idx.data(), sizeof(TileIndexEntry), idx.size(), fp);
+    bool ok = !ferror(fp);
+    fclose(fp);
+
+    printf("Built %s: %d tiles in %u levels, %.1f MB\n", fileName, tiles, hdr.levels, offset / (1024.0 * 1024.0));
+    return ok;
+}
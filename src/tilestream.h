@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+class SurfaceGrid;
+
+// Tiled height-field format (.sott). A complete quadtree of tiles: level 0 is
+// a single tile covering the whole grid, every level below halves the sample
+// spacing. Each tile stores (tileSize+2)^2 float32 heights, i.e. tileSize^2
+// samples plus a one-sample apron so derivatives are continuous across tiles.
+//
+// Layout: TileFileHeader, then one TileIndexEntry per node in level order
+// (node (level,tx,ty) is at (4^level-1)/3 + tx*2^level + ty), then payloads.
+struct TileFileHeader {
+    char magic[4];          // "SOTT"
+    uint32_t version;
+    uint32_t tileSize;      // samples per tile edge, excluding the apron
+    uint32_t levels;        // quadtree depth
+    uint32_t M, N;          // samples of the finest level
+    float originX, originZ; // world position of sample (0,0)
+    float spacing;          // world distance between finest-level samples
+    uint32_t reserved[3];
+};
+
+struct TileIndexEntry {
+    uint64_t offset;        // 0 if the tile lies completely outside the grid
+    float minHeight, maxHeight;
+};
+
+// Streams tiles of a .sott file through a fixed-budget LRU cache. Reads run on
+// a background I/O thread; everything else (selection, cache, patch output)
+// runs on the render thread.
+class TileStream {
+public:
+    static const uint32_t FILE_VERSION = 1;
+    // Deepest quadtree build() writes and open() accepts
+    static const uint32_t MAX_LEVELS = 12;
+
+    struct Metrics {
+        int residentTiles;
+        size_t residentBytes;
+        size_t budgetBytes;
+        int drawnTiles;
+        int queuedTiles;
+        uint64_t hits;          // wanted tiles that were resident
+        uint64_t misses;        // wanted tiles that had to be read
+        uint64_t prefetches;    // reads issued for the predicted camera position
+        uint64_t evictions;
+        double avgIoMs;         // request to completion, since the last getMetrics()
+        double maxIoMs;
+    };
+
+    TileStream();
+    ~TileStream();
+
+    bool open(const char * fileName, size_t budgetBytes);
+    void close();
+    bool isOpen() const { return file != nullptr; }
+
+    // Pick the tiles to draw for this camera position (in surface space), queue
+    // reads for missing ones and prefetch along the motion vector.
+    void update(const glm::vec3 & cameraPos, const glm::vec3 & cameraVelocity);
+
+    // Write F-surface patches (12 vec3 each) for the selected tiles. Returns the
+    // number of patches written, at most getMaxPatchCount().
+    size_t fillPatchData(float * dst) const;
+    size_t getMaxPatchCount() const;
+
+    // Snapshot of the metrics; resets the I/O latency window
+    Metrics getMetrics();
+
+    static bool build(const SurfaceGrid & grid, const char * fileName, int tileSize = 33);
+
+private:
+    enum NodeState : uint8_t { ABSENT, QUEUED, RESIDENT };
+
+    struct Request {
+        int node;
+        bool prefetch;
+        std::chrono::steady_clock::time_point queued;
+    };
+
+    struct Completed {
+        Request request;
+        std::vector<float> heights;
+    };
+
+    struct SelectedTile {
+        int node, level, tx, ty;
+    };
+
+    struct CacheEntry {
+        std::vector<float> heights;
+        std::list<int>::iterator lruPos;
+        uint64_t lastUsedFrame;
+    };
+
+    TileFileHeader header;
+    std::vector<TileIndexEntry> index;
+    std::vector<uint8_t> nodeState;
+    FILE * file;
+    size_t tileBytes;
+    size_t budget;
+
+    // Render thread only
+    std::unordered_map<int, CacheEntry> cache;
+    std::list<int> lru;     // most recently used at the front
+    std::vector<SelectedTile> selected;
+    uint64_t frame;
+    Metrics metrics;
+    double ioMsTotal;
+    int ioCount;
+
+    // Shared with the I/O thread, guarded by ioMutex
+    std::mutex ioMutex;
+    std::condition_variable ioCond;
+    std::deque<Request> demandQueue;
+    std::deque<Request> prefetchQueue;
+    std::vector<Completed> completed;
+    bool stopping;
+    std::thread ioThread;
+
+    void ioLoop();
+    bool readTile(int node, std::vector<float> & heights);
+
+    void collectCompleted();
+    void request(int node, bool prefetch);
+    void dropStalePrefetches();
+    void selectNode(int level, int tx, int ty, const glm::vec3 & pos, bool prefetchOnly);
+    void touch(int node);
+    void evict();
+
+    int nodeIndex(int level, int tx, int ty) const;
+    bool nodeExists(int level, int tx, int ty) const;
+    float nodeWorldSize(int level) const;
+    float nodeDistance(int level, int tx, int ty, const glm::vec3 & pos) const;
+
+    TileStream(const TileStream &) = delete;
+    TileStream & operator=(const TileStream &) = delete;
+};
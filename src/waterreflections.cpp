@@ -0,0 +1,217 @@
+#include "waterreflections.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+using glm::mat4;
+using glm::vec4;
+
+namespace {
+    // Timings to average before the scale may drop, or rise again
+    const int SAMPLES_TO_SHRINK = 8;
+    const int SAMPLES_TO_GROW = 30;
+    // Only grow when the predicted time leaves this much of the budget
+    const double GROW_HEADROOM = 0.8;
+
+    float signOf(float v) {
+        return v > 0.0f ? 1.0f : (v < 0.0f ? -1.0f : 0.0f);
+    }
+}
+
+WaterReflections::WaterReflections() :
+    reflection(0), reflectionDepth(0), refractionDepth(0), targetWidth(0), targetHeight(0),
+    nextQuery(0), activeQuery(-1), budgetMs(2.0f), scale(MAX_SCALE), gpuMs(0.0), samples(0),
+    windowWidth(0), windowHeight(0)
+{
+    fbos[0] = fbos[1] = 0;
+    memset(queries, 0, sizeof(queries));
+    memset(queryScale, 0, sizeof(queryScale));
+}
+
+WaterReflections::~WaterReflections() {
+    destroy();
+}
+
+void WaterReflections::init(float budget) {
+    destroy();
+    budgetMs = budget;
+    scale = MAX_SCALE;
+    gpuMs = 0.0;
+    samples = 0;
+
+    glGenFramebuffers(2, fbos);
+    glGenQueries(QUERY_COUNT, queries);
+    memset(queryScale, 0, sizeof(queryScale));
+    nextQuery = 0;
+    activeQuery = -1;
+
+    // Reflection: colour texture and a depth buffer nobody samples
+    glGenTextures(1, &reflection);
+    glBindTexture(GL_TEXTURE_2D, reflection);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glGenRenderbuffers(1, &reflectionDepth);
+
+    // Refraction: depth only, read back as plain values (no comparison)
+    glGenTextures(1, &refractionDepth);
+    glBindTexture(GL_TEXTURE_2D, refractionDepth);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    targetWidth = targetHeight = 0;
+}
+
+void WaterReflections::destroy() {
+    if( fbos[0] != 0 ) glDeleteFramebuffers(2, fbos);
+    if( queries[0] != 0 ) glDeleteQueries(QUERY_COUNT, queries);
+    if( reflection != 0 ) glDeleteTextures(1, &reflection);
+    if( reflectionDepth != 0 ) glDeleteRenderbuffers(1, &reflectionDepth);
+    if( refractionDepth != 0 ) glDeleteTextures(1, &refractionDepth);
+    fbos[0] = fbos[1] = 0;
+    memset(queries, 0, sizeof(queries));
+    reflection = reflectionDepth = refractionDepth = 0;
+    targetWidth = targetHeight = 0;
+}
+
+void WaterReflections::beginFrame(int width, int height) {
+    windowWidth = width;
+    windowHeight = height;
+    collectTimings();
+    adaptScale();
+    resize();
+
+    // Time this frame's passes unless every query is still in flight
+    activeQuery = -1;
+    if( queryScale[nextQuery] == 0 ) {
+        activeQuery = nextQuery;
+        nextQuery = (nextQuery + 1) % QUERY_COUNT;
+        queryScale[activeQuery] = scale;
+        glBeginQuery(GL_TIME_ELAPSED, queries[activeQuery]);
+    }
+}
+
+void WaterReflections::bindReflection() {
+    glBindFramebuffer(GL_FRAMEBUFFER, fbos[0]);
+    glViewport(0, 0, targetWidth, targetHeight);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void WaterReflections::bindRefraction() {
+    glBindFramebuffer(GL_FRAMEBUFFER, fbos[1]);
+    glViewport(0, 0, targetWidth, targetHeight);
+    glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void WaterReflections::endFrame() {
+    if( activeQuery >= 0 ) glEndQuery(GL_TIME_ELAPSED);
+    activeQuery = -1;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// Results come in without waiting; the ones taken at another scale are dropped
+void WaterReflections::collectTimings() {
+    for( int i = 0; i < QUERY_COUNT; i++ ) {
+        if( queryScale[i] == 0 ) continue;
+        GLint available = 0;
+        glGetQueryObjectiv(queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+        if( !available ) continue;
+
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &ns);
+        if( queryScale[i] == scale ) {
+            double ms = ns / 1.0e6;
+            gpuMs = samples == 0 ? ms : gpuMs + (ms - gpuMs) * 0.1;
+            samples++;
+        }
+        queryScale[i] = 0;
+    }
+}
+
+// Shrink as soon as the passes are over budget. Grow only when the time
+// predicted from the pixel count fits with some headroom, so the scale does
+// not flip back and forth between two steps.
+void WaterReflections::adaptScale() {
+    int newScale = scale;
+    if( samples >= SAMPLES_TO_SHRINK && gpuMs > budgetMs && scale > MIN_SCALE ) {
+        newScale = scale - 1;
+    } else if( samples >= SAMPLES_TO_GROW && scale < MAX_SCALE ) {
+        double growth = (double)(scale + 1) / scale;
+        if( gpuMs * growth * growth < budgetMs * GROW_HEADROOM ) newScale = scale + 1;
+    }
+    if( newScale != scale ) {
+        scale = newScale;
+        samples = 0;
+    }
+}
+
+void WaterReflections::resize() {
+    int w = std::max(1, (windowWidth * scale + 8) / 16);
+    int h = std::max(1, (windowHeight * scale + 8) / 16);
+    if( w == targetWidth && h == targetHeight ) return;
+    targetWidth = w;
+    targetHeight = h;
+
+    // Same names, new storage: whoever bound the textures keeps them bound
+    glBindTexture(GL_TEXTURE_2D, reflection);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, w, h, 0, GL_RGBA, GL_HALF_FLOAT, NULL);
+    glBindRenderbuffer(GL_RENDERBUFFER, reflectionDepth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, w, h);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D, refractionDepth);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, w, h, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbos[0]);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, reflection, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, reflectionDepth);
+    GLenum reflectionStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbos[1]);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, refractionDepth, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    GLenum refractionStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    if( reflectionStatus != GL_FRAMEBUFFER_COMPLETE || refractionStatus != GL_FRAMEBUFFER_COMPLETE ) {
+        fprintf(stderr, "Water reflection targets incomplete (0x%x, 0x%x)\n", reflectionStatus, refractionStatus);
+    }
+}
+
+mat4 WaterReflections::mirror(float height) {
+    mat4 m(1.0f);
+    m[1][1] = -1.0f;
+    m[3][1] = 2.0f * height;
+    return m;
+}
+
+// Lengyel, "Oblique View Frustum Depth Projection and Clipping": the third
+// row of the projection becomes the clip plane, scaled so that the far
+// plane still passes through the frustum corner opposite to it.
+mat4 WaterReflections::obliqueProjection(const mat4 & projection, const mat4 & view, const vec4 & plane) {
+    // Planes transform with the inverse transpose
+    vec4 c = glm::transpose(glm::inverse(view)) * plane;
+    // The eye has to be on the clipped side
+    if( c.w >= 0.0f ) return projection;
+
+    vec4 q;
+    q.x = (signOf(c.x) + projection[2][0]) / projection[0][0];
+    q.y = (signOf(c.y) + projection[2][1]) / projection[1][1];
+    q.z = -1.0f;
+    q.w = (1.0f + projection[2][2]) / projection[3][2];
+    c *= 2.0f / glm::dot(c, q);
+
+    mat4 m = projection;
+    m[0][2] = c.x;
+    m[1][2] = c.y;
+    m[2][2] = c.z + 1.0f;
+    m[3][2] = c.w;
+    return m;
+}
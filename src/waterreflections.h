@@ -0,0 +1,80 @@
+#pragma once
+
+#include "cookbookogl.h"
+#include "framering.h"
+
+#include <glm/glm.hpp>
+
+// Render targets for what the water shows besides itself, at a fraction of
+// the window size:
+//  - reflection: colour (RGBA16F, linear) of the scene seen from the camera
+//    mirrored about the mean water plane. An oblique near plane clips away
+//    everything below the plane, so no clip distances are needed.
+//  - refraction depth: depth of the scene without the water, from the normal
+//    camera. The water compares it with its own depth to find where objects
+//    pierce the surface.
+// Both passes run between beginFrame() and endFrame() inside one timer
+// query. The results arrive a few frames later and move the scale between
+// 1/4 and 1/2 of the window so the two passes stay within the budget.
+class WaterReflections {
+public:
+    // Scale in sixteenths of the window size
+    static const int MIN_SCALE = 4;
+    static const int MAX_SCALE = 8;
+    // One query per frame in flight plus the one being recorded
+    static const int QUERY_COUNT = FrameRing::FRAMES_IN_FLIGHT + 1;
+
+    WaterReflections();
+    ~WaterReflections();
+
+    void init(float budgetMs);
+    void destroy();
+    bool isInitialized() const { return fbos[0] != 0; }
+
+    // Pick up finished timings, adapt the scale and resize the targets to it
+    void beginFrame(int width, int height);
+    // Bind and clear a target; the viewport is set to its size
+    void bindReflection();
+    void bindRefraction();
+    // Back to the window framebuffer (the viewport is left to the caller)
+    void endFrame();
+
+    // Reflection about the plane y = height, for view * mirror(height)
+    static glm::mat4 mirror(float height);
+    // projection with its near plane replaced by the world space plane
+    // (a, b, c, d), keeping the side where ax + by + cz + d > 0. Returned
+    // unchanged when the camera is on that side, where the trick does not work.
+    static glm::mat4 obliqueProjection(const glm::mat4 & projection, const glm::mat4 & view, const glm::vec4 & plane);
+
+    GLuint getReflection() const { return reflection; }
+    GLuint getRefractionDepth() const { return refractionDepth; }
+    int getWidth() const { return targetWidth; }
+    int getHeight() const { return targetHeight; }
+    float getScale() const { return scale / 16.0f; }
+    // Smoothed GPU time of both passes at the current scale
+    double getGpuMs() const { return gpuMs; }
+    float getBudgetMs() const { return budgetMs; }
+
+private:
+    GLuint fbos[2];                 // reflection, refraction
+    GLuint reflection, reflectionDepth, refractionDepth;
+    int targetWidth, targetHeight;
+
+    GLuint queries[QUERY_COUNT];
+    int queryScale[QUERY_COUNT];    // 0 when the query is free
+    int nextQuery, activeQuery;
+
+    float budgetMs;
+    int scale;
+    double gpuMs;
+    int samples;                    // timings at the current scale
+    int windowWidth, windowHeight;
+
+    void collectTimings();
+    void adaptScale();
+    void resize();
+
+    // Non-copyable: owns GL objects.
+    WaterReflections(const WaterReflections &) = delete;
+    WaterReflections & operator=(const WaterReflections &) = delete;
+};